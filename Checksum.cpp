@@ -0,0 +1,204 @@
+/* Aden Prince
+ * HiMER Lab at U. of Illinois, Chicago
+ * K4ARecorder GUI
+ *
+ * Checksum.cpp
+ * Contains the XXH64 hash function, following the reference algorithm at
+ * https://github.com/Cyan4973/xxHash/blob/dev/doc/xxhash_spec.md, and the
+ * tree checksum built from it.
+ */
+
+#include "Checksum.h"
+
+#include <cstring>
+
+using namespace std;
+
+const uint64_t prime1 = 0x9E3779B185EBCA87ULL;
+const uint64_t prime2 = 0xC2B2AE3D27D4EB4FULL;
+const uint64_t prime3 = 0x165667B19E3779F9ULL;
+const uint64_t prime4 = 0x85EBCA77C2B2AE63ULL;
+const uint64_t prime5 = 0x27D4EB2F165667C5ULL;
+
+static inline uint64_t rotateLeft(uint64_t value, int bits) {
+    return (value << bits) | (value >> (64 - bits));
+}
+
+// Read little-endian values, memcpy lets the compiler use a plain load
+static inline uint64_t read64(const uint8_t* data) {
+    uint64_t value;
+    memcpy(&value, data, sizeof(value));
+    return value;
+}
+
+static inline uint32_t read32(const uint8_t* data) {
+    uint32_t value;
+    memcpy(&value, data, sizeof(value));
+    return value;
+}
+
+static inline uint64_t round64(uint64_t accumulator, uint64_t input) {
+    accumulator += input * prime2;
+    accumulator = rotateLeft(accumulator, 31);
+    return accumulator * prime1;
+}
+
+static inline uint64_t mergeRound(uint64_t hash, uint64_t accumulator) {
+    hash ^= round64(0, accumulator);
+    return hash * prime1 + prime4;
+}
+
+// Mix in 32-byte stripes, the four lanes are independent so they run in parallel on one core
+static const uint8_t* consumeStripes(uint64_t accumulators[4], const uint8_t* data, const uint8_t* end) {
+    uint64_t a0 = accumulators[0];
+    uint64_t a1 = accumulators[1];
+    uint64_t a2 = accumulators[2];
+    uint64_t a3 = accumulators[3];
+    while (end - data >= 32) {
+        a0 = round64(a0, read64(data));
+        a1 = round64(a1, read64(data + 8));
+        a2 = round64(a2, read64(data + 16));
+        a3 = round64(a3, read64(data + 24));
+        data += 32;
+    }
+    accumulators[0] = a0;
+    accumulators[1] = a1;
+    accumulators[2] = a2;
+    accumulators[3] = a3;
+    return data;
+}
+
+// Start a new hash
+void xxh64Reset(Xxh64State& state, uint64_t seed) {
+    state = Xxh64State();
+    state.seed = seed;
+    state.accumulators[0] = seed + prime1 + prime2;
+    state.accumulators[1] = seed + prime2;
+    state.accumulators[2] = seed;
+    state.accumulators[3] = seed - prime1;
+}
+
+// Add the next chunk of data
+void xxh64Update(Xxh64State& state, const void* data, size_t length) {
+    const uint8_t* input = (const uint8_t*) data;
+    const uint8_t* end = input + length;
+    state.totalLength += length;
+
+    // Finish a stripe left over from the last chunk
+    if (state.bufferSize > 0) {
+        size_t needed = 32 - state.bufferSize;
+        size_t copied = (length < needed) ? length : needed;
+        memcpy(state.buffer + state.bufferSize, input, copied);
+        state.bufferSize += copied;
+        input += copied;
+        if (state.bufferSize < 32) {
+            return;
+        }
+        consumeStripes(state.accumulators, state.buffer, state.buffer + 32);
+        state.bufferSize = 0;
+    }
+
+    input = consumeStripes(state.accumulators, input, end);
+
+    memcpy(state.buffer, input, end - input);
+    state.bufferSize = end - input;
+}
+
+// Get the hash of everything added so far
+uint64_t xxh64Digest(const Xxh64State& state) {
+    uint64_t hash;
+    if (state.totalLength >= 32) {
+        const uint64_t* a = state.accumulators;
+        hash = rotateLeft(a[0], 1) + rotateLeft(a[1], 7) + rotateLeft(a[2], 12) + rotateLeft(a[3], 18);
+        for (int i = 0; i < 4; i++) {
+            hash = mergeRound(hash, a[i]);
+        }
+    }
+    else {
+        hash = state.seed + prime5;
+    }
+    hash += state.totalLength;
+
+    // Mix in the last 0 to 31 bytes
+    const uint8_t* data = state.buffer;
+    const uint8_t* end = state.buffer + state.bufferSize;
+    while (end - data >= 8) {
+        hash ^= round64(0, read64(data));
+        hash = rotateLeft(hash, 27) * prime1 + prime4;
+        data += 8;
+    }
+    if (end - data >= 4) {
+        hash ^= (uint64_t) read32(data) * prime1;
+        hash = rotateLeft(hash, 23) * prime2 + prime3;
+        data += 4;
+    }
+    while (data < end) {
+        hash ^= (*data) * prime5;
+        hash = rotateLeft(hash, 11) * prime1;
+        data++;
+    }
+
+    hash ^= hash >> 33;
+    hash *= prime2;
+    hash ^= hash >> 29;
+    hash *= prime3;
+    hash ^= hash >> 32;
+    return hash;
+}
+
+// Hash data in one call
+uint64_t xxh64(const void* data, size_t length, uint64_t seed) {
+    Xxh64State state;
+    xxh64Reset(state, seed);
+    xxh64Update(state, data, length);
+    return xxh64Digest(state);
+}
+
+// Start a new tree checksum
+void treeHashReset(TreeHashState& state) {
+    xxh64Reset(state.leaf);
+    state.leafLength = 0;
+    state.totalLength = 0;
+    state.leaves.clear();
+}
+
+// Add the next chunk of data, ending leaves every treeLeafBytes
+void treeHashUpdate(TreeHashState& state, const void* data, size_t length) {
+    const uint8_t* bytes = (const uint8_t*) data;
+    while (length > 0) {
+        uint64_t room = treeLeafBytes - state.leafLength;
+        size_t part = (length < room) ? length : (size_t) room;
+        xxh64Update(state.leaf, bytes, part);
+        state.leafLength += part;
+        state.totalLength += part;
+        bytes += part;
+        length -= part;
+
+        if (state.leafLength == treeLeafBytes) {
+            state.leaves.push_back(xxh64Digest(state.leaf));
+            xxh64Reset(state.leaf);
+            state.leafLength = 0;
+        }
+    }
+}
+
+// Get the tree checksum of everything added so far
+uint64_t treeHashDigest(const TreeHashState& state) {
+    vector<uint64_t> leaves = state.leaves;
+    if (state.leafLength > 0 || leaves.empty()) {
+        leaves.push_back(xxh64Digest(state.leaf));
+    }
+    return combineTreeHash(leaves, state.totalLength);
+}
+
+// Combine the XXH64 of each treeLeafBytes piece of the data, in order, into its tree checksum
+uint64_t combineTreeHash(const vector<uint64_t>& leaves, uint64_t totalLength) {
+    // Leaf checksums are hashed as little-endian bytes, seeded with the length so files that only differ by trailing leaves differ
+    vector<uint8_t> bytes(leaves.size() * 8);
+    for (size_t i = 0; i < leaves.size(); i++) {
+        for (int b = 0; b < 8; b++) {
+            bytes[i * 8 + b] = (uint8_t) (leaves[i] >> (8 * b));
+        }
+    }
+    return xxh64(bytes.data(), bytes.size(), totalLength);
+}
@@ -0,0 +1,53 @@
+/* Aden Prince
+ * HiMER Lab at U. of Illinois, Chicago
+ * K4ARecorder GUI
+ *
+ * Checksum.h
+ * Contains the 64-bit xxHash (XXH64) checksum used to verify copies of
+ * recordings, and a tree checksum built from it so the pieces of a large
+ * file can be hashed on every core. Has no Windows or ImGui dependencies.
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Bytes in each leaf of a tree checksum
+const uint64_t treeLeafBytes = 64ULL * 1024 * 1024;
+
+// Running XXH64 state, for data hashed a chunk at a time
+struct Xxh64State {
+    uint64_t accumulators[4] = {};
+    uint8_t buffer[32] = {};
+    size_t bufferSize = 0;
+    uint64_t totalLength = 0;
+    uint64_t seed = 0;
+};
+
+// Start a new hash
+void xxh64Reset(Xxh64State& state, uint64_t seed = 0);
+// Add the next chunk of data
+void xxh64Update(Xxh64State& state, const void* data, size_t length);
+// Get the hash of everything added so far
+uint64_t xxh64Digest(const Xxh64State& state);
+// Hash data in one call
+uint64_t xxh64(const void* data, size_t length, uint64_t seed = 0);
+
+// Running tree checksum, for data hashed in order a chunk at a time
+struct TreeHashState {
+    Xxh64State leaf;
+    uint64_t leafLength = 0;
+    uint64_t totalLength = 0;
+    std::vector<uint64_t> leaves;
+};
+
+// Start a new tree checksum
+void treeHashReset(TreeHashState& state);
+// Add the next chunk of data, ending leaves every treeLeafBytes
+void treeHashUpdate(TreeHashState& state, const void* data, size_t length);
+// Get the tree checksum of everything added so far
+uint64_t treeHashDigest(const TreeHashState& state);
+// Combine the XXH64 of each treeLeafBytes piece of the data, in order, into its tree checksum
+uint64_t combineTreeHash(const std::vector<uint64_t>& leaves, uint64_t totalLength);
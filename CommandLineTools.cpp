@@ -0,0 +1,542 @@
+/* Aden Prince
+ * HiMER Lab at U. of Illinois, Chicago
+ * K4ARecorder GUI
+ *
+ * CommandLineTools.cpp
+ * Contains the command-line tools that work on finished recordings.
+ */
+
+#include "CommandLineTools.h"
+#include "Demux.h"
+#include "DepthCompression.h"
+#include "DepthQuality.h"
+#include "FrameExport.h"
+#include "ImuExport.h"
+#include "LibraryIndex.h"
+#include "Manifest.h"
+#include "RecordingEdit.h"
+#include "RecordingInspector.h"
+#include "RecordingRepair.h"
+#include "SyncAnalysis.h"
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+// Print a summary of every recording passed, returns 2 if any has dropped frames or was cut off
+static int inspectCommand(int argc, char* argv[]) {
+    if (argc < 3) {
+        cout << "Usage: K4ARecorderGUI.exe --inspect <recording.mkv> [<recording.mkv> ...]" << endl;
+        return 1;
+    }
+
+    int exitCode = 0;
+    for (int i = 2; i < argc; i++) {
+        RecordingSummary summary;
+        string errorText;
+        if (!inspectRecording(argv[i], summary, errorText)) {
+            cout << errorText;
+            exitCode = 1;
+            continue;
+        }
+
+        cout << formatRecordingSummary(summary);
+        for (const TrackSummary& track : summary.tracks) {
+            if (track.droppedFrames > 0 && exitCode == 0) {
+                exitCode = 2;
+            }
+        }
+        if (summary.truncated && exitCode == 0) {
+            exitCode = 2;
+        }
+    }
+    return exitCode;
+}
+
+// Repair every recording passed in place, returns 1 if any cannot be repaired
+static int repairCommand(int argc, char* argv[]) {
+    if (argc < 3) {
+        cout << "Usage: K4ARecorderGUI.exe --repair <recording.mkv> [<recording.mkv> ...]" << endl;
+        return 1;
+    }
+
+    int exitCode = 0;
+    for (int i = 2; i < argc; i++) {
+        RepairPlan plan;
+        string errorText;
+        cout << argv[i] << endl;
+        if (!repairRecording(argv[i], plan, errorText)) {
+            cout << errorText;
+            exitCode = 1;
+            continue;
+        }
+        cout << formatRepairPlan(plan);
+
+        // A manifest written before the repair no longer matches the file, so it is written again with the same arguments
+        Manifest manifest;
+        if (plan.needed && readManifest(manifestFilename(argv[i]), manifest, errorText)) {
+            if (!writeRecordingManifest(argv[i], manifest.args, manifest, nullptr, nullptr, errorText)) {
+                cout << errorText;
+                exitCode = 1;
+                continue;
+            }
+            cout << "  Manifest updated\n";
+        }
+    }
+    return exitCode;
+}
+
+// Write a copy of every recording passed with its depth track compressed or decompressed, returns 1 if any cannot be converted
+static int depthCompressionCommand(int argc, char* argv[], bool compress) {
+    if (argc < 3) {
+        cout << "Usage: K4ARecorderGUI.exe " << argv[1] << " <recording.mkv> [<recording.mkv> ...]" << endl;
+        return 1;
+    }
+
+    int exitCode = 0;
+    for (int i = 2; i < argc; i++) {
+        DepthCompression job;
+        job.inputFilename = argv[i];
+        job.outputFilename = depthOutputFilename(argv[i], compress);
+        job.compress = compress;
+        cout << argv[i] << endl;
+        if (!transcodeDepthTrack(job)) {
+            cout << job.errorText;
+            exitCode = 1;
+            continue;
+        }
+        cout << formatDepthCompression(job);
+    }
+    return exitCode;
+}
+
+// Measure the depth frames of every recording passed and save the statistics next to it, returns 1 if any cannot be measured
+static int depthStatsCommand(int argc, char* argv[]) {
+    if (argc < 3) {
+        cout << "Usage: K4ARecorderGUI.exe --depth-stats <recording.mkv> [<recording.mkv> ...]" << endl;
+        return 1;
+    }
+
+    int exitCode = 0;
+    for (int i = 2; i < argc; i++) {
+        DepthQualityJob job;
+        job.filename = argv[i];
+        cout << argv[i] << endl;
+        if (!makeDepthQuality(job)) {
+            cout << (job.errorText.empty() ? "ERROR: Recording has no depth frames\n" : job.errorText);
+            exitCode = 1;
+            continue;
+        }
+        cout << formatDepthQuality(job);
+    }
+    return exitCode;
+}
+
+// Checksum every recording passed and write its manifest, keeping the arguments of an existing manifest
+static int manifestCommand(int argc, char* argv[]) {
+    if (argc < 3) {
+        cout << "Usage: K4ARecorderGUI.exe --manifest <recording.mkv> [<recording.mkv> ...]" << endl;
+        return 1;
+    }
+
+    int exitCode = 0;
+    for (int i = 2; i < argc; i++) {
+        Manifest existing;
+        string ignoredError;
+        string args = readManifest(manifestFilename(argv[i]), existing, ignoredError) ? existing.args : "";
+
+        Manifest manifest;
+        string errorText;
+        if (!writeRecordingManifest(argv[i], args, manifest, nullptr, nullptr, errorText)) {
+            cout << errorText;
+            exitCode = 1;
+            continue;
+        }
+        printf("%016llx  %s\n", (unsigned long long) manifest.checksum, argv[i]);
+    }
+    return exitCode;
+}
+
+// Check every recording passed against its manifest, returns 2 if any does not match
+static int verifyCommand(int argc, char* argv[]) {
+    if (argc < 3) {
+        cout << "Usage: K4ARecorderGUI.exe --verify <recording.mkv> [<recording.mkv> ...]" << endl;
+        return 1;
+    }
+
+    int exitCode = 0;
+    for (int i = 2; i < argc; i++) {
+        // Either the recording or its manifest can be passed
+        string recording = argv[i];
+        string extension = manifestFilename("");
+        if (recording.length() > extension.length() && recording.substr(recording.length() - extension.length()) == extension) {
+            recording = recording.substr(0, recording.length() - extension.length());
+        }
+
+        Manifest manifest;
+        uint64_t size = 0;
+        uint64_t checksum = 0;
+        string errorText;
+        auto start = chrono::steady_clock::now();
+        if (!readManifest(manifestFilename(recording), manifest, errorText) || !checksumFile(recording, size, checksum, nullptr, nullptr, errorText)) {
+            cout << errorText;
+            exitCode = 1;
+            continue;
+        }
+        double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+
+        bool matches = size == manifest.size && checksum == manifest.checksum;
+        printf("%s  %s, %.2f GB in %.1f s (%.2f GB/s)\n", matches ? "OK      " : "MISMATCH", recording.c_str(), size / 1e9, seconds,
+               (seconds > 0) ? size / 1e9 / seconds : 0);
+        if (!matches) {
+            printf("  Expected %llu bytes with checksum %016llx, found %llu bytes with checksum %016llx\n", (unsigned long long) manifest.size,
+                   (unsigned long long) manifest.checksum, (unsigned long long) size, (unsigned long long) checksum);
+            if (exitCode == 0) {
+                exitCode = 2;
+            }
+        }
+    }
+    return exitCode;
+}
+
+// Export the frames of a recording to a directory, returns 1 if the arguments are invalid or the export fails
+static int exportCommand(int argc, char* argv[]) {
+    const char* usage = "Usage: K4ARecorderGUI.exe --export <recording.mkv> <output directory> [--tracks color,depth,ir] [--format png|raw|ply|ply-stream]\n"
+                        "       [--stride <frames>] [--start <seconds>] [--end <seconds>]";
+    if (argc < 4) {
+        cout << usage << endl;
+        return 1;
+    }
+
+    ExportOptions options;
+    options.recording = argv[2];
+    options.outputDirectory = argv[3];
+    for (int i = 4; i < argc; i++) {
+        string option = argv[i];
+        if (i + 1 == argc) {
+            cout << "ERROR: " << option << " needs a value" << endl << usage << endl;
+            return 1;
+        }
+        string value = argv[++i];
+
+        if (option == "--tracks") {
+            options.color = value.find("color") != string::npos;
+            options.depth = value.find("depth") != string::npos;
+            options.ir = value.find("ir") != string::npos;
+        }
+        else if (option == "--format" && value == "png") {
+            options.format = ExportPng;
+        }
+        else if (option == "--format" && value == "raw") {
+            options.format = ExportRaw;
+        }
+        else if (option == "--format" && value == "ply") {
+            options.format = ExportPly;
+        }
+        else if (option == "--format" && value == "ply-stream") {
+            options.format = ExportPlyStream;
+        }
+        else if (option == "--stride") {
+            options.stride = atoi(value.c_str());
+        }
+        else if (option == "--start") {
+            options.startSeconds = atof(value.c_str());
+        }
+        else if (option == "--end") {
+            options.endSeconds = atof(value.c_str());
+        }
+        else {
+            cout << "ERROR: Invalid option " << option << " " << value << endl << usage << endl;
+            return 1;
+        }
+    }
+
+    ExportResult result;
+    string errorText;
+    bool succeeded = exportFrames(options, result, errorText);
+    cout << formatExportResult(result) << errorText;
+    return succeeded ? 0 : 1;
+}
+
+// Extract the IMU samples of a recording to CSV or columnar binary, returns 1 if the arguments are invalid or the extraction fails
+static int imuCommand(int argc, char* argv[]) {
+    const char* usage = "Usage: K4ARecorderGUI.exe --imu <recording.mkv> [<output file>] [--format csv|binary]";
+    if (argc < 3) {
+        cout << usage << endl;
+        return 1;
+    }
+
+    bool binary = false;
+    string output;
+    for (int i = 3; i < argc; i++) {
+        string option = argv[i];
+        if (option == "--format" && i + 1 < argc && (strcmp(argv[i + 1], "csv") == 0 || strcmp(argv[i + 1], "binary") == 0)) {
+            binary = strcmp(argv[++i], "binary") == 0;
+        }
+        else if (output.empty() && option.rfind("--", 0) != 0) {
+            output = option;
+        }
+        else {
+            cout << "ERROR: Invalid option " << option << endl << usage << endl;
+            return 1;
+        }
+    }
+    if (output.empty()) {
+        output = imuOutputFilename(argv[2], binary);
+    }
+
+    ImuExportResult result;
+    string errorText;
+    bool succeeded = exportImu(argv[2], output, binary, result, errorText);
+    cout << output << endl << formatImuExportResult(result) << errorText;
+    return succeeded ? 0 : 1;
+}
+
+// Split every track of a recording into its own file, returns 1 if the arguments are invalid or the split fails
+static int demuxCommand(int argc, char* argv[]) {
+    const char* usage = "Usage: K4ARecorderGUI.exe --demux <recording.mkv> [<output directory>] [--format mkv|raw]";
+    if (argc < 3) {
+        cout << usage << endl;
+        return 1;
+    }
+
+    DemuxFormat format = DemuxMkv;
+    string outputDirectory;
+    for (int i = 3; i < argc; i++) {
+        string option = argv[i];
+        if (option == "--format" && i + 1 < argc && (strcmp(argv[i + 1], "mkv") == 0 || strcmp(argv[i + 1], "raw") == 0)) {
+            format = (strcmp(argv[++i], "raw") == 0) ? DemuxRaw : DemuxMkv;
+        }
+        else if (outputDirectory.empty() && option.rfind("--", 0) != 0) {
+            outputDirectory = option;
+        }
+        else {
+            cout << "ERROR: Invalid option " << option << endl << usage << endl;
+            return 1;
+        }
+    }
+
+    DemuxResult result;
+    string errorText;
+    bool succeeded = demuxRecording(argv[2], outputDirectory, format, result, errorText);
+    cout << errorText;
+    if (succeeded) {
+        cout << formatDemuxResult(result);
+    }
+    return succeeded ? 0 : 1;
+}
+
+// Update the index of a directory tree of recordings and list the ones matching a filter, returns 1 if the directory cannot be scanned
+static int libraryCommand(int argc, char* argv[]) {
+    const char* usage = "Usage: K4ARecorderGUI.exe --library <directory> [<filter word> ...] [--days <days>] [--sort path|modified|duration|size|depth|color|serial]";
+    if (argc < 3) {
+        cout << usage << endl;
+        return 1;
+    }
+
+    const char* sortNames[librarySortCount] = {"path", "modified", "duration", "size", "depth", "color", "serial"};
+    string filter;
+    int maxAgeDays = 0;
+    LibrarySort sort = SortPath;
+    for (int i = 3; i < argc; i++) {
+        string option = argv[i];
+        if (option == "--days" && i + 1 < argc) {
+            maxAgeDays = atoi(argv[++i]);
+        }
+        else if (option == "--sort" && i + 1 < argc) {
+            string column = argv[++i];
+            int found = 0;
+            while (found < librarySortCount && column != sortNames[found]) {
+                found++;
+            }
+            if (found == librarySortCount) {
+                cout << "ERROR: Invalid sort column " << column << endl << usage << endl;
+                return 1;
+            }
+            sort = (LibrarySort) found;
+        }
+        else if (option.rfind("--", 0) != 0) {
+            filter += option + " ";
+        }
+        else {
+            cout << "ERROR: Invalid option " << option << endl << usage << endl;
+            return 1;
+        }
+    }
+
+    LibraryScan scan;
+    scan.root = argv[2];
+    if (!scanLibrary(scan)) {
+        cout << scan.errorText;
+        return 1;
+    }
+    vector<uint32_t> matches;
+    filterLibrary(scan.scanned, filter, maxAgeDays, sort, false, matches);
+    for (uint32_t match : matches) {
+        const LibraryEntry& entry = scan.scanned[match];
+        printf("%s  %8.1f s  %7.2f GB  %-16s %-12s %-14s %s\n", formatLibraryTime(entry.writeTime).c_str(), entry.durationSeconds, entry.size / 1e9,
+               entry.depthMode.c_str(), entry.colorMode.c_str(), entry.serialNumber.c_str(), entry.path.c_str());
+    }
+    printf("%llu of %llu recordings match, %llu parsed and %llu unchanged in %.2f s\n", (unsigned long long) matches.size(),
+           (unsigned long long) scan.scanned.size(), (unsigned long long) (scan.scanned.size() - scan.reused), (unsigned long long) scan.reused, scan.seconds);
+    return 0;
+}
+
+// Check the recordings of a multiple device take line up, returns 2 if any frame has no partner
+static int syncCommand(int argc, char* argv[]) {
+    const char* usage = "Usage: K4ARecorderGUI.exe --sync <recording.mkv> <recording.mkv> [<recording.mkv> ...] [--track color|depth|ir]";
+    vector<string> filenames;
+    string trackName = "DEPTH";
+    for (int i = 2; i < argc; i++) {
+        string argument = argv[i];
+        if (argument == "--track" && i + 1 < argc) {
+            string track = argv[++i];
+            if (track != "color" && track != "depth" && track != "ir") {
+                cout << "ERROR: Invalid track " << track << endl << usage << endl;
+                return 1;
+            }
+            trackName = (track == "ir") ? "IR" : (track == "color") ? "COLOR" : "DEPTH";
+        }
+        else {
+            filenames.push_back(argument);
+        }
+    }
+    if (filenames.size() < 2) {
+        cout << usage << endl;
+        return 1;
+    }
+
+    SyncAnalysis analysis;
+    string errorText;
+    if (!analyzeSync(filenames, trackName, analysis, errorText)) {
+        cout << errorText;
+        return 1;
+    }
+    cout << formatSyncAnalysis(analysis);
+    return hasUnpairedFrames(analysis) ? 2 : 0;
+}
+
+// Cut a time range out of a recording without decoding it, returns 1 if the arguments are invalid or the cut fails
+static int cutCommand(int argc, char* argv[]) {
+    const char* usage = "Usage: K4ARecorderGUI.exe --cut <recording.mkv> <output.mkv> [--start <seconds>] [--end <seconds>]";
+    if (argc < 4) {
+        cout << usage << endl;
+        return 1;
+    }
+
+    double startSeconds = 0;
+    double endSeconds = -1;
+    for (int i = 4; i < argc; i++) {
+        string option = argv[i];
+        if (i + 1 == argc) {
+            cout << "ERROR: " << option << " needs a value" << endl << usage << endl;
+            return 1;
+        }
+        string value = argv[++i];
+
+        if (option == "--start") {
+            startSeconds = atof(value.c_str());
+        }
+        else if (option == "--end") {
+            endSeconds = atof(value.c_str());
+        }
+        else {
+            cout << "ERROR: Invalid option " << option << " " << value << endl << usage << endl;
+            return 1;
+        }
+    }
+
+    EditResult result;
+    string errorText;
+    bool succeeded = cutRecording(argv[2], argv[3], startSeconds, endSeconds, result, errorText);
+    cout << errorText;
+    if (succeeded) {
+        cout << argv[3] << endl << formatEditResult(result);
+    }
+    return succeeded ? 0 : 1;
+}
+
+// Join recordings of the same modes end to end without decoding them, returns 1 if the arguments are invalid or the join fails
+static int concatCommand(int argc, char* argv[]) {
+    if (argc < 5) {
+        cout << "Usage: K4ARecorderGUI.exe --concat <output.mkv> <recording.mkv> <recording.mkv> [<recording.mkv> ...]" << endl;
+        return 1;
+    }
+
+    vector<string> inputs(argv + 3, argv + argc);
+    EditResult result;
+    string errorText;
+    bool succeeded = concatRecordings(inputs, argv[2], result, errorText);
+    cout << errorText;
+    if (succeeded) {
+        cout << argv[2] << endl << formatEditResult(result);
+    }
+    return succeeded ? 0 : 1;
+}
+
+// Run the tool named by the first argument, returns false if it does not name a tool
+bool runCommandLineTool(int argc, char* argv[], int& exitCode) {
+    if (argc < 2) {
+        return false;
+    }
+
+    if (strcmp(argv[1], "--inspect") == 0) {
+        exitCode = inspectCommand(argc, argv);
+        return true;
+    }
+    if (strcmp(argv[1], "--repair") == 0) {
+        exitCode = repairCommand(argc, argv);
+        return true;
+    }
+    if (strcmp(argv[1], "--manifest") == 0) {
+        exitCode = manifestCommand(argc, argv);
+        return true;
+    }
+    if (strcmp(argv[1], "--verify") == 0) {
+        exitCode = verifyCommand(argc, argv);
+        return true;
+    }
+    if (strcmp(argv[1], "--export") == 0) {
+        exitCode = exportCommand(argc, argv);
+        return true;
+    }
+    if (strcmp(argv[1], "--imu") == 0) {
+        exitCode = imuCommand(argc, argv);
+        return true;
+    }
+    if (strcmp(argv[1], "--demux") == 0) {
+        exitCode = demuxCommand(argc, argv);
+        return true;
+    }
+    if (strcmp(argv[1], "--library") == 0) {
+        exitCode = libraryCommand(argc, argv);
+        return true;
+    }
+    if (strcmp(argv[1], "--sync") == 0) {
+        exitCode = syncCommand(argc, argv);
+        return true;
+    }
+    if (strcmp(argv[1], "--cut") == 0) {
+        exitCode = cutCommand(argc, argv);
+        return true;
+    }
+    if (strcmp(argv[1], "--concat") == 0) {
+        exitCode = concatCommand(argc, argv);
+        return true;
+    }
+    if (strcmp(argv[1], "--depth-stats") == 0) {
+        exitCode = depthStatsCommand(argc, argv);
+        return true;
+    }
+    if (strcmp(argv[1], "--compress-depth") == 0 || strcmp(argv[1], "--decompress-depth") == 0) {
+        exitCode = depthCompressionCommand(argc, argv, strcmp(argv[1], "--compress-depth") == 0);
+        return true;
+    }
+    return false;
+}
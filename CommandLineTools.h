@@ -0,0 +1,13 @@
+/* Aden Prince
+ * HiMER Lab at U. of Illinois, Chicago
+ * K4ARecorder GUI
+ *
+ * CommandLineTools.h
+ * Contains the command-line tools that work on finished recordings
+ * instead of starting K4ARecorder, such as --inspect and --repair.
+ */
+
+#pragma once
+
+// Run the tool named by the first argument, returns false if it does not name a tool
+bool runCommandLineTool(int argc, char* argv[], int& exitCode);
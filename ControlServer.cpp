@@ -0,0 +1,532 @@
+/* Aden Prince
+ * HiMER Lab at U. of Illinois, Chicago
+ * K4ARecorder GUI
+ *
+ * ControlServer.cpp
+ * Contains functions used to serve start, stop and status requests from
+ * scripts on worker threads, so client traffic never waits on the GUI
+ * and the GUI never waits on clients.
+ */
+
+// Winsock 2 has to be included before Windows.h, which would otherwise include the original Winsock
+#include <winsock2.h>
+
+#include "ControlServer.h"
+#include "RecorderOptions.h"
+#include "RecordingSession.h"
+
+#include <cctype>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <mutex>
+
+using namespace std;
+
+// Split a request line into words, keeping double-quoted text such as paths with spaces together
+vector<string> splitControlRequest(const string& line) {
+    vector<string> words;
+    string word;
+    bool inWord = false;
+    bool quoted = false;
+
+    for (char c : line) {
+        if (c == '"') {
+            quoted = !quoted;
+            inWord = true;
+        }
+        else if (!quoted && isspace((unsigned char) c)) {
+            if (inWord) {
+                words.push_back(word);
+                word.clear();
+                inWord = false;
+            }
+        }
+        else {
+            word += c;
+            inWord = true;
+        }
+    }
+    if (inWord) {
+        words.push_back(word);
+    }
+    return words;
+}
+
+// Quote text as a JSON string
+string jsonString(const string& text) {
+    string quoted = "\"";
+    for (char c : text) {
+        if (c == '"' || c == '\\') {
+            quoted += '\\';
+            quoted += c;
+        }
+        else if (c == '\n') {
+            quoted += "\\n";
+        }
+        else if ((unsigned char) c < 0x20) {
+            char escaped[8];
+            snprintf(escaped, sizeof(escaped), "\\u%04x", (unsigned char) c);
+            quoted += escaped;
+        }
+        else {
+            quoted += c;
+        }
+    }
+    return quoted + "\"";
+}
+
+// Describe the session as JSON members, the session must be locked
+static string statusMembers(const ControlServer& server, const RecordingSession& session) {
+    const char* state = "idle";
+    if (session.running) {
+        state = session.stopRequested ? "stopping" : "recording";
+    }
+    else if (multiDeviceTakeRunning(session.multiDevice)) {
+        state = "recording";
+    }
+
+    string members = "\"state\":\"" + string(state) + "\"";
+    members += ",\"take\":" + to_string(session.takeCount);
+    members += ",\"output\":" + jsonString(session.outputFilename);
+    members += ",\"lastExitCode\":" + to_string(session.lastExitCode);
+    members += ",\"lastLockWaitUs\":" + to_string(server.lastLockWaitUs.load());
+    members += ",\"lastDispatchUs\":" + to_string(server.lastDispatchUs.load());
+    members += ",\"lastStartUs\":" + to_string(server.lastStartUs.load());
+    return members;
+}
+
+// Start a take with K4ARecorder-style options from the words of a start request, the session must be locked
+static bool startFromRequest(ControlServer& server, const vector<string>& words, chrono::steady_clock::time_point received,
+                             chrono::steady_clock::time_point locked, string& errorText) {
+    RecordingSession& session = *server.session;
+    if (sessionBusy(session)) {
+        errorText = "ERROR: A take is already running\n";
+        return false;
+    }
+
+    // Without the session kept open, the take would close the GUI and the control server with it
+    if (!session.enabled) {
+        errorText = "ERROR: Turn on \"Keep GUI open between takes\" to start takes through the control server\n";
+        return false;
+    }
+
+    // The options are parsed like headless mode's command line, whose first argument is the program
+    vector<char*> argv;
+    argv.push_back(const_cast<char*>(words[0].c_str()));
+    for (size_t i = 1; i < words.size(); i++) {
+        argv.push_back(const_cast<char*>(words[i].c_str()));
+    }
+
+    RecorderOptions options;
+    string recorderPathStr = *server.recorderPathStr;
+    if (!parseCommandLine((int) argv.size(), argv.data(), options, recorderPathStr, errorText)) {
+        return false;
+    }
+    if (options.print_help || options.list_devices) {
+        errorText = "ERROR: --help and --list cannot be run through the control server\n";
+        return false;
+    }
+
+    auto dispatched = chrono::steady_clock::now();
+    string argsStr;
+    if (!beginTake(session, options, recorderPathStr, argsStr, errorText)) {
+        return false;
+    }
+
+    server.lastLockWaitUs = chrono::duration_cast<chrono::microseconds>(locked - received).count();
+    server.lastDispatchUs = chrono::duration_cast<chrono::microseconds>(dispatched - locked).count();
+    server.lastStartUs = chrono::duration_cast<chrono::microseconds>(chrono::steady_clock::now() - locked).count();
+    return true;
+}
+
+// Run one request line on the session, locking it, and get the JSON reply
+string runControlRequest(ControlServer& server, const string& line) {
+    auto received = chrono::steady_clock::now();
+    server.requests++;
+
+    vector<string> words = splitControlRequest(line);
+    RecordingSession& session = *server.session;
+    string errorText;
+
+    // The GUI holds the lock only while it builds a frame, not while it waits for the display
+    lock_guard<mutex> lock(session.mutex);
+    auto locked = chrono::steady_clock::now();
+
+    if (words.empty()) {
+        errorText = "ERROR: Empty request\n";
+    }
+    else if (words[0] == "start") {
+        startFromRequest(server, words, received, locked, errorText);
+    }
+    else if (words[0] == "stop") {
+        if (sessionBusy(session)) {
+            stopTake(session);
+            stopMultiDeviceTake(session.multiDevice);
+        }
+        else {
+            errorText = "ERROR: No take is running\n";
+        }
+    }
+    else if (words[0] != "status") {
+        errorText = "ERROR: Unknown request \"" + words[0] + "\", expected start, stop or status\n";
+    }
+
+    if (errorText.empty() == false) {
+        return "{\"ok\":false,\"error\":" + jsonString(errorText) + "," + statusMembers(server, session) + "}";
+    }
+    return "{\"ok\":true," + statusMembers(server, session) + "}";
+}
+
+// Start reading the next piece of a request, returns false if the client has gone
+static bool readPipe(ControlPipe& pipe) {
+    ResetEvent(pipe.overlapped.hEvent);
+    if (ReadFile(pipe.pipe, pipe.readBuffer, sizeof(pipe.readBuffer), NULL, &pipe.overlapped)) {
+        return true; // The event is set on completion either way
+    }
+    return GetLastError() == ERROR_IO_PENDING;
+}
+
+// Wait for the next client of a pipe instance without blocking, the instance's event is set once one connects or sends text
+static void listenPipe(ControlPipe& pipe) {
+    pipe.connected = false;
+    pipe.request.clear();
+
+    // A client that connected and closed before this point leaves the instance to be disconnected first
+    for (int attempt = 0; attempt < 2; attempt++) {
+        ResetEvent(pipe.overlapped.hEvent);
+        BOOL connected = ConnectNamedPipe(pipe.pipe, &pipe.overlapped);
+        DWORD error = GetLastError();
+        if (!connected && error == ERROR_IO_PENDING) {
+            return;
+        }
+
+        // A client that connected before ConnectNamedPipe was called is read from straight away
+        if (connected || error == ERROR_PIPE_CONNECTED) {
+            pipe.connected = true;
+            if (readPipe(pipe)) {
+                return;
+            }
+        }
+        DisconnectNamedPipe(pipe.pipe);
+        pipe.connected = false;
+    }
+}
+
+// Write a reply to a pipe client, giving up if it does not read it in time
+static bool writePipe(ControlPipe& pipe, const string& reply) {
+    ResetEvent(pipe.writeOverlapped.hEvent);
+    DWORD written = 0;
+    if (!WriteFile(pipe.pipe, reply.data(), (DWORD) reply.length(), NULL, &pipe.writeOverlapped) && GetLastError() != ERROR_IO_PENDING) {
+        return false;
+    }
+    if (WaitForSingleObject(pipe.writeOverlapped.hEvent, controlClientTimeoutMs) != WAIT_OBJECT_0) {
+        CancelIoEx(pipe.pipe, &pipe.writeOverlapped);
+        GetOverlappedResult(pipe.pipe, &pipe.writeOverlapped, &written, TRUE);
+        return false;
+    }
+    return GetOverlappedResult(pipe.pipe, &pipe.writeOverlapped, &written, FALSE) && written == reply.length();
+}
+
+// Handle a pipe instance whose connection or read has completed, answering each complete line of text
+static void servePipe(ControlServer& server, ControlPipe& pipe) {
+    DWORD bytes = 0;
+    bool completed = GetOverlappedResult(pipe.pipe, &pipe.overlapped, &bytes, FALSE) != 0;
+    bool keep = completed;
+
+    if (completed && pipe.connected) {
+        pipe.request.append(pipe.readBuffer, bytes);
+
+        size_t end;
+        while (keep && (end = pipe.request.find('\n')) != string::npos) {
+            string line = pipe.request.substr(0, end);
+            pipe.request.erase(0, end + 1);
+            keep = writePipe(pipe, runControlRequest(server, line) + "\n");
+        }
+        if (keep && pipe.request.length() > controlRequestBytes) {
+            writePipe(pipe, "{\"ok\":false,\"error\":\"ERROR: Request too long\\n\"}\n");
+            keep = false;
+        }
+    }
+    pipe.connected = true;
+
+    // A client that has closed its end or stopped reading frees the instance for the next one
+    if (!keep || !readPipe(pipe)) {
+        DisconnectNamedPipe(pipe.pipe);
+        listenPipe(pipe);
+    }
+}
+
+// Find the length of an HTTP request from its headers, returns false until every header has arrived
+static bool httpRequestLength(const string& text, size_t& length) {
+    size_t headerEnd = text.find("\r\n\r\n");
+    if (headerEnd == string::npos) {
+        return false;
+    }
+
+    string headers = text.substr(0, headerEnd + 2);
+    for (char& c : headers) {
+        c = (char) tolower((unsigned char) c);
+    }
+    length = headerEnd + 4;
+    size_t contentLength = headers.find("\r\ncontent-length:");
+    if (contentLength != string::npos) {
+        length += strtoul(headers.c_str() + contentLength + 17, nullptr, 10);
+    }
+    return true;
+}
+
+// Turn an HTTP request into a request line, returns the status to reply with instead if it is not a control request
+static int httpControlLine(const string& text, string& line, string& errorText) {
+    size_t methodEnd = text.find(' ');
+    size_t pathEnd = (methodEnd == string::npos) ? string::npos : text.find(' ', methodEnd + 1);
+    size_t headerEnd = text.find("\r\n\r\n");
+    if (pathEnd == string::npos || headerEnd == string::npos) {
+        errorText = "ERROR: Malformed HTTP request\n";
+        return 400;
+    }
+    string method = text.substr(0, methodEnd);
+    string path = text.substr(methodEnd + 1, pathEnd - methodEnd - 1);
+
+    // Browsers send an Origin header with requests made by web pages, which must not be able to start takes
+    string headers = text.substr(0, headerEnd + 2);
+    for (char& c : headers) {
+        c = (char) tolower((unsigned char) c);
+    }
+    if (headers.find("\r\norigin:") != string::npos) {
+        errorText = "ERROR: Requests from web pages are not accepted\n";
+        return 403;
+    }
+
+    if (path != "/start" && path != "/stop" && path != "/status") {
+        errorText = "ERROR: Unknown path " + path + ", expected /start, /stop or /status\n";
+        return 404;
+    }
+    if (method != "POST" && (method != "GET" || path != "/status")) {
+        errorText = "ERROR: " + path + " needs a POST request\n";
+        return 405;
+    }
+
+    // The options of a start request are its body, written as on the command line
+    line = path.substr(1);
+    if (path == "/start") {
+        line += " " + text.substr(headerEnd + 4);
+    }
+    return 200;
+}
+
+// Answer one HTTP client waiting on the listening socket, closing the connection afterwards
+static void serveHttp(ControlServer& server, SOCKET listenSocket, WSAEVENT acceptEvent) {
+    WSANETWORKEVENTS networkEvents;
+    WSAEnumNetworkEvents(listenSocket, acceptEvent, &networkEvents);
+    SOCKET client = accept(listenSocket, NULL, NULL);
+    if (client == INVALID_SOCKET) {
+        return;
+    }
+
+    // Accepted sockets inherit the listening socket's event selection, the client is served with blocking calls instead
+    WSAEventSelect(client, NULL, 0);
+    u_long nonBlockingMode = 0;
+    ioctlsocket(client, FIONBIO, &nonBlockingMode);
+    DWORD timeout = controlClientTimeoutMs;
+    setsockopt(client, SOL_SOCKET, SO_RCVTIMEO, (const char*) &timeout, sizeof(timeout));
+    setsockopt(client, SOL_SOCKET, SO_SNDTIMEO, (const char*) &timeout, sizeof(timeout));
+
+    // Read until the whole request has arrived, it is too long, or the client closes or times out
+    string text;
+    size_t length = 0;
+    bool headersRead = false;
+    char buffer[1024];
+    while (true) {
+        headersRead = httpRequestLength(text, length);
+        if ((headersRead && (text.length() >= length || length > controlRequestBytes)) || text.length() > controlRequestBytes) {
+            break;
+        }
+        int received = recv(client, buffer, sizeof(buffer), 0);
+        if (received <= 0) {
+            break;
+        }
+        text.append(buffer, received);
+    }
+
+    int status = 0;
+    string line;
+    string errorText;
+    string reply;
+    if ((headersRead ? length : text.length()) > controlRequestBytes) {
+        status = 413;
+        errorText = "ERROR: Request too long\n";
+    }
+    else if (headersRead && text.length() >= length) {
+        status = httpControlLine(text.substr(0, length), line, errorText);
+    }
+
+    if (status == 200) {
+        reply = runControlRequest(server, line);
+        if (reply.compare(0, 11, "{\"ok\":false") == 0) {
+            status = 409;
+        }
+    }
+    else if (status != 0) {
+        reply = "{\"ok\":false,\"error\":" + jsonString(errorText) + "}";
+    }
+
+    // A client that closed or timed out before sending a whole request gets no reply
+    if (reply.empty() == false) {
+        const char* reason = (status == 200) ? "OK" : (status == 400) ? "Bad Request" : (status == 403) ? "Forbidden" : (status == 404) ? "Not Found" :
+                             (status == 405) ? "Method Not Allowed" : (status == 409) ? "Conflict" : "Payload Too Large";
+        reply += "\n";
+        string response = "HTTP/1.1 " + to_string(status) + " " + reason + "\r\nContent-Type: application/json\r\nContent-Length: " +
+                          to_string(reply.length()) + "\r\nConnection: close\r\n\r\n" + reply;
+        send(client, response.data(), (int) response.length(), 0);
+    }
+    shutdown(client, SD_SEND);
+    closesocket(client);
+}
+
+// Wait for pipe clients and the stop event on the pipe worker thread
+static void servePipes(ControlServer& server) {
+    vector<HANDLE> events;
+    events.push_back(server.stopEvent);
+    for (ControlPipe& pipe : server.pipes) {
+        listenPipe(pipe);
+        events.push_back(pipe.overlapped.hEvent);
+    }
+
+    // The stop event is first, so it is seen even while clients keep the others set
+    while (true) {
+        DWORD waited = WaitForMultipleObjects((DWORD) events.size(), events.data(), FALSE, INFINITE);
+        if (waited == WAIT_FAILED || waited == WAIT_OBJECT_0) {
+            break;
+        }
+        servePipe(server, server.pipes[waited - WAIT_OBJECT_0 - 1]);
+    }
+
+    for (ControlPipe& pipe : server.pipes) {
+        CancelIoEx(pipe.pipe, NULL);
+        DWORD bytes = 0;
+        GetOverlappedResult(pipe.pipe, &pipe.overlapped, &bytes, TRUE);
+        DisconnectNamedPipe(pipe.pipe);
+    }
+}
+
+// Wait for HTTP clients and the stop event on their own worker thread, so a slow client never holds up pipe clients
+static void serveHttpClients(ControlServer& server, SOCKET listenSocket) {
+    WSAEVENT acceptEvent = WSACreateEvent();
+    WSAEventSelect(listenSocket, acceptEvent, FD_ACCEPT);
+    HANDLE events[2] = {server.stopEvent, acceptEvent};
+
+    while (true) {
+        DWORD waited = WaitForMultipleObjects(2, events, FALSE, INFINITE);
+        if (waited == WAIT_FAILED || waited == WAIT_OBJECT_0) {
+            break;
+        }
+        serveHttp(server, listenSocket, acceptEvent);
+    }
+
+    closesocket(listenSocket);
+    WSACloseEvent(acceptEvent);
+}
+
+// Close the pipes and events of a server that is not running
+static void closeControlHandles(ControlServer& server) {
+    for (ControlPipe& pipe : server.pipes) {
+        if (pipe.pipe != INVALID_HANDLE_VALUE) {
+            CloseHandle(pipe.pipe);
+        }
+        if (pipe.overlapped.hEvent != NULL) {
+            CloseHandle(pipe.overlapped.hEvent);
+        }
+        if (pipe.writeOverlapped.hEvent != NULL) {
+            CloseHandle(pipe.writeOverlapped.hEvent);
+        }
+    }
+    server.pipes.clear();
+    if (server.stopEvent != NULL) {
+        CloseHandle(server.stopEvent);
+        server.stopEvent = NULL;
+    }
+    if (server.httpPort > 0) {
+        WSACleanup();
+        server.httpPort = 0;
+    }
+}
+
+// Open the pipe and the HTTP port if httpPort is above 0, then serve each on its own worker thread
+bool startControlServer(ControlServer& server, RecordingSession& session, string& recorderPathStr, const string& pipeName, int httpPort,
+                        string& errorText) {
+    if (server.running) {
+        return false;
+    }
+    server.session = &session;
+    server.recorderPathStr = &recorderPathStr;
+    server.pipeName = pipeName;
+    server.httpPort = 0;
+    server.stopEvent = CreateEvent(NULL, TRUE, FALSE, NULL);
+
+    // The first instance fails if another program already serves the name, so clients never reach the wrong one
+    server.pipes = vector<ControlPipe>(controlPipeInstances);
+    for (int i = 0; i < controlPipeInstances; i++) {
+        ControlPipe& pipe = server.pipes[i];
+        DWORD openMode = PIPE_ACCESS_DUPLEX | FILE_FLAG_OVERLAPPED | ((i == 0) ? FILE_FLAG_FIRST_PIPE_INSTANCE : 0);
+        pipe.pipe = CreateNamedPipeA(pipeName.c_str(), openMode, PIPE_TYPE_BYTE | PIPE_READMODE_BYTE | PIPE_WAIT | PIPE_REJECT_REMOTE_CLIENTS,
+                                     controlPipeInstances, 4096, 4096, 0, NULL);
+        pipe.overlapped.hEvent = CreateEvent(NULL, TRUE, FALSE, NULL);
+        pipe.writeOverlapped.hEvent = CreateEvent(NULL, TRUE, FALSE, NULL);
+        if (pipe.pipe == INVALID_HANDLE_VALUE) {
+            errorText = "ERROR: Could not create pipe " + pipeName + " (error " + to_string(GetLastError()) + "), it may already be in use\n";
+            closeControlHandles(server);
+            return false;
+        }
+    }
+
+    // HTTP is only served to this computer
+    SOCKET listenSocket = INVALID_SOCKET;
+    if (httpPort > 0) {
+        WSADATA wsaData;
+        if (WSAStartup(MAKEWORD(2, 2), &wsaData) != 0) {
+            errorText = "ERROR: Winsock failed to initialize\n";
+            closeControlHandles(server);
+            return false;
+        }
+        server.httpPort = httpPort;
+
+        sockaddr_in address = {};
+        address.sin_family = AF_INET;
+        address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        address.sin_port = htons((u_short) httpPort);
+        listenSocket = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+        if (listenSocket == INVALID_SOCKET || bind(listenSocket, (const sockaddr*) &address, sizeof(address)) == SOCKET_ERROR ||
+            listen(listenSocket, SOMAXCONN) == SOCKET_ERROR) {
+            errorText = "ERROR: Could not listen on 127.0.0.1:" + to_string(httpPort) + " (error " + to_string(WSAGetLastError()) + ")\n";
+            if (listenSocket != INVALID_SOCKET) {
+                closesocket(listenSocket);
+            }
+            closeControlHandles(server);
+            return false;
+        }
+    }
+
+    server.running = true;
+    server.pipeThread = thread(servePipes, ref(server));
+    if (listenSocket != INVALID_SOCKET) {
+        server.httpThread = thread(serveHttpClients, ref(server), listenSocket);
+    }
+    return true;
+}
+
+// Stop serving and wait for the workers, which must happen while the session is not locked by the caller
+void endControlServer(ControlServer& server) {
+    if (!server.running) {
+        return;
+    }
+    SetEvent(server.stopEvent);
+    if (server.pipeThread.joinable()) {
+        server.pipeThread.join();
+    }
+    if (server.httpThread.joinable()) {
+        server.httpThread.join();
+    }
+    closeControlHandles(server);
+    server.running = false;
+}
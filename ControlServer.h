@@ -0,0 +1,74 @@
+/* Aden Prince
+ * HiMER Lab at U. of Illinois, Chicago
+ * K4ARecorder GUI
+ *
+ * ControlServer.h
+ * Contains the state and functions used to start, stop and check takes
+ * from scripts through a named pipe, and optionally a loopback HTTP port,
+ * while the GUI keeps running.
+ */
+
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <Windows.h>
+
+struct RecordingSession;
+
+// Pipe opened by --control
+const char controlPipeName[] = "\\\\.\\pipe\\k4arecorder-gui";
+// Clients that can be connected to the pipe at once
+const int controlPipeInstances = 4;
+// Longest request accepted, enough for every option and a long output path
+const size_t controlRequestBytes = 8192;
+// Time a client has to send its HTTP request or read a reply before it is dropped, so it cannot hold up other clients for long
+const DWORD controlClientTimeoutMs = 1000;
+
+// One instance of the control pipe, waiting for a client or for its next request
+struct ControlPipe {
+    HANDLE pipe = INVALID_HANDLE_VALUE;
+    OVERLAPPED overlapped = {};      // Connecting or reading, its event is waited on by the pipe worker
+    OVERLAPPED writeOverlapped = {}; // Writing a reply
+    bool connected = false;
+    char readBuffer[512];
+    std::string request; // Text read since the last complete line
+};
+
+// Serves control requests on worker threads, which lock the session only while they run a request
+struct ControlServer {
+    std::thread pipeThread;
+    std::thread httpThread; // Only started if httpPort is above 0
+    std::atomic<bool> running{false};
+    HANDLE stopEvent = NULL;
+
+    // Set before the workers start
+    RecordingSession* session = nullptr;
+    std::string* recorderPathStr = nullptr; // Read with the session locked
+    std::string pipeName;
+    int httpPort = 0; // 0 for no HTTP endpoint
+    std::vector<ControlPipe> pipes; // Not resized while the pipe worker runs, since their reads are pending
+
+    // Shown by the GUI
+    std::atomic<uint64_t> requests{0};
+    std::atomic<int64_t> lastLockWaitUs{-1}; // From reading a start request to locking the session, -1 before the first
+    std::atomic<int64_t> lastDispatchUs{-1}; // From locking the session to starting the take
+    std::atomic<int64_t> lastStartUs{-1};    // From locking the session to CreateProcess returning
+};
+
+// Split a request line into words, keeping double-quoted text such as paths with spaces together
+std::vector<std::string> splitControlRequest(const std::string& line);
+// Quote text as a JSON string
+std::string jsonString(const std::string& text);
+// Run one request line on the session, locking it, and get the JSON reply
+std::string runControlRequest(ControlServer& server, const std::string& line);
+
+// Open the pipe and the HTTP port if httpPort is above 0, then serve each on its own worker thread
+bool startControlServer(ControlServer& server, RecordingSession& session, std::string& recorderPathStr, const std::string& pipeName, int httpPort,
+                        std::string& errorText);
+// Stop serving and wait for the workers, which must happen while the session is not locked by the caller
+void endControlServer(ControlServer& server);
@@ -0,0 +1,362 @@
+/* Aden Prince
+ * HiMER Lab at U. of Illinois, Chicago
+ * K4ARecorder GUI
+ *
+ * Demux.cpp
+ * Contains functions used to split a recording into one file per track.
+ */
+
+#include "Demux.h"
+#include "FrameReader.h"
+#include "MappedFile.h"
+#include "MatroskaParser.h"
+#include "MatroskaWriter.h"
+#include "RecordingEdit.h"
+
+#include <algorithm>
+#include <cctype>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <memory>
+
+#include <Windows.h>
+
+using namespace std;
+
+// A track being split out and the file it goes to
+struct DemuxTrack {
+    const TrackInfo* info = nullptr;
+    EditOutput out;
+    EditOutput index; // Raw format only
+    DemuxTrackResult result;
+
+    // Matroska format only
+    uint64_t segmentDataOffset = 0;
+    uint64_t previousSize = 0;
+    vector<SeekEntry> seekEntries;
+    vector<CuePointInfo> cuePoints;
+    vector<pair<uint64_t, uint64_t>> spans; // Blocks of the cluster being split, adjacent ones merged
+    uint64_t spanBytes = 0;
+    int64_t firstBlockTimestamp = -1;
+};
+
+// Get the file a track is split into, e.g. take_color.mkv or take_depth.raw, in outputDirectory or next to the recording if it is empty
+string demuxFilename(const string& recording, const string& outputDirectory, const string& trackName, const string& extension) {
+    string stem = recording;
+    if (stem.length() >= 4 && _stricmp(stem.substr(stem.length() - 4).c_str(), ".mkv") == 0) {
+        stem = stem.substr(0, stem.length() - 4);
+    }
+    if (outputDirectory.empty() == false) {
+        size_t slash = stem.find_last_of("\\/");
+        string directory = outputDirectory;
+        if (directory.back() != '\\' && directory.back() != '/') {
+            directory += "\\";
+        }
+        stem = directory + ((slash == string::npos) ? stem : stem.substr(slash + 1));
+    }
+
+    string name = trackName;
+    transform(name.begin(), name.end(), name.begin(), [](unsigned char c) { return (char) tolower(c); });
+    return stem + "_" + name + extension;
+}
+
+// Create a file for writing, failing if it already exists, and add it to the files to delete if the split fails
+static bool createOutput(const string& filename, EditOutput& out, vector<string>& createdFiles, string& errorText) {
+    out.file = CreateFileA(filename.c_str(), GENERIC_WRITE, 0, NULL, CREATE_NEW, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+    if (out.file == INVALID_HANDLE_VALUE) {
+        errorText += "ERROR: Could not create \"" + filename + "\", it may already exist\n";
+        return false;
+    }
+    out.buffer.reserve(editBufferBytes);
+    createdFiles.push_back(filename);
+    return true;
+}
+
+// Flush and close a file, returns false if any write to it failed
+static bool closeOutput(EditOutput& out) {
+    if (out.file == INVALID_HANDLE_VALUE) {
+        return true;
+    }
+    flushEditOutput(out);
+    bool written = !out.failed && FlushFileBuffers(out.file);
+    CloseHandle(out.file);
+    out.file = INVALID_HANDLE_VALUE;
+    return written;
+}
+
+// Copy the top-level elements in a range of the recording to a track's file, keeping only its entry in Tracks
+static void appendDemuxHeaders(DemuxTrack& track, const MatroskaFile& file, uint64_t begin, uint64_t end) {
+    EbmlElement element;
+    for (uint64_t offset = begin; offset < end && readElement(file.data, offset, end, element); offset = element.dataOffset + element.size) {
+        if (element.size == unknownElementSize || element.size > end - element.dataOffset) {
+            break;
+        }
+        if (element.id == seekHeadId || element.id == cuesId || element.id == voidId || element.id == crc32Id || element.id == clusterId) {
+            continue;
+        }
+
+        SeekEntry entry;
+        entry.id = element.id;
+        entry.position = track.out.position - track.segmentDataOffset;
+        track.seekEntries.push_back(entry);
+
+        if (element.id != tracksId) {
+            appendEditBytes(track.out, file.data + element.offset, element.dataOffset + element.size - element.offset);
+            continue;
+        }
+        uint64_t tracksEnd = element.dataOffset + element.size;
+        EbmlElement trackEntry;
+        vector<uint8_t> entries;
+        for (uint64_t entryOffset = element.dataOffset; readElement(file.data, entryOffset, tracksEnd, trackEntry) && trackEntry.size != unknownElementSize &&
+             trackEntry.size <= tracksEnd - trackEntry.dataOffset; entryOffset = trackEntry.dataOffset + trackEntry.size) {
+            uint64_t entryEnd = trackEntry.dataOffset + trackEntry.size;
+            EbmlElement child;
+            for (uint64_t childOffset = trackEntry.dataOffset; trackEntry.id == trackEntryId && readElement(file.data, childOffset, entryEnd, child) &&
+                 child.size != unknownElementSize && child.size <= entryEnd - child.dataOffset; childOffset = child.dataOffset + child.size) {
+                if (child.id == trackNumberId && readUnsigned(file.data, child, entryEnd) == track.info->number) {
+                    entries.insert(entries.end(), file.data + trackEntry.offset, file.data + entryEnd);
+                }
+            }
+        }
+        vector<uint8_t> tracks;
+        writeMasterElement(tracks, tracksId, entries);
+        appendEditBytes(track.out, tracks.data(), tracks.size());
+    }
+}
+
+// Start a track's Matroska file with the EBML header, a segment sized at the end, room for the seek head and the headers before the clusters
+static void startDemuxFile(DemuxTrack& track, const MatroskaFile& file) {
+    appendEditBytes(track.out, file.data, file.segment.offset);
+    vector<uint8_t> start;
+    writeElementId(start, segmentId);
+    writeVarInt(start, 0, 8);
+    appendEditBytes(track.out, start.data(), start.size());
+    track.segmentDataOffset = track.out.position;
+
+    vector<uint8_t> seekHead;
+    writeVoidElement(seekHead, editSeekHeadBytes);
+    appendEditBytes(track.out, seekHead.data(), seekHead.size());
+    appendDemuxHeaders(track, file, file.segment.dataOffset, file.firstClusterOffset);
+}
+
+// Write a cluster holding the blocks of a track found in one of the recording's clusters
+static void appendDemuxCluster(DemuxTrack& track, const MatroskaFile& file, const ClusterInfo& cluster, bool hasPosition, bool hasPrevSize) {
+    uint64_t clusterPosition = track.out.position - track.segmentDataOffset;
+    vector<uint8_t> header;
+    writeUnsignedElement(header, timestampId, (uint64_t) cluster.timestamp);
+    if (hasPosition) {
+        writeUnsignedElement(header, positionId, clusterPosition);
+    }
+    if (hasPrevSize) {
+        writeUnsignedElement(header, prevSizeId, track.previousSize);
+    }
+    vector<uint8_t> start;
+    writeElementId(start, clusterId);
+    writeVarInt(start, header.size() + track.spanBytes);
+    start.insert(start.end(), header.begin(), header.end());
+
+    appendEditBytes(track.out, start.data(), start.size());
+    for (const pair<uint64_t, uint64_t>& span : track.spans) {
+        appendEditBytes(track.out, file.data + span.first, span.second - span.first);
+    }
+    track.previousSize = start.size() + track.spanBytes;
+
+    CuePointInfo cue;
+    cue.time = (uint64_t) max(track.firstBlockTimestamp, (int64_t) 0);
+    cue.track = track.info->number;
+    cue.clusterPosition = clusterPosition;
+    track.cuePoints.push_back(cue);
+}
+
+// End a track's Matroska file with the headers after the clusters and new cues, then patch its segment size and seek head
+static bool finishDemuxFile(DemuxTrack& track, const MatroskaFile& file, DemuxResult& result) {
+    appendDemuxHeaders(track, file, file.firstClusterOffset, file.segmentEnd);
+    SeekEntry cuesEntry;
+    cuesEntry.id = cuesId;
+    cuesEntry.position = track.out.position - track.segmentDataOffset;
+    track.seekEntries.push_back(cuesEntry);
+    vector<uint8_t> cues = buildCues(track.cuePoints);
+    appendEditBytes(track.out, cues.data(), cues.size());
+    flushEditOutput(track.out);
+
+    vector<uint8_t> segmentSize(8);
+    if (track.out.failed || !patchVarInt(segmentSize.data(), track.out.position - track.segmentDataOffset, 8) ||
+        !writeEditAt(track.out.file, track.segmentDataOffset - 8, segmentSize)) {
+        return false;
+    }
+    vector<uint8_t> seekHead;
+    if (!buildSeekHeadToFit(track.seekEntries, editSeekHeadBytes, seekHead) || !writeEditAt(track.out.file, track.segmentDataOffset, seekHead)) {
+        result.warningText += "WARNING: Too many top-level elements for the seek head of \"" + track.result.filename + "\"\n";
+    }
+    return true;
+}
+
+// Add a block to its track's file, as a span of the cluster being split or as raw frame data with an index line
+static void addDemuxBlock(DemuxTrack& track, const MatroskaFile& file, const BlockInfo& block, DemuxFormat format) {
+    track.result.blocks++;
+    if (format == DemuxRaw) {
+        char line[80];
+        int length = snprintf(line, sizeof(line), "%lld,%llu,%llu\n", (long long) block.timestampNs, (unsigned long long) track.out.position,
+                              (unsigned long long) block.dataSize);
+        appendEditBytes(track.index, (const uint8_t*) line, (uint64_t) length);
+        appendEditBytes(track.out, file.data + block.dataOffset, block.dataSize);
+        return;
+    }
+
+    if (track.spans.empty()) {
+        track.firstBlockTimestamp = block.timestampNs / (int64_t) file.timestampScale;
+    }
+    if (track.spans.empty() == false && track.spans.back().second == block.offset) {
+        track.spans.back().second = block.end;
+    }
+    else {
+        track.spans.push_back(make_pair(block.offset, block.end));
+    }
+    track.spanBytes += block.end - block.offset;
+}
+
+// Split every track of a recording into its own file in one pass, never overwriting a file
+bool demuxRecording(const string& recording, const string& outputDirectory, DemuxFormat format, DemuxResult& result, string& errorText) {
+    result = DemuxResult();
+    auto start = chrono::steady_clock::now();
+
+    MappedFile mapped;
+    MatroskaFile file;
+    if (!openMappedFile(recording, mapped, errorText)) {
+        return false;
+    }
+    if (!parseMatroskaHeaders(mapped.data, mapped.length, file, errorText)) {
+        closeMappedFile(mapped);
+        return false;
+    }
+    if (file.firstClusterOffset == 0) {
+        errorText += "ERROR: \"" + recording + "\" has no clusters\n";
+        closeMappedFile(mapped);
+        return false;
+    }
+    if (!outputDirectory.empty() && !CreateDirectoryA(outputDirectory.c_str(), NULL) && GetLastError() != ERROR_ALREADY_EXISTS) {
+        errorText += "ERROR: Could not create \"" + outputDirectory + "\"\n";
+        closeMappedFile(mapped);
+        return false;
+    }
+
+    // Tracks are looked up by number for every block, K4ARecorder numbers them from 1
+    vector<unique_ptr<DemuxTrack>> tracks;
+    vector<DemuxTrack*> trackByNumber;
+    vector<string> createdFiles;
+    bool created = true;
+    for (const TrackInfo& info : file.tracks) {
+        tracks.push_back(unique_ptr<DemuxTrack>(new DemuxTrack()));
+        DemuxTrack& track = *tracks.back();
+        track.info = &info;
+
+        string name = info.name.empty() ? "track" + to_string(info.number) : info.name;
+        string extension = ".mkv";
+        if (format == DemuxRaw) {
+            extension = (info.type == videoTrackType && trackFormat(file, info) == FormatMjpg) ? ".mjpeg" : ".raw";
+            track.result.indexFilename = demuxFilename(recording, outputDirectory, name, ".csv");
+        }
+        track.result.filename = demuxFilename(recording, outputDirectory, name, extension);
+
+        created = created && createOutput(track.result.filename, track.out, createdFiles, errorText);
+        if (created && format == DemuxRaw) {
+            created = createOutput(track.result.indexFilename, track.index, createdFiles, errorText);
+            const char* header = "timestamp_ns,offset,size\n";
+            appendEditBytes(track.index, (const uint8_t*) header, strlen(header));
+        }
+        if (created && format == DemuxMkv) {
+            startDemuxFile(track, file);
+        }
+        if (info.number < 1024) {
+            trackByNumber.resize(max(trackByNumber.size(), (size_t) info.number + 1), nullptr);
+            trackByNumber[info.number] = &track;
+        }
+    }
+
+    // One pass over the clusters feeds every track's file
+    bool laced = false;
+    uint64_t offset = 0;
+    ClusterInfo cluster;
+    while (created && nextCluster(file, offset, cluster)) {
+        if (!cluster.complete) {
+            result.warningText += "WARNING: The recording was cut off inside a cluster, its blocks are left out\n";
+            break;
+        }
+        result.clusters++;
+
+        uint64_t blockOffset = 0;
+        BlockInfo block;
+        while (nextBlock(file, cluster, blockOffset, block)) {
+            DemuxTrack* track = (block.track < trackByNumber.size()) ? trackByNumber[block.track] : nullptr;
+            if (track != nullptr) {
+                laced = laced || block.frameCount > 1;
+                addDemuxBlock(*track, file, block, format);
+            }
+        }
+        if (format != DemuxMkv) {
+            continue;
+        }
+
+        // The new clusters keep the same elements the recording's clusters had
+        bool hasPosition = false;
+        bool hasPrevSize = false;
+        EbmlElement child;
+        for (uint64_t childOffset = cluster.dataOffset; readElement(file.data, childOffset, cluster.end, child) && child.size != unknownElementSize &&
+             (child.id == timestampId || child.id == positionId || child.id == prevSizeId || child.id == crc32Id); childOffset = child.dataOffset + child.size) {
+            hasPosition = hasPosition || child.id == positionId;
+            hasPrevSize = hasPrevSize || child.id == prevSizeId;
+        }
+        for (unique_ptr<DemuxTrack>& track : tracks) {
+            if (track->spans.empty() == false) {
+                appendDemuxCluster(*track, file, cluster, hasPosition, hasPrevSize);
+                track->spans.clear();
+                track->spanBytes = 0;
+            }
+        }
+    }
+    if (laced && format == DemuxRaw) {
+        result.warningText += "WARNING: Some blocks hold more than one frame, their data is written with its lacing header\n";
+    }
+
+    bool written = created;
+    for (unique_ptr<DemuxTrack>& track : tracks) {
+        if (written && format == DemuxMkv) {
+            written = finishDemuxFile(*track, file, result);
+        }
+        track->result.bytes = track->out.position;
+        result.outputBytes += track->out.position + track->index.position;
+        result.bytesCopied += track->out.bytesCopied;
+        written = closeOutput(track->out) && closeOutput(track->index) && written;
+        result.tracks.push_back(track->result);
+    }
+    closeMappedFile(mapped);
+
+    if (!written) {
+        for (const string& filename : createdFiles) {
+            DeleteFileA(filename.c_str());
+        }
+        if (created) {
+            errorText += "ERROR: Writing the split tracks failed\n";
+        }
+        return false;
+    }
+    result.seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    return true;
+}
+
+// Format what a split did as lines of text for the console
+string formatDemuxResult(const DemuxResult& result) {
+    char line[256];
+    string text;
+    for (const DemuxTrackResult& track : result.tracks) {
+        snprintf(line, sizeof(line), "  %llu blocks, %.1f MB\n", (unsigned long long) track.blocks, track.bytes / 1e6);
+        text += track.filename + (track.indexFilename.empty() ? "" : " and " + track.indexFilename) + "\n" + line;
+    }
+    snprintf(line, sizeof(line), "Split %llu clusters into %llu tracks, %.2f GB in %.1f s (%.0f MB/s)\n", (unsigned long long) result.clusters,
+             (unsigned long long) result.tracks.size(), result.outputBytes / 1e9, result.seconds, (result.seconds > 0) ? result.outputBytes / 1e6 / result.seconds : 0);
+    text += line;
+    snprintf(line, sizeof(line), "%.1f%% of the output was written straight from the recording\n",
+             (result.outputBytes > 0) ? 100.0 * result.bytesCopied / result.outputBytes : 0);
+    return text + line + result.warningText;
+}
@@ -0,0 +1,47 @@
+/* Aden Prince
+ * HiMER Lab at U. of Illinois, Chicago
+ * K4ARecorder GUI
+ *
+ * Demux.h
+ * Contains functions used to split a recording into one file per track,
+ * either a Matroska file holding only that track or the track's frames
+ * back to back with a CSV index. Every track is written in one pass over
+ * the memory-mapped recording.
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// What each track is split into
+enum DemuxFormat {
+    DemuxMkv, // A Matroska file with the recording's headers and only this track's blocks
+    DemuxRaw  // Each frame's data back to back, with a CSV of where each frame starts
+};
+
+// One file written by a split
+struct DemuxTrackResult {
+    std::string filename;
+    std::string indexFilename; // Empty unless the format is raw
+    uint64_t blocks = 0;
+    uint64_t bytes = 0;
+};
+
+// What a split did, for display
+struct DemuxResult {
+    uint64_t clusters = 0;
+    uint64_t bytesCopied = 0; // Written straight from the recording
+    uint64_t outputBytes = 0;
+    double seconds = 0;
+    std::vector<DemuxTrackResult> tracks;
+    std::string warningText;
+};
+
+// Get the file a track is split into, e.g. take_color.mkv or take_depth.raw, in outputDirectory or next to the recording if it is empty
+std::string demuxFilename(const std::string& recording, const std::string& outputDirectory, const std::string& trackName, const std::string& extension);
+// Split every track of a recording into its own file in one pass, never overwriting a file
+bool demuxRecording(const std::string& recording, const std::string& outputDirectory, DemuxFormat format, DemuxResult& result, std::string& errorText);
+// Format what a split did as lines of text for the console
+std::string formatDemuxResult(const DemuxResult& result);
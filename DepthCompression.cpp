@@ -0,0 +1,512 @@
+/* Aden Prince
+ * HiMER Lab at U. of Illinois, Chicago
+ * K4ARecorder GUI
+ *
+ * DepthCompression.cpp
+ * Contains functions used to compress and decompress the depth track of
+ * a recording into a new file.
+ */
+
+#include "DepthCompression.h"
+#include "MappedFile.h"
+#include "MatroskaWriter.h"
+#include "Parallel.h"
+#include "RvlCodec.h"
+
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <map>
+
+using namespace std;
+
+// A BITMAPINFOHEADER is 40 bytes, with the FourCC of the frames 16 bytes in
+const uint64_t bitmapInfoHeaderBytes = 40;
+const uint64_t fourccOffset = 16;
+
+// Find the depth track and check its frames are in the format being converted from
+static const TrackInfo* findDepthTrack(const MatroskaFile& file, bool compress, string& errorText) {
+    const TrackInfo* track = findTrack(file, "DEPTH");
+    if (track == nullptr) {
+        errorText += "ERROR: Recording has no depth track\n";
+        return nullptr;
+    }
+
+    const char* fourcc = compress ? rawDepthFourcc : rvlDepthFourcc;
+    if (track->codecId != "V_MS/VFW/FOURCC" || track->codecPrivateSize < bitmapInfoHeaderBytes ||
+        memcmp(file.data + track->codecPrivateOffset + fourccOffset, fourcc, 4) != 0) {
+        errorText += compress ? "ERROR: Depth track is not raw 16-bit depth, it may already be compressed\n" : "ERROR: Depth track is not RVL compressed\n";
+        return nullptr;
+    }
+    if (track->width == 0 || track->height == 0) {
+        errorText += "ERROR: Depth track has no frame size\n";
+        return nullptr;
+    }
+    return track;
+}
+
+// List the clusters and the elements after them, counting depth frames, returns false if the file is not complete
+static bool listClusters(const MatroskaFile& file, const TrackInfo& depth, bool compress, vector<ClusterInfo>& clusters,
+                         vector<EbmlElement>& trailing, uint64_t& depthFrames, string& errorText) {
+    uint64_t rawFrameBytes = (uint64_t) depth.width * depth.height * 2;
+    uint64_t offset = file.firstClusterOffset;
+    EbmlElement element;
+    depthFrames = 0;
+
+    while (offset < file.segmentEnd && readElement(file.data, offset, file.segmentEnd, element)) {
+        if (element.id != clusterId) {
+            if (element.size == unknownElementSize || element.size > file.segmentEnd - element.dataOffset) {
+                break;
+            }
+
+            // The cues and any seek head after the clusters are rebuilt for the new positions
+            if (element.id != cuesId && element.id != seekHeadId && element.id != voidId) {
+                trailing.push_back(element);
+            }
+            offset = element.dataOffset + element.size;
+            continue;
+        }
+
+        ClusterInfo cluster;
+        uint64_t clusterOffset = offset;
+        if (!nextCluster(file, clusterOffset, cluster) || !cluster.complete) {
+            break;
+        }
+        offset = clusterOffset;
+
+        uint64_t blockOffset = 0;
+        BlockInfo block;
+        while (nextBlock(file, cluster, blockOffset, block)) {
+            if (block.track != depth.number) {
+                continue;
+            }
+            if (block.frameCount != 1 || (compress && block.dataSize != rawFrameBytes)) {
+                errorText += "ERROR: Depth frame at byte " + to_string(block.offset) + " is not a single " + to_string(depth.width) + "x" +
+                             to_string(depth.height) + " frame\n";
+                return false;
+            }
+            depthFrames++;
+        }
+        clusters.push_back(cluster);
+    }
+
+    bool segmentCutOff = file.segment.size != unknownElementSize && file.segment.size > file.length - file.segment.dataOffset;
+    if (offset < file.segmentEnd || segmentCutOff) {
+        errorText += "ERROR: Recording was cut off at byte " + to_string(offset) + ", repair it with --repair first\n";
+        return false;
+    }
+    if (clusters.empty()) {
+        errorText += "ERROR: Recording has no clusters\n";
+        return false;
+    }
+    return true;
+}
+
+// Convert one frame and convert it back, returns false if the result does not match the original exactly
+static bool convertFrame(const uint8_t* data, uint64_t size, size_t pixelCount, bool compress, vector<uint8_t>& converted) {
+    if (compress) {
+        converted.resize(rvlMaxCompressedSize(pixelCount));
+        converted.resize(compressRvl(data, pixelCount, true, converted.data()));
+
+        vector<uint8_t> check(pixelCount * 2);
+        return decompressRvl(converted.data(), converted.size(), pixelCount, true, check.data()) && memcmp(check.data(), data, check.size()) == 0;
+    }
+
+    // RVL coding has one encoding per frame, so compressing the result again must give back the same bytes
+    converted.resize(pixelCount * 2);
+    if (!decompressRvl(data, (size_t) size, pixelCount, true, converted.data())) {
+        return false;
+    }
+    vector<uint8_t> check(rvlMaxCompressedSize(pixelCount));
+    check.resize(compressRvl(converted.data(), pixelCount, true, check.data()));
+    return check.size() == size && memcmp(check.data(), data, check.size()) == 0;
+}
+
+// Get the track number of a SimpleBlock or Block element
+static uint64_t blockTrack(const MatroskaFile& file, const EbmlElement& element) {
+    uint64_t track = 0;
+    int16_t relativeTimestamp;
+    uint8_t flags;
+    readBlockHeader(file.data + element.dataOffset, element.size, track, relativeTimestamp, flags);
+    return track;
+}
+
+// Append a SimpleBlock or Block element with the original's header and the converted frame
+static void writeConvertedBlock(vector<uint8_t>& out, const MatroskaFile& file, const EbmlElement& element, const vector<uint8_t>& frame) {
+    uint64_t track;
+    int16_t relativeTimestamp;
+    uint8_t flags;
+    int headerLength = readBlockHeader(file.data + element.dataOffset, element.size, track, relativeTimestamp, flags);
+
+    writeElementId(out, element.id);
+    writeVarInt(out, headerLength + frame.size());
+    out.insert(out.end(), file.data + element.dataOffset, file.data + element.dataOffset + headerLength);
+    out.insert(out.end(), frame.begin(), frame.end());
+}
+
+// Append a copy of a cluster with its depth frames replaced by the next converted frames
+static void writeConvertedCluster(vector<uint8_t>& out, const MatroskaFile& file, const ClusterInfo& cluster, uint64_t depthTrack,
+                                  const vector<vector<uint8_t>>& frames, size_t& frameIndex, uint64_t clusterPosition, uint64_t previousSize) {
+    vector<uint8_t> children;
+    EbmlElement child;
+
+    for (uint64_t offset = cluster.dataOffset; offset < cluster.end && readElement(file.data, offset, cluster.end, child) &&
+         child.size != unknownElementSize; offset = child.dataOffset + child.size) {
+        if (child.id == simpleBlockId && blockTrack(file, child) == depthTrack) {
+            if (frameIndex < frames.size()) {
+                writeConvertedBlock(children, file, child, frames[frameIndex]);
+            }
+            frameIndex++;
+        }
+        else if (child.id == blockGroupId) {
+            // Copy the group's other children, such as the block duration, around the converted block
+            vector<uint8_t> group;
+            uint64_t groupEnd = child.dataOffset + child.size;
+            EbmlElement member;
+            for (uint64_t memberOffset = child.dataOffset; readElement(file.data, memberOffset, groupEnd, member) && member.size != unknownElementSize;
+                 memberOffset = member.dataOffset + member.size) {
+                if (member.id == blockId && blockTrack(file, member) == depthTrack) {
+                    if (frameIndex < frames.size()) {
+                        writeConvertedBlock(group, file, member, frames[frameIndex]);
+                    }
+                    frameIndex++;
+                }
+                else {
+                    group.insert(group.end(), file.data + member.offset, file.data + member.dataOffset + member.size);
+                }
+            }
+            writeMasterElement(children, blockGroupId, group);
+        }
+        else if (child.id == positionId) {
+            writeUnsignedElement(children, positionId, clusterPosition);
+        }
+        else if (child.id == prevSizeId) {
+            writeUnsignedElement(children, prevSizeId, previousSize);
+        }
+        else if (child.id != crc32Id) {
+            // A checksum of the cluster would no longer match, so it is dropped
+            children.insert(children.end(), file.data + child.offset, file.data + child.dataOffset + child.size);
+        }
+    }
+
+    writeMasterElement(out, clusterId, children);
+}
+
+// Write all of bytes at the file pointer
+static bool writeAll(HANDLE file, const vector<uint8_t>& bytes) {
+    DWORD bytesWritten = 0;
+    return WriteFile(file, bytes.data(), (DWORD) bytes.size(), &bytesWritten, NULL) && bytesWritten == bytes.size();
+}
+
+// Write bytes at offset without moving the file pointer
+static bool writeAt(HANDLE file, uint64_t offset, const vector<uint8_t>& bytes) {
+    OVERLAPPED overlapped = {};
+    overlapped.Offset = (DWORD) offset;
+    overlapped.OffsetHigh = (DWORD) (offset >> 32);
+
+    DWORD bytesWritten = 0;
+    return WriteFile(file, bytes.data(), (DWORD) bytes.size(), &bytesWritten, &overlapped) && bytesWritten == bytes.size();
+}
+
+// Point the copied seek head at where the elements after the clusters and the new cues ended up
+static bool writeSeekHead(HANDLE output, const MatroskaFile& file, const map<uint64_t, uint64_t>& movedElements, uint64_t cuesPosition) {
+    SeekHeadRegion region = findSeekHeadRegion(file);
+    if (region.end == 0) {
+        return false;
+    }
+
+    // Without a seek head, add the elements players look for in one
+    vector<SeekEntry> entries = region.entries;
+    if (!region.hasSeekHead) {
+        const uint32_t ids[4] = {infoId, tracksId, attachmentsId, tagsId};
+        const uint64_t offsets[4] = {file.infoOffset, file.tracksOffset, file.attachmentsOffset, file.tagsOffset};
+        for (int i = 0; i < 4; i++) {
+            if (offsets[i] != 0) {
+                SeekEntry entry;
+                entry.id = ids[i];
+                entry.position = offsets[i] - file.segment.dataOffset;
+                entries.push_back(entry);
+            }
+        }
+    }
+
+    // Elements before the clusters were copied to the same place, the cues are added back at their new position
+    vector<SeekEntry> newEntries;
+    for (SeekEntry entry : entries) {
+        uint64_t offset = file.segment.dataOffset + entry.position;
+        auto moved = movedElements.find(offset);
+        if (entry.id == cuesId) {
+            continue;
+        }
+        if (offset >= file.firstClusterOffset) {
+            if (moved == movedElements.end()) {
+                continue;
+            }
+            entry.position = moved->second - file.segment.dataOffset;
+        }
+        newEntries.push_back(entry);
+    }
+    SeekEntry cuesEntry;
+    cuesEntry.id = cuesId;
+    cuesEntry.position = cuesPosition;
+    newEntries.push_back(cuesEntry);
+
+    vector<uint8_t> seekHead;
+    return buildSeekHeadToFit(newEntries, region.end - region.start, seekHead) && writeAt(output, region.start, seekHead);
+}
+
+// Write the converted copy of file, converting batches of depth frames on every core and writing them in order
+static bool writeConvertedFile(DepthCompression& job, const MatroskaFile& file, const TrackInfo& depth, const vector<ClusterInfo>& clusters,
+                               const vector<EbmlElement>& trailing, HANDLE output, string& errorText) {
+    DepthCompressionResult& result = job.result;
+    size_t pixelCount = (size_t) depth.width * depth.height;
+
+    // Everything before the clusters is copied, with the FourCC changed to the new format
+    vector<uint8_t> buffer(file.data, file.data + file.firstClusterOffset);
+    memcpy(buffer.data() + depth.codecPrivateOffset + fourccOffset, job.compress ? rvlDepthFourcc : rawDepthFourcc, 4);
+    if (!writeAll(output, buffer)) {
+        errorText += "ERROR: Writing to \"" + job.outputFilename + "\" failed\n";
+        return false;
+    }
+    uint64_t position = buffer.size();
+
+    vector<CuePointInfo> cuePoints;
+    uint64_t previousClusterSize = 0;
+    double codecSeconds = 0;
+    size_t batchFrames = (size_t) (workerCount() * depthFramesPerWorker);
+    size_t clusterIndex = 0;
+
+    while (clusterIndex < clusters.size()) {
+        if (job.cancel) {
+            errorText += "Conversion of \"" + job.inputFilename + "\" cancelled\n";
+            return false;
+        }
+
+        // Take whole clusters until the batch has enough depth frames to keep every core busy
+        vector<BlockInfo> frames;
+        vector<int> clusterCues;
+        size_t batchEnd = clusterIndex;
+        while (batchEnd < clusters.size() && frames.size() < batchFrames) {
+            uint64_t blockOffset = 0;
+            BlockInfo block;
+            clusterCues.push_back(-1);
+            while (nextBlock(file, clusters[batchEnd], blockOffset, block)) {
+                // The cue points at the cluster's first block
+                if (clusterCues.back() < 0) {
+                    CuePointInfo cue;
+                    cue.time = (uint64_t) (block.timestampNs / (int64_t) file.timestampScale);
+                    cue.track = block.track;
+                    clusterCues.back() = (int) cuePoints.size();
+                    cuePoints.push_back(cue);
+                }
+                if (block.track == depth.number) {
+                    frames.push_back(block);
+                }
+            }
+            batchEnd++;
+        }
+
+        // Each frame is converted into its own buffer so they can be written back in order
+        vector<vector<uint8_t>> converted(frames.size());
+        atomic<bool> mismatch{false};
+        auto codecStart = chrono::steady_clock::now();
+        parallelFor((int) frames.size(), [&](int i) {
+            if (!convertFrame(file.data + frames[i].dataOffset, frames[i].dataSize, pixelCount, job.compress, converted[i])) {
+                mismatch = true;
+            }
+        });
+        codecSeconds += chrono::duration<double>(chrono::steady_clock::now() - codecStart).count();
+
+        if (mismatch) {
+            errorText += job.compress ? "ERROR: A depth frame did not decompress to the original, the output was deleted\n"
+                                      : "ERROR: A depth frame is not valid RVL data, the output was deleted\n";
+            return false;
+        }
+
+        buffer.clear();
+        size_t frameIndex = 0;
+        for (size_t i = clusterIndex; i < batchEnd; i++) {
+            uint64_t clusterPosition = position + buffer.size() - file.segment.dataOffset;
+            if (clusterCues[i - clusterIndex] >= 0) {
+                cuePoints[clusterCues[i - clusterIndex]].clusterPosition = clusterPosition;
+            }
+
+            size_t clusterStart = buffer.size();
+            writeConvertedCluster(buffer, file, clusters[i], depth.number, converted, frameIndex, clusterPosition, previousClusterSize);
+            previousClusterSize = buffer.size() - clusterStart;
+        }
+        if (frameIndex != frames.size()) {
+            errorText += "ERROR: Depth frames in \"" + job.inputFilename + "\" could not be matched to their blocks\n";
+            return false;
+        }
+
+        for (size_t i = 0; i < frames.size(); i++) {
+            result.rawDepthBytes += job.compress ? frames[i].dataSize : converted[i].size();
+            result.codedDepthBytes += job.compress ? converted[i].size() : frames[i].dataSize;
+        }
+        result.depthFrames += frames.size();
+
+        if (!writeAll(output, buffer)) {
+            errorText += "ERROR: Writing to \"" + job.outputFilename + "\" failed\n";
+            return false;
+        }
+        position += buffer.size();
+        clusterIndex = batchEnd;
+        job.framesDone = result.depthFrames;
+    }
+
+    // Elements after the clusters, such as tags, are copied after the new clusters, then the cues are rebuilt
+    map<uint64_t, uint64_t> movedElements;
+    buffer.clear();
+    for (const EbmlElement& element : trailing) {
+        movedElements[element.offset] = position + buffer.size();
+        buffer.insert(buffer.end(), file.data + element.offset, file.data + element.dataOffset + element.size);
+    }
+    uint64_t cuesPosition = position + buffer.size() - file.segment.dataOffset;
+    vector<uint8_t> cues = buildCues(cuePoints);
+    buffer.insert(buffer.end(), cues.begin(), cues.end());
+    bool written = writeAll(output, buffer);
+    position += buffer.size();
+
+    // A segment of unknown size can stay that way
+    if (written && file.segment.size != unknownElementSize) {
+        vector<uint8_t> segmentSize(file.segment.sizeLength);
+        if (!patchVarInt(segmentSize.data(), position - file.segment.dataOffset, file.segment.sizeLength)) {
+            errorText += "ERROR: Segment size is too short for the converted file\n";
+            return false;
+        }
+        written = writeAt(output, file.segment.dataOffset - file.segment.sizeLength, segmentSize);
+    }
+    if (written && !writeSeekHead(output, file, movedElements, cuesPosition)) {
+        result.warningText += "WARNING: No room for a seek head, players will have to find the cues at the end of the file\n";
+    }
+    if (!written) {
+        errorText += "ERROR: Writing to \"" + job.outputFilename + "\" failed\n";
+        return false;
+    }
+
+    result.outputBytes = position;
+    result.codecFps = (codecSeconds > 0) ? result.depthFrames / codecSeconds : 0;
+    return true;
+}
+
+// Get the filename a conversion writes to, e.g. take_rvl.mkv for take.mkv, or take_raw.mkv when decompressing
+string depthOutputFilename(const string& filename, bool compress) {
+    string stem = filename;
+    if (stem.length() >= 4 && _stricmp(stem.substr(stem.length() - 4).c_str(), ".mkv") == 0) {
+        stem = stem.substr(0, stem.length() - 4);
+    }
+    if (!compress && stem.length() >= 4 && stem.substr(stem.length() - 4) == "_rvl") {
+        stem = stem.substr(0, stem.length() - 4);
+    }
+    return stem + (compress ? "_rvl.mkv" : "_raw.mkv");
+}
+
+// Write a copy of job.inputFilename with every depth frame converted and checked to convert back bit-exact
+bool transcodeDepthTrack(DepthCompression& job) {
+    auto start = chrono::steady_clock::now();
+    job.result = DepthCompressionResult();
+    job.framesDone = 0;
+    job.totalFrames = 0;
+
+    MappedFile mapped;
+    if (!openMappedFile(job.inputFilename, mapped, job.errorText)) {
+        return false;
+    }
+    job.result.inputBytes = mapped.length;
+
+    MatroskaFile file;
+    const TrackInfo* depth = nullptr;
+    vector<ClusterInfo> clusters;
+    vector<EbmlElement> trailing;
+    uint64_t depthFrames = 0;
+    bool valid = parseMatroskaHeaders(mapped.data, mapped.length, file, job.errorText) && file.firstClusterOffset != 0 &&
+                 (depth = findDepthTrack(file, job.compress, job.errorText)) != nullptr &&
+                 listClusters(file, *depth, job.compress, clusters, trailing, depthFrames, job.errorText);
+    if (!valid) {
+        closeMappedFile(mapped);
+        return false;
+    }
+    job.totalFrames = depthFrames;
+
+    // Never overwrite an existing file
+    HANDLE output = CreateFileA(job.outputFilename.c_str(), GENERIC_WRITE, 0, NULL, CREATE_NEW, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+    if (output == INVALID_HANDLE_VALUE) {
+        closeMappedFile(mapped);
+        job.errorText += "ERROR: Could not create \"" + job.outputFilename + "\", it may already exist\n";
+        return false;
+    }
+
+    bool written = writeConvertedFile(job, file, *depth, clusters, trailing, output, job.errorText) && FlushFileBuffers(output);
+    CloseHandle(output);
+    closeMappedFile(mapped);
+    if (!written) {
+        DeleteFileA(job.outputFilename.c_str());
+        return false;
+    }
+
+    job.result.seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    return true;
+}
+
+// Format what a conversion did as lines of text for the console
+string formatDepthCompression(const DepthCompression& job) {
+    const DepthCompressionResult& result = job.result;
+    double ratio = (result.codedDepthBytes > 0) ? (double) result.rawDepthBytes / result.codedDepthBytes : 0;
+
+    char line[256];
+    string text = "  Wrote " + job.outputFilename + "\n";
+    snprintf(line, sizeof(line), "  %llu depth frames, %.2f GB raw, %.2f GB compressed (%.2fx), every frame checked bit-exact\n",
+             (unsigned long long) result.depthFrames, result.rawDepthBytes / 1e9, result.codedDepthBytes / 1e9, ratio);
+    text += line;
+    snprintf(line, sizeof(line), "  File %.2f GB to %.2f GB in %.1f s, %.0f frames/s on %d threads\n", result.inputBytes / 1e9,
+             result.outputBytes / 1e9, result.seconds, result.codecFps, workerCount());
+    text += line;
+    return text + result.warningText;
+}
+
+// Convert the file and record the result for the GUI
+static void runDepthCompression(DepthCompression* job) {
+    job->succeeded = transcodeDepthTrack(*job);
+    job->finished = true;
+}
+
+// Start converting a recording's depth track on a worker thread
+bool startDepthCompression(DepthCompression& job, const string& filename, bool compress) {
+    if (job.running) {
+        return false;
+    }
+    endDepthCompression(job);
+
+    job.inputFilename = filename;
+    job.outputFilename = depthOutputFilename(filename, compress);
+    job.compress = compress;
+    job.succeeded = false;
+    job.result = DepthCompressionResult();
+    job.errorText = "";
+
+    job.cancel = false;
+    job.running = true;
+    job.finished = false;
+    job.workerThread = thread(runDepthCompression, &job);
+    return true;
+}
+
+// Check if the conversion has finished, joining the worker once it has, never blocks
+bool pollDepthCompression(DepthCompression& job) {
+    if (!job.running || !job.finished) {
+        return false;
+    }
+    job.workerThread.join();
+    job.running = false;
+    return true;
+}
+
+// Cancel the conversion and wait for it, deleting the partly written output
+void endDepthCompression(DepthCompression& job) {
+    job.cancel = true;
+    if (job.workerThread.joinable()) {
+        job.workerThread.join();
+    }
+    job.running = false;
+}
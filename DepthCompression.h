@@ -0,0 +1,71 @@
+/* Aden Prince
+ * HiMER Lab at U. of Illinois, Chicago
+ * K4ARecorder GUI
+ *
+ * DepthCompression.h
+ * Contains functions used to write a copy of a recording with its depth
+ * track losslessly compressed with RVL coding, or decompressed back to
+ * the raw 16-bit frames K4ARecorder writes.
+ */
+
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <string>
+#include <thread>
+
+// Depth frames converted at once per worker, which bounds the memory used by a batch
+const int depthFramesPerWorker = 4;
+
+// FourCC in the depth track's BITMAPINFOHEADER, raw big-endian 16-bit as K4ARecorder writes it, or compressed
+const char rawDepthFourcc[5] = "b16g";
+const char rvlDepthFourcc[5] = "rvlg";
+
+// What a conversion did, for display
+struct DepthCompressionResult {
+    uint64_t depthFrames = 0;
+    uint64_t rawDepthBytes = 0;
+    uint64_t codedDepthBytes = 0;
+    uint64_t inputBytes = 0;
+    uint64_t outputBytes = 0;
+    double seconds = 0;
+    double codecFps = 0; // Frames converted and checked per second spent converting
+    std::string warningText;
+};
+
+// Converts the depth track of one recording on a worker thread
+struct DepthCompression {
+    std::thread workerThread;
+    std::atomic<bool> running{false};
+    std::atomic<bool> finished{false};
+    std::atomic<bool> cancel{false};
+
+    // Set before the worker starts
+    std::string inputFilename;
+    std::string outputFilename;
+    bool compress = true;
+
+    // Progress, updated after each batch
+    std::atomic<uint64_t> framesDone{0};
+    std::atomic<uint64_t> totalFrames{0};
+
+    // Set by the worker, read once finished is true
+    bool succeeded = false;
+    DepthCompressionResult result;
+    std::string errorText;
+};
+
+// Get the filename a conversion writes to, e.g. take_rvl.mkv for take.mkv, or take_raw.mkv when decompressing
+std::string depthOutputFilename(const std::string& filename, bool compress);
+// Write a copy of job.inputFilename with every depth frame converted and checked to convert back bit-exact
+bool transcodeDepthTrack(DepthCompression& job);
+// Format what a conversion did as lines of text for the console
+std::string formatDepthCompression(const DepthCompression& job);
+
+// Start converting a recording's depth track on a worker thread
+bool startDepthCompression(DepthCompression& job, const std::string& filename, bool compress);
+// Check if the conversion has finished, joining the worker once it has, never blocks
+bool pollDepthCompression(DepthCompression& job);
+// Cancel the conversion and wait for it, deleting the partly written output
+void endDepthCompression(DepthCompression& job);
@@ -0,0 +1,538 @@
+/* Aden Prince
+ * HiMER Lab at U. of Illinois, Chicago
+ * K4ARecorder GUI
+ *
+ * DepthQuality.cpp
+ * Contains functions used to measure, save and plot the depth frames of a
+ * recording.
+ */
+
+#include "DepthQuality.h"
+#include "FrameReader.h"
+#include "Parallel.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+
+using namespace std;
+
+// Running totals of the pixels measured so far
+struct DepthSums {
+    uint64_t invalid = 0;
+    uint64_t sum = 0;
+    uint16_t minMm = 0xFFFF; // Of valid pixels only
+    uint16_t maxMm = 0;
+};
+
+// Vectors added into 32-bit sums before they are moved to the 64-bit total, 2 * 4096 * 65535 cannot overflow
+const size_t depthSumFlushVectors = 4096;
+
+// Get the statistics filename of a recording, e.g. take.mkv.depthstats
+string depthStatsFilename(const string& recording) {
+    return recording + ".depthstats";
+}
+
+// Measure pixels first to last - 1 one at a time
+static void measureDepthScalar(const uint16_t* depth, size_t first, size_t last, DepthSums& sums) {
+    for (size_t i = first; i < last; i++) {
+        uint16_t value = depth[i];
+        sums.sum += value;
+        sums.maxMm = max(sums.maxMm, value);
+        if (value == 0) {
+            sums.invalid++;
+        }
+        else {
+            sums.minMm = min(sums.minMm, value);
+        }
+    }
+}
+
+#ifdef X64_SIMD
+// Measure the first pixelCount pixels 8 at a time, pixelCount must be a multiple of 8
+static void measureDepthSse2(const uint16_t* depth, size_t pixelCount, DepthSums& sums) {
+    // SSE2 only compares signed 16-bit values, so values are moved down by 0x8000 first, invalid pixels become 0xFFFF for the minimum
+    const __m128i bias = _mm_set1_epi16((short) 0x8000);
+    const __m128i zero = _mm_setzero_si128();
+    __m128i minimum = _mm_set1_epi16(0x7FFF);
+    __m128i maximum = _mm_set1_epi16((short) 0x8000);
+    for (size_t block = 0; block < pixelCount; block += depthSumFlushVectors * 8) {
+        size_t end = min(pixelCount, block + depthSumFlushVectors * 8);
+        __m128i invalid = zero;
+        __m128i sum = zero;
+        for (size_t i = block; i < end; i += 8) {
+            __m128i values = _mm_loadu_si128((const __m128i*) (depth + i));
+            __m128i isZero = _mm_cmpeq_epi16(values, zero);
+            invalid = _mm_sub_epi16(invalid, isZero);
+            minimum = _mm_min_epi16(minimum, _mm_xor_si128(_mm_or_si128(values, isZero), bias));
+            maximum = _mm_max_epi16(maximum, _mm_xor_si128(values, bias));
+            sum = _mm_add_epi32(sum, _mm_add_epi32(_mm_unpacklo_epi16(values, zero), _mm_unpackhi_epi16(values, zero)));
+        }
+
+        uint16_t invalidLanes[8];
+        uint32_t sumLanes[4];
+        _mm_storeu_si128((__m128i*) invalidLanes, invalid);
+        _mm_storeu_si128((__m128i*) sumLanes, sum);
+        for (int lane = 0; lane < 8; lane++) {
+            sums.invalid += invalidLanes[lane];
+        }
+        for (int lane = 0; lane < 4; lane++) {
+            sums.sum += sumLanes[lane];
+        }
+    }
+
+    uint16_t minLanes[8];
+    uint16_t maxLanes[8];
+    _mm_storeu_si128((__m128i*) minLanes, _mm_xor_si128(minimum, bias));
+    _mm_storeu_si128((__m128i*) maxLanes, _mm_xor_si128(maximum, bias));
+    for (int lane = 0; lane < 8; lane++) {
+        sums.minMm = min(sums.minMm, minLanes[lane]);
+        sums.maxMm = max(sums.maxMm, maxLanes[lane]);
+    }
+}
+
+// Measure the first pixelCount pixels 16 at a time, pixelCount must be a multiple of 16
+AVX2_FUNCTION static void measureDepthAvx2(const uint16_t* depth, size_t pixelCount, DepthSums& sums) {
+    const __m256i zero = _mm256_setzero_si256();
+    __m256i minimum = _mm256_set1_epi16((short) 0xFFFF);
+    __m256i maximum = zero;
+    for (size_t block = 0; block < pixelCount; block += depthSumFlushVectors * 16) {
+        size_t end = min(pixelCount, block + depthSumFlushVectors * 16);
+        __m256i invalid = zero;
+        __m256i sum = zero;
+        for (size_t i = block; i < end; i += 16) {
+            __m256i values = _mm256_loadu_si256((const __m256i*) (depth + i));
+            __m256i isZero = _mm256_cmpeq_epi16(values, zero);
+            invalid = _mm256_sub_epi16(invalid, isZero);
+            minimum = _mm256_min_epu16(minimum, _mm256_or_si256(values, isZero));
+            maximum = _mm256_max_epu16(maximum, values);
+            sum = _mm256_add_epi32(sum, _mm256_add_epi32(_mm256_unpacklo_epi16(values, zero), _mm256_unpackhi_epi16(values, zero)));
+        }
+
+        uint16_t invalidLanes[16];
+        uint32_t sumLanes[8];
+        _mm256_storeu_si256((__m256i*) invalidLanes, invalid);
+        _mm256_storeu_si256((__m256i*) sumLanes, sum);
+        for (int lane = 0; lane < 16; lane++) {
+            sums.invalid += invalidLanes[lane];
+        }
+        for (int lane = 0; lane < 8; lane++) {
+            sums.sum += sumLanes[lane];
+        }
+    }
+
+    uint16_t minLanes[16];
+    uint16_t maxLanes[16];
+    _mm256_storeu_si256((__m256i*) minLanes, minimum);
+    _mm256_storeu_si256((__m256i*) maxLanes, maximum);
+    for (int lane = 0; lane < 16; lane++) {
+        sums.minMm = min(sums.minMm, minLanes[lane]);
+        sums.maxMm = max(sums.maxMm, maxLanes[lane]);
+    }
+}
+#endif
+
+// Count the valid pixels of a frame per 1 mm, even and odd pixels in separate histograms so runs of the same depth do not wait on each other
+static void histogramDepth(const uint16_t* depth, size_t pixelCount, uint32_t* histograms) {
+    uint32_t* even = histograms;
+    uint32_t* odd = histograms + depthHistogramBins;
+    size_t i = 0;
+    for (; i + 2 <= pixelCount; i += 2) {
+        even[min<uint32_t>(depth[i], depthHistogramBins - 1)]++;
+        odd[min<uint32_t>(depth[i + 1], depthHistogramBins - 1)]++;
+    }
+    if (i < pixelCount) {
+        even[min<uint32_t>(depth[i], depthHistogramBins - 1)]++;
+    }
+}
+
+// Measure one depth frame of little-endian millimetres, histograms is 2 * depthHistogramBins counts that must be 0 and are left 0
+void measureDepthFrame(const uint16_t* depth, size_t pixelCount, uint32_t* histograms, uint64_t* takeHistogram, DepthFrameStats& stats) {
+    DepthSums sums;
+    size_t done = 0;
+
+#ifdef X64_SIMD
+    if (hasAvx2()) {
+        done = pixelCount / 16 * 16;
+        measureDepthAvx2(depth, done, sums);
+    }
+    else {
+        done = pixelCount / 8 * 8;
+        measureDepthSse2(depth, done, sums);
+    }
+#endif
+
+    measureDepthScalar(depth, done, pixelCount, sums);
+    stats.validPixels = (uint32_t) (pixelCount - sums.invalid);
+    stats.meanMm = (stats.validPixels > 0) ? (float) ((double) sums.sum / stats.validPixels) : 0.0f;
+    stats.minMm = (stats.validPixels > 0) ? sums.minMm : 0;
+    stats.maxMm = (stats.validPixels > 0) ? sums.maxMm : 0;
+    stats.p5Mm = stats.medianMm = stats.p95Mm = 0;
+    if (stats.validPixels == 0) {
+        return;
+    }
+
+    // Only the bins between the nearest and farthest pixel can be set, so only they are read and cleared
+    histogramDepth(depth, pixelCount, histograms);
+    uint32_t* even = histograms;
+    uint32_t* odd = histograms + depthHistogramBins;
+    even[0] = odd[0] = 0;
+    uint64_t targets[3] = {(stats.validPixels - 1) * 5ULL / 100, (stats.validPixels - 1) / 2ULL, (stats.validPixels - 1) * 95ULL / 100};
+    uint16_t* percentiles[3] = {&stats.p5Mm, &stats.medianMm, &stats.p95Mm};
+    int found = 0;
+    uint64_t counted = 0;
+    uint32_t last = min<uint32_t>(stats.maxMm, depthHistogramBins - 1);
+    for (uint32_t bin = min<uint32_t>(stats.minMm, last); bin <= last; bin++) {
+        uint32_t count = even[bin] + odd[bin];
+        even[bin] = odd[bin] = 0;
+        takeHistogram[bin] += count;
+        counted += count;
+        while (found < 3 && counted > targets[found]) {
+            *percentiles[found++] = (uint16_t) bin;
+        }
+    }
+}
+
+// Read saved statistics, returns false if they are missing, damaged or from another version of the recording
+static bool loadDepthQuality(const string& filename, uint64_t size, uint64_t writeTime, DepthQuality& quality) {
+    // Each frame's time, valid pixels, minimum, maximum, mean and percentiles, after a header of 48 bytes
+    const uint64_t headerBytes = 48;
+    const uint64_t frameRecordBytes = 8 + 4 + 2 + 2 + 4 + 2 + 2 + 2;
+
+    ifstream input(filename, ios::binary | ios::ate);
+    streamoff fileBytes = input.tellg();
+    input.seekg(0);
+    char magic[8];
+    uint64_t savedSize = 0;
+    uint64_t savedTime = 0;
+    uint64_t count = 0;
+    uint32_t binCount = 0;
+    input.read(magic, 8);
+    input.read((char*) &savedSize, 8);
+    input.read((char*) &savedTime, 8);
+    input.read((char*) &quality.width, 4);
+    input.read((char*) &quality.height, 4);
+    input.read((char*) &count, 8);
+    input.read((char*) &quality.histogramFirstMm, 4);
+    input.read((char*) &binCount, 4);
+    if (!input || fileBytes < (streamoff) headerBytes || memcmp(magic, depthStatsMagic, 8) != 0 || savedSize != size || savedTime != writeTime ||
+        count > ((uint64_t) fileBytes - headerBytes) / frameRecordBytes || quality.histogramFirstMm + (uint64_t) binCount > depthHistogramBins) {
+        return false;
+    }
+
+    // Each measurement is stored as a column, so one can be read without the others
+    vector<DepthFrameStats>& frames = quality.frames;
+    frames.resize((size_t) count);
+    for (DepthFrameStats& frame : frames) {
+        input.read((char*) &frame.timeNs, 8);
+    }
+    for (DepthFrameStats& frame : frames) {
+        input.read((char*) &frame.validPixels, 4);
+    }
+    for (DepthFrameStats& frame : frames) {
+        input.read((char*) &frame.minMm, 2);
+    }
+    for (DepthFrameStats& frame : frames) {
+        input.read((char*) &frame.maxMm, 2);
+    }
+    for (DepthFrameStats& frame : frames) {
+        input.read((char*) &frame.meanMm, 4);
+    }
+    for (DepthFrameStats& frame : frames) {
+        input.read((char*) &frame.p5Mm, 2);
+    }
+    for (DepthFrameStats& frame : frames) {
+        input.read((char*) &frame.medianMm, 2);
+    }
+    for (DepthFrameStats& frame : frames) {
+        input.read((char*) &frame.p95Mm, 2);
+    }
+    quality.histogram.resize(binCount);
+    input.read((char*) quality.histogram.data(), binCount * 8ULL);
+    return (bool) input;
+}
+
+// Save the statistics next to the recording, a failure only means they are measured again next time
+static void saveDepthQuality(const string& filename, uint64_t size, uint64_t writeTime, const DepthQuality& quality) {
+    ofstream output(filename, ios::binary | ios::trunc);
+    uint64_t count = quality.frames.size();
+    uint32_t binCount = (uint32_t) quality.histogram.size();
+    output.write(depthStatsMagic, 8);
+    output.write((const char*) &size, 8);
+    output.write((const char*) &writeTime, 8);
+    output.write((const char*) &quality.width, 4);
+    output.write((const char*) &quality.height, 4);
+    output.write((const char*) &count, 8);
+    output.write((const char*) &quality.histogramFirstMm, 4);
+    output.write((const char*) &binCount, 4);
+
+    const vector<DepthFrameStats>& frames = quality.frames;
+    for (const DepthFrameStats& frame : frames) {
+        output.write((const char*) &frame.timeNs, 8);
+    }
+    for (const DepthFrameStats& frame : frames) {
+        output.write((const char*) &frame.validPixels, 4);
+    }
+    for (const DepthFrameStats& frame : frames) {
+        output.write((const char*) &frame.minMm, 2);
+    }
+    for (const DepthFrameStats& frame : frames) {
+        output.write((const char*) &frame.maxMm, 2);
+    }
+    for (const DepthFrameStats& frame : frames) {
+        output.write((const char*) &frame.meanMm, 4);
+    }
+    for (const DepthFrameStats& frame : frames) {
+        output.write((const char*) &frame.p5Mm, 2);
+    }
+    for (const DepthFrameStats& frame : frames) {
+        output.write((const char*) &frame.medianMm, 2);
+    }
+    for (const DepthFrameStats& frame : frames) {
+        output.write((const char*) &frame.p95Mm, 2);
+    }
+    output.write((const char*) quality.histogram.data(), binCount * 8ULL);
+    output.close();
+    if (!output) {
+        remove(filename.c_str());
+    }
+}
+
+// Average the statistics down to at most depthQualityPlotPoints points and the histogram into depthPlotBinMm bars for the GUI
+static void makeDepthQualityPlots(DepthQualityJob& job) {
+    const DepthQuality& quality = job.quality;
+    size_t count = quality.frames.size();
+    size_t points = min(count, (size_t) depthQualityPlotPoints);
+    double pixels = (double) quality.width * quality.height;
+    job.invalidPlot.assign(points, 0.0f);
+    job.meanPlot.assign(points, 0.0f);
+    for (size_t point = 0; point < points; point++) {
+        size_t begin = point * count / points;
+        size_t end = max((point + 1) * count / points, begin + 1);
+        double invalid = 0;
+        double weightedMean = 0;
+        double valid = 0;
+        for (size_t i = begin; i < end; i++) {
+            invalid += pixels - quality.frames[i].validPixels;
+            weightedMean += (double) quality.frames[i].meanMm * quality.frames[i].validPixels;
+            valid += quality.frames[i].validPixels;
+        }
+        job.invalidPlot[point] = (pixels > 0) ? (float) (100.0 * invalid / (pixels * (end - begin))) : 0.0f;
+        job.meanPlot[point] = (valid > 0) ? (float) (weightedMean / valid) : 0.0f;
+    }
+
+    job.histogramPlot.clear();
+    for (size_t bin = 0; bin < quality.histogram.size(); bin++) {
+        size_t bar = (quality.histogramFirstMm + bin) / depthPlotBinMm - quality.histogramFirstMm / depthPlotBinMm;
+        if (bar >= job.histogramPlot.size()) {
+            job.histogramPlot.resize(bar + 1, 0.0f);
+        }
+        job.histogramPlot[bar] += (float) quality.histogram[bin];
+    }
+}
+
+// Load a recording's depth statistics from their file, or measure every depth frame across every core and save them
+bool makeDepthQuality(DepthQualityJob& job) {
+    auto start = chrono::steady_clock::now();
+    DepthQuality& quality = job.quality;
+    quality = DepthQuality();
+    job.fromCache = false;
+
+    // The file is only trusted for the exact recording it was made from
+    uint64_t size = 0;
+    uint64_t writeTime = 0;
+    string statsFilename = depthStatsFilename(job.filename);
+    bool stamped = fileStamp(job.filename, size, writeTime);
+    if (stamped && loadDepthQuality(statsFilename, size, writeTime, quality)) {
+        job.fromCache = true;
+        job.totalFrames = quality.frames.size();
+        job.framesDone = quality.frames.size();
+        makeDepthQualityPlots(job);
+        job.seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+        return true;
+    }
+    quality = DepthQuality();
+
+    // Only the reader's index is used, each frame is decoded straight from the recording
+    FrameReader reader;
+    if (!openFrameReader(job.filename, 0, reader, job.errorText)) {
+        return false;
+    }
+    const ReaderTrackState& depth = reader.tracks[ReaderDepth];
+    if (depth.info == nullptr || depth.frames.empty()) {
+        closeFrameReader(reader);
+        return false;
+    }
+    quality.width = depth.info->width;
+    quality.height = depth.info->height;
+    int count = (int) depth.frames.size();
+    quality.frames.resize(count);
+    job.totalFrames = count;
+
+    // Each chunk keeps its own histograms, the take's histogram is summed from them at the end
+    int chunks = (count + depthStatsChunkFrames - 1) / depthStatsChunkFrames;
+    vector<vector<uint64_t>> takeHistograms(chunks);
+    vector<string> errors(chunks);
+    vector<int> failures(chunks, 0);
+    parallelFor(chunks, [&](int chunk) {
+        vector<uint32_t> histograms(depthHistogramBins * 2, 0);
+        takeHistograms[chunk].assign(depthHistogramBins, 0);
+        DecodedFrame frame;
+        int end = min(count, (chunk + 1) * depthStatsChunkFrames);
+        for (int i = chunk * depthStatsChunkFrames; i < end && !job.cancel; i++) {
+            DepthFrameStats& stats = quality.frames[i];
+            stats.timeNs = depth.frames[i].timestampNs - depth.frames[0].timestampNs;
+            if (decodeIndexedFrame(reader, ReaderDepth, i, frame, errors[chunk])) {
+                measureDepthFrame((const uint16_t*) frame.pixels.data(), (size_t) frame.width * frame.height, histograms.data(),
+                                  takeHistograms[chunk].data(), stats);
+            }
+            else {
+                failures[chunk]++;
+            }
+        }
+        job.framesDone += end - chunk * depthStatsChunkFrames;
+    });
+    closeFrameReader(reader);
+
+    if (job.cancel) {
+        return false;
+    }
+    int failed = 0;
+    for (int chunk = 0; chunk < chunks; chunk++) {
+        // The first few errors say enough, the rest are usually the same
+        if (failures[chunk] > 0 && failed < 3) {
+            job.errorText += errors[chunk];
+        }
+        failed += failures[chunk];
+    }
+    if (failed == count) {
+        return false;
+    }
+
+    vector<uint64_t> histogram(depthHistogramBins, 0);
+    for (const vector<uint64_t>& chunkHistogram : takeHistograms) {
+        for (uint32_t bin = 0; bin < depthHistogramBins; bin++) {
+            histogram[bin] += chunkHistogram[bin];
+        }
+    }
+    uint32_t first = 1;
+    uint32_t last = depthHistogramBins - 1;
+    while (first < last && histogram[first] == 0) {
+        first++;
+    }
+    while (last > first && histogram[last] == 0) {
+        last--;
+    }
+    quality.histogramFirstMm = first;
+    quality.histogram.assign(histogram.begin() + first, histogram.begin() + last + 1);
+    makeDepthQualityPlots(job);
+
+    // Frames that could not be decoded are not saved, in case they can be next time
+    if (stamped && failed == 0) {
+        saveDepthQuality(statsFilename, size, writeTime, quality);
+    }
+    job.seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    return true;
+}
+
+// Format a summary of the depth statistics of a recording as lines of text for the console
+string formatDepthQuality(const DepthQualityJob& job) {
+    const DepthQuality& quality = job.quality;
+    char line[256];
+    snprintf(line, sizeof(line), "%llu depth frames of %ux%u, %s in %.2f s (%.0f frames/s)\n", (unsigned long long) quality.frames.size(), quality.width,
+             quality.height, job.fromCache ? "loaded" : "measured", job.seconds, (job.seconds > 0) ? quality.frames.size() / job.seconds : 0);
+    string text = line;
+    if (quality.frames.empty()) {
+        return text;
+    }
+
+    double pixels = (double) quality.width * quality.height;
+    double invalid = 0;
+    size_t worst = 0;
+    uint16_t nearest = 0xFFFF;
+    uint16_t farthest = 0;
+    for (size_t i = 0; i < quality.frames.size(); i++) {
+        const DepthFrameStats& frame = quality.frames[i];
+        invalid += pixels - frame.validPixels;
+        if (frame.validPixels < quality.frames[worst].validPixels) {
+            worst = i;
+        }
+        if (frame.validPixels > 0) {
+            nearest = min(nearest, frame.minMm);
+            farthest = max(farthest, frame.maxMm);
+        }
+    }
+    snprintf(line, sizeof(line), "Invalid pixels: %.1f%% on average, %.1f%% at worst in the frame at %.3f s\n",
+             100.0 * invalid / (pixels * quality.frames.size()), 100.0 * (pixels - quality.frames[worst].validPixels) / pixels,
+             quality.frames[worst].timeNs / 1e9);
+    text += line;
+
+    // Percentiles of the whole take come from its histogram
+    uint64_t total = 0;
+    for (uint64_t count : quality.histogram) {
+        total += count;
+    }
+    uint64_t targets[3] = {total * 5 / 100, total / 2, total * 95 / 100};
+    uint32_t percentiles[3] = {};
+    uint64_t counted = 0;
+    int found = 0;
+    for (size_t bin = 0; bin < quality.histogram.size() && found < 3; bin++) {
+        counted += quality.histogram[bin];
+        while (found < 3 && counted > targets[found]) {
+            percentiles[found++] = quality.histogramFirstMm + (uint32_t) bin;
+        }
+    }
+    snprintf(line, sizeof(line), "Valid depth: %u to %u mm, 5th percentile %u mm, median %u mm, 95th percentile %u mm\n", (nearest == 0xFFFF) ? 0 : nearest,
+             farthest, percentiles[0], percentiles[1], percentiles[2]);
+    return text + line + job.errorText;
+}
+
+// Measure the depth frames on the worker thread
+static void runDepthQuality(DepthQualityJob* job) {
+    job->succeeded = makeDepthQuality(*job);
+    job->finished = true;
+}
+
+// Start measuring a recording's depth frames on a worker thread, cancelling a measurement already running
+bool startDepthQuality(DepthQualityJob& job, const string& filename) {
+    endDepthQuality(job);
+
+    job.filename = filename;
+    job.succeeded = false;
+    job.fromCache = false;
+    job.seconds = 0;
+    job.quality = DepthQuality();
+    job.invalidPlot.clear();
+    job.meanPlot.clear();
+    job.histogramPlot.clear();
+    job.errorText = "";
+    job.framesDone = 0;
+    job.totalFrames = 0;
+
+    job.cancel = false;
+    job.running = true;
+    job.finished = false;
+    job.workerThread = thread(runDepthQuality, &job);
+    return true;
+}
+
+// Check if the measurement is done, joining the worker once it is, never blocks
+bool pollDepthQuality(DepthQualityJob& job) {
+    if (!job.running || !job.finished) {
+        return false;
+    }
+    job.workerThread.join();
+    job.running = false;
+    return true;
+}
+
+// Cancel the measurement and wait for the worker
+void endDepthQuality(DepthQualityJob& job) {
+    job.cancel = true;
+    if (job.workerThread.joinable()) {
+        job.workerThread.join();
+    }
+    job.running = false;
+}
@@ -0,0 +1,90 @@
+/* Aden Prince
+ * HiMER Lab at U. of Illinois, Chicago
+ * K4ARecorder GUI
+ *
+ * DepthQuality.h
+ * Contains the state and functions used to measure every depth frame of a
+ * finished recording: how many pixels are invalid, the range, mean and
+ * percentiles of the rest, and a 1 mm histogram of the whole take. The
+ * results are saved next to the recording as a compact time series.
+ */
+
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <string>
+#include <thread>
+#include <vector>
+
+// 1 mm bins from 0, farther than any depth mode reaches, farther depths are counted in the last bin
+const uint32_t depthHistogramBins = 16384;
+// Frames measured by one task, which keeps its own histograms
+const int depthStatsChunkFrames = 32;
+// Points in each plot shown by the GUI, longer takes are averaged down to this many
+const int depthQualityPlotPoints = 600;
+// Width of the bars of the take's histogram shown by the GUI
+const uint32_t depthPlotBinMm = 50;
+// Start of a depth statistics file, followed by the recording's size and write time
+const char depthStatsMagic[9] = "K4ADQS01";
+
+// Measurements of one depth frame, the depths are 0 if no pixel is valid
+struct DepthFrameStats {
+    int64_t timeNs = 0; // From the first depth frame
+    uint32_t validPixels = 0;
+    uint16_t minMm = 0;
+    uint16_t maxMm = 0;
+    float meanMm = 0;
+    uint16_t p5Mm = 0;
+    uint16_t medianMm = 0;
+    uint16_t p95Mm = 0;
+};
+
+struct DepthQuality {
+    uint32_t width = 0;
+    uint32_t height = 0;
+    std::vector<DepthFrameStats> frames;
+    uint32_t histogramFirstMm = 0;  // Bins before the nearest valid depth of the take are not kept
+    std::vector<uint64_t> histogram; // Valid pixels of the whole take per 1 mm from histogramFirstMm
+};
+
+// Measures the depth frames of one recording on a worker thread
+struct DepthQualityJob {
+    std::thread workerThread;
+    std::atomic<bool> running{false};
+    std::atomic<bool> finished{false};
+    std::atomic<bool> cancel{false};
+
+    // Set before the worker starts
+    std::string filename;
+
+    // Progress, updated after each chunk of frames
+    std::atomic<uint64_t> framesDone{0};
+    std::atomic<uint64_t> totalFrames{0};
+
+    // Set by the worker, read once finished is true
+    bool succeeded = false;
+    bool fromCache = false;
+    double seconds = 0;
+    DepthQuality quality;
+    std::vector<float> invalidPlot; // Percent of pixels invalid
+    std::vector<float> meanPlot;    // Mean valid depth in millimetres
+    std::vector<float> histogramPlot;
+    std::string errorText;
+};
+
+// Get the statistics filename of a recording, e.g. take.mkv.depthstats
+std::string depthStatsFilename(const std::string& recording);
+// Measure one depth frame of little-endian millimetres, histograms is 2 * depthHistogramBins counts that must be 0 and are left 0
+void measureDepthFrame(const uint16_t* depth, size_t pixelCount, uint32_t* histograms, uint64_t* takeHistogram, DepthFrameStats& stats);
+// Load a recording's depth statistics from their file, or measure every depth frame across every core and save them
+bool makeDepthQuality(DepthQualityJob& job);
+// Format a summary of the depth statistics of a recording as lines of text for the console
+std::string formatDepthQuality(const DepthQualityJob& job);
+
+// Start measuring a recording's depth frames on a worker thread, cancelling a measurement already running
+bool startDepthQuality(DepthQualityJob& job, const std::string& filename);
+// Check if the measurement is done, joining the worker once it is, never blocks
+bool pollDepthQuality(DepthQualityJob& job);
+// Cancel the measurement and wait for the worker
+void endDepthQuality(DepthQualityJob& job);
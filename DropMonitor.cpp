@@ -0,0 +1,273 @@
+/* Aden Prince
+ * HiMER Lab at U. of Illinois, Chicago
+ * K4ARecorder GUI
+ *
+ * DropMonitor.cpp
+ * Contains functions used to follow the output files while K4ARecorder
+ * writes them and report frames missing between their timestamps.
+ */
+
+#include "DropMonitor.h"
+#include "RecordingInspector.h"
+
+#include <algorithm>
+#include <climits>
+
+using namespace std;
+
+// Most bytes read from the start of a file while looking for its first cluster
+const DWORD maxHeaderBytes = 16 * 1024 * 1024;
+// Bytes read at each element, enough for its ID, size and a block header
+const DWORD elementReadBytes = 32;
+
+// Read up to bytes at offset without moving the file pointer
+static DWORD readAt(HANDLE file, uint64_t offset, uint8_t* buffer, DWORD bytes) {
+    OVERLAPPED overlapped = {};
+    overlapped.Offset = (DWORD) offset;
+    overlapped.OffsetHigh = (DWORD) (offset >> 32);
+
+    DWORD bytesRead = 0;
+    if (!ReadFile(file, buffer, bytes, &bytesRead, &overlapped)) {
+        return 0;
+    }
+    return bytesRead;
+}
+
+// Read the element header at offset, returns false if it has not been written yet
+static bool readElementAt(HANDLE file, uint64_t offset, uint64_t fileSize, EbmlElement& element, uint8_t* buffer, DWORD& bytesRead) {
+    DWORD bytes = (fileSize - offset < elementReadBytes) ? (DWORD) (fileSize - offset) : elementReadBytes;
+    bytesRead = readAt(file, offset, buffer, bytes);
+    if (!readElement(buffer, 0, bytesRead, element)) {
+        return false;
+    }
+
+    // Offsets are read relative to the buffer
+    element.offset += offset;
+    element.dataOffset += offset;
+    return true;
+}
+
+// Check the step from the previous frame of a block's track and count the frame
+static void checkBlock(DropMonitor& monitor, TailReader& reader, int fileIndex, const uint8_t* data, uint64_t available) {
+    uint64_t trackNumber;
+    int16_t relativeTimestamp;
+    uint8_t flags;
+    if (readBlockHeader(data, available, trackNumber, relativeTimestamp, flags) == 0) {
+        return;
+    }
+
+    int index = 0;
+    while (index < (int) reader.tracks.size() && reader.tracks[index].number != trackNumber) {
+        index++;
+    }
+    if (index == (int) reader.tracks.size() || index >= maxMonitoredTracks) {
+        return;
+    }
+
+    // IMU samples do not follow the frame rate
+    const TrackInfo& track = reader.tracks[index];
+    if (track.codecId == "S_K4A/IMU") {
+        return;
+    }
+
+    int64_t timestampNs = scaleTimestamp(reader.clusterTimestamp + relativeTimestamp, reader.timestampScale);
+    if (reader.firstTimestampNs < 0) {
+        reader.firstTimestampNs = timestampNs;
+    }
+
+    int64_t stepNs = timestampNs - reader.lastTimestampNs[index];
+    if (reader.seenTrack[index] && stepNs > monitor.framePeriodNs * gapThreshold) {
+        FrameGap gap;
+        gap.fileIndex = fileIndex;
+        track.name.copy(gap.trackName, sizeof(gap.trackName) - 1);
+        gap.seconds = (timestampNs - reader.firstTimestampNs) / 1e9;
+        gap.gapMs = stepNs / 1e6;
+        gap.droppedFrames = (int) ((stepNs + monitor.framePeriodNs / 2) / monitor.framePeriodNs) - 1;
+        monitor.newGaps.push(&gap, 1);
+    }
+
+    reader.lastTimestampNs[index] = timestampNs;
+    reader.seenTrack[index] = true;
+    monitor.framesChecked++;
+}
+
+// Parse every element written since the last call, reading only element headers
+static void readNewClusters(DropMonitor& monitor, TailReader& reader, int fileIndex) {
+    if (reader.file == INVALID_HANDLE_VALUE) {
+        // K4ARecorder creates the file once the device has opened
+        reader.file = CreateFileA(reader.filename.c_str(), GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE,
+                                  NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+        if (reader.file == INVALID_HANDLE_VALUE) {
+            return;
+        }
+    }
+
+    LARGE_INTEGER size;
+    if (!GetFileSizeEx(reader.file, &size)) {
+        return;
+    }
+    uint64_t fileSize = (uint64_t) size.QuadPart;
+
+    // Read the tracks once everything before the first cluster has been written
+    if (!reader.headerParsed) {
+        vector<uint8_t> header((fileSize < maxHeaderBytes) ? (size_t) fileSize : maxHeaderBytes);
+        DWORD bytesRead = header.empty() ? 0 : readAt(reader.file, 0, header.data(), (DWORD) header.size());
+
+        // The read may stop short of the file size, so wait until the first cluster's header is inside the bytes read
+        MatroskaFile file;
+        string errorText;
+        EbmlElement cluster;
+        if (!parseMatroskaHeaders(header.data(), bytesRead, file, errorText) || file.firstClusterOffset == 0 ||
+            !readElement(header.data(), file.firstClusterOffset, bytesRead, cluster)) {
+            return;
+        }
+        reader.headerParsed = true;
+        reader.timestampScale = file.timestampScale;
+        reader.tracks = file.tracks;
+        reader.offset = file.firstClusterOffset;
+    }
+
+    uint64_t startOffset = reader.offset;
+    uint8_t buffer[elementReadBytes];
+    DWORD bytesRead;
+    EbmlElement element;
+
+    while (readElementAt(reader.file, reader.offset, fileSize, element, buffer, bytesRead)) {
+        bool unknownSize = element.size == unknownElementSize;
+        uint64_t end = unknownSize ? unknownElementSize : element.dataOffset + element.size;
+
+        // Start a cluster once all of it has been written, or once its header has if its size is unknown
+        if (!reader.inCluster) {
+            if (element.id == clusterId) {
+                if (!unknownSize && end > fileSize) {
+                    break;
+                }
+                reader.inCluster = true;
+                reader.clusterEnd = end;
+                reader.clusterTimestamp = 0;
+                reader.offset = element.dataOffset;
+            }
+            else if (!unknownSize && end <= fileSize) {
+                reader.offset = end;
+            }
+            else {
+                break;
+            }
+            continue;
+        }
+
+        // The cluster ends at its size, or at the next top-level element if its size is unknown
+        if (reader.offset >= reader.clusterEnd || (reader.clusterEnd == unknownElementSize && isTopLevelId(element.id))) {
+            reader.inCluster = false;
+            continue;
+        }
+        if (unknownSize || end > fileSize) {
+            break;
+        }
+
+        uint64_t headerLength = element.dataOffset - element.offset;
+        uint64_t available = (bytesRead > headerLength) ? bytesRead - headerLength : 0;
+
+        if (element.id == timestampId) {
+            // Only the first elementReadBytes of the element are in the buffer
+            EbmlElement value = element;
+            value.dataOffset = headerLength;
+            if (headerLength <= bytesRead && value.size <= bytesRead - value.dataOffset) {
+                reader.clusterTimestamp = (int64_t) min(readUnsigned(buffer, value, bytesRead), (uint64_t) INT64_MAX / 2);
+            }
+        }
+        else if (element.id == simpleBlockId) {
+            checkBlock(monitor, reader, fileIndex, buffer + headerLength, available < element.size ? available : element.size);
+        }
+        else if (element.id == blockGroupId) {
+            uint8_t childBuffer[elementReadBytes];
+            DWORD childBytesRead;
+            EbmlElement child;
+            for (uint64_t childOffset = element.dataOffset; childOffset < end &&
+                 readElementAt(reader.file, childOffset, end, child, childBuffer, childBytesRead); childOffset = child.dataOffset + child.size) {
+                if (child.id == blockId) {
+                    uint64_t childHeaderLength = child.dataOffset - child.offset;
+                    uint64_t childAvailable = (childBytesRead > childHeaderLength) ? childBytesRead - childHeaderLength : 0;
+                    checkBlock(monitor, reader, fileIndex, childBuffer + childHeaderLength, childAvailable);
+                    break;
+                }
+                if (child.size == unknownElementSize) {
+                    break;
+                }
+            }
+        }
+        reader.offset = end;
+    }
+
+    monitor.bytesParsed += reader.offset - startOffset;
+}
+
+// Check every file for new clusters each interval until the stop event is set, then once more
+static void monitorDrops(DropMonitor* monitor) {
+    bool stopping = false;
+    while (!stopping) {
+        stopping = WaitForSingleObject(monitor->stopEvent, dropMonitorIntervalMs) != WAIT_TIMEOUT;
+
+        for (int i = 0; i < (int) monitor->readers.size(); i++) {
+            readNewClusters(*monitor, monitor->readers[i], i);
+        }
+    }
+
+    for (TailReader& reader : monitor->readers) {
+        if (reader.file != INVALID_HANDLE_VALUE) {
+            CloseHandle(reader.file);
+            reader.file = INVALID_HANDLE_VALUE;
+        }
+    }
+}
+
+// Start following filenames for frames missing at the passed frame rate
+void startDropMonitor(DropMonitor& monitor, const vector<string>& filenames, int fps) {
+    stopDropMonitor(monitor);
+
+    monitor.readers.clear();
+    for (const string& filename : filenames) {
+        TailReader reader;
+        reader.filename = filename;
+        monitor.readers.push_back(reader);
+    }
+    monitor.framePeriodNs = 1000000000LL / fps;
+
+    monitor.framesChecked = 0;
+    monitor.bytesParsed = 0;
+    monitor.gaps.clear();
+    monitor.droppedFrames = 0;
+    monitor.alarm = false;
+    monitor.active = true;
+
+    monitor.stopEvent = CreateEvent(NULL, TRUE, FALSE, NULL);
+    monitor.monitorThread = thread(monitorDrops, &monitor);
+}
+
+// Read what is left of the files and stop the monitor thread, keeping the gaps for display
+void stopDropMonitor(DropMonitor& monitor) {
+    if (monitor.monitorThread.joinable()) {
+        SetEvent(monitor.stopEvent);
+        monitor.monitorThread.join();
+        drainDropMonitor(monitor);
+    }
+    if (monitor.stopEvent != NULL) {
+        CloseHandle(monitor.stopEvent);
+        monitor.stopEvent = NULL;
+    }
+    monitor.active = false;
+}
+
+// Move new gaps into the list shown in the GUI and raise the alarm, never blocks
+void drainDropMonitor(DropMonitor& monitor) {
+    FrameGap gap;
+    while (monitor.newGaps.pop(&gap, 1) == 1) {
+        monitor.droppedFrames += gap.droppedFrames;
+        monitor.alarm = true;
+
+        if ((int) monitor.gaps.size() == maxShownGaps) {
+            monitor.gaps.erase(monitor.gaps.begin());
+        }
+        monitor.gaps.push_back(gap);
+    }
+}
@@ -0,0 +1,84 @@
+/* Aden Prince
+ * HiMER Lab at U. of Illinois, Chicago
+ * K4ARecorder GUI
+ *
+ * DropMonitor.h
+ * Contains the state and functions used to detect dropped frames while
+ * recording, by reading each new cluster of the output files as they grow.
+ */
+
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <Windows.h>
+
+#include "MatroskaParser.h"
+#include "RingBuffer.h"
+
+// Time between checks of the output files for new clusters
+const DWORD dropMonitorIntervalMs = 100;
+// Tracks followed in each file, K4ARecorder writes at most four
+const int maxMonitoredTracks = 8;
+// Gaps kept for display, oldest first
+const int maxShownGaps = 64;
+
+// A step between two frames of a track longer than gapThreshold frame periods
+struct FrameGap {
+    int fileIndex = 0;
+    char trackName[16] = {};
+    double seconds = 0;     // Time of the frame after the gap, from the first frame in the file
+    double gapMs = 0;
+    int droppedFrames = 0;  // Frame periods missing from the gap
+};
+
+// Parse position in one growing output file, only touched by the monitor thread
+struct TailReader {
+    std::string filename;
+    HANDLE file = INVALID_HANDLE_VALUE;
+
+    // Read from the start of the file once it contains the first cluster
+    bool headerParsed = false;
+    uint64_t timestampScale = 1000000;
+    std::vector<TrackInfo> tracks;
+
+    // First byte not parsed yet, always the start of an element
+    uint64_t offset = 0;
+    bool inCluster = false;
+    uint64_t clusterEnd = 0; // unknownElementSize until a top-level element follows the cluster
+    int64_t clusterTimestamp = 0;
+
+    int64_t firstTimestampNs = -1;
+    int64_t lastTimestampNs[maxMonitoredTracks] = {};
+    bool seenTrack[maxMonitoredTracks] = {};
+};
+
+// Monitor thread and the gaps shown in the GUI
+struct DropMonitor {
+    std::thread monitorThread;
+    HANDLE stopEvent = NULL;
+    std::vector<TailReader> readers;
+    int64_t framePeriodNs = 0;
+
+    // Written by the monitor thread
+    SpscRingBuffer<FrameGap, 256> newGaps;
+    std::atomic<uint64_t> framesChecked{0};
+    std::atomic<uint64_t> bytesParsed{0};
+
+    // Filled by drainDropMonitor
+    std::vector<FrameGap> gaps;
+    uint64_t droppedFrames = 0;
+    bool alarm = false;
+    bool active = false;
+};
+
+// Start following filenames for frames missing at the passed frame rate
+void startDropMonitor(DropMonitor& monitor, const std::vector<std::string>& filenames, int fps);
+// Read what is left of the files and stop the monitor thread, keeping the gaps for display
+void stopDropMonitor(DropMonitor& monitor);
+// Move new gaps into the list shown in the GUI and raise the alarm, never blocks
+void drainDropMonitor(DropMonitor& monitor);
@@ -0,0 +1,264 @@
+/* Aden Prince
+ * HiMER Lab at U. of Illinois, Chicago
+ * K4ARecorder GUI
+ *
+ * FileMover.cpp
+ * Contains functions used to move recordings from the scratch directory
+ * to their output paths.
+ */
+
+#include "FileMover.h"
+#include "Checksum.h"
+#include "Manifest.h"
+#include "RecorderOptions.h"
+
+#include <chrono>
+#include <cstring>
+#include <iostream>
+
+#include <Windows.h>
+
+using namespace std;
+
+// Unbuffered I/O must use sizes and offsets that are a multiple of the sector size, a page covers every common one
+const uint32_t ioAlignment = 4096;
+
+// Get the path in the scratch directory that filename is recorded to before it is moved
+string stagedFilename(const string& scratchDirectory, const string& filename) {
+    size_t slash = filename.find_last_of("\\/");
+    string name = (slash == string::npos) ? filename : filename.substr(slash + 1);
+
+    string directory = scratchDirectory;
+    if (directory.empty() == false && directory.back() != '\\' && directory.back() != '/') {
+        directory += "\\";
+    }
+    return directory + name;
+}
+
+// Wait out the rest of a chunk's time at the bandwidth limit, if there is one
+static void throttle(const FileMover& mover, chrono::steady_clock::time_point chunkStart, DWORD bytes) {
+    int limit = mover.limitMBps;
+    if (limit > 0) {
+        this_thread::sleep_until(chunkStart + chrono::duration_cast<chrono::steady_clock::duration>(chrono::duration<double>(bytes / (limit * 1e6))));
+    }
+}
+
+// Hash a file reading past the file cache, so the copy is checked as it is on disk
+static bool hashFile(const string& filename, FileMover& mover, uint8_t* buffer, uint64_t& checksum) {
+    HANDLE file = CreateFileA(filename.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING,
+                              FILE_FLAG_NO_BUFFERING | FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+    if (file == INVALID_HANDLE_VALUE) {
+        return false;
+    }
+
+    TreeHashState state;
+    treeHashReset(state);
+    mover.bytesDone = 0;
+
+    DWORD bytesRead = 0;
+    bool succeeded = true;
+    while (!mover.cancel) {
+        auto chunkStart = chrono::steady_clock::now();
+        if (!ReadFile(file, buffer, moveChunkBytes, &bytesRead, NULL)) {
+            succeeded = false;
+            break;
+        }
+        if (bytesRead == 0) {
+            break;
+        }
+        treeHashUpdate(state, buffer, bytesRead);
+        mover.bytesDone += bytesRead;
+        throttle(mover, chunkStart, bytesRead);
+    }
+
+    CloseHandle(file);
+    checksum = treeHashDigest(state);
+    return succeeded && !mover.cancel;
+}
+
+// Copy source to destination with unbuffered aligned I/O, verify the copy, write its manifest, then delete source
+bool moveRecording(const MoveJob& job, FileMover& mover, MoveResult& result) {
+    result = MoveResult();
+    result.job = job;
+    mover.phase = MoveCopying;
+    mover.bytesDone = 0;
+
+    // Deny writes so the recording cannot change while it is copied
+    HANDLE source = CreateFileA(job.source.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING,
+                                FILE_FLAG_NO_BUFFERING | FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+    if (source == INVALID_HANDLE_VALUE) {
+        result.errorText = "ERROR: Could not open \"" + job.source + "\"\n";
+        return false;
+    }
+
+    LARGE_INTEGER size;
+    GetFileSizeEx(source, &size);
+    result.bytes = (uint64_t) size.QuadPart;
+    mover.totalBytes = result.bytes;
+
+    // Copy to a temporary name so a partial copy is never mistaken for the recording
+    string partialFilename = job.destination + ".partial";
+    HANDLE destination = CreateFileA(partialFilename.c_str(), GENERIC_WRITE, 0, NULL, CREATE_ALWAYS, FILE_FLAG_NO_BUFFERING, NULL);
+    if (destination == INVALID_HANDLE_VALUE) {
+        CloseHandle(source);
+        result.errorText = "ERROR: Could not create \"" + partialFilename + "\"\n";
+        return false;
+    }
+
+    // Reserve the whole file up front so it is laid out in one piece
+    LARGE_INTEGER alignedSize;
+    alignedSize.QuadPart = (size.QuadPart + ioAlignment - 1) / ioAlignment * ioAlignment;
+    LARGE_INTEGER start = {};
+    SetFilePointerEx(destination, alignedSize, NULL, FILE_BEGIN);
+    SetEndOfFile(destination);
+    SetFilePointerEx(destination, start, NULL, FILE_BEGIN);
+
+    uint8_t* buffer = (uint8_t*) VirtualAlloc(NULL, moveChunkBytes, MEM_COMMIT | MEM_RESERVE, PAGE_READWRITE);
+    TreeHashState state;
+    treeHashReset(state);
+    bool copied = buffer != nullptr;
+    auto copyStart = chrono::steady_clock::now();
+
+    while (copied && !mover.cancel) {
+        auto chunkStart = chrono::steady_clock::now();
+        DWORD bytesRead = 0;
+        if (!ReadFile(source, buffer, moveChunkBytes, &bytesRead, NULL)) {
+            copied = false;
+            break;
+        }
+        if (bytesRead == 0) {
+            break;
+        }
+        treeHashUpdate(state, buffer, bytesRead);
+
+        // The last chunk is padded to the alignment and the padding is cut off afterwards
+        DWORD writeBytes = (bytesRead + ioAlignment - 1) / ioAlignment * ioAlignment;
+        memset(buffer + bytesRead, 0, writeBytes - bytesRead);
+        DWORD bytesWritten = 0;
+        if (!WriteFile(destination, buffer, writeBytes, &bytesWritten, NULL) || bytesWritten != writeBytes) {
+            copied = false;
+            break;
+        }
+
+        mover.bytesDone += bytesRead;
+        throttle(mover, chunkStart, writeBytes);
+    }
+    CloseHandle(source);
+
+    double copySeconds = chrono::duration<double>(chrono::steady_clock::now() - copyStart).count();
+    result.copyMBps = (copySeconds > 0) ? result.bytes / 1e6 / copySeconds : 0;
+    result.checksum = treeHashDigest(state);
+
+    FILE_END_OF_FILE_INFO endOfFile;
+    endOfFile.EndOfFile = size;
+    copied = copied && !mover.cancel && SetFileInformationByHandle(destination, FileEndOfFileInfo, &endOfFile, sizeof(endOfFile)) &&
+             FlushFileBuffers(destination);
+    CloseHandle(destination);
+
+    // Read the copy back from disk and compare it with what was read from the scratch file
+    uint64_t copyChecksum = 0;
+    bool verified = false;
+    if (copied) {
+        mover.phase = MoveVerifying;
+        verified = hashFile(partialFilename, mover, buffer, copyChecksum) && copyChecksum == result.checksum;
+    }
+    if (buffer != nullptr) {
+        VirtualFree(buffer, 0, MEM_RELEASE);
+    }
+
+    if (mover.cancel) {
+        DeleteFileA(partialFilename.c_str());
+        result.errorText = "Move of \"" + job.source + "\" cancelled, the recording is still in the scratch directory\n";
+        return false;
+    }
+    if (!copied || !verified) {
+        DeleteFileA(partialFilename.c_str());
+        result.errorText = copied ? "ERROR: Copy of \"" + job.source + "\" did not match, the recording is still in the scratch directory\n"
+                                  : "ERROR: Copying \"" + job.source + "\" failed, the recording is still in the scratch directory\n";
+        return false;
+    }
+
+    // The scratch file is only deleted once the copy is in place
+    if (!MoveFileExA(partialFilename.c_str(), job.destination.c_str(), MOVEFILE_WRITE_THROUGH)) {
+        result.errorText = "ERROR: Could not rename \"" + partialFilename + "\" to \"" + job.destination + "\"\n";
+        return false;
+    }
+
+    // The checksum was taken from the scratch file and matched on the copy, so it is not read a third time
+    Manifest manifest;
+    size_t slash = job.destination.find_last_of("\\/");
+    manifest.filename = (slash == string::npos) ? job.destination : job.destination.substr(slash + 1);
+    manifest.size = result.bytes;
+    manifest.checksum = result.checksum;
+    manifest.args = job.args;
+    writeManifest(job.destination, manifest, result.errorText);
+
+    if (!DeleteFileA(job.source.c_str())) {
+        result.errorText = "ERROR: Moved \"" + job.source + "\" but could not delete it from the scratch directory\n";
+    }
+
+    result.succeeded = true;
+    return true;
+}
+
+// Move one file and record the result for the GUI
+static void runMove(FileMover* mover) {
+    moveRecording(mover->current, *mover, mover->result);
+    mover->finished = true;
+}
+
+// Queue the moves of the take that just ended
+void queueTakeMoves(FileMover& mover) {
+    // K4ARecorder does not create the file if it fails to open the device
+    for (const MoveJob& job : mover.takeJobs) {
+        if (fileExists(job.source)) {
+            mover.queue.push_back(job);
+        }
+    }
+    mover.takeJobs.clear();
+}
+
+// Collect a finished move and start the next one, never blocks
+bool pollFileMover(FileMover& mover) {
+    bool collected = false;
+    if (mover.running && mover.finished) {
+        mover.workerThread.join();
+        mover.running = false;
+
+        if ((int) mover.results.size() == maxShownMoves) {
+            mover.results.erase(mover.results.begin());
+        }
+        mover.results.push_back(mover.result);
+        collected = true;
+    }
+
+    if (!mover.running && mover.queue.empty() == false) {
+        mover.current = mover.queue.front();
+        mover.queue.pop_front();
+        mover.cancel = false;
+        mover.running = true;
+        mover.finished = false;
+        mover.workerThread = thread(runMove, &mover);
+    }
+    return collected;
+}
+
+// Cancel the move in progress and wait for it, leaving unmoved files in the scratch directory
+void endFileMover(FileMover& mover) {
+    mover.cancel = true;
+    if (mover.workerThread.joinable()) {
+        mover.workerThread.join();
+    }
+    mover.running = false;
+
+    queueTakeMoves(mover);
+    if (mover.queue.empty() == false || (mover.finished && !mover.result.succeeded)) {
+        cout << "Recordings left in the scratch directory " << mover.scratchDirectory << ":" << endl;
+        if (mover.finished && !mover.result.succeeded) {
+            cout << "  " << mover.current.source << " -> " << mover.current.destination << endl;
+        }
+        for (const MoveJob& job : mover.queue) {
+            cout << "  " << job.source << " -> " << job.destination << endl;
+        }
+    }
+}
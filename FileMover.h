@@ -0,0 +1,82 @@
+/* Aden Prince
+ * HiMER Lab at U. of Illinois, Chicago
+ * K4ARecorder GUI
+ *
+ * FileMover.h
+ * Contains the state and functions used to record to a fast scratch
+ * directory and move each finished take to its output path in the
+ * background, verifying the copy before the scratch file is deleted.
+ */
+
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <deque>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Size of each aligned read and write when moving a file
+const uint32_t moveChunkBytes = 8 * 1024 * 1024;
+// Results kept for display, oldest first
+const int maxShownMoves = 8;
+
+// A recording to move from the scratch directory to where it was meant to go
+struct MoveJob {
+    std::string source;
+    std::string destination;
+    std::string args; // K4ARecorder arguments, written to the manifest next to the destination
+};
+
+struct MoveResult {
+    MoveJob job;
+    bool succeeded = false;
+    uint64_t bytes = 0;
+    uint64_t checksum = 0; // Tree checksum, see Checksum.h
+    double copyMBps = 0;
+    std::string errorText;
+};
+
+enum MovePhase {
+    MoveCopying,
+    MoveVerifying
+};
+
+// Staging settings, the queue of takes to move and the worker moving one of them
+struct FileMover {
+    // Record to scratchDirectory instead of the output path
+    bool enabled = false;
+    std::string scratchDirectory;
+    std::atomic<int> limitMBps{0}; // Most MB/s read or written by the mover, 0 for no limit
+
+    // Moves for the take being recorded, queued once it ends
+    std::vector<MoveJob> takeJobs;
+    std::deque<MoveJob> queue;
+
+    // Worker moving one file, started by pollFileMover
+    std::thread workerThread;
+    std::atomic<bool> running{false};
+    std::atomic<bool> finished{false};
+    std::atomic<bool> cancel{false};
+    MoveJob current;
+    std::atomic<int> phase{MoveCopying};
+    std::atomic<uint64_t> bytesDone{0};
+    std::atomic<uint64_t> totalBytes{0};
+    MoveResult result;
+
+    // Finished moves, filled by pollFileMover
+    std::vector<MoveResult> results;
+};
+
+// Get the path in the scratch directory that filename is recorded to before it is moved
+std::string stagedFilename(const std::string& scratchDirectory, const std::string& filename);
+// Copy source to destination with unbuffered aligned I/O, verify the copy, write its manifest, then delete source
+bool moveRecording(const MoveJob& job, FileMover& mover, MoveResult& result);
+
+// Queue the moves of the take that just ended
+void queueTakeMoves(FileMover& mover);
+// Collect a finished move and start the next one, never blocks
+bool pollFileMover(FileMover& mover);
+// Cancel the move in progress and wait for it, leaving unmoved files in the scratch directory
+void endFileMover(FileMover& mover);
@@ -0,0 +1,411 @@
+/* Aden Prince
+ * HiMER Lab at U. of Illinois, Chicago
+ * K4ARecorder GUI
+ *
+ * Filmstrip.cpp
+ * Contains functions used to make and cache the filmstrip of a recording.
+ */
+
+#include "Filmstrip.h"
+#include "FrameReader.h"
+#include "Parallel.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include <fstream>
+
+using namespace std;
+
+// Get the cache filename of a recording's filmstrip, e.g. take.mkv.filmstrip
+string filmstripFilename(const string& recording) {
+    return recording + ".filmstrip";
+}
+
+// Colormap pixels first to last - 1 one at a time, matching the SIMD kernels exactly
+static void colormapDepthScalar(const uint16_t* depth, size_t first, size_t last, float nearMm, float scale, uint8_t* bgra) {
+    for (size_t i = first; i < last; i++) {
+        uint8_t* pixel = bgra + i * 4;
+        pixel[3] = 255;
+        if (depth[i] == 0) {
+            pixel[0] = pixel[1] = pixel[2] = 0;
+            continue;
+        }
+        // Blue, green and red each peak at a different point along the range
+        float t = min(max(((float) depth[i] - nearMm) * scale, 0.0f), 1.0f) * 4.0f;
+        for (int channel = 0; channel < 3; channel++) {
+            float value = min(max(1.5f - fabsf(t - (float) (channel + 1)), 0.0f), 1.0f);
+            pixel[channel] = (uint8_t) (value * 255.0f + 0.5f);
+        }
+    }
+}
+
+#ifdef X64_SIMD
+// Colormap the first pixelCount pixels 4 at a time, pixelCount must be a multiple of 4
+static void colormapDepthSse2(const uint16_t* depth, size_t pixelCount, float nearMm, float scale, uint8_t* bgra) {
+    const __m128 zero = _mm_setzero_ps();
+    const __m128 one = _mm_set1_ps(1.0f);
+    const __m128 absMask = _mm_castsi128_ps(_mm_set1_epi32(0x7FFFFFFF));
+    const __m128i alpha = _mm_set1_epi32((int) 0xFF000000);
+    for (size_t i = 0; i < pixelCount; i += 4) {
+        __m128i wide = _mm_unpacklo_epi16(_mm_loadl_epi64((const __m128i*) (depth + i)), _mm_setzero_si128());
+        __m128 t = _mm_mul_ps(_mm_min_ps(_mm_max_ps(_mm_mul_ps(_mm_sub_ps(_mm_cvtepi32_ps(wide), _mm_set1_ps(nearMm)), _mm_set1_ps(scale)), zero), one),
+                              _mm_set1_ps(4.0f));
+        __m128i channels[3];
+        for (int channel = 0; channel < 3; channel++) {
+            __m128 distance = _mm_and_ps(_mm_sub_ps(t, _mm_set1_ps((float) (channel + 1))), absMask);
+            __m128 value = _mm_min_ps(_mm_max_ps(_mm_sub_ps(_mm_set1_ps(1.5f), distance), zero), one);
+            channels[channel] = _mm_cvttps_epi32(_mm_add_ps(_mm_mul_ps(value, _mm_set1_ps(255.0f)), _mm_set1_ps(0.5f)));
+        }
+        __m128i colors = _mm_or_si128(channels[0], _mm_or_si128(_mm_slli_epi32(channels[1], 8), _mm_slli_epi32(channels[2], 16)));
+        __m128i invalid = _mm_cmpeq_epi32(wide, _mm_setzero_si128());
+        _mm_storeu_si128((__m128i*) (bgra + i * 4), _mm_or_si128(_mm_andnot_si128(invalid, colors), alpha));
+    }
+}
+
+// Colormap the first pixelCount pixels 8 at a time, pixelCount must be a multiple of 8
+AVX2_FUNCTION static void colormapDepthAvx2(const uint16_t* depth, size_t pixelCount, float nearMm, float scale, uint8_t* bgra) {
+    const __m256 zero = _mm256_setzero_ps();
+    const __m256 one = _mm256_set1_ps(1.0f);
+    const __m256 absMask = _mm256_castsi256_ps(_mm256_set1_epi32(0x7FFFFFFF));
+    const __m256i alpha = _mm256_set1_epi32((int) 0xFF000000);
+    for (size_t i = 0; i < pixelCount; i += 8) {
+        __m256i wide = _mm256_cvtepu16_epi32(_mm_loadu_si128((const __m128i*) (depth + i)));
+        __m256 t = _mm256_mul_ps(
+            _mm256_min_ps(_mm256_max_ps(_mm256_mul_ps(_mm256_sub_ps(_mm256_cvtepi32_ps(wide), _mm256_set1_ps(nearMm)), _mm256_set1_ps(scale)), zero), one),
+            _mm256_set1_ps(4.0f));
+        __m256i channels[3];
+        for (int channel = 0; channel < 3; channel++) {
+            __m256 distance = _mm256_and_ps(_mm256_sub_ps(t, _mm256_set1_ps((float) (channel + 1))), absMask);
+            __m256 value = _mm256_min_ps(_mm256_max_ps(_mm256_sub_ps(_mm256_set1_ps(1.5f), distance), zero), one);
+            channels[channel] = _mm256_cvttps_epi32(_mm256_add_ps(_mm256_mul_ps(value, _mm256_set1_ps(255.0f)), _mm256_set1_ps(0.5f)));
+        }
+        __m256i colors = _mm256_or_si256(channels[0], _mm256_or_si256(_mm256_slli_epi32(channels[1], 8), _mm256_slli_epi32(channels[2], 16)));
+        __m256i invalid = _mm256_cmpeq_epi32(wide, _mm256_setzero_si256());
+        _mm256_storeu_si256((__m256i*) (bgra + i * 4), _mm256_or_si256(_mm256_andnot_si256(invalid, colors), alpha));
+    }
+}
+#endif
+
+// Color depth in millimetres as BGRA, from blue when near to red when far and black when invalid
+void colormapDepth(const uint16_t* depth, size_t pixelCount, uint16_t nearMm, uint16_t farMm, uint8_t* bgra) {
+    float scale = 1.0f / (float) max(farMm - nearMm, 1);
+    size_t done = 0;
+
+#ifdef X64_SIMD
+    if (hasAvx2()) {
+        done = pixelCount / 8 * 8;
+        colormapDepthAvx2(depth, done, nearMm, scale, bgra);
+    }
+    else {
+        done = pixelCount / 4 * 4;
+        colormapDepthSse2(depth, done, nearMm, scale, bgra);
+    }
+#endif
+
+    colormapDepthScalar(depth, done, pixelCount, nearMm, scale, bgra);
+}
+
+// Get the source rows or columns averaged into destination pixel i of count
+static void sourceSpan(uint32_t i, uint32_t count, uint32_t sourceCount, uint32_t& begin, uint32_t& end) {
+    begin = (uint32_t) ((uint64_t) i * sourceCount / count);
+    end = max((uint32_t) ((uint64_t) (i + 1) * sourceCount / count), begin + 1);
+}
+
+// Average the BGRA pixels of a frame into a width by thumbnailHeight thumbnail
+static void downscaleColor(const DecodedFrame& frame, uint32_t width, vector<uint8_t>& thumbnail) {
+    thumbnail.assign((size_t) width * thumbnailHeight * 4, 0);
+    for (uint32_t y = 0; y < thumbnailHeight; y++) {
+        uint32_t rowBegin, rowEnd;
+        sourceSpan(y, thumbnailHeight, frame.height, rowBegin, rowEnd);
+        for (uint32_t x = 0; x < width; x++) {
+            uint32_t columnBegin, columnEnd;
+            sourceSpan(x, width, frame.width, columnBegin, columnEnd);
+
+            uint64_t sums[3] = {};
+            for (uint32_t row = rowBegin; row < rowEnd; row++) {
+                const uint8_t* pixel = frame.pixels.data() + ((size_t) row * frame.width + columnBegin) * 4;
+                for (uint32_t column = columnBegin; column < columnEnd; column++, pixel += 4) {
+                    sums[0] += pixel[0];
+                    sums[1] += pixel[1];
+                    sums[2] += pixel[2];
+                }
+            }
+            uint64_t count = (uint64_t) (rowEnd - rowBegin) * (columnEnd - columnBegin);
+            uint8_t* out = thumbnail.data() + ((size_t) y * width + x) * 4;
+            for (int channel = 0; channel < 3; channel++) {
+                out[channel] = (uint8_t) (sums[channel] / count);
+            }
+            out[3] = 255;
+        }
+    }
+}
+
+// Average the valid pixels of a depth frame into a width by thumbnailHeight thumbnail, 0 where none are valid
+static void downscaleDepth(const DecodedFrame& frame, uint32_t width, vector<uint16_t>& thumbnail) {
+    const uint16_t* depth = (const uint16_t*) frame.pixels.data();
+    thumbnail.assign((size_t) width * thumbnailHeight, 0);
+    for (uint32_t y = 0; y < thumbnailHeight; y++) {
+        uint32_t rowBegin, rowEnd;
+        sourceSpan(y, thumbnailHeight, frame.height, rowBegin, rowEnd);
+        for (uint32_t x = 0; x < width; x++) {
+            uint32_t columnBegin, columnEnd;
+            sourceSpan(x, width, frame.width, columnBegin, columnEnd);
+
+            uint64_t sum = 0;
+            uint32_t valid = 0;
+            for (uint32_t row = rowBegin; row < rowEnd; row++) {
+                for (uint32_t column = columnBegin; column < columnEnd; column++) {
+                    uint16_t value = depth[(size_t) row * frame.width + column];
+                    sum += value;
+                    valid += (value != 0);
+                }
+            }
+            thumbnail[(size_t) y * width + x] = (valid > 0) ? (uint16_t) (sum / valid) : 0;
+        }
+    }
+}
+
+// Get the width of a thumbnail of a track, keeping its aspect ratio, 0 if the track is not shown
+static uint32_t thumbnailWidth(const FrameReader& reader, ReaderTrack track) {
+    const TrackInfo* info = reader.tracks[track].info;
+    if (info == nullptr || reader.tracks[track].frames.empty() || reader.tracks[track].format == FormatOther) {
+        return 0;
+    }
+    return max((uint32_t) lround((double) thumbnailHeight * info->width / info->height), 1u);
+}
+
+// Read a cached filmstrip, returns false if it is missing, damaged or from another version of the recording
+static bool loadFilmstrip(const string& filename, uint64_t size, uint64_t writeTime, Filmstrip& strip) {
+    ifstream input(filename, ios::binary);
+    char magic[8];
+    uint64_t savedSize = 0;
+    uint64_t savedTime = 0;
+    uint32_t height = 0;
+    uint64_t count = 0;
+    input.read(magic, 8);
+    input.read((char*) &savedSize, 8);
+    input.read((char*) &savedTime, 8);
+    input.read((char*) &height, 4);
+    input.read((char*) &strip.colorWidth, 4);
+    input.read((char*) &strip.depthWidth, 4);
+    input.read((char*) &strip.intervalSeconds, 8);
+    input.read((char*) &count, 8);
+    if (!input || memcmp(magic, filmstripMagic, 8) != 0 || savedSize != size || savedTime != writeTime || height != thumbnailHeight ||
+        count > (uint64_t) maxFilmstripThumbnails || strip.colorWidth > thumbnailHeight * 4 || strip.depthWidth > thumbnailHeight * 4) {
+        return false;
+    }
+
+    // Color is stored as BGR, depth as millimetres, and both are made back into what is shown
+    size_t colorPixels = (size_t) strip.colorWidth * thumbnailHeight;
+    size_t depthPixels = (size_t) strip.depthWidth * thumbnailHeight;
+    vector<uint8_t> bgr(colorPixels * 3);
+    strip.thumbnails.resize((size_t) count);
+    for (FilmstripThumbnail& thumbnail : strip.thumbnails) {
+        input.read((char*) &thumbnail.timeNs, 8);
+        input.read((char*) bgr.data(), bgr.size());
+        thumbnail.color.resize(colorPixels * 4);
+        for (size_t i = 0; i < colorPixels; i++) {
+            memcpy(&thumbnail.color[i * 4], &bgr[i * 3], 3);
+            thumbnail.color[i * 4 + 3] = 255;
+        }
+        thumbnail.depth.resize(depthPixels);
+        input.read((char*) thumbnail.depth.data(), depthPixels * 2);
+        thumbnail.depthColors.resize(depthPixels * 4);
+        colormapDepth(thumbnail.depth.data(), depthPixels, colormapNearMm, colormapFarMm, thumbnail.depthColors.data());
+    }
+    return (bool) input;
+}
+
+// Save a filmstrip next to the recording, a failure only means it is made again next time
+static void saveFilmstrip(const string& filename, uint64_t size, uint64_t writeTime, const Filmstrip& strip) {
+    ofstream output(filename, ios::binary | ios::trunc);
+    uint32_t height = thumbnailHeight;
+    uint64_t count = strip.thumbnails.size();
+    output.write(filmstripMagic, 8);
+    output.write((const char*) &size, 8);
+    output.write((const char*) &writeTime, 8);
+    output.write((const char*) &height, 4);
+    output.write((const char*) &strip.colorWidth, 4);
+    output.write((const char*) &strip.depthWidth, 4);
+    output.write((const char*) &strip.intervalSeconds, 8);
+    output.write((const char*) &count, 8);
+
+    size_t colorPixels = (size_t) strip.colorWidth * thumbnailHeight;
+    vector<uint8_t> bgr(colorPixels * 3);
+    for (const FilmstripThumbnail& thumbnail : strip.thumbnails) {
+        output.write((const char*) &thumbnail.timeNs, 8);
+        for (size_t i = 0; i < colorPixels; i++) {
+            memcpy(&bgr[i * 3], &thumbnail.color[i * 4], 3);
+        }
+        output.write((const char*) bgr.data(), bgr.size());
+        output.write((const char*) thumbnail.depth.data(), thumbnail.depth.size() * 2);
+    }
+    output.close();
+    if (!output) {
+        remove(filename.c_str());
+    }
+}
+
+// Decode and shrink the frames at one point in the strip, leaving images black if their frame cannot be decoded
+static bool makeThumbnail(const FrameReader& reader, const Filmstrip& strip, double seconds, FilmstripThumbnail& thumbnail, string& errorText) {
+    bool succeeded = true;
+    DecodedFrame frame;
+    if (strip.colorWidth > 0) {
+        int64_t index = findFrameAt(reader, ReaderColor, seconds);
+        if (decodeIndexedFrame(reader, ReaderColor, index, frame, errorText)) {
+            thumbnail.timeNs = frame.timestampNs - reader.originNs;
+            downscaleColor(frame, strip.colorWidth, thumbnail.color);
+        }
+        else {
+            thumbnail.color.assign((size_t) strip.colorWidth * thumbnailHeight * 4, 0);
+            succeeded = false;
+        }
+    }
+
+    if (strip.depthWidth > 0) {
+        int64_t index = findFrameAt(reader, ReaderDepth, seconds);
+        if (decodeIndexedFrame(reader, ReaderDepth, index, frame, errorText)) {
+            if (strip.colorWidth == 0) {
+                thumbnail.timeNs = frame.timestampNs - reader.originNs;
+            }
+            downscaleDepth(frame, strip.depthWidth, thumbnail.depth);
+        }
+        else {
+            thumbnail.depth.assign((size_t) strip.depthWidth * thumbnailHeight, 0);
+            succeeded = false;
+        }
+        thumbnail.depthColors.resize(thumbnail.depth.size() * 4);
+        colormapDepth(thumbnail.depth.data(), thumbnail.depth.size(), colormapNearMm, colormapFarMm, thumbnail.depthColors.data());
+    }
+    return succeeded;
+}
+
+// Load a recording's filmstrip from its cache, or decode it across every core and save the cache
+bool makeFilmstrip(FilmstripJob& job) {
+    auto start = chrono::steady_clock::now();
+    Filmstrip& strip = job.strip;
+    strip = Filmstrip();
+    job.fromCache = false;
+
+    // The cache is only trusted for the exact file it was made from
+    uint64_t size = 0;
+    uint64_t writeTime = 0;
+    string cacheFilename = filmstripFilename(job.filename);
+    bool stamped = fileStamp(job.filename, size, writeTime);
+    if (stamped && loadFilmstrip(cacheFilename, size, writeTime, strip)) {
+        job.fromCache = true;
+        job.totalThumbnails = strip.thumbnails.size();
+        job.thumbnailsDone = strip.thumbnails.size();
+        job.seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+        return true;
+    }
+    strip = Filmstrip();
+
+    // Only the reader's index is used, each thumbnail's frames are decoded straight from the recording
+    FrameReader reader;
+    if (!openFrameReader(job.filename, 0, reader, job.errorText)) {
+        return false;
+    }
+    strip.colorWidth = thumbnailWidth(reader, ReaderColor);
+    strip.depthWidth = thumbnailWidth(reader, ReaderDepth);
+    if (strip.colorWidth == 0 && strip.depthWidth == 0) {
+        job.errorText += "ERROR: Recording has no MJPG or BGRA color frames or depth frames to show\n";
+        closeFrameReader(reader);
+        return false;
+    }
+
+    int64_t lastNs = 0;
+    for (const ReaderTrackState& track : reader.tracks) {
+        if (track.frames.empty() == false) {
+            lastNs = max(lastNs, track.frames.back().timestampNs - reader.originNs);
+        }
+    }
+    double duration = lastNs / 1e9;
+    strip.intervalSeconds = max(filmstripIntervalSeconds, duration / (maxFilmstripThumbnails - 1));
+    int count = min((int) (duration / strip.intervalSeconds) + 1, maxFilmstripThumbnails);
+    strip.thumbnails.resize(count);
+    job.totalThumbnails = count;
+
+    // Every frame K4ARecorder writes is a key frame, so each thumbnail decodes only the frame it shows
+    vector<string> errors(count);
+    vector<char> decoded(count, 0);
+    parallelFor(count, [&](int i) {
+        if (job.cancel) {
+            return;
+        }
+        decoded[i] = makeThumbnail(reader, strip, i * strip.intervalSeconds, strip.thumbnails[i], errors[i]);
+        job.thumbnailsDone++;
+    });
+    closeFrameReader(reader);
+
+    if (job.cancel) {
+        return false;
+    }
+    int failed = 0;
+    for (int i = 0; i < count; i++) {
+        if (!decoded[i]) {
+            // The first few errors say enough, the rest are usually the same
+            if (failed++ < 3) {
+                job.errorText += errors[i];
+            }
+        }
+    }
+    if (failed == count) {
+        return false;
+    }
+
+    // Frames that could not be decoded are not cached, in case they can be next time
+    if (stamped && failed == 0) {
+        saveFilmstrip(cacheFilename, size, writeTime, strip);
+    }
+    job.seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    return true;
+}
+
+// Make the filmstrip on the worker thread
+static void runFilmstrip(FilmstripJob* job) {
+    job->succeeded = makeFilmstrip(*job);
+    job->finished = true;
+}
+
+// Start making a recording's filmstrip on a worker thread, cancelling one already being made
+bool startFilmstrip(FilmstripJob& job, const string& filename) {
+    endFilmstrip(job);
+
+    job.filename = filename;
+    job.generation++;
+    job.succeeded = false;
+    job.fromCache = false;
+    job.seconds = 0;
+    job.strip = Filmstrip();
+    job.errorText = "";
+    job.thumbnailsDone = 0;
+    job.totalThumbnails = 0;
+
+    job.cancel = false;
+    job.running = true;
+    job.finished = false;
+    job.workerThread = thread(runFilmstrip, &job);
+    return true;
+}
+
+// Check if the filmstrip is done, joining the worker once it is, never blocks
+bool pollFilmstrip(FilmstripJob& job) {
+    if (!job.running || !job.finished) {
+        return false;
+    }
+    job.workerThread.join();
+    job.running = false;
+    return true;
+}
+
+// Cancel making the filmstrip and wait for the worker
+void endFilmstrip(FilmstripJob& job) {
+    job.cancel = true;
+    if (job.workerThread.joinable()) {
+        job.workerThread.join();
+    }
+    job.running = false;
+}
@@ -0,0 +1,85 @@
+/* Aden Prince
+ * HiMER Lab at U. of Illinois, Chicago
+ * K4ARecorder GUI
+ *
+ * Filmstrip.h
+ * Contains the state and functions used to make a strip of small color and
+ * colormapped depth images spread over a finished recording, cached next
+ * to it so it is only made once.
+ */
+
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Time between thumbnails, made longer for long recordings so there are at most maxFilmstripThumbnails
+const double filmstripIntervalSeconds = 2.0;
+const int maxFilmstripThumbnails = 200;
+// Height of every thumbnail in pixels, widths keep each track's aspect ratio
+const uint32_t thumbnailHeight = 64;
+// Depth shown from blue at the near end to red at the far end, invalid pixels are black
+const uint16_t colormapNearMm = 250;
+const uint16_t colormapFarMm = 5000;
+// Start of a filmstrip cache file, followed by the recording's size and write time
+const char filmstripMagic[9] = "K4AFLM01";
+
+// One point in the strip, each image empty if the recording has no such track
+struct FilmstripThumbnail {
+    int64_t timeNs = 0;               // From the start of the recording to the color frame, or the depth frame if there is no color
+    std::vector<uint8_t> color;       // BGRA
+    std::vector<uint16_t> depth;      // Millimetres, 0 where no pixel was valid
+    std::vector<uint8_t> depthColors; // BGRA made from depth with the colormap
+};
+
+struct Filmstrip {
+    uint32_t colorWidth = 0;
+    uint32_t depthWidth = 0;
+    double intervalSeconds = 0;
+    std::vector<FilmstripThumbnail> thumbnails;
+};
+
+// Makes the filmstrip of one recording on a worker thread
+struct FilmstripJob {
+    std::thread workerThread;
+    std::atomic<bool> running{false};
+    std::atomic<bool> finished{false};
+    std::atomic<bool> cancel{false};
+
+    // Set before the worker starts
+    std::string filename;
+    uint64_t generation = 0; // Counts the jobs started, so the GUI knows when to remake its textures
+
+    // Progress, updated after each thumbnail
+    std::atomic<uint64_t> thumbnailsDone{0};
+    std::atomic<uint64_t> totalThumbnails{0};
+
+    // Set by the worker, read once finished is true
+    bool succeeded = false;
+    bool fromCache = false;
+    double seconds = 0;
+    Filmstrip strip;
+    std::string errorText;
+
+    // Textures of strip, made and released by the GUI on its thread
+    std::vector<void*> colorTextures;
+    std::vector<void*> depthTextures;
+    uint64_t textureGeneration = 0;
+};
+
+// Get the cache filename of a recording's filmstrip, e.g. take.mkv.filmstrip
+std::string filmstripFilename(const std::string& recording);
+// Color depth in millimetres as BGRA, from blue when near to red when far and black when invalid
+void colormapDepth(const uint16_t* depth, size_t pixelCount, uint16_t nearMm, uint16_t farMm, uint8_t* bgra);
+// Load a recording's filmstrip from its cache, or decode it across every core and save the cache
+bool makeFilmstrip(FilmstripJob& job);
+
+// Start making a recording's filmstrip on a worker thread, cancelling one already being made
+bool startFilmstrip(FilmstripJob& job, const std::string& filename);
+// Check if the filmstrip is done, joining the worker once it is, never blocks
+bool pollFilmstrip(FilmstripJob& job);
+// Cancel making the filmstrip and wait for the worker
+void endFilmstrip(FilmstripJob& job);
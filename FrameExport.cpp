@@ -0,0 +1,479 @@
+/* Aden Prince
+ * HiMER Lab at U. of Illinois, Chicago
+ * K4ARecorder GUI
+ *
+ * FrameExport.cpp
+ * Contains functions used to export the frames of a recording to images.
+ */
+
+#include "FrameExport.h"
+#include "FrameReader.h"
+#include "MappedFile.h"
+#include "MatroskaParser.h"
+#include "Parallel.h"
+#include "PointCloud.h"
+#include "RvlCodec.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <climits>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <vector>
+
+#include <Windows.h>
+#include <wincodec.h>
+
+using namespace std;
+
+// A track being exported
+struct ExportTrack {
+    const TrackInfo* info = nullptr;
+    string name; // Used in filenames, e.g. depth_1000000.png
+    FrameFormat format = FormatOther;
+    uint64_t* frameCount = nullptr;
+};
+
+// A frame to export, found from its block header without reading its data
+struct ExportFrame {
+    int track = 0;
+    int64_t timestampNs = 0;
+    uint64_t dataOffset = 0;
+    uint64_t dataSize = 0;
+};
+
+// A frame encoded by a worker, waiting to be written in order
+struct EncodedFrame {
+    vector<uint8_t> bytes;
+    const char* extension = "raw";
+    uint64_t points = 0; // XYZ triples held in bytes when exporting point clouds
+    string errorText;
+};
+
+// Find the tracks selected in options, returns false if the recording has none of them
+static bool findExportTracks(const MatroskaFile& file, const ExportOptions& options, ExportResult& result, vector<ExportTrack>& tracks,
+                             string& errorText) {
+    const char* names[3] = {"COLOR", "DEPTH", "IR"};
+    const char* filenames[3] = {"color", "depth", "ir"};
+    // Point clouds are only made from depth
+    bool ply = options.format == ExportPly || options.format == ExportPlyStream;
+    bool selected[3] = {options.color && !ply, options.depth, options.ir && !ply};
+    uint64_t* counts[3] = {&result.colorFrames, &result.depthFrames, &result.irFrames};
+
+    for (int i = 0; i < 3; i++) {
+        if (!selected[i]) {
+            continue;
+        }
+        const TrackInfo* info = findTrack(file, names[i]);
+        if (info == nullptr) {
+            result.warningText += string("WARNING: Recording has no ") + names[i] + " track\n";
+            continue;
+        }
+        if (info->width == 0 || info->height == 0) {
+            result.warningText += string("WARNING: ") + names[i] + " track has no frame size, skipping it\n";
+            continue;
+        }
+
+        ExportTrack track;
+        track.info = info;
+        track.name = filenames[i];
+        track.format = trackFormat(file, *info);
+        track.frameCount = counts[i];
+        if (track.format == FormatOther && options.format == ExportPng) {
+            result.warningText += string("WARNING: ") + names[i] + " frames are not MJPG, BGRA or 16-bit, they are written as recorded\n";
+        }
+        tracks.push_back(track);
+    }
+
+    if (tracks.empty()) {
+        errorText += "ERROR: Recording has none of the tracks to export\n";
+        return false;
+    }
+    return true;
+}
+
+// List the frames in the time range at the stride in timestamp order, reading only block headers
+static void collectFrames(const MatroskaFile& file, const vector<ExportTrack>& tracks, const ExportOptions& options, ExportResult& result,
+                          vector<ExportFrame>& frames) {
+    // Times are from the first cluster, which K4ARecorder starts at the first frame
+    uint64_t offset = 0;
+    ClusterInfo cluster;
+    if (!nextCluster(file, offset, cluster)) {
+        return;
+    }
+    int64_t origin = scaleTimestamp(cluster.timestamp, file.timestampScale);
+    int64_t startNs = origin + (int64_t) (options.startSeconds * 1e9);
+    int64_t endNs = (options.endSeconds < 0) ? LLONG_MAX : origin + (int64_t) (options.endSeconds * 1e9);
+
+    // Jump to a cluster a second before the start, since a cluster's blocks can start after its cue
+    offset = findClusterAt(file, startNs - 1000000000LL);
+    vector<uint64_t> seen(tracks.size(), 0);
+
+    while (nextCluster(file, offset, cluster)) {
+        if (scaleTimestamp(cluster.timestamp, file.timestampScale) > endNs) {
+            break;
+        }
+
+        uint64_t blockOffset = 0;
+        BlockInfo block;
+        while (nextBlock(file, cluster, blockOffset, block)) {
+            if (block.timestampNs < startNs || block.timestampNs > endNs || block.frameCount != 1) {
+                continue;
+            }
+            for (size_t i = 0; i < tracks.size(); i++) {
+                if (block.track != tracks[i].info->number || seen[i]++ % options.stride != 0) {
+                    continue;
+                }
+                ExportFrame frame;
+                frame.track = (int) i;
+                frame.timestampNs = block.timestampNs;
+                frame.dataOffset = block.dataOffset;
+                frame.dataSize = block.dataSize;
+                frames.push_back(frame);
+            }
+        }
+
+        if (!cluster.complete) {
+            result.warningText += "WARNING: Recording was cut off at byte " + to_string(cluster.end) + ", later frames are not exported\n";
+            break;
+        }
+    }
+
+    // Tracks are interleaved close to but not exactly in time order
+    stable_sort(frames.begin(), frames.end(), [](const ExportFrame& a, const ExportFrame& b) {
+        return (a.timestampNs != b.timestampNs) ? a.timestampNs < b.timestampNs : a.track < b.track;
+    });
+}
+
+// Encode a bitmap as a PNG file in memory
+static bool encodePng(IWICImagingFactory* factory, IWICBitmapSource* source, vector<uint8_t>& png) {
+    IStream* stream = nullptr;
+    IWICBitmapEncoder* encoder = nullptr;
+    IWICBitmapFrameEncode* frame = nullptr;
+
+    // The encoder converts the source to the nearest format PNG supports
+    bool succeeded = SUCCEEDED(CreateStreamOnHGlobal(NULL, TRUE, &stream)) && SUCCEEDED(factory->CreateEncoder(GUID_ContainerFormatPng, NULL, &encoder)) &&
+                     SUCCEEDED(encoder->Initialize(stream, WICBitmapEncoderNoCache)) && SUCCEEDED(encoder->CreateNewFrame(&frame, NULL)) &&
+                     SUCCEEDED(frame->Initialize(NULL)) && SUCCEEDED(frame->WriteSource(source, NULL)) && SUCCEEDED(frame->Commit()) &&
+                     SUCCEEDED(encoder->Commit());
+
+    HGLOBAL global = NULL;
+    STATSTG stat;
+    if (succeeded && SUCCEEDED(GetHGlobalFromStream(stream, &global)) && SUCCEEDED(stream->Stat(&stat, STATFLAG_NONAME))) {
+        const uint8_t* bytes = (const uint8_t*) GlobalLock(global);
+        png.assign(bytes, bytes + stat.cbSize.QuadPart);
+        GlobalUnlock(global);
+    }
+    else {
+        succeeded = false;
+    }
+
+    if (frame != nullptr) {
+        frame->Release();
+    }
+    if (encoder != nullptr) {
+        encoder->Release();
+    }
+    if (stream != nullptr) {
+        stream->Release();
+    }
+    return succeeded;
+}
+
+// Encode pixels already in memory as a PNG file
+static bool encodePixelsPng(IWICImagingFactory* factory, const TrackInfo& track, REFWICPixelFormatGUID format, uint32_t bytesPerPixel,
+                            const uint8_t* pixels, vector<uint8_t>& png) {
+    IWICBitmap* bitmap = nullptr;
+    UINT stride = track.width * bytesPerPixel;
+    bool succeeded = SUCCEEDED(factory->CreateBitmapFromMemory(track.width, track.height, format, stride, stride * track.height, (BYTE*) pixels, &bitmap)) &&
+                     encodePng(factory, bitmap, png);
+    if (bitmap != nullptr) {
+        bitmap->Release();
+    }
+    return succeeded;
+}
+
+// Decode a JPEG frame and encode it as a PNG file
+static bool transcodeJpegPng(IWICImagingFactory* factory, const uint8_t* data, uint64_t size, vector<uint8_t>& png) {
+    IWICStream* stream = nullptr;
+    IWICBitmapDecoder* decoder = nullptr;
+    IWICBitmapFrameDecode* frame = nullptr;
+
+    // The decoder only reads from the mapped recording
+    bool succeeded = SUCCEEDED(factory->CreateStream(&stream)) && SUCCEEDED(stream->InitializeFromMemory((BYTE*) data, (DWORD) size)) &&
+                     SUCCEEDED(factory->CreateDecoder(GUID_ContainerFormatJpeg, NULL, &decoder)) &&
+                     SUCCEEDED(decoder->Initialize(stream, WICDecodeMetadataCacheOnDemand)) && SUCCEEDED(decoder->GetFrame(0, &frame)) &&
+                     encodePng(factory, frame, png);
+
+    if (frame != nullptr) {
+        frame->Release();
+    }
+    if (decoder != nullptr) {
+        decoder->Release();
+    }
+    if (stream != nullptr) {
+        stream->Release();
+    }
+    return succeeded;
+}
+
+// Encode one frame as a PNG image, as its raw data or as points if lut is passed, leaving the error in encoded.errorText
+static void encodeFrame(const MatroskaFile& file, const ExportTrack& track, const ExportFrame& frame, IWICImagingFactory* factory,
+                        const PointCloudLut* lut, EncodedFrame& encoded) {
+    const uint8_t* data = file.data + frame.dataOffset;
+    size_t pixelCount = (size_t) track.info->width * track.info->height;
+    string where = track.name + " frame at " + to_string(frame.timestampNs) + " ns";
+
+    if (track.format == FormatOther || (factory == nullptr && track.format != FormatRawDepth && track.format != FormatRvlDepth)) {
+        encoded.bytes.assign(data, data + frame.dataSize);
+        encoded.extension = (track.format == FormatMjpg) ? "jpg" : "raw";
+        return;
+    }
+    if (track.format == FormatMjpg) {
+        encoded.extension = "png";
+        if (!transcodeJpegPng(factory, data, frame.dataSize, encoded.bytes)) {
+            encoded.errorText = "ERROR: Could not decode the " + where + "\n";
+        }
+        return;
+    }
+    if (track.format == FormatBgra) {
+        encoded.extension = "png";
+        if (frame.dataSize != pixelCount * 4 || !encodePixelsPng(factory, *track.info, GUID_WICPixelFormat32bppBGR, 4, data, encoded.bytes)) {
+            encoded.errorText = "ERROR: Could not encode the " + where + "\n";
+        }
+        return;
+    }
+
+    // Raw frames are read in place, RVL frames are decoded to little-endian
+    vector<uint8_t> pixels;
+    const uint8_t* depth = data;
+    bool bigEndian = true;
+    if (track.format == FormatRawDepth && frame.dataSize != pixelCount * 2) {
+        encoded.errorText = "ERROR: The " + where + " is not a single " + to_string(track.info->width) + "x" + to_string(track.info->height) + " frame\n";
+        return;
+    }
+    if (track.format == FormatRvlDepth) {
+        pixels.resize(pixelCount * 2);
+        if (!decompressRvl(data, (size_t) frame.dataSize, pixelCount, false, pixels.data())) {
+            encoded.errorText = "ERROR: The " + where + " is not valid RVL data\n";
+            return;
+        }
+        depth = pixels.data();
+        bigEndian = false;
+    }
+
+    // Points are written without a header, which depends on whether every frame goes to one file
+    if (lut != nullptr) {
+        encoded.bytes.resize(pixelCount * 3 * sizeof(float));
+        encoded.points = depthToPoints(*lut, depth, bigEndian, (float*) encoded.bytes.data());
+        encoded.bytes.resize(encoded.points * 3 * sizeof(float));
+        encoded.extension = "ply";
+        return;
+    }
+
+    // Depth and IR images are little-endian 16-bit, the order PNG encoding and most readers of raw frames expect
+    if (bigEndian) {
+        pixels.resize(pixelCount * 2);
+        for (size_t i = 0; i < pixels.size(); i += 2) {
+            pixels[i] = data[i + 1];
+            pixels[i + 1] = data[i];
+        }
+    }
+
+    if (factory == nullptr) {
+        encoded.bytes.swap(pixels);
+        encoded.extension = "raw";
+        return;
+    }
+    encoded.extension = "png";
+    if (!encodePixelsPng(factory, *track.info, GUID_WICPixelFormat16bppGray, 2, pixels.data(), encoded.bytes)) {
+        encoded.errorText = "ERROR: Could not encode the " + where + "\n";
+    }
+}
+
+// Encode frames[first] onwards into encoded across every core
+static void encodeBatch(const MatroskaFile& file, const vector<ExportTrack>& tracks, const vector<ExportFrame>& frames, size_t first, bool png,
+                        const PointCloudLut* lut, vector<EncodedFrame>& encoded) {
+    atomic<size_t> nextFrame{0};
+    int lanes = (workerCount() < (int) encoded.size()) ? workerCount() : (int) encoded.size();
+
+    parallelFor(lanes, [&](int) {
+        // WIC objects are made per thread, so no lock is shared between workers
+        bool comStarted = SUCCEEDED(CoInitializeEx(NULL, COINIT_MULTITHREADED));
+        IWICImagingFactory* factory = nullptr;
+        if (png) {
+            CoCreateInstance(CLSID_WICImagingFactory, NULL, CLSCTX_INPROC_SERVER, IID_PPV_ARGS(&factory));
+        }
+
+        for (size_t i = nextFrame++; i < encoded.size(); i = nextFrame++) {
+            encoded[i] = EncodedFrame();
+            if (png && factory == nullptr) {
+                encoded[i].errorText = "ERROR: Could not start Windows Imaging Component\n";
+                continue;
+            }
+            const ExportFrame& frame = frames[first + i];
+            encodeFrame(file, tracks[frame.track], frame, factory, lut, encoded[i]);
+        }
+
+        if (factory != nullptr) {
+            factory->Release();
+        }
+        if (comStarted) {
+            CoUninitialize();
+        }
+    });
+}
+
+// Unproject the depth mode with the calibration K4ARecorder attaches to every recording
+static bool loadPointCloudLut(const MatroskaFile& file, const TrackInfo& depth, PointCloudLut& lut, string& errorText) {
+    for (const AttachmentInfo& attachment : file.attachments) {
+        if (attachment.name == "calibration.json") {
+            string json((const char*) file.data + attachment.dataOffset, (size_t) attachment.size);
+            DepthIntrinsics intrinsics;
+            return readDepthIntrinsics(json, intrinsics, errorText) && buildPointCloudLut(intrinsics, depth.width, depth.height, lut, errorText);
+        }
+    }
+    errorText += "ERROR: Recording has no calibration.json attachment\n";
+    return false;
+}
+
+// Write the header and frame records of a streamed PLY file, each record holding a frame's timestamp and number of points
+static void writePlyStreamHeader(ofstream& ply, const vector<ExportFrame>& frames, const vector<uint32_t>& framePoints, uint64_t points) {
+    vector<uint8_t> records(frames.size() * 12);
+    for (size_t i = 0; i < framePoints.size(); i++) {
+        double seconds = frames[i].timestampNs / 1e9;
+        memcpy(&records[i * 12], &seconds, 8);
+        memcpy(&records[i * 12 + 8], &framePoints[i], 4);
+    }
+    ply << streamedPlyHeader(frames.size(), points);
+    ply.write((const char*) records.data(), records.size());
+}
+
+// Export the selected frames of a recording in timestamp order, encoding them across every core
+bool exportFrames(const ExportOptions& options, ExportResult& result, string& errorText) {
+    result = ExportResult();
+    auto start = chrono::steady_clock::now();
+
+    if (options.stride < 1 || (options.endSeconds >= 0 && options.endSeconds < options.startSeconds)) {
+        errorText += "ERROR: Stride must be at least 1 and the end must not be before the start\n";
+        return false;
+    }
+    if (!CreateDirectoryA(options.outputDirectory.c_str(), NULL) && GetLastError() != ERROR_ALREADY_EXISTS) {
+        errorText += "ERROR: Could not create \"" + options.outputDirectory + "\"\n";
+        return false;
+    }
+
+    MappedFile mapped;
+    if (!openMappedFile(options.recording, mapped, errorText)) {
+        return false;
+    }
+
+    MatroskaFile file;
+    vector<ExportTrack> tracks;
+    if (!parseMatroskaHeaders(mapped.data, mapped.length, file, errorText) || !findExportTracks(file, options, result, tracks, errorText)) {
+        closeMappedFile(mapped);
+        return false;
+    }
+
+    PointCloudLut lut;
+    bool ply = options.format == ExportPly || options.format == ExportPlyStream;
+    if (ply && !loadPointCloudLut(file, *tracks[0].info, lut, errorText)) {
+        closeMappedFile(mapped);
+        return false;
+    }
+
+    vector<ExportFrame> frames;
+    collectFrames(file, tracks, options, result, frames);
+    if (frames.empty()) {
+        result.warningText += "WARNING: No frames in the range to export\n";
+    }
+
+    string directory = options.outputDirectory;
+    if (directory.back() != '\\' && directory.back() != '/') {
+        directory += "\\";
+    }
+    ofstream index(directory + "frames.csv", ios::trunc);
+    index << "track,timestamp_ns,file" << endl;
+
+    // A streamed point cloud's counts are only known at the end, so its header is written twice
+    ofstream plyStream;
+    vector<uint32_t> framePoints;
+    if (options.format == ExportPlyStream) {
+        plyStream.open(directory + "points.ply", ios::binary | ios::trunc);
+        writePlyStreamHeader(plyStream, frames, vector<uint32_t>(), 0);
+    }
+
+    // Each batch is encoded in parallel, then written by this thread so files appear in timestamp order
+    bool succeeded = index && (options.format != ExportPlyStream || plyStream);
+    size_t batchFrames = (size_t) workerCount() * exportFramesPerWorker;
+    for (size_t first = 0; succeeded && first < frames.size(); first += batchFrames) {
+        vector<EncodedFrame> encoded(min(batchFrames, frames.size() - first));
+        encodeBatch(file, tracks, frames, first, options.format == ExportPng, ply ? &lut : nullptr, encoded);
+
+        for (size_t i = 0; i < encoded.size(); i++) {
+            const ExportFrame& frame = frames[first + i];
+            const ExportTrack& track = tracks[frame.track];
+            if (encoded[i].errorText.empty() == false) {
+                errorText += encoded[i].errorText;
+                succeeded = false;
+                break;
+            }
+
+            string name = track.name + "_" + to_string(frame.timestampNs / 1000) + "." + encoded[i].extension;
+            ofstream output;
+            if (options.format == ExportPlyStream) {
+                name = "points.ply";
+                framePoints.push_back((uint32_t) encoded[i].points);
+            }
+            else {
+                output.open(directory + name, ios::binary | ios::trunc);
+                if (options.format == ExportPly) {
+                    output << pointCloudPlyHeader(encoded[i].points, frame.timestampNs);
+                }
+            }
+            ofstream& destination = (options.format == ExportPlyStream) ? plyStream : output;
+            destination.write((const char*) encoded[i].bytes.data(), encoded[i].bytes.size());
+            if (!destination) {
+                errorText += "ERROR: Could not write \"" + directory + name + "\"\n";
+                succeeded = false;
+                break;
+            }
+            index << track.name << "," << frame.timestampNs << "," << name << "\n";
+
+            (*track.frameCount)++;
+            result.points += encoded[i].points;
+            result.bytesRead += frame.dataSize;
+            result.bytesWritten += encoded[i].bytes.size();
+        }
+    }
+
+    if (succeeded && options.format == ExportPlyStream) {
+        plyStream.seekp(0);
+        writePlyStreamHeader(plyStream, frames, framePoints, result.points);
+        succeeded = (bool) plyStream;
+    }
+
+    closeMappedFile(mapped);
+    result.seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    return succeeded && (bool) index;
+}
+
+// Format what an export did as lines of text for the console
+string formatExportResult(const ExportResult& result) {
+    char line[256];
+    uint64_t frames = result.colorFrames + result.depthFrames + result.irFrames;
+    string text;
+
+    snprintf(line, sizeof(line), "Exported %llu color, %llu depth and %llu IR frames in %.1f s (%.1f frames/s)\n", (unsigned long long) result.colorFrames,
+             (unsigned long long) result.depthFrames, (unsigned long long) result.irFrames, result.seconds, (result.seconds > 0) ? frames / result.seconds : 0);
+    text += line;
+    snprintf(line, sizeof(line), "Read %.1f MB of frame data, wrote %.1f MB\n", result.bytesRead / 1e6, result.bytesWritten / 1e6);
+    text += line;
+    if (result.points > 0) {
+        snprintf(line, sizeof(line), "Wrote %llu points (%.0f per frame)\n", (unsigned long long) result.points, (double) result.points / result.depthFrames);
+        text += line;
+    }
+    return text + result.warningText;
+}
@@ -0,0 +1,54 @@
+/* Aden Prince
+ * HiMER Lab at U. of Illinois, Chicago
+ * K4ARecorder GUI
+ *
+ * FrameExport.h
+ * Contains functions used to export the color, depth and IR frames of a
+ * recording to a directory as PNG images or as their raw data.
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <string>
+
+// Frames encoded at once per worker, which bounds the memory a batch holds before it is written in order
+const int exportFramesPerWorker = 8;
+
+// What each frame is written as
+enum ExportFormat {
+    ExportPng,      // PNG images
+    ExportRaw,      // Each frame's data as it was recorded
+    ExportPly,      // A PLY point cloud per depth frame
+    ExportPlyStream // Every depth frame's points in one PLY file
+};
+
+// What to export and where, set from the --export arguments
+struct ExportOptions {
+    std::string recording;
+    std::string outputDirectory;
+    bool color = true;
+    bool depth = true;
+    bool ir = true;
+    ExportFormat format = ExportPng;
+    int stride = 1;           // Export every stride-th frame of each track
+    double startSeconds = 0;  // Range to export, in seconds from the first frame
+    double endSeconds = -1;   // -1 exports to the end of the recording
+};
+
+// What an export did, for display
+struct ExportResult {
+    uint64_t colorFrames = 0;
+    uint64_t depthFrames = 0;
+    uint64_t irFrames = 0;
+    uint64_t points = 0;
+    uint64_t bytesRead = 0; // Frame data read from the recording, skipped frames are never read
+    uint64_t bytesWritten = 0;
+    double seconds = 0;
+    std::string warningText;
+};
+
+// Export the selected frames of a recording in timestamp order, encoding them across every core
+bool exportFrames(const ExportOptions& options, ExportResult& result, std::string& errorText);
+// Format what an export did as lines of text for the console
+std::string formatExportResult(const ExportResult& result);
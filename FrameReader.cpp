@@ -0,0 +1,480 @@
+/* Aden Prince
+ * HiMER Lab at U. of Illinois, Chicago
+ * K4ARecorder GUI
+ *
+ * FrameReader.cpp
+ * Contains functions used to read and decode frames of a recording at any
+ * time.
+ */
+
+#include "FrameReader.h"
+#include "DepthCompression.h"
+#include "RvlCodec.h"
+
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+
+#include <Windows.h>
+#include <wincodec.h>
+
+using namespace std;
+
+// A BITMAPINFOHEADER is 40 bytes, with the bits per pixel 14 bytes in and the FourCC of the frames 16 bytes in
+const uint64_t bitmapInfoHeaderBytes = 40;
+const uint64_t bitCountOffset = 14;
+const uint64_t fourccOffset = 16;
+// Names of the tracks the reader serves, in ReaderTrack order
+const char* readerTrackNames[readerTrackCount] = {"COLOR", "DEPTH", "IR"};
+
+// Work out how a track's frames are stored from its codec and BITMAPINFOHEADER
+FrameFormat trackFormat(const MatroskaFile& file, const TrackInfo& track) {
+    if (track.codecId == "V_MJPEG") {
+        return FormatMjpg;
+    }
+    if (track.codecId != "V_MS/VFW/FOURCC" || track.codecPrivateSize < bitmapInfoHeaderBytes) {
+        return FormatOther;
+    }
+
+    const uint8_t* header = file.data + track.codecPrivateOffset;
+    uint16_t bitCount = (uint16_t) (header[bitCountOffset] | (header[bitCountOffset + 1] << 8));
+    if (memcmp(header + fourccOffset, "MJPG", 4) == 0) {
+        return FormatMjpg;
+    }
+    if (memcmp(header + fourccOffset, rawDepthFourcc, 4) == 0) {
+        return FormatRawDepth;
+    }
+    if (memcmp(header + fourccOffset, rvlDepthFourcc, 4) == 0) {
+        return FormatRvlDepth;
+    }
+    if (memcmp(header + fourccOffset, "\0\0\0\0", 4) == 0 && bitCount == 32) {
+        return FormatBgra;
+    }
+    return FormatOther;
+}
+
+// Get the index filename of a recording, e.g. take.mkv.k4aidx
+string frameIndexFilename(const string& recording) {
+    return recording + ".k4aidx";
+}
+
+// Get the size and last write time of a file, which an index or cache saved next to a recording must match to be used
+bool fileStamp(const string& filename, uint64_t& size, uint64_t& writeTime) {
+    WIN32_FILE_ATTRIBUTE_DATA attributes;
+    if (!GetFileAttributesExA(filename.c_str(), GetFileExInfoStandard, &attributes)) {
+        return false;
+    }
+    size = ((uint64_t) attributes.nFileSizeHigh << 32) | attributes.nFileSizeLow;
+    writeTime = ((uint64_t) attributes.ftLastWriteTime.dwHighDateTime << 32) | attributes.ftLastWriteTime.dwLowDateTime;
+    return true;
+}
+
+// List every frame of the reader's tracks in timestamp order, reading only block headers
+static void buildFrameIndex(FrameReader& reader) {
+    uint64_t offset = 0;
+    ClusterInfo cluster;
+    while (nextCluster(reader.file, offset, cluster)) {
+        uint64_t blockOffset = 0;
+        BlockInfo block;
+        while (nextBlock(reader.file, cluster, blockOffset, block)) {
+            for (ReaderTrackState& track : reader.tracks) {
+                if (track.info != nullptr && block.track == track.info->number && block.frameCount == 1) {
+                    FrameIndexEntry entry;
+                    entry.timestampNs = block.timestampNs;
+                    entry.dataOffset = block.dataOffset;
+                    entry.dataSize = block.dataSize;
+                    track.frames.push_back(entry);
+                }
+            }
+        }
+        if (!cluster.complete) {
+            break;
+        }
+    }
+
+    // Blocks are close to but not exactly in time order
+    for (ReaderTrackState& track : reader.tracks) {
+        stable_sort(track.frames.begin(), track.frames.end(),
+                    [](const FrameIndexEntry& a, const FrameIndexEntry& b) { return a.timestampNs < b.timestampNs; });
+    }
+}
+
+// Read a saved index, returns false if it is missing, damaged or from another version of the recording
+static bool loadFrameIndex(const string& filename, uint64_t size, uint64_t writeTime, FrameReader& reader) {
+    ifstream input(filename, ios::binary);
+    char magic[8];
+    uint64_t savedSize = 0;
+    uint64_t savedTime = 0;
+    input.read(magic, 8);
+    input.read((char*) &savedSize, 8);
+    input.read((char*) &savedTime, 8);
+    if (!input || memcmp(magic, frameIndexMagic, 8) != 0 || savedSize != size || savedTime != writeTime) {
+        return false;
+    }
+
+    for (ReaderTrackState& track : reader.tracks) {
+        uint64_t number = 0;
+        uint64_t count = 0;
+        input.read((char*) &number, 8);
+        input.read((char*) &count, 8);
+        uint64_t expectedNumber = (track.info != nullptr) ? track.info->number : 0;
+        if (!input || number != expectedNumber || count > size / sizeof(FrameIndexEntry)) {
+            return false;
+        }
+        track.frames.resize((size_t) count);
+        input.read((char*) track.frames.data(), count * sizeof(FrameIndexEntry));
+        if (!input) {
+            return false;
+        }
+        for (const FrameIndexEntry& entry : track.frames) {
+            if (entry.dataOffset > reader.file.length || entry.dataSize > reader.file.length - entry.dataOffset) {
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+// Save the index next to the recording, a failure only means it is built again next time
+static void saveFrameIndex(const string& filename, uint64_t size, uint64_t writeTime, const FrameReader& reader) {
+    ofstream output(filename, ios::binary | ios::trunc);
+    output.write(frameIndexMagic, 8);
+    output.write((const char*) &size, 8);
+    output.write((const char*) &writeTime, 8);
+    for (const ReaderTrackState& track : reader.tracks) {
+        uint64_t number = (track.info != nullptr) ? track.info->number : 0;
+        uint64_t count = track.frames.size();
+        output.write((const char*) &number, 8);
+        output.write((const char*) &count, 8);
+        output.write((const char*) track.frames.data(), count * sizeof(FrameIndexEntry));
+    }
+    output.close();
+    if (!output) {
+        DeleteFileA(filename.c_str());
+    }
+}
+
+// Decode a JPEG frame to BGRA
+static bool decodeJpeg(const uint8_t* data, uint64_t size, DecodedFrame& decoded) {
+    bool comStarted = SUCCEEDED(CoInitializeEx(NULL, COINIT_MULTITHREADED));
+    IWICImagingFactory* factory = nullptr;
+    IWICStream* stream = nullptr;
+    IWICBitmapDecoder* decoder = nullptr;
+    IWICBitmapFrameDecode* frame = nullptr;
+    IWICFormatConverter* converter = nullptr;
+    UINT width = 0;
+    UINT height = 0;
+
+    // The decoder only reads from the mapped recording
+    bool succeeded = SUCCEEDED(CoCreateInstance(CLSID_WICImagingFactory, NULL, CLSCTX_INPROC_SERVER, IID_PPV_ARGS(&factory))) &&
+                     SUCCEEDED(factory->CreateStream(&stream)) && SUCCEEDED(stream->InitializeFromMemory((BYTE*) data, (DWORD) size)) &&
+                     SUCCEEDED(factory->CreateDecoder(GUID_ContainerFormatJpeg, NULL, &decoder)) &&
+                     SUCCEEDED(decoder->Initialize(stream, WICDecodeMetadataCacheOnDemand)) && SUCCEEDED(decoder->GetFrame(0, &frame)) &&
+                     SUCCEEDED(frame->GetSize(&width, &height)) && SUCCEEDED(factory->CreateFormatConverter(&converter)) &&
+                     SUCCEEDED(converter->Initialize(frame, GUID_WICPixelFormat32bppBGRA, WICBitmapDitherTypeNone, NULL, 0.0, WICBitmapPaletteTypeCustom));
+    if (succeeded) {
+        decoded.width = width;
+        decoded.height = height;
+        decoded.bytesPerPixel = 4;
+        decoded.pixels.resize((size_t) width * height * 4);
+        succeeded = SUCCEEDED(converter->CopyPixels(NULL, width * 4, (UINT) decoded.pixels.size(), decoded.pixels.data()));
+    }
+
+    if (converter != nullptr) {
+        converter->Release();
+    }
+    if (frame != nullptr) {
+        frame->Release();
+    }
+    if (decoder != nullptr) {
+        decoder->Release();
+    }
+    if (stream != nullptr) {
+        stream->Release();
+    }
+    if (factory != nullptr) {
+        factory->Release();
+    }
+    if (comStarted) {
+        CoUninitialize();
+    }
+    return succeeded;
+}
+
+// Decode one frame from the mapped recording
+static bool decodeFrame(const FrameReader& reader, ReaderTrack track, const FrameIndexEntry& entry, DecodedFrame& decoded, string& errorText) {
+    const ReaderTrackState& state = reader.tracks[track];
+    const uint8_t* data = reader.file.data + entry.dataOffset;
+    size_t pixelCount = (size_t) state.info->width * state.info->height;
+    string where = string(readerTrackNames[track]) + " frame at " + to_string(entry.timestampNs) + " ns";
+
+    decoded.timestampNs = entry.timestampNs;
+    decoded.width = state.info->width;
+    decoded.height = state.info->height;
+    switch (state.format) {
+    case FormatMjpg:
+        if (!decodeJpeg(data, entry.dataSize, decoded)) {
+            errorText += "ERROR: Could not decode the " + where + "\n";
+            return false;
+        }
+        return true;
+    case FormatBgra:
+        if (entry.dataSize != pixelCount * 4) {
+            break;
+        }
+        decoded.bytesPerPixel = 4;
+        decoded.pixels.assign(data, data + entry.dataSize);
+        return true;
+    case FormatRawDepth:
+        if (entry.dataSize != pixelCount * 2) {
+            break;
+        }
+        decoded.bytesPerPixel = 2;
+        decoded.pixels.resize(pixelCount * 2);
+        for (size_t i = 0; i < decoded.pixels.size(); i += 2) {
+            decoded.pixels[i] = data[i + 1];
+            decoded.pixels[i + 1] = data[i];
+        }
+        return true;
+    case FormatRvlDepth:
+        decoded.bytesPerPixel = 2;
+        decoded.pixels.resize(pixelCount * 2);
+        if (!decompressRvl(data, (size_t) entry.dataSize, pixelCount, false, decoded.pixels.data())) {
+            errorText += "ERROR: The " + where + " is not valid RVL data\n";
+            return false;
+        }
+        return true;
+    default:
+        errorText += "ERROR: The " + where + " is NV12 or YUY2, which cannot be decoded\n";
+        return false;
+    }
+
+    errorText += "ERROR: The " + where + " is not a single " + to_string(decoded.width) + "x" + to_string(decoded.height) + " frame\n";
+    return false;
+}
+
+// Combine a track and frame number into a cache key
+static uint64_t cacheKey(ReaderTrack track, int64_t index) {
+    return ((uint64_t) track << 48) | (uint64_t) index;
+}
+
+// Get a frame from the cache or decode it, called holding lock, which is released while decoding
+static shared_ptr<const DecodedFrame> cachedOrDecoded(FrameReader& reader, ReaderTrack track, int64_t index, unique_lock<mutex>& lock, bool readAhead,
+                                                      string& errorText) {
+    uint64_t key = cacheKey(track, index);
+    // Wait for another thread already decoding the frame rather than decoding it twice
+    for (;;) {
+        auto found = reader.cached.find(key);
+        if (found != reader.cached.end()) {
+            reader.lru.splice(reader.lru.begin(), reader.lru, found->second);
+            if (!readAhead) {
+                reader.stats.hits++;
+            }
+            return found->second->frame;
+        }
+        if (reader.decoding.count(key) == 0) {
+            break;
+        }
+        reader.frameDecoded.wait(lock);
+    }
+
+    if (!readAhead) {
+        reader.stats.misses++;
+    }
+    reader.decoding.insert(key);
+    lock.unlock();
+    shared_ptr<DecodedFrame> frame = make_shared<DecodedFrame>();
+    bool succeeded = decodeFrame(reader, track, reader.tracks[track].frames[(size_t) index], *frame, errorText);
+    lock.lock();
+    reader.decoding.erase(key);
+    reader.frameDecoded.notify_all();
+    if (!succeeded) {
+        return nullptr;
+    }
+
+    reader.stats.decodes++;
+    reader.stats.readAhead += readAhead;
+    reader.lru.push_front(CachedFrame{key, frame});
+    reader.cached[key] = reader.lru.begin();
+    reader.stats.cachedBytes += frame->pixels.size();
+
+    // Evict the least recently used frames, always keeping the one just decoded
+    while (reader.stats.cachedBytes > reader.cacheLimit && reader.lru.size() > 1) {
+        reader.stats.cachedBytes -= reader.lru.back().frame->pixels.size();
+        reader.cached.erase(reader.lru.back().key);
+        reader.lru.pop_back();
+    }
+    reader.stats.cachedFrames = reader.lru.size();
+    return frame;
+}
+
+// Decode the frames queued by readFrame until the reader is closed
+static void readAheadLoop(FrameReader* reader) {
+    unique_lock<mutex> lock(reader->cacheMutex);
+    for (;;) {
+        reader->readAheadWake.wait(lock, [&]() { return reader->stopping || reader->readAheadQueue.empty() == false; });
+        if (reader->stopping) {
+            return;
+        }
+
+        uint64_t key = reader->readAheadQueue.front();
+        reader->readAheadQueue.erase(reader->readAheadQueue.begin());
+        if (reader->cached.count(key) > 0 || reader->decoding.count(key) > 0) {
+            continue;
+        }
+        string errorText;
+        cachedOrDecoded(*reader, (ReaderTrack) (key >> 48), (int64_t) (key & 0xFFFFFFFFFFFFULL), lock, true, errorText);
+    }
+}
+
+// Open a recording, loading its index or building and saving it, and start the read-ahead thread
+bool openFrameReader(const string& recording, size_t cacheBytes, FrameReader& reader, string& errorText) {
+    if (!openMappedFile(recording, reader.mapped, errorText)) {
+        return false;
+    }
+    if (!parseMatroskaHeaders(reader.mapped.data, reader.mapped.length, reader.file, errorText)) {
+        closeMappedFile(reader.mapped);
+        return false;
+    }
+
+    bool anyTrack = false;
+    for (int i = 0; i < readerTrackCount; i++) {
+        const TrackInfo* info = findTrack(reader.file, readerTrackNames[i]);
+        if (info != nullptr && info->width > 0 && info->height > 0) {
+            reader.tracks[i].info = info;
+            reader.tracks[i].format = trackFormat(reader.file, *info);
+            anyTrack = true;
+        }
+    }
+    if (!anyTrack) {
+        errorText += "ERROR: Recording has no color, depth or IR track\n";
+        closeMappedFile(reader.mapped);
+        return false;
+    }
+
+    // The index is only trusted for the exact file it was built from
+    uint64_t size = 0;
+    uint64_t writeTime = 0;
+    string indexFilename = frameIndexFilename(recording);
+    bool stamped = fileStamp(recording, size, writeTime);
+    reader.stats.indexLoaded = stamped && loadFrameIndex(indexFilename, size, writeTime, reader);
+    if (!reader.stats.indexLoaded) {
+        for (ReaderTrackState& track : reader.tracks) {
+            track.frames.clear();
+        }
+        buildFrameIndex(reader);
+        if (stamped) {
+            saveFrameIndex(indexFilename, size, writeTime, reader);
+        }
+    }
+
+    reader.originNs = INT64_MAX;
+    for (const ReaderTrackState& track : reader.tracks) {
+        if (track.frames.empty() == false) {
+            reader.originNs = min(reader.originNs, track.frames.front().timestampNs);
+        }
+    }
+    if (reader.originNs == INT64_MAX) {
+        reader.originNs = 0;
+    }
+
+    reader.cacheLimit = cacheBytes;
+    reader.stopping = false;
+    reader.readAheadThread = thread(readAheadLoop, &reader);
+    return true;
+}
+
+// Stop the read-ahead thread, free the cache and close the recording
+void closeFrameReader(FrameReader& reader) {
+    {
+        lock_guard<mutex> lock(reader.cacheMutex);
+        reader.stopping = true;
+    }
+    reader.readAheadWake.notify_one();
+    if (reader.readAheadThread.joinable()) {
+        reader.readAheadThread.join();
+    }
+
+    // Frames still held by callers stay valid, they are freed with the last reference
+    reader.lru.clear();
+    reader.cached.clear();
+    reader.readAheadQueue.clear();
+    reader.stats.cachedBytes = 0;
+    reader.stats.cachedFrames = 0;
+    for (ReaderTrackState& track : reader.tracks) {
+        track = ReaderTrackState();
+    }
+    closeMappedFile(reader.mapped);
+}
+
+// Get the number of frames of a track, 0 if the recording does not have it
+uint64_t frameCount(const FrameReader& reader, ReaderTrack track) {
+    return reader.tracks[track].frames.size();
+}
+
+// Find the last frame at or before a time in seconds from the first frame, or the first frame, -1 if the track is empty
+int64_t findFrameAt(const FrameReader& reader, ReaderTrack track, double seconds) {
+    const vector<FrameIndexEntry>& frames = reader.tracks[track].frames;
+    if (frames.empty()) {
+        return -1;
+    }
+    int64_t target = reader.originNs + (int64_t) (seconds * 1e9);
+    auto after = upper_bound(frames.begin(), frames.end(), target, [](int64_t time, const FrameIndexEntry& entry) { return time < entry.timestampNs; });
+    return (after == frames.begin()) ? 0 : (after - frames.begin()) - 1;
+}
+
+// Get a decoded frame from the cache or the recording, nullptr if it cannot be decoded
+shared_ptr<const DecodedFrame> readFrame(FrameReader& reader, ReaderTrack track, int64_t index, string& errorText) {
+    int64_t count = (int64_t) reader.tracks[track].frames.size();
+    if (index < 0 || index >= count) {
+        errorText += string("ERROR: ") + readerTrackNames[track] + " frame " + to_string(index) + " is not in the recording\n";
+        return nullptr;
+    }
+
+    unique_lock<mutex> lock(reader.cacheMutex);
+    // Decode ahead in the direction reading last moved, replacing whatever was queued for an older position
+    int64_t last = reader.lastRead[track];
+    if (last >= 0 && index != last) {
+        reader.direction[track] = (index > last) ? 1 : -1;
+    }
+    reader.lastRead[track] = index;
+    reader.readAheadQueue.clear();
+    // Frames decoded ahead take at most half the cache, so they never push out the frames being scrubbed over
+    const TrackInfo& info = *reader.tracks[track].info;
+    size_t frameBytes = (size_t) info.width * info.height * ((track == ReaderColor) ? 4 : 2);
+    int64_t ahead = min((int64_t) readAheadFrames, (int64_t) (reader.cacheLimit / 2 / frameBytes));
+    for (int64_t i = 1; i <= ahead; i++) {
+        int64_t next = index + (int64_t) reader.direction[track] * i;
+        if (next >= 0 && next < count) {
+            reader.readAheadQueue.push_back(cacheKey(track, next));
+        }
+    }
+    reader.readAheadWake.notify_one();
+
+    return cachedOrDecoded(reader, track, index, lock, false, errorText);
+}
+
+// Get the decoded frame shown at a time in seconds from the first frame
+shared_ptr<const DecodedFrame> readFrameAt(FrameReader& reader, ReaderTrack track, double seconds, string& errorText) {
+    int64_t index = findFrameAt(reader, track, seconds);
+    if (index < 0) {
+        errorText += string("ERROR: Recording has no ") + readerTrackNames[track] + " frames\n";
+        return nullptr;
+    }
+    return readFrame(reader, track, index, errorText);
+}
+
+// Decode a frame straight from the recording without the cache, safe to call from any thread
+bool decodeIndexedFrame(const FrameReader& reader, ReaderTrack track, int64_t index, DecodedFrame& decoded, string& errorText) {
+    if (index < 0 || index >= (int64_t) reader.tracks[track].frames.size()) {
+        errorText += string("ERROR: ") + readerTrackNames[track] + " frame " + to_string(index) + " is not in the recording\n";
+        return false;
+    }
+    return decodeFrame(reader, track, reader.tracks[track].frames[(size_t) index], decoded, errorText);
+}
+
+// Get the cache counters, taking the cache lock
+FrameReaderStats frameReaderStats(FrameReader& reader) {
+    lock_guard<mutex> lock(reader.cacheMutex);
+    return reader.stats;
+}
@@ -0,0 +1,143 @@
+/* Aden Prince
+ * HiMER Lab at U. of Illinois, Chicago
+ * K4ARecorder GUI
+ *
+ * FrameReader.h
+ * Contains a random-access reader of the color, depth and IR frames of a
+ * recording. Frames are found through a timestamp index saved next to the
+ * recording, and decoded frames are kept in a least recently used cache
+ * that a background thread fills ahead of playback.
+ */
+
+#pragma once
+
+#include "MappedFile.h"
+#include "MatroskaParser.h"
+
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+// Decoded frames kept in memory by default, about 700 NFOV depth frames or 15 2160p color frames
+const size_t defaultFrameCacheBytes = 512 * 1024 * 1024;
+// Frames decoded ahead of the last one read, in the direction playback or scrubbing is moving
+const int readAheadFrames = 8;
+// Start of an index file, followed by the recording's size and write time and then each track's frames
+const char frameIndexMagic[9] = "K4AFIX01";
+
+// How a track's frames are stored in the recording
+enum FrameFormat {
+    FormatMjpg,
+    FormatBgra,
+    FormatRawDepth, // Big-endian 16-bit, as K4ARecorder writes depth and IR
+    FormatRvlDepth, // RVL coded by --compress-depth
+    FormatOther     // NV12 or YUY2 color
+};
+
+// Tracks the reader serves
+enum ReaderTrack {
+    ReaderColor,
+    ReaderDepth,
+    ReaderIr,
+    readerTrackCount
+};
+
+// Where one frame's data is in the recording
+struct FrameIndexEntry {
+    int64_t timestampNs = 0;
+    uint64_t dataOffset = 0;
+    uint64_t dataSize = 0;
+};
+
+// A decoded frame, BGRA for color and little-endian 16-bit for depth and IR
+struct DecodedFrame {
+    int64_t timestampNs = 0;
+    uint32_t width = 0;
+    uint32_t height = 0;
+    uint32_t bytesPerPixel = 0;
+    std::vector<uint8_t> pixels;
+};
+
+// A track's frames in timestamp order
+struct ReaderTrackState {
+    const TrackInfo* info = nullptr; // nullptr if the recording does not have the track
+    FrameFormat format = FormatOther;
+    std::vector<FrameIndexEntry> frames;
+};
+
+// Cache hits and decodes since the reader was opened, for display
+struct FrameReaderStats {
+    uint64_t hits = 0;
+    uint64_t misses = 0;
+    uint64_t decodes = 0;   // Includes frames decoded ahead
+    uint64_t readAhead = 0; // Frames decoded by the read-ahead thread
+    size_t cachedBytes = 0;
+    size_t cachedFrames = 0;
+    bool indexLoaded = false; // True if the index was read from its file instead of built
+};
+
+// A decoded frame in the cache, keyed by track and frame number
+struct CachedFrame {
+    uint64_t key = 0;
+    std::shared_ptr<const DecodedFrame> frame;
+};
+
+// An open recording, its index and the decoded frame cache shared with the read-ahead thread
+struct FrameReader {
+    MappedFile mapped;
+    MatroskaFile file;
+    ReaderTrackState tracks[readerTrackCount];
+    int64_t originNs = 0; // Timestamp of the first frame of any track
+
+    // Most recently used frames first, guarded by cacheMutex
+    std::mutex cacheMutex;
+    std::list<CachedFrame> lru;
+    std::unordered_map<uint64_t, std::list<CachedFrame>::iterator> cached;
+    std::unordered_set<uint64_t> decoding; // Frames a thread is decoding, waited for instead of decoded twice
+    std::condition_variable frameDecoded;
+    size_t cacheLimit = defaultFrameCacheBytes;
+    FrameReaderStats stats;
+
+    // Last frame read of each track and which way reading moved
+    int64_t lastRead[readerTrackCount] = {-1, -1, -1};
+    int direction[readerTrackCount] = {1, 1, 1};
+
+    // Frames for the read-ahead thread, replaced on every read so it follows the newest position
+    std::thread readAheadThread;
+    std::condition_variable readAheadWake;
+    std::vector<uint64_t> readAheadQueue;
+    bool stopping = false;
+};
+
+// Work out how a track's frames are stored from its codec and BITMAPINFOHEADER
+FrameFormat trackFormat(const MatroskaFile& file, const TrackInfo& track);
+// Get the index filename of a recording, e.g. take.mkv.k4aidx
+std::string frameIndexFilename(const std::string& recording);
+// Get the size and last write time of a file, which an index or cache saved next to a recording must match to be used
+bool fileStamp(const std::string& filename, uint64_t& size, uint64_t& writeTime);
+
+// Open a recording, loading its index or building and saving it, and start the read-ahead thread
+bool openFrameReader(const std::string& recording, size_t cacheBytes, FrameReader& reader, std::string& errorText);
+// Stop the read-ahead thread, free the cache and close the recording
+void closeFrameReader(FrameReader& reader);
+
+// Get the number of frames of a track, 0 if the recording does not have it
+uint64_t frameCount(const FrameReader& reader, ReaderTrack track);
+// Find the last frame at or before a time in seconds from the first frame, or the first frame, -1 if the track is empty
+int64_t findFrameAt(const FrameReader& reader, ReaderTrack track, double seconds);
+// Get a decoded frame from the cache or the recording, nullptr if it cannot be decoded
+std::shared_ptr<const DecodedFrame> readFrame(FrameReader& reader, ReaderTrack track, int64_t index, std::string& errorText);
+// Get the decoded frame shown at a time in seconds from the first frame
+std::shared_ptr<const DecodedFrame> readFrameAt(FrameReader& reader, ReaderTrack track, double seconds, std::string& errorText);
+// Decode a frame straight from the recording without the cache, safe to call from any thread
+bool decodeIndexedFrame(const FrameReader& reader, ReaderTrack track, int64_t index, DecodedFrame& decoded, std::string& errorText);
+// Get the cache counters, taking the cache lock
+FrameReaderStats frameReaderStats(FrameReader& reader);
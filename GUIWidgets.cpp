@@ -7,18 +7,17 @@
  */
 
 #include "GUIWidgets.h"
-
-#include <fstream>
+#include "RecorderOptions.h"
+#include "RecordingSession.h"
+#include "StorageCheck.h"
 
 using namespace std;
 
-// Check if a file exists with the passed filename
-bool fileExists(string filename) {
-    ifstream inputFile;
-    inputFile.open(filename);
-    bool isOpen = inputFile.is_open();
-    inputFile.close();
-    return isOpen;
+// Get the name of a mode table entry for ImGui::Combo
+template <typename T>
+bool modeName(void* table, int index, const char** name) {
+    *name = ((const T*) table)[index].name;
+    return true;
 }
 
 // Enable or disable an integer input based on a passed boolean value
@@ -36,68 +35,590 @@ void conditionalInputInt(const char* label, int* value, bool enabled) {
     }
 }
 
+// Show the state, start skew and output of every device in a multiple device take
+void showMultiDeviceStatus(MultiDeviceSession& multi) {
+    if (multi.state == MultiDeviceState::WaitingForSubordinates) {
+        ImGui::Text("Waiting for subordinates before starting the master");
+    }
+    if (multi.launchSkewMs >= 0) {
+        ImGui::Text("Subordinate launch skew: %.2f ms", multi.launchSkewMs);
+    }
+    if (multi.masterDelayMs >= 0) {
+        ImGui::SameLine();
+        ImGui::Text("Master started %.2f ms later", multi.masterDelayMs);
+    }
+    if (multi.startSkewMs >= 0) {
+        ImGui::SameLine();
+        ImGui::Text("Start skew: %.2f ms", multi.startSkewMs);
+    }
+    if (multi.statusText.empty() == false) {
+        ImGui::TextWrapped("%s", multi.statusText.c_str());
+    }
+
+    for (int i = 0; i < multi.takeDeviceCount; i++) {
+        DeviceTake& device = multi.devices[i];
+        const char* state = device.running ? "recording" : (device.launched ? "exited" : "not started");
+
+        ImGui::PushID(i);
+        bool open = ImGui::TreeNode("device", "%s (device %d): %s, exit code %lu", device.output_filename.c_str(),
+                                    multi.deviceIndices[i], state, device.exitCode);
+        if (open) {
+            showLogPane(device.log);
+            ImGui::TreePop();
+        }
+        ImGui::PopID();
+    }
+}
+
+// Show the stage times of the last take and their percentiles per mode across sessions
+void showStartLatency(StartLatency& latency) {
+    if (latency.measuring) {
+        ImGui::Text("Timing the current take...");
+    }
+    else if (latency.history.empty() == false) {
+        const StartLatencyRecord& last = latency.history.back();
+        ImGui::Text("Last take (%s):", last.mode.c_str());
+        for (int stage = 0; stage < StageCount; stage++) {
+            ImGui::SameLine();
+            if (last.stageMs[stage] >= 0) {
+                ImGui::Text("%s %.1f ms", startStageNames[stage], last.stageMs[stage]);
+            }
+            else {
+                ImGui::Text("%s -", startStageNames[stage]);
+            }
+        }
+    }
+
+    // p50 and p99 of each stage in milliseconds, one row per mode
+    ImGui::Columns(2 + StageCount, "Start latency");
+    ImGui::Text("Mode");
+    ImGui::NextColumn();
+    ImGui::Text("Takes");
+    ImGui::NextColumn();
+    for (int stage = 0; stage < StageCount; stage++) {
+        ImGui::Text("%s p50/p99", startStageNames[stage]);
+        ImGui::NextColumn();
+    }
+    ImGui::Separator();
+
+    for (const StartLatencyStats& stats : latency.stats) {
+        ImGui::Text("%s", stats.mode.c_str());
+        ImGui::NextColumn();
+        ImGui::Text("%d", stats.takeCount);
+        ImGui::NextColumn();
+        for (int stage = 0; stage < StageCount; stage++) {
+            if (stats.p50Ms[stage] >= 0) {
+                ImGui::Text("%.1f / %.1f", stats.p50Ms[stage], stats.p99Ms[stage]);
+            }
+            else {
+                ImGui::Text("-");
+            }
+            ImGui::NextColumn();
+        }
+    }
+    ImGui::Columns(1);
+}
+
+// Plot the write rate of the output files and show when the target volume will be full
+void showThroughputMonitor(ThroughputMonitor& monitor) {
+    char overlay[64];
+    snprintf(overlay, sizeof(overlay), "%.1f MB/s (average %.1f MB/s)", monitor.latest.mbPerSecond, monitor.averageMBps);
+    ImGui::PlotLines("Write rate", monitor.plot, throughputPlotLength, monitor.plotOffset, overlay, 0.0f, FLT_MAX,
+                     ImVec2(0, ImGui::GetTextLineHeight() * 5));
+
+    ImGui::Text("Written: %.2f GB  Free: %.2f GB", monitor.latest.totalBytes / 1e9, monitor.latest.freeBytes / 1e9);
+
+    double seconds = secondsUntilFull(monitor);
+    if (seconds >= 0) {
+        int totalMinutes = (int) (seconds / 60);
+        ImGui::SameLine();
+        ImGui::Text("Full in: %d h %02d min", totalMinutes / 60, totalMinutes % 60);
+    }
+}
+
+// Show an alarm and the gaps found if frames have been dropped from the take
+void showDropMonitor(DropMonitor& monitor) {
+    if (!monitor.alarm) {
+        ImGui::TextColored(ImVec4(0.3f, 1.0f, 0.3f, 1.0f), "No dropped frames (%llu frames checked)", (unsigned long long) monitor.framesChecked.load());
+        return;
+    }
+
+    // Flash the alarm while the take is running
+    bool flash = monitor.active && fmod(ImGui::GetTime(), 1.0) < 0.5;
+    ImGui::TextColored(flash ? ImVec4(1.0f, 1.0f, 0.0f, 1.0f) : ImVec4(1.0f, 0.3f, 0.0f, 1.0f), "DROPPED FRAMES: %llu in %d gaps",
+                       (unsigned long long) monitor.droppedFrames, (int) monitor.gaps.size());
+
+    // Newest gap first
+    ImGui::BeginChild("Frame gaps", ImVec2(0, ImGui::GetTextLineHeightWithSpacing() * 4), true);
+    for (int i = (int) monitor.gaps.size() - 1; i >= 0; i--) {
+        const FrameGap& gap = monitor.gaps[i];
+        ImGui::Text("%s %s: %.1f ms gap at %.2f s, %d frames missing", monitor.readers[gap.fileIndex].filename.c_str(), gap.trackName,
+                    gap.gapMs, gap.seconds, gap.droppedFrames);
+    }
+    ImGui::EndChild();
+}
+
+// Show the progress of the move in progress and the result of each finished one
+void showFileMover(FileMover& mover) {
+    if (mover.running) {
+        uint64_t total = mover.totalBytes;
+        float fraction = (total > 0) ? (float) ((double) mover.bytesDone / total) : 0.0f;
+        ImGui::Text("%s %s", (mover.phase == MoveCopying) ? "Copying" : "Verifying", mover.current.destination.c_str());
+        ImGui::ProgressBar(fraction);
+    }
+    if (mover.queue.empty() == false) {
+        ImGui::Text("%d more take files waiting to be moved", (int) mover.queue.size());
+    }
+
+    for (const MoveResult& result : mover.results) {
+        if (result.succeeded) {
+            ImGui::TextColored(ImVec4(0.3f, 1.0f, 0.3f, 1.0f), "Moved %s, %.2f GB at %.0f MB/s, checksum %016llx", result.job.destination.c_str(),
+                               result.bytes / 1e9, result.copyMBps, (unsigned long long) result.checksum);
+        }
+        if (result.errorText.empty() == false) {
+            ImGui::TextColored(ImVec4(1.0f, 0.3f, 0.0f, 1.0f), "%s", result.errorText.c_str());
+        }
+    }
+}
+
+// Show the progress of the checksum being taken and the manifests written
+void showManifestWriter(ManifestWriter& writer) {
+    if (writer.running) {
+        uint64_t total = writer.totalBytes;
+        ImGui::Text("Checksumming %s", writer.current.recording.c_str());
+        ImGui::ProgressBar((total > 0) ? (float) ((double) writer.bytesDone / total) : 0.0f);
+    }
+    if (writer.queue.empty() == false) {
+        ImGui::Text("%d more take files waiting to be checksummed", (int) writer.queue.size());
+    }
+
+    for (const ManifestResult& result : writer.results) {
+        if (result.succeeded) {
+            double rate = (result.seconds > 0) ? result.manifest.size / 1e9 / result.seconds : 0;
+            ImGui::Text("%s: %016llx, %.2f GB at %.2f GB/s", manifestFilename(result.job.recording).c_str(), (unsigned long long) result.manifest.checksum,
+                        result.manifest.size / 1e9, rate);
+        }
+        else {
+            ImGui::TextColored(ImVec4(1.0f, 0.3f, 0.0f, 1.0f), "%s", result.errorText.c_str());
+        }
+    }
+}
+
+// Show the throughput and write latency measured by the storage benchmark against what recording needs
+void showStorageBenchmark(StorageBenchmark& benchmark) {
+    if (benchmark.errorText.empty() == false) {
+        ImGui::TextColored(ImVec4(1.0f, 0.3f, 0.0f, 1.0f), "%s", benchmark.errorText.c_str());
+        return;
+    }
+
+    double headroom = benchmark.sustainedMBps / benchmark.requiredMBps;
+    ImVec4 color = (headroom >= 1.5 && benchmark.pacedP99Ms < benchmark.frameMs) ? ImVec4(0.3f, 1.0f, 0.3f, 1.0f) : ImVec4(1.0f, 0.3f, 0.0f, 1.0f);
+
+    ImGui::TextColored(color, "Storage: %.0f MB/s sustained, %.1fx the %.1f MB/s needed", benchmark.sustainedMBps, headroom, benchmark.requiredMBps);
+    ImGui::TextColored(color, "Frame writes at %d FPS: p99 %.1f ms, max %.1f ms of %.1f ms per frame", benchmark.fps,
+                       benchmark.pacedP99Ms, benchmark.pacedMaxMs, benchmark.frameMs);
+}
+
+// Show the frame counts, gaps and IMU sample rate of every file from the last take, with buttons to repair or compress them
+void showRecordingInspection(RecordingSession& session) {
+    RecordingInspection& inspection = session.inspection;
+    RecordingRepair& repair = session.repair;
+    DepthCompression& depthCompression = session.depthCompression;
+    if (inspection.running) {
+        ImGui::Text("Inspecting...");
+        return;
+    }
+    if (inspection.errorText.empty() == false) {
+        ImGui::TextColored(ImVec4(1.0f, 0.3f, 0.0f, 1.0f), "%s", inspection.errorText.c_str());
+    }
+
+    for (const RecordingSummary& summary : inspection.summaries) {
+        ImGui::Text("%s: %.2f GB, %.1f s, parsed in %.1f ms", summary.filename.c_str(), summary.fileBytes / 1e9,
+                    summary.durationSeconds, summary.parseMs);
+        ImGui::PushID(summary.filename.c_str());
+
+        // Rebuild the cues and fix the sizes of a file K4ARecorder did not finish
+        if (summary.truncated || !summary.hasCues) {
+            ImGui::TextColored(ImVec4(1.0f, 0.3f, 0.0f, 1.0f), summary.truncated ? "File ends inside a cluster, K4ARecorder may not have exited cleanly"
+                                                                              : "File has no cues, K4ARecorder may not have exited cleanly");
+            ImGui::SameLine();
+
+            // Windows will not cut short a file another job has mapped, so wait for them to finish
+            string job = jobUsingRecording(session, summary.filename);
+            if (job.empty() == false) {
+                ImGui::PushItemFlag(ImGuiItemFlags_Disabled, true);
+                ImGui::PushStyleVar(ImGuiStyleVar_Alpha, ImGui::GetStyle().Alpha * 0.5f);
+            }
+            if (ImGui::Button(repair.running ? "Repairing...###Repair" : "Repair") && !repair.running && job.empty()) {
+                startRepair(repair, summary.filename);
+            }
+            if (job.empty() == false) {
+                ImGui::PopItemFlag();
+                ImGui::PopStyleVar();
+                ImGui::SameLine();
+                ImGui::Text("Waiting for the %s to finish", job.c_str());
+            }
+        }
+        if (!repair.running && repair.finished && repair.filename == summary.filename) {
+            ImGui::TextWrapped("%s", repair.succeeded ? formatRepairPlan(repair.plan).c_str() : repair.errorText.c_str());
+        }
+
+        // Write a copy with the depth track losslessly compressed, only once the file is complete
+        bool hasDepth = false;
+        for (const TrackSummary& track : summary.tracks) {
+            hasDepth = hasDepth || track.name == "DEPTH";
+        }
+        if (hasDepth && !summary.truncated && summary.hasCues && !repair.running) {
+            bool converting = depthCompression.running && depthCompression.inputFilename == summary.filename;
+            if (ImGui::Button("Compress depth") && !depthCompression.running) {
+                startDepthCompression(depthCompression, summary.filename, true);
+            }
+            if (converting) {
+                uint64_t total = depthCompression.totalFrames;
+                ImGui::SameLine();
+                ImGui::ProgressBar((total > 0) ? (float) ((double) depthCompression.framesDone / total) : 0.0f);
+            }
+        }
+        if (!depthCompression.running && depthCompression.finished && depthCompression.inputFilename == summary.filename) {
+            ImGui::TextWrapped("%s", depthCompression.succeeded ? formatDepthCompression(depthCompression).c_str() : depthCompression.errorText.c_str());
+        }
+        ImGui::Columns(5, "Tracks");
+        ImGui::Text("Track");
+        ImGui::NextColumn();
+        ImGui::Text("Frames");
+        ImGui::NextColumn();
+        ImGui::Text("Rate");
+        ImGui::NextColumn();
+        ImGui::Text("Gaps / dropped");
+        ImGui::NextColumn();
+        ImGui::Text("Longest gap");
+        ImGui::NextColumn();
+        ImGui::Separator();
+
+        for (const TrackSummary& track : summary.tracks) {
+            ImVec4 color = (track.droppedFrames > 0) ? ImVec4(1.0f, 0.3f, 0.0f, 1.0f) : ImGui::GetStyleColorVec4(ImGuiCol_Text);
+            ImGui::TextColored(color, "%s", track.name.c_str());
+            ImGui::NextColumn();
+            ImGui::Text("%llu", (unsigned long long) track.frameCount);
+            ImGui::NextColumn();
+            ImGui::Text((track.codecId == "S_K4A/IMU") ? "%.1f Hz" : "%.2f FPS", track.rate);
+            ImGui::NextColumn();
+            ImGui::TextColored(color, "%llu / %llu", (unsigned long long) track.gapCount, (unsigned long long) track.droppedFrames);
+            ImGui::NextColumn();
+            ImGui::Text("%.1f ms", track.longestGapNs / 1e6);
+            ImGui::NextColumn();
+        }
+        ImGui::Columns(1);
+        ImGui::PopID();
+    }
+}
+
+// Make a texture ImGui can draw from BGRA pixels, nullptr if it cannot be made
+static void* createBgraTexture(const uint8_t* pixels, uint32_t width, uint32_t height) {
+    D3D11_TEXTURE2D_DESC description = {};
+    description.Width = width;
+    description.Height = height;
+    description.MipLevels = 1;
+    description.ArraySize = 1;
+    description.Format = DXGI_FORMAT_B8G8R8A8_UNORM;
+    description.SampleDesc.Count = 1;
+    description.Usage = D3D11_USAGE_IMMUTABLE;
+    description.BindFlags = D3D11_BIND_SHADER_RESOURCE;
+
+    D3D11_SUBRESOURCE_DATA data = {pixels, width * 4, 0};
+    ID3D11Texture2D* texture = nullptr;
+    ID3D11ShaderResourceView* view = nullptr;
+    if (SUCCEEDED(g_pd3dDevice->CreateTexture2D(&description, &data, &texture))) {
+        g_pd3dDevice->CreateShaderResourceView(texture, NULL, &view);
+        texture->Release();
+    }
+    return view;
+}
+
+// Release the textures made for a filmstrip
+void releaseFilmstripTextures(FilmstripJob& job) {
+    for (vector<void*>* textures : {&job.colorTextures, &job.depthTextures}) {
+        for (void* texture : *textures) {
+            if (texture != nullptr) {
+                ((ID3D11ShaderResourceView*) texture)->Release();
+            }
+        }
+        textures->clear();
+    }
+    job.textureGeneration = 0;
+}
+
+// Show a row of thumbnails, with the time of each when hovered
+static void showThumbnailRow(const Filmstrip& strip, const vector<void*>& textures, uint32_t width) {
+    for (size_t i = 0; i < textures.size(); i++) {
+        if (i > 0) {
+            ImGui::SameLine(0.0f, 2.0f);
+        }
+        ImGui::Image((ImTextureID) textures[i], ImVec2((float) width, (float) thumbnailHeight));
+        if (ImGui::IsItemHovered()) {
+            ImGui::SetTooltip("%.1f s", strip.thumbnails[i].timeNs / 1e9);
+        }
+    }
+}
+
+// Show color and depth thumbnails spread over the last take, making their textures once they are ready
+void showFilmstrip(FilmstripJob& job) {
+    if (job.running) {
+        uint64_t total = job.totalThumbnails;
+        ImGui::Text("Making filmstrip");
+        ImGui::SameLine();
+        ImGui::ProgressBar((total > 0) ? (float) ((double) job.thumbnailsDone / total) : 0.0f);
+        return;
+    }
+    if (!job.finished) {
+        return;
+    }
+    if (job.errorText.empty() == false) {
+        ImGui::TextColored(ImVec4(1.0f, 0.3f, 0.0f, 1.0f), "%s", job.errorText.c_str());
+    }
+    if (!job.succeeded) {
+        return;
+    }
+
+    // Textures are made on this thread, once per filmstrip
+    const Filmstrip& strip = job.strip;
+    if (job.textureGeneration != job.generation) {
+        releaseFilmstripTextures(job);
+        for (const FilmstripThumbnail& thumbnail : strip.thumbnails) {
+            if (strip.colorWidth > 0) {
+                job.colorTextures.push_back(createBgraTexture(thumbnail.color.data(), strip.colorWidth, thumbnailHeight));
+            }
+            if (strip.depthWidth > 0) {
+                job.depthTextures.push_back(createBgraTexture(thumbnail.depthColors.data(), strip.depthWidth, thumbnailHeight));
+            }
+        }
+        job.textureGeneration = job.generation;
+    }
+
+    ImGui::Text("Filmstrip: %d thumbnails every %.1f s, %s in %.0f ms", (int) strip.thumbnails.size(), strip.intervalSeconds,
+                job.fromCache ? "loaded from cache" : "decoded", job.seconds * 1000);
+    int rows = (strip.colorWidth > 0) + (strip.depthWidth > 0);
+    float height = rows * (thumbnailHeight + ImGui::GetStyle().ItemSpacing.y) + ImGui::GetStyle().ScrollbarSize;
+    ImGui::BeginChild("Filmstrip", ImVec2(0, height), false, ImGuiWindowFlags_HorizontalScrollbar);
+    showThumbnailRow(strip, job.colorTextures, strip.colorWidth);
+    showThumbnailRow(strip, job.depthTextures, strip.depthWidth);
+    ImGui::EndChild();
+}
+
+// Plot the invalid pixels and mean depth of every frame of the last take and the histogram of its depths
+void showDepthQuality(DepthQualityJob& job) {
+    if (job.running) {
+        uint64_t total = job.totalFrames;
+        ImGui::Text("Measuring depth frames");
+        ImGui::SameLine();
+        ImGui::ProgressBar((total > 0) ? (float) ((double) job.framesDone / total) : 0.0f);
+        return;
+    }
+    if (!job.finished || !job.succeeded) {
+        return;
+    }
+
+    const DepthQuality& quality = job.quality;
+    ImGui::Text("Depth quality: %d frames, %s in %.0f ms", (int) quality.frames.size(), job.fromCache ? "loaded" : "measured", job.seconds * 1000);
+    if (job.invalidPlot.empty()) {
+        return;
+    }
+    float height = ImGui::GetTextLineHeight() * 4;
+    char overlay[64];
+    snprintf(overlay, sizeof(overlay), "Invalid pixels (%%), last %.1f", job.invalidPlot.back());
+    ImGui::PlotLines("##Invalid", job.invalidPlot.data(), (int) job.invalidPlot.size(), 0, overlay, 0.0f, 100.0f, ImVec2(-1, height));
+    snprintf(overlay, sizeof(overlay), "Mean valid depth (mm), last %.0f", job.meanPlot.back());
+    ImGui::PlotLines("##Mean", job.meanPlot.data(), (int) job.meanPlot.size(), 0, overlay, 0.0f, FLT_MAX, ImVec2(-1, height));
+    snprintf(overlay, sizeof(overlay), "Depths from %u mm, %u mm per bar", quality.histogramFirstMm / depthPlotBinMm * depthPlotBinMm, depthPlotBinMm);
+    ImGui::PlotHistogram("##Histogram", job.histogramPlot.data(), (int) job.histogramPlot.size(), 0, overlay, 0.0f, FLT_MAX, ImVec2(-1, height));
+}
+
+// Search, sort and list the recordings of a directory tree from its index, drawing only the visible rows
+void showLibrary(LibraryScan& scan) {
+    static char library_root[260] = "";
+    static char library_filter[128] = "";
+    static int library_age = 0;
+    static int sort_column = SortModified;
+    static bool sort_descending = true;
+    static vector<uint32_t> matches;
+    static string shownFilter;
+    static int shownAge = -1;
+    static int shownSort = -1;
+    static bool shownDescending = false;
+    static uint64_t shownGeneration = 0;
+
+    ImGui::InputText("Library directory", library_root, IM_ARRAYSIZE(library_root));
+    ImGui::SameLine();
+    if (ImGui::Button(scan.running ? "Scanning..." : "Scan") && !scan.running && library_root[0] != '\0') {
+        startLibraryScan(scan, library_root);
+    }
+    if (scan.running) {
+        uint64_t toParse = scan.filesToParse;
+        if (toParse > 0) {
+            ImGui::ProgressBar((float) ((double) scan.filesParsed / toParse));
+        }
+        else {
+            ImGui::Text("%llu recordings found", (unsigned long long) scan.filesFound);
+        }
+    }
+    else if (scan.finished && !scan.succeeded) {
+        ImGui::TextColored(ImVec4(1.0f, 0.3f, 0.0f, 1.0f), "%s", scan.errorText.c_str());
+    }
+    if (scan.generation == 0) {
+        return;
+    }
+
+    const int ageDays[] = {0, 1, 7, 30};
+    const char* ageNames[] = {"Any time", "Today", "Last 7 days", "Last 30 days"};
+    ImGui::InputText("Filter", library_filter, IM_ARRAYSIZE(library_filter));
+    ImGui::SameLine();
+    ImGui::PushItemWidth(120);
+    ImGui::Combo("Modified", &library_age, ageNames, IM_ARRAYSIZE(ageNames));
+    ImGui::PopItemWidth();
+
+    // Filtering and sorting only happen when something changes, not every frame
+    if (shownGeneration != scan.generation || shownFilter != library_filter || shownAge != library_age || shownSort != sort_column || shownDescending != sort_descending) {
+        filterLibrary(scan.entries, library_filter, ageDays[library_age], (LibrarySort) sort_column, sort_descending, matches);
+        shownGeneration = scan.generation;
+        shownFilter = library_filter;
+        shownAge = library_age;
+        shownSort = sort_column;
+        shownDescending = sort_descending;
+    }
+    ImGui::Text("%d of %d recordings, %llu parsed and %llu unchanged in the last scan (%.2f s)", (int) matches.size(), (int) scan.entries.size(),
+                (unsigned long long) (scan.entries.size() - scan.reused), (unsigned long long) scan.reused, scan.seconds);
+
+    // Clicking a column's title sorts by it, clicking it again reverses the order
+    const LibrarySort columnSorts[] = {SortModified, SortDuration, SortSize, SortDepthMode, SortColorMode, SortSerial, SortPath};
+    const char* columnNames[] = {"Modified", "Duration", "Size", "Depth mode", "Color mode", "Serial", "Path"};
+    const int columnCount = IM_ARRAYSIZE(columnNames);
+    ImGui::Columns(columnCount, "Library titles");
+    for (int column = 0; column < columnCount; column++) {
+        string title = string(columnNames[column]) + ((sort_column == columnSorts[column]) ? (sort_descending ? " v" : " ^") : "");
+        if (ImGui::Selectable(title.c_str(), sort_column == columnSorts[column])) {
+            sort_descending = (sort_column == columnSorts[column]) ? !sort_descending : false;
+            sort_column = columnSorts[column];
+        }
+        ImGui::NextColumn();
+    }
+    ImGui::Columns(1);
+    ImGui::Separator();
+
+    ImGui::BeginChild("Library", ImVec2(0, ImGui::GetTextLineHeightWithSpacing() * 16), false);
+    ImGui::Columns(columnCount, "Library rows");
+    ImGuiListClipper clipper;
+    clipper.Begin((int) matches.size());
+    while (clipper.Step()) {
+        for (int row = clipper.DisplayStart; row < clipper.DisplayEnd; row++) {
+            const LibraryEntry& entry = scan.entries[matches[row]];
+            ImGui::Text("%s", formatLibraryTime(entry.writeTime).c_str());
+            ImGui::NextColumn();
+            ImGui::Text("%.1f s", entry.durationSeconds);
+            ImGui::NextColumn();
+            ImGui::Text("%.2f GB", entry.size / 1e9);
+            ImGui::NextColumn();
+            if (entry.readable) {
+                ImGui::Text("%s", entry.depthMode.c_str());
+            }
+            else {
+                ImGui::TextColored(ImVec4(1.0f, 0.3f, 0.0f, 1.0f), "Unreadable");
+            }
+            ImGui::NextColumn();
+            ImGui::Text("%s", entry.colorMode.c_str());
+            ImGui::NextColumn();
+            ImGui::Text("%s", entry.serialNumber.c_str());
+            ImGui::NextColumn();
+            ImGui::Text("%s", entry.path.c_str());
+            if (ImGui::IsItemHovered() && entry.args.empty() == false) {
+                ImGui::SetTooltip("%s", entry.args.c_str());
+            }
+            ImGui::NextColumn();
+        }
+    }
+    clipper.End();
+    ImGui::Columns(1);
+    ImGui::EndChild();
+}
+
 // Create ImGui widgets and get program arguments from them
-int getArgs(string& argsStr, string& errorText, string& recorderPathStr) {
+int getArgs(string& argsStr, string& errorText, string& recorderPathStr, RecordingSession& session) {
     // 0: Continue running GUI, 1: Start K4ARecorder, -1: Quit program
     int startRecorder = 0;
 
-    if (ImGui::Button("Print help")) {
-        argsStr += " --help";
+    if (ImGui::Button("Print help") && !sessionBusy(session)) {
+        RecorderOptions helpOptions;
+        helpOptions.print_help = true;
+        argsStr = buildArgs(helpOptions);
+        session.outputFilename = "";
         return 1;
     }
     ImGui::SameLine();
-    if (ImGui::Button("List devices")) {
-        argsStr += " --list";
+    if (ImGui::Button("List devices") && !sessionBusy(session)) {
+        RecorderOptions listOptions;
+        listOptions.list_devices = true;
+        argsStr = buildArgs(listOptions);
+        session.outputFilename = "";
         return 1;
     }
 
-    // Display recording options
-    static bool imu_recording_mode = false;
-    static bool record_for_time = false;
-    static int recording_time = 0;
-    static int depth_delay = 0;
+    // Options shown in the GUI, kept between frames
+    static RecorderOptions options;
 
+    // Display recording options
     if (ImGui::CollapsingHeader("Recording options")) {
-        ImGui::Checkbox("Record IMU data", &imu_recording_mode);
-        ImGui::Checkbox("Record for set time", &record_for_time);
-        conditionalInputInt("Seconds to record", &recording_time, record_for_time);
-        ImGui::InputInt("Depth delay", &depth_delay);
+        ImGui::Checkbox("Record IMU data", &options.imu_recording_mode);
+        ImGui::Checkbox("Record for set time", &options.record_for_time);
+        conditionalInputInt("Seconds to record", &options.recording_time, options.record_for_time);
+        ImGui::InputInt("Depth delay", &options.depth_delay);
         ImGui::Separator();
     }
 
     // Display camera options
-    const char* color_modes[] = {"OFF", "720p_YUY2", "720p_NV12", "720p", "1080p", "1440p", "1536p", "2160p", "3072p"};
-    static int color_mode_index = 3; // Default color mode is 720p
-    const char* depth_modes[] = {"OFF", "PASSIVE_IR", "WFOV_UNBINNED", "WFOV_2X2BINNED", "NFOV_UNBINNED", "NFOV_2X2BINNED"};
-    static int depth_mode_index = 4; // Default depth mode is NFOV_UNBINNED
-    const char* frame_rates[] = {"5", "15", "30"};
-    static int frame_rate_index = 2; // Default frame rate is 30 FPS
-    static bool manual_exposure = false;
-    static bool manual_gain = false;
-    static int exposure_value = 0;
-    static int gain_value = 0;
-
     if (ImGui::CollapsingHeader("Camera options")) {
-        ImGui::Combo("Color mode", &color_mode_index, color_modes, IM_ARRAYSIZE(color_modes));
-        ImGui::Combo("Depth mode", &depth_mode_index, depth_modes, IM_ARRAYSIZE(depth_modes));
-        ImGui::Combo("Frame rate", &frame_rate_index, frame_rates, IM_ARRAYSIZE(frame_rates));
-        ImGui::Checkbox("Manual exposure", &manual_exposure);
-        ImGui::Checkbox("Manual gain", &manual_gain);
-        conditionalInputInt("Exposure value", &exposure_value, manual_exposure);
-        conditionalInputInt("Gain value", &gain_value, manual_gain);
+        ImGui::Combo("Color mode", &options.color_mode_index, modeName<CameraModeInfo>, (void*) colorModeTable, colorModeCount);
+        ImGui::Combo("Depth mode", &options.depth_mode_index, modeName<CameraModeInfo>, (void*) depthModeTable, depthModeCount);
+        ImGui::Combo("Frame rate", &options.frame_rate_index, modeName<FrameRateInfo>, (void*) frameRateTable, frameRateCount);
+
+        // Show the expected data rate, or why the selected modes cannot be recorded
+        const CameraModeInfo& color = colorModeTable[options.color_mode_index];
+        const CameraModeInfo& depth = depthModeTable[options.depth_mode_index];
+        if (!supportsFrameRate(color.frameRates, options.frame_rate_index) ||
+            !supportsFrameRate(depth.frameRates, options.frame_rate_index)) {
+            ImGui::TextColored(ImVec4(1.0f, 0.3f, 0.0f, 1.0f), "%s and %s cannot record at %s FPS", color.name, depth.name,
+                               frameRateTable[options.frame_rate_index].name);
+        }
+        else {
+            double bytesPerSecond = expectedBytesPerSecond(options);
+            ImGui::Text("Expected data rate: %.1f MB/s, %.1f GB/hour", bytesPerSecond / 1e6, bytesPerSecond * 3600 / 1e9);
+        }
+        ImGui::Checkbox("Manual exposure", &options.manual_exposure);
+        ImGui::Checkbox("Manual gain", &options.manual_gain);
+        conditionalInputInt("Exposure value", &options.exposure_value, options.manual_exposure);
+        conditionalInputInt("Gain value", &options.gain_value, options.manual_gain);
         ImGui::Separator();
     }
 
     // Multiple device options
-    const char* external_sync_modes[] = {"Standalone", "Subordinate", "Master"};
-    static int external_sync_mode_index = 0; // Default external sync mode is Standalone
-    static int external_sync_delay = 0;
-    static int device_index = 0;
-
     if (ImGui::CollapsingHeader("Multiple device options")) {
-        ImGui::Combo("External sync mode", &external_sync_mode_index, external_sync_modes, IM_ARRAYSIZE(external_sync_modes));
-        conditionalInputInt("External sync delay", &external_sync_delay, (external_sync_mode_index == 1));
-        ImGui::InputInt("Device index", &device_index);
+        ImGui::Combo("External sync mode", &options.external_sync_mode_index, external_sync_modes, IM_ARRAYSIZE(external_sync_modes));
+        conditionalInputInt("External sync delay", &options.external_sync_delay, (options.external_sync_mode_index == 1));
+        ImGui::InputInt("Device index", &options.device_index);
+
+        // Record every device of a synchronized rig at once, one K4ARecorder per device
+        MultiDeviceSession& multi = session.multiDevice;
+        ImGui::Checkbox("Record from several devices at once", &multi.enabled);
+        if (multi.enabled) {
+            ImGui::InputInt("Number of devices", &multi.deviceCount);
+            multi.deviceCount = ImClamp(multi.deviceCount, 1, maxDevices);
+
+            for (int i = 0; i < multi.deviceCount; i++) {
+                ImGui::PushID(i);
+                ImGui::Text(i == 0 ? "Master" : "Subordinate %d", i);
+                ImGui::InputInt("Device index", &multi.deviceIndices[i]);
+                conditionalInputInt("Sync delay (us)", &multi.syncDelays[i], i > 0);
+                ImGui::PopID();
+            }
+        }
         ImGui::Separator();
     }
 
@@ -113,107 +634,145 @@ int getArgs(string& argsStr, string& errorText, string& recorderPathStr) {
     recorderPathStr = recorder_path; // Update recorder path string in main
 
     static char output_filename[128] = "";
-    ImGui::InputText("Output filename (.mkv)", output_filename, IM_ARRAYSIZE(output_filename));
 
-    ImGui::PushStyleColor(ImGuiCol_Button, ImVec4(ImColor::HSV(0.4f, 0.6f, 0.6f)));
-    ImGui::PushStyleColor(ImGuiCol_ButtonHovered, ImVec4(ImColor::HSV(0.4f, 0.7f, 0.7f)));
-    ImGui::PushStyleColor(ImGuiCol_ButtonActive, ImVec4(ImColor::HSV(0.4f, 0.8f, 0.8f)));
+    // Move on to the next numbered filename once a take in the session has recorded a file, which may have been started by a script
+    if (session.takeFinished) {
+        if (session.takeWroteFile) {
+            strcpy_s(output_filename, nextTakeFilename(session.requestedFilename).c_str());
+        }
+        session.takeFinished = false;
+    }
 
-    // Set arguments and attempt to start K4ARecorder when Start is clicked
-    if (ImGui::Button("Start")) {
-        // Reset args text
-        argsStr = "";
+    ImGui::InputText("Output filename (.mkv)", output_filename, IM_ARRAYSIZE(output_filename));
 
-        // Reset error text
+    // Check the output directory can keep up with the selected modes
+    StorageBenchmark& benchmark = session.storageBenchmark;
+    ImGui::SameLine();
+    if (ImGui::Button(benchmark.running ? "Testing...###Test storage" : "Test storage") && !benchmark.running && !sessionBusy(session)) {
         errorText = "";
+        RecorderOptions benchmarkOptions = options;
+        benchmarkOptions.output_filename = output_filename;
+        startStorageBenchmark(benchmark, benchmarkOptions, errorText);
+    }
+    if (!benchmark.running && benchmark.finished) {
+        showStorageBenchmark(benchmark);
+    }
+    ImGui::Checkbox("Keep GUI open between takes", &session.enabled);
+
+    // Record to a fast volume and move each take to the output path once it ends
+    static char scratch_directory[128] = "";
+    static int move_limit = 0;
+    ImGui::Checkbox("Record to a scratch directory first", &session.mover.enabled);
+    if (session.mover.enabled) {
+        ImGui::InputText("Scratch directory", scratch_directory, IM_ARRAYSIZE(scratch_directory));
+        session.mover.scratchDirectory = scratch_directory; // Also used by takes started through the control server
+        ImGui::InputInt("Move bandwidth limit (MB/s, 0 for none)", &move_limit);
+        if (move_limit < 0) {
+            move_limit = 0;
+        }
+        session.mover.limitMBps = move_limit;
+    }
 
-        string output_filename_str = output_filename;
+    ImGui::PushStyleColor(ImGuiCol_Button, ImVec4(ImColor::HSV(0.4f, 0.6f, 0.6f)));
+    ImGui::PushStyleColor(ImGuiCol_ButtonHovered, ImVec4(ImColor::HSV(0.4f, 0.7f, 0.7f)));
+    ImGui::PushStyleColor(ImGuiCol_ButtonActive, ImVec4(ImColor::HSV(0.4f, 0.8f, 0.8f)));
 
-        // Set K4ARecorder command-line arguments
-        argsStr += " --imu";
-        if (imu_recording_mode) {
-            argsStr += " ON";
-        }
-        else {
-            argsStr += " OFF";
+    // Finish the take that is running instead of starting a new one
+    if (sessionBusy(session)) {
+        if (ImGui::Button("Stop")) {
+            stopTake(session);
+            stopMultiDeviceTake(session.multiDevice);
         }
-
-        if (record_for_time) {
-            argsStr += " --record-length " + to_string(recording_time);
+    }
+    // Set arguments and attempt to start K4ARecorder when Start is clicked, which waits for a running storage test
+    else {
+        bool benchmarkRunning = benchmark.running;
+        if (benchmarkRunning) {
+            ImGui::PushItemFlag(ImGuiItemFlags_Disabled, true);
+            ImGui::PushStyleVar(ImGuiStyleVar_Alpha, ImGui::GetStyle().Alpha * 0.5f);
         }
+        if (ImGui::Button("Start")) {
+            // Reset error text
+            errorText = "";
 
-        argsStr += " --depth-delay " + to_string(depth_delay);
-        argsStr += " --color-mode " + string(color_modes[color_mode_index]);
-        argsStr += " --depth-mode " + string(depth_modes[depth_mode_index]);
-        argsStr += " --rate " + string(frame_rates[frame_rate_index]);
+            options.output_filename = output_filename;
 
-        if (manual_exposure) {
-            argsStr += " --exposure-control " + to_string(exposure_value);
+            // K4ARecorder has already started in session mode, otherwise it starts once the GUI has closed
+            if (beginTake(session, options, recorderPathStr, argsStr, errorText) && !session.enabled && !session.multiDevice.enabled) {
+                startRecorder = 1;
+            }
         }
-
-        if (manual_gain) {
-            argsStr += " --gain " + to_string(gain_value);
+        if (benchmarkRunning) {
+            ImGui::PopItemFlag();
+            ImGui::PopStyleVar();
         }
+    }
 
-        argsStr += " --external-sync " + string(external_sync_modes[external_sync_mode_index]);
-        argsStr += " --sync-delay " + to_string(external_sync_delay);
-        argsStr += " --device " + to_string(device_index);
-        argsStr += " " + output_filename_str;
+    ImGui::SameLine();
 
-        // 1 is returned and K4ARecorder starts if there are no errors
-        startRecorder = 1;
+    ImGui::PushStyleColor(ImGuiCol_Button, ImVec4(ImColor::HSV(0.0f, 0.6f, 0.6f)));
+    ImGui::PushStyleColor(ImGuiCol_ButtonHovered, ImVec4(ImColor::HSV(0.0f, 0.7f, 0.7f)));
+    ImGui::PushStyleColor(ImGuiCol_ButtonActive, ImVec4(ImColor::HSV(0.0f, 0.8f, 0.8f)));
 
-        // Check for errors
-        if (record_for_time && recording_time < 0) {
-            errorText += "ERROR: Recording length cannot be negative\n";
-            startRecorder = 0; // K4ARecorder will not start and the GUI will continue running
-        }
+    if (ImGui::Button("Quit")) {
+        startRecorder = -1; // Quit program
+    }
 
-        if (exposure_value < -11 || exposure_value > 200000) {
-            errorText += "ERROR: Exposure value must be between -11 and 200,000\n";
-            startRecorder = 0;
-        }
+    // Show the state of the current session
+    if (session.running) {
+        ImGui::Text("Recording take %d%s", session.takeCount, session.stopRequested ? " (stopping)" : "");
+    }
+    else if (session.takeCount > 0 && session.multiDevice.state == MultiDeviceState::Idle) {
+        ImGui::Text("Take %d finished with exit code %lu", session.takeCount, session.lastExitCode);
+    }
 
-        if (gain_value < 0 || gain_value > 255) {
-            errorText += "ERROR: Gain value must be between 0 and 255\n";
-            startRecorder = 0;
+    // Show where scripts can reach the control server and how quickly it started their last take
+    ControlServer& control = session.control;
+    if (control.running) {
+        string address = control.pipeName + ((control.httpPort > 0) ? " and http://127.0.0.1:" + to_string(control.httpPort) : "");
+        ImGui::Text("Control server on %s, %llu requests", address.c_str(), (unsigned long long) control.requests);
+        if (control.lastStartUs >= 0) {
+            ImGui::Text("Last remote start: %lld us waiting for the GUI, %lld us to dispatch, %lld us until K4ARecorder launched",
+                        (long long) control.lastLockWaitUs, (long long) control.lastDispatchUs, (long long) control.lastStartUs);
         }
+    }
 
-        if (device_index < 0 || device_index > 255) {
-            errorText += "ERROR: Device index must be between 0 and 255\n";
-            startRecorder = 0;
-        }
+    if (session.drops.active || session.drops.framesChecked > 0) {
+        showDropMonitor(session.drops);
+    }
 
-        if (external_sync_delay < 0) {
-            errorText += "ERROR: External sync delay cannot be negative\n";
-            startRecorder = 0;
-        }
+    if (session.multiDevice.state != MultiDeviceState::Idle) {
+        showMultiDeviceStatus(session.multiDevice);
+    }
+    else if (session.takeCount > 0 && ImGui::CollapsingHeader("Recorder output", ImGuiTreeNodeFlags_DefaultOpen)) {
+        showLogPane(session.log);
+    }
 
-        if (fileExists(recorderPathStr) == false) {
-            errorText += "ERROR: Recorder file path \"" + recorderPathStr + "\" not found\n";
-            startRecorder = 0;
-        }
+    if ((session.inspection.running || session.inspection.finished) && ImGui::CollapsingHeader("Last take", ImGuiTreeNodeFlags_DefaultOpen)) {
+        showRecordingInspection(session);
+        showFilmstrip(session.filmstrip);
+        showDepthQuality(session.depthQuality);
+    }
 
-        // Check if there are no non-space characters in the output filename
-        if (output_filename_str.find_first_not_of(' ') == std::string::npos) {
-            errorText += "ERROR: Output filename is empty\n";
-            startRecorder = 0;
-        }
+    if ((session.mover.running || session.mover.queue.empty() == false || session.mover.results.empty() == false) && ImGui::CollapsingHeader("Moves to output path", ImGuiTreeNodeFlags_DefaultOpen)) {
+        showFileMover(session.mover);
+    }
 
-        if (fileExists(output_filename_str)) {
-            errorText += "ERROR: Output file \"" + output_filename_str + "\" already exists\n";
-            startRecorder = 0;
-        }
+    ManifestWriter& manifests = session.manifests;
+    if ((manifests.running || manifests.queue.empty() == false || manifests.results.empty() == false) && ImGui::CollapsingHeader("Checksums")) {
+        showManifestWriter(manifests);
     }
 
-    ImGui::SameLine();
+    if (session.throughput.hasSamples && ImGui::CollapsingHeader("Write throughput", ImGuiTreeNodeFlags_DefaultOpen)) {
+        showThroughputMonitor(session.throughput);
+    }
 
-    ImGui::PushStyleColor(ImGuiCol_Button, ImVec4(ImColor::HSV(0.0f, 0.6f, 0.6f)));
-    ImGui::PushStyleColor(ImGuiCol_ButtonHovered, ImVec4(ImColor::HSV(0.0f, 0.7f, 0.7f)));
-    ImGui::PushStyleColor(ImGuiCol_ButtonActive, ImVec4(ImColor::HSV(0.0f, 0.8f, 0.8f)));
+    if (session.latency.historyLoaded && ImGui::CollapsingHeader("Start latency")) {
+        showStartLatency(session.latency);
+    }
 
-    if (ImGui::Button("Quit")) {
-        startRecorder = -1; // Quit program
+    if (ImGui::CollapsingHeader("Library")) {
+        showLibrary(session.library);
     }
 
     ImGui::PushStyleColor(ImGuiCol_Text, ImVec4(1.0f, 0.3f, 0.0f, 1.0f));
@@ -9,10 +9,36 @@
 
 #include <string>
 
+#include "RecordingSession.h"
+
 #include "imgui_dx11.h"
 #include "imgui_internal.h"
 
 // Enable or disable an integer input based on a passed boolean value
 void conditionalInputInt(const char* label, int* value, bool enabled);
+// Show the state, start skew and output of every device in a multiple device take
+void showMultiDeviceStatus(MultiDeviceSession& multi);
+// Show the stage times of the last take and their percentiles per mode across sessions
+void showStartLatency(StartLatency& latency);
+// Plot the write rate of the output files and show when the target volume will be full
+void showThroughputMonitor(ThroughputMonitor& monitor);
+// Show an alarm and the gaps found if frames have been dropped from the take
+void showDropMonitor(DropMonitor& monitor);
+// Show the progress of the move in progress and the result of each finished one
+void showFileMover(FileMover& mover);
+// Show the progress of the checksum being taken and the manifests written
+void showManifestWriter(ManifestWriter& writer);
+// Show the throughput and write latency measured by the storage benchmark against what recording needs
+void showStorageBenchmark(StorageBenchmark& benchmark);
+// Show the frame counts, gaps and IMU sample rate of every file from the last take, with buttons to repair or compress them
+void showRecordingInspection(RecordingSession& session);
+// Release the textures made for a filmstrip
+void releaseFilmstripTextures(FilmstripJob& job);
+// Show color and depth thumbnails spread over the last take, making their textures once they are ready
+void showFilmstrip(FilmstripJob& job);
+// Plot the invalid pixels and mean depth of every frame of the last take and the histogram of its depths
+void showDepthQuality(DepthQualityJob& job);
+// Search, sort and list the recordings of a directory tree from its index, drawing only the visible rows
+void showLibrary(LibraryScan& scan);
 // Create ImGui widgets and get program arguments from them
-int getArgs(std::string& argsStr, std::string& errorText, std::string& recorderPathStr);
\ No newline at end of file
+int getArgs(std::string& argsStr, std::string& errorText, std::string& recorderPathStr, RecordingSession& session);
\ No newline at end of file
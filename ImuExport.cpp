@@ -0,0 +1,212 @@
+/* Aden Prince
+ * HiMER Lab at U. of Illinois, Chicago
+ * K4ARecorder GUI
+ *
+ * ImuExport.cpp
+ * Contains functions used to extract the IMU samples of a recording.
+ */
+
+#include "ImuExport.h"
+#include "MappedFile.h"
+#include "MatroskaParser.h"
+#include "NumberFormat.h"
+#include "RecordingInspector.h"
+
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <functional>
+#include <vector>
+
+using namespace std;
+
+// Longest CSV line formatSample can write, two 20-digit timestamps, six numbers and the separators
+const size_t maxImuLineBytes = 256;
+// Columns of the binary format and the bytes of each value
+const int imuColumnCount = 8;
+const size_t imuColumnBytes[imuColumnCount] = {8, 4, 4, 4, 8, 4, 4, 4};
+// Where each column's value is in a stored sample, which keeps the fields in the order of the columns
+const uint64_t imuFieldOffsets[imuColumnCount] = {0, 8, 12, 16, 20, 28, 32, 36};
+
+// Read one sample from where K4ARecorder stored it, the fields are packed without padding
+static void readSample(const uint8_t* data, ImuSample& sample) {
+    memcpy(&sample.accTimestampNs, data, 8);
+    memcpy(sample.acc, data + 8, 12);
+    memcpy(&sample.gyroTimestampNs, data + 20, 8);
+    memcpy(sample.gyro, data + 28, 12);
+}
+
+// Call function with the data of every IMU block in file order, reading only block headers of the other tracks
+static void forEachImuBlock(const MatroskaFile& file, uint64_t track, const function<void(const uint8_t*, uint64_t)>& function) {
+    uint64_t offset = 0;
+    ClusterInfo cluster;
+    while (nextCluster(file, offset, cluster)) {
+        uint64_t blockOffset = 0;
+        BlockInfo block;
+        while (nextBlock(file, cluster, blockOffset, block)) {
+            if (block.track == track) {
+                function(file.data + block.dataOffset, block.dataSize);
+            }
+        }
+    }
+}
+
+// Format one sample as a CSV line, returns its length
+static size_t formatSample(const ImuSample& sample, char* line) {
+    char* out = writeUnsigned(line, sample.accTimestampNs);
+    for (int i = 0; i < 3; i++) {
+        *out++ = ',';
+        out = writeFloat(out, sample.acc[i]);
+    }
+    *out++ = ',';
+    out = writeUnsigned(out, sample.gyroTimestampNs);
+    for (int i = 0; i < 3; i++) {
+        *out++ = ',';
+        out = writeFloat(out, sample.gyro[i]);
+    }
+    *out++ = '\n';
+    return out - line;
+}
+
+// Get the filename IMU samples are extracted to by default, e.g. take_imu.csv for take.mkv
+string imuOutputFilename(const string& recording, bool binary) {
+    string stem = recording;
+    if (stem.length() >= 4 && _stricmp(stem.substr(stem.length() - 4).c_str(), ".mkv") == 0) {
+        stem = stem.substr(0, stem.length() - 4);
+    }
+    return stem + (binary ? "_imu.bin" : "_imu.csv");
+}
+
+// Write the samples as CSV lines through one buffer, so no line is allocated
+static bool writeImuCsv(const MatroskaFile& file, uint64_t track, ofstream& output, ImuExportResult& result) {
+    vector<char> buffer(imuWriteBufferBytes);
+    size_t used = 0;
+    const char* header = "acc_timestamp_ns,acc_x,acc_y,acc_z,gyro_timestamp_ns,gyro_x,gyro_y,gyro_z\n";
+    output << header;
+    result.bytesWritten += strlen(header);
+
+    uint64_t oddBlocks = 0;
+    forEachImuBlock(file, track, [&](const uint8_t* data, uint64_t size) {
+        oddBlocks += (size % imuSampleBytes != 0);
+        for (uint64_t sampleOffset = 0; sampleOffset + imuSampleBytes <= size; sampleOffset += imuSampleBytes) {
+            if (used + maxImuLineBytes > buffer.size()) {
+                output.write(buffer.data(), used);
+                result.bytesWritten += used;
+                used = 0;
+            }
+            ImuSample sample;
+            readSample(data + sampleOffset, sample);
+            used += formatSample(sample, buffer.data() + used);
+            result.samples++;
+        }
+    });
+    output.write(buffer.data(), used);
+    result.bytesWritten += used;
+
+    if (oddBlocks > 0) {
+        result.warningText += "WARNING: " + to_string(oddBlocks) + " IMU blocks were not whole samples, the rest of each was skipped\n";
+    }
+    return (bool) output;
+}
+
+// Write the samples as columns, filling a buffer per column and writing each where its column goes in the file
+static bool writeImuColumns(const MatroskaFile& file, uint64_t track, ofstream& output, ImuExportResult& result) {
+    // Count the samples first, from block sizes alone, so every column's place in the file is known
+    uint64_t sampleCount = 0;
+    uint64_t oddBlocks = 0;
+    forEachImuBlock(file, track, [&](const uint8_t*, uint64_t size) {
+        sampleCount += size / imuSampleBytes;
+        oddBlocks += (size % imuSampleBytes != 0);
+    });
+
+    output.write(imuBinaryMagic, 8);
+    output.write((const char*) &sampleCount, 8);
+
+    uint64_t columnOffsets[imuColumnCount];
+    uint64_t columnDone[imuColumnCount] = {};
+    vector<uint8_t> buffers[imuColumnCount];
+    size_t used[imuColumnCount] = {};
+    uint64_t offset = 16;
+    for (int c = 0; c < imuColumnCount; c++) {
+        columnOffsets[c] = offset;
+        offset += sampleCount * imuColumnBytes[c];
+        buffers[c].resize(imuWriteBufferBytes / imuColumnCount);
+    }
+
+    auto flushColumn = [&](int c) {
+        output.seekp(columnOffsets[c] + columnDone[c]);
+        output.write((const char*) buffers[c].data(), used[c]);
+        columnDone[c] += used[c];
+        used[c] = 0;
+    };
+
+    forEachImuBlock(file, track, [&](const uint8_t* data, uint64_t size) {
+        for (uint64_t sampleOffset = 0; sampleOffset + imuSampleBytes <= size; sampleOffset += imuSampleBytes) {
+            for (int c = 0; c < imuColumnCount; c++) {
+                if (used[c] + imuColumnBytes[c] > buffers[c].size()) {
+                    flushColumn(c);
+                }
+                memcpy(buffers[c].data() + used[c], data + sampleOffset + imuFieldOffsets[c], imuColumnBytes[c]);
+                used[c] += imuColumnBytes[c];
+            }
+            result.samples++;
+        }
+    });
+    for (int c = 0; c < imuColumnCount; c++) {
+        flushColumn(c);
+    }
+    result.bytesWritten = offset;
+
+    if (oddBlocks > 0) {
+        result.warningText += "WARNING: " + to_string(oddBlocks) + " IMU blocks were not whole samples, the rest of each was skipped\n";
+    }
+    return (bool) output;
+}
+
+// Write every IMU sample of a recording to output as CSV, or as columns if binary is set
+bool exportImu(const string& recording, const string& output, bool binary, ImuExportResult& result, string& errorText) {
+    result = ImuExportResult();
+    auto start = chrono::steady_clock::now();
+
+    MappedFile mapped;
+    if (!openMappedFile(recording, mapped, errorText)) {
+        return false;
+    }
+
+    MatroskaFile file;
+    if (!parseMatroskaHeaders(mapped.data, mapped.length, file, errorText)) {
+        closeMappedFile(mapped);
+        return false;
+    }
+    const TrackInfo* imu = findTrack(file, "IMU");
+    if (imu == nullptr) {
+        errorText += "ERROR: Recording has no IMU track, it was recorded without IMU data\n";
+        closeMappedFile(mapped);
+        return false;
+    }
+
+    ofstream outputFile(output, ios::binary | ios::trunc);
+    if (!outputFile) {
+        errorText += "ERROR: Could not create \"" + output + "\"\n";
+        closeMappedFile(mapped);
+        return false;
+    }
+
+    bool succeeded = binary ? writeImuColumns(file, imu->number, outputFile, result) : writeImuCsv(file, imu->number, outputFile, result);
+    if (!succeeded) {
+        errorText += "ERROR: Writing \"" + output + "\" failed\n";
+    }
+
+    closeMappedFile(mapped);
+    result.seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    return succeeded;
+}
+
+// Format what an extraction did as lines of text for the console
+string formatImuExportResult(const ImuExportResult& result) {
+    char line[256];
+    snprintf(line, sizeof(line), "Extracted %llu IMU samples in %.2f s (%.1f MB at %.0f MB/s)\n", (unsigned long long) result.samples, result.seconds,
+             result.bytesWritten / 1e6, (result.seconds > 0) ? result.bytesWritten / 1e6 / result.seconds : 0);
+    return line + result.warningText;
+}
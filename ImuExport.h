@@ -0,0 +1,42 @@
+/* Aden Prince
+ * HiMER Lab at U. of Illinois, Chicago
+ * K4ARecorder GUI
+ *
+ * ImuExport.h
+ * Contains functions used to extract the accelerometer and gyroscope
+ * samples of a recording's IMU track to CSV or a columnar binary file.
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+// Formatted samples are collected in buffers of this size before each write
+const size_t imuWriteBufferBytes = 1024 * 1024;
+// Start of a columnar binary file, followed by the sample count and then each column in turn
+const char imuBinaryMagic[9] = "K4AIMU01";
+
+// One accelerometer and gyroscope sample, stored by K4ARecorder as each timestamp followed by its three readings
+struct ImuSample {
+    uint64_t accTimestampNs = 0;
+    float acc[3] = {}; // m/s^2
+    uint64_t gyroTimestampNs = 0;
+    float gyro[3] = {}; // rad/s
+};
+
+// What an extraction did, for display
+struct ImuExportResult {
+    uint64_t samples = 0;
+    uint64_t bytesWritten = 0;
+    double seconds = 0;
+    std::string warningText;
+};
+
+// Get the filename IMU samples are extracted to by default, e.g. take_imu.csv for take.mkv
+std::string imuOutputFilename(const std::string& recording, bool binary);
+// Write every IMU sample of a recording to output as CSV, or as columns if binary is set
+bool exportImu(const std::string& recording, const std::string& output, bool binary, ImuExportResult& result, std::string& errorText);
+// Format what an extraction did as lines of text for the console
+std::string formatImuExportResult(const ImuExportResult& result);
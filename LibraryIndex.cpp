@@ -0,0 +1,432 @@
+/* Aden Prince
+ * HiMER Lab at U. of Illinois, Chicago
+ * K4ARecorder GUI
+ *
+ * LibraryIndex.cpp
+ * Contains functions used to scan, save, filter and sort the recordings of
+ * a library.
+ */
+
+#include "LibraryIndex.h"
+#include "Manifest.h"
+#include "MappedFile.h"
+#include "MatroskaParser.h"
+#include "Parallel.h"
+
+#include <algorithm>
+#include <cctype>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+#include <unordered_map>
+
+#include <Windows.h>
+
+using namespace std;
+
+// Get the index filename of a library, in its root directory
+string libraryIndexFilename(const string& root) {
+    string directory = root;
+    if (directory.empty() == false && directory.back() != '\\' && directory.back() != '/') {
+        directory += "\\";
+    }
+    return directory + libraryIndexName;
+}
+
+// Get a copy of text with every letter lowercase
+static string lowercase(const string& text) {
+    string lower = text;
+    transform(lower.begin(), lower.end(), lower.begin(), [](unsigned char c) { return (char) tolower(c); });
+    return lower;
+}
+
+// Join the fields a filter searches into one lowercase string
+static void makeSearchText(LibraryEntry& entry) {
+    entry.searchText = lowercase(entry.path + "\n" + entry.colorMode + "\n" + entry.depthMode + "\n" + entry.imuMode + "\n" + entry.serialNumber + "\n" + entry.args);
+}
+
+// Write a string as its length and bytes
+static void writeString(ofstream& output, const string& text) {
+    uint32_t length = (uint32_t) text.length();
+    output.write((const char*) &length, 4);
+    output.write(text.data(), length);
+}
+
+// Read a string written by writeString, returns false if it runs past the end or is implausibly long
+static bool readString(ifstream& input, string& text) {
+    uint32_t length = 0;
+    input.read((char*) &length, 4);
+    if (!input || length > 1024 * 1024) {
+        return false;
+    }
+    text.resize(length);
+    input.read(&text[0], length);
+    return (bool) input;
+}
+
+// Read a library's saved index, returns false if it is missing or damaged
+static bool loadLibraryIndex(const string& filename, vector<LibraryEntry>& entries) {
+    ifstream input(filename, ios::binary);
+    char magic[8];
+    uint64_t count = 0;
+    input.read(magic, 8);
+    input.read((char*) &count, 8);
+    if (!input || memcmp(magic, libraryIndexMagic, 8) != 0 || count > 100000000) {
+        return false;
+    }
+
+    entries.resize((size_t) count);
+    for (LibraryEntry& entry : entries) {
+        uint8_t readable = 0;
+        bool valid = readString(input, entry.path);
+        input.read((char*) &entry.size, 8);
+        input.read((char*) &entry.writeTime, 8);
+        input.read((char*) &entry.manifestWriteTime, 8);
+        input.read((char*) &entry.durationSeconds, 8);
+        input.read((char*) &readable, 1);
+        valid = valid && readString(input, entry.colorMode) && readString(input, entry.depthMode) && readString(input, entry.imuMode) &&
+                readString(input, entry.serialNumber) && readString(input, entry.args);
+        if (!valid) {
+            entries.clear();
+            return false;
+        }
+        entry.readable = readable != 0;
+    }
+    return true;
+}
+
+// Save a library's index in its root, a failure only means every recording is parsed again next time
+static void saveLibraryIndex(const string& filename, const vector<LibraryEntry>& entries) {
+    // Write next to the index and replace it at the end, so a crash or full disk leaves the old index whole
+    string partialFilename = filename + ".partial";
+    ofstream output(partialFilename, ios::binary | ios::trunc);
+    uint64_t count = entries.size();
+    output.write(libraryIndexMagic, 8);
+    output.write((const char*) &count, 8);
+    for (const LibraryEntry& entry : entries) {
+        uint8_t readable = entry.readable ? 1 : 0;
+        writeString(output, entry.path);
+        output.write((const char*) &entry.size, 8);
+        output.write((const char*) &entry.writeTime, 8);
+        output.write((const char*) &entry.manifestWriteTime, 8);
+        output.write((const char*) &entry.durationSeconds, 8);
+        output.write((const char*) &readable, 1);
+        writeString(output, entry.colorMode);
+        writeString(output, entry.depthMode);
+        writeString(output, entry.imuMode);
+        writeString(output, entry.serialNumber);
+        writeString(output, entry.args);
+    }
+    output.close();
+    if (!output || !MoveFileExA(partialFilename.c_str(), filename.c_str(), MOVEFILE_REPLACE_EXISTING)) {
+        remove(partialFilename.c_str());
+    }
+}
+
+// Get a FILETIME as one number
+static uint64_t fileTimeValue(const FILETIME& time) {
+    return ((uint64_t) time.dwHighDateTime << 32) | time.dwLowDateTime;
+}
+
+// List every recording under a directory with its size and write times, without opening any file
+static void walkLibrary(const string& root, const string& relative, vector<LibraryEntry>& found, LibraryScan& scan) {
+    vector<string> directories;
+    vector<LibraryEntry> recordings;
+    unordered_map<string, uint64_t> manifests;
+
+    WIN32_FIND_DATAA findData;
+    HANDLE findHandle = FindFirstFileA((root + "\\" + relative + "*").c_str(), &findData);
+    if (findHandle == INVALID_HANDLE_VALUE) {
+        return;
+    }
+    do {
+        string name = findData.cFileName;
+        string lower = lowercase(name);
+        if (findData.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) {
+            // Links are not followed, so a link back up the tree cannot make the walk endless
+            if (name != "." && name != ".." && !(findData.dwFileAttributes & FILE_ATTRIBUTE_REPARSE_POINT)) {
+                directories.push_back(name);
+            }
+        }
+        else if (lower.length() > 4 && lower.compare(lower.length() - 4, 4, ".mkv") == 0) {
+            LibraryEntry entry;
+            entry.path = relative + name;
+            entry.size = ((uint64_t) findData.nFileSizeHigh << 32) | findData.nFileSizeLow;
+            entry.writeTime = fileTimeValue(findData.ftLastWriteTime);
+            recordings.push_back(entry);
+        }
+        else if (lower.length() > 13 && lower.compare(lower.length() - 13, 13, ".mkv.manifest") == 0) {
+            manifests[lower.substr(0, lower.length() - 9)] = fileTimeValue(findData.ftLastWriteTime);
+        }
+    } while (!scan.cancel && FindNextFileA(findHandle, &findData));
+    FindClose(findHandle);
+
+    // A manifest written after the recording changes what is known about it, so its time is part of the key
+    for (LibraryEntry& entry : recordings) {
+        auto manifest = manifests.find(lowercase(entry.path.substr(relative.length())));
+        if (manifest != manifests.end()) {
+            entry.manifestWriteTime = manifest->second;
+        }
+        found.push_back(entry);
+    }
+    scan.filesFound += recordings.size();
+
+    for (const string& directory : directories) {
+        if (scan.cancel) {
+            return;
+        }
+        walkLibrary(root, relative + directory + "\\", found, scan);
+    }
+}
+
+// Get the length of a recording from its Info, or from its first and last blocks if K4ARecorder did not finish it
+static double recordingDuration(const MatroskaFile& file) {
+    if (file.duration >= 0) {
+        return file.duration * file.timestampScale / 1e9;
+    }
+
+    int64_t first = -1;
+    int64_t last = -1;
+    uint64_t offset = 0;
+    ClusterInfo cluster;
+    if (nextCluster(file, offset, cluster)) {
+        uint64_t blockOffset = 0;
+        BlockInfo block;
+        if (nextBlock(file, cluster, blockOffset, block)) {
+            first = block.timestampNs;
+        }
+    }
+
+    // The cues lead to the last cluster, without them every cluster header is read
+    offset = findClusterAt(file, INT64_MAX);
+    while (nextCluster(file, offset, cluster)) {
+        uint64_t blockOffset = 0;
+        BlockInfo block;
+        while (nextBlock(file, cluster, blockOffset, block)) {
+            last = max(last, block.timestampNs);
+        }
+        offset = cluster.end;
+        if (!cluster.complete) {
+            break;
+        }
+    }
+    return (first >= 0 && last >= first) ? (last - first) / 1e9 : 0;
+}
+
+// Read the modes, length and serial number of a recording, and the arguments in its manifest
+static void parseLibraryEntry(const string& root, LibraryEntry& entry) {
+    string filename = root + "\\" + entry.path;
+    MappedFile mapped;
+    MatroskaFile file;
+    string errorText;
+    entry.readable = openMappedFile(filename, mapped, errorText) && parseMatroskaHeaders(mapped.data, mapped.length, file, errorText);
+    if (entry.readable) {
+        entry.colorMode = findTag(file, "K4A_COLOR_MODE");
+        entry.depthMode = findTag(file, "K4A_DEPTH_MODE");
+        entry.imuMode = findTag(file, "K4A_IMU_MODE");
+        entry.serialNumber = findTag(file, "K4A_DEVICE_SERIAL_NUMBER");
+        entry.durationSeconds = recordingDuration(file);
+    }
+    closeMappedFile(mapped);
+
+    Manifest manifest;
+    if (entry.manifestWriteTime != 0 && readManifest(manifestFilename(filename), manifest, errorText)) {
+        entry.args = manifest.args;
+    }
+}
+
+// Walk a directory tree and update its saved index into scanned, parsing only new and changed recordings
+bool scanLibrary(LibraryScan& scan) {
+    auto start = chrono::steady_clock::now();
+    string root = scan.root;
+    while (root.length() > 1 && (root.back() == '\\' || root.back() == '/')) {
+        root.pop_back();
+    }
+    DWORD attributes = GetFileAttributesA(root.c_str());
+    if (attributes == INVALID_FILE_ATTRIBUTES || !(attributes & FILE_ATTRIBUTE_DIRECTORY)) {
+        scan.errorText += "ERROR: \"" + root + "\" is not a directory\n";
+        return false;
+    }
+
+    vector<LibraryEntry> saved;
+    string indexFilename = libraryIndexFilename(root);
+    loadLibraryIndex(indexFilename, saved);
+    unordered_map<string, size_t> savedByPath;
+    for (size_t i = 0; i < saved.size(); i++) {
+        savedByPath[saved[i].path] = i;
+    }
+
+    vector<LibraryEntry>& entries = scan.scanned;
+    walkLibrary(root, "", entries, scan);
+    if (scan.cancel) {
+        return false;
+    }
+
+    // Only recordings whose size or write times changed are opened
+    vector<size_t> toParse;
+    for (size_t i = 0; i < entries.size(); i++) {
+        auto match = savedByPath.find(entries[i].path);
+        if (match != savedByPath.end()) {
+            const LibraryEntry& previous = saved[match->second];
+            if (previous.size == entries[i].size && previous.writeTime == entries[i].writeTime && previous.manifestWriteTime == entries[i].manifestWriteTime) {
+                entries[i] = previous;
+                scan.reused++;
+                continue;
+            }
+        }
+        toParse.push_back(i);
+    }
+    scan.filesToParse = toParse.size();
+
+    int chunks = (int) ((toParse.size() + libraryParseChunk - 1) / libraryParseChunk);
+    parallelFor(chunks, [&](int chunk) {
+        size_t end = min(toParse.size(), (size_t) (chunk + 1) * libraryParseChunk);
+        for (size_t i = (size_t) chunk * libraryParseChunk; i < end && !scan.cancel; i++) {
+            parseLibraryEntry(root, entries[toParse[i]]);
+            scan.filesParsed++;
+        }
+    });
+    if (scan.cancel) {
+        return false;
+    }
+
+    sort(entries.begin(), entries.end(), [](const LibraryEntry& a, const LibraryEntry& b) { return a.path < b.path; });
+    for (LibraryEntry& entry : entries) {
+        makeSearchText(entry);
+    }
+    if (toParse.empty() == false || entries.size() != saved.size()) {
+        saveLibraryIndex(indexFilename, entries);
+    }
+    scan.seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    return true;
+}
+
+// Compare two entries by a column other than the path
+static bool libraryLess(const LibraryEntry& a, const LibraryEntry& b, LibrarySort sort) {
+    switch (sort) {
+    case SortModified:
+        return a.writeTime < b.writeTime;
+    case SortDuration:
+        return a.durationSeconds < b.durationSeconds;
+    case SortSize:
+        return a.size < b.size;
+    case SortDepthMode:
+        return a.depthMode < b.depthMode;
+    case SortColorMode:
+        return a.colorMode < b.colorMode;
+    case SortSerial:
+        return a.serialNumber < b.serialNumber;
+    default:
+        return false;
+    }
+}
+
+// Find the entries matching every word of filter, modified within maxAgeDays if it is above 0, sorted by a column
+void filterLibrary(const vector<LibraryEntry>& entries, const string& filter, int maxAgeDays, LibrarySort sort, bool descending, vector<uint32_t>& matches) {
+    vector<string> words;
+    istringstream stream(lowercase(filter));
+    string word;
+    while (stream >> word) {
+        words.push_back(word);
+    }
+
+    uint64_t oldest = 0;
+    if (maxAgeDays > 0) {
+        FILETIME now;
+        GetSystemTimeAsFileTime(&now);
+        oldest = fileTimeValue(now) - min(fileTimeValue(now), maxAgeDays * fileTimeTicksPerDay);
+    }
+
+    matches.clear();
+    for (uint32_t i = 0; i < (uint32_t) entries.size(); i++) {
+        const LibraryEntry& entry = entries[i];
+        bool match = entry.writeTime >= oldest;
+        for (size_t w = 0; match && w < words.size(); w++) {
+            match = entry.searchText.find(words[w]) != string::npos;
+        }
+        if (match) {
+            matches.push_back(i);
+        }
+    }
+
+    // Entries are in path order, so a stable sort leaves equal entries in path order without comparing paths, in either direction
+    if (sort == SortPath) {
+        if (descending) {
+            reverse(matches.begin(), matches.end());
+        }
+    }
+    else if (descending) {
+        stable_sort(matches.begin(), matches.end(), [&](uint32_t a, uint32_t b) { return libraryLess(entries[b], entries[a], sort); });
+    }
+    else {
+        stable_sort(matches.begin(), matches.end(), [&](uint32_t a, uint32_t b) { return libraryLess(entries[a], entries[b], sort); });
+    }
+}
+
+// Format the modification time of an entry as local time, e.g. 2024-05-14 16:03
+string formatLibraryTime(uint64_t writeTime) {
+    FILETIME utc;
+    FILETIME local;
+    SYSTEMTIME time;
+    utc.dwLowDateTime = (DWORD) writeTime;
+    utc.dwHighDateTime = (DWORD) (writeTime >> 32);
+    if (!FileTimeToLocalFileTime(&utc, &local) || !FileTimeToSystemTime(&local, &time)) {
+        return "";
+    }
+    char text[32];
+    snprintf(text, sizeof(text), "%04u-%02u-%02u %02u:%02u", time.wYear, time.wMonth, time.wDay, time.wHour, time.wMinute);
+    return text;
+}
+
+// Scan the library on the worker thread
+static void runLibraryScan(LibraryScan* scan) {
+    scan->succeeded = scanLibrary(*scan);
+    scan->finished = true;
+}
+
+// Start scanning a library on a worker thread, cancelling a scan already running
+bool startLibraryScan(LibraryScan& scan, const string& root) {
+    endLibraryScan(scan);
+
+    scan.root = root;
+    scan.succeeded = false;
+    scan.scanned.clear();
+    scan.reused = 0;
+    scan.seconds = 0;
+    scan.errorText = "";
+    scan.filesFound = 0;
+    scan.filesParsed = 0;
+    scan.filesToParse = 0;
+
+    scan.cancel = false;
+    scan.running = true;
+    scan.finished = false;
+    scan.workerThread = thread(runLibraryScan, &scan);
+    return true;
+}
+
+// Check if the scan is done, joining the worker once it is, never blocks
+bool pollLibraryScan(LibraryScan& scan) {
+    if (!scan.running || !scan.finished) {
+        return false;
+    }
+    scan.workerThread.join();
+    scan.running = false;
+    if (scan.succeeded) {
+        scan.entries.swap(scan.scanned);
+        scan.scanned.clear();
+        scan.generation++;
+    }
+    return true;
+}
+
+// Cancel the scan and wait for the worker
+void endLibraryScan(LibraryScan& scan) {
+    scan.cancel = true;
+    if (scan.workerThread.joinable()) {
+        scan.workerThread.join();
+    }
+    scan.running = false;
+}
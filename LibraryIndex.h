@@ -0,0 +1,101 @@
+/* Aden Prince
+ * HiMER Lab at U. of Illinois, Chicago
+ * K4ARecorder GUI
+ *
+ * LibraryIndex.h
+ * Contains the state and functions used to index every recording in a
+ * directory tree. The index is saved in the root of the tree, and a
+ * rescan only parses recordings that are new or whose size or
+ * modification time changed.
+ */
+
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Name of the index file kept in the root of a library
+const char libraryIndexName[] = "k4alibrary.idx";
+// Start of an index file, followed by the number of entries
+const char libraryIndexMagic[9] = "K4ALIB01";
+// Recordings parsed by one task during a scan
+const int libraryParseChunk = 16;
+// File times count 100 ns intervals
+const uint64_t fileTimeTicksPerDay = 864000000000ULL;
+
+// What is known about one recording
+struct LibraryEntry {
+    std::string path; // Relative to the library root
+    uint64_t size = 0;
+    uint64_t writeTime = 0;         // FILETIME of the last write
+    uint64_t manifestWriteTime = 0; // 0 if the recording has no manifest
+    double durationSeconds = 0;
+    std::string colorMode;
+    std::string depthMode;
+    std::string imuMode;
+    std::string serialNumber;
+    std::string args; // From the manifest, if there is one
+    bool readable = false; // False if the file could not be parsed, it is not parsed again until it changes
+
+    // Lowercase text searched by filters, made when the entry is loaded or parsed and not saved
+    std::string searchText;
+};
+
+// Columns entries can be sorted by
+enum LibrarySort {
+    SortPath,
+    SortModified,
+    SortDuration,
+    SortSize,
+    SortDepthMode,
+    SortColorMode,
+    SortSerial,
+    librarySortCount
+};
+
+// Scans a library on a worker thread
+struct LibraryScan {
+    std::thread workerThread;
+    std::atomic<bool> running{false};
+    std::atomic<bool> finished{false};
+    std::atomic<bool> cancel{false};
+
+    // Set before the worker starts
+    std::string root;
+
+    // Progress
+    std::atomic<uint64_t> filesFound{0};
+    std::atomic<uint64_t> filesParsed{0};
+    std::atomic<uint64_t> filesToParse{0};
+
+    // Set by the worker, read once finished is true
+    bool succeeded = false;
+    std::vector<LibraryEntry> scanned; // In path order
+    uint64_t reused = 0;               // Entries taken from the saved index unchanged
+    double seconds = 0;
+    std::string errorText;
+
+    // Entries of the last scan that succeeded, replaced by pollLibraryScan so they can be shown during a rescan
+    std::vector<LibraryEntry> entries;
+    uint64_t generation = 0; // Counts the times entries was replaced, so the GUI knows when to filter again
+};
+
+// Get the index filename of a library, in its root directory
+std::string libraryIndexFilename(const std::string& root);
+// Walk a directory tree and update its saved index into scanned, parsing only new and changed recordings
+bool scanLibrary(LibraryScan& scan);
+// Find the entries matching every word of filter, modified within maxAgeDays if it is above 0, sorted by a column
+void filterLibrary(const std::vector<LibraryEntry>& entries, const std::string& filter, int maxAgeDays, LibrarySort sort, bool descending,
+                   std::vector<uint32_t>& matches);
+// Format the modification time of an entry as local time, e.g. 2024-05-14 16:03
+std::string formatLibraryTime(uint64_t writeTime);
+
+// Start scanning a library on a worker thread, cancelling a scan already running
+bool startLibraryScan(LibraryScan& scan, const std::string& root);
+// Check if the scan is done, joining the worker once it is, never blocks
+bool pollLibraryScan(LibraryScan& scan);
+// Cancel the scan and wait for the worker
+void endLibraryScan(LibraryScan& scan);
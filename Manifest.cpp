@@ -0,0 +1,243 @@
+/* Aden Prince
+ * HiMER Lab at U. of Illinois, Chicago
+ * K4ARecorder GUI
+ *
+ * Manifest.cpp
+ * Contains functions used to checksum recordings and to write and read
+ * their manifests.
+ */
+
+#include "Manifest.h"
+#include "Checksum.h"
+#include "Parallel.h"
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+
+#include <Windows.h>
+
+using namespace std;
+
+// Hash one leaf of a file with its own handle, so leaves can be read at the same time
+static bool hashLeaf(const string& filename, uint64_t offset, uint64_t length, uint64_t& leafHash, atomic<uint64_t>* bytesDone,
+                     const atomic<bool>* cancel) {
+    // Reads past the file cache are aligned, which leaf offsets and the read size are
+    HANDLE file = CreateFileA(filename.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_FLAG_NO_BUFFERING, NULL);
+    if (file == INVALID_HANDLE_VALUE) {
+        return false;
+    }
+    uint8_t* buffer = (uint8_t*) VirtualAlloc(NULL, checksumReadBytes, MEM_COMMIT | MEM_RESERVE, PAGE_READWRITE);
+
+    Xxh64State state;
+    xxh64Reset(state);
+    bool succeeded = buffer != nullptr;
+    uint64_t done = 0;
+
+    while (succeeded && done < length && (cancel == nullptr || !*cancel)) {
+        OVERLAPPED overlapped = {};
+        overlapped.Offset = (DWORD) (offset + done);
+        overlapped.OffsetHigh = (DWORD) ((offset + done) >> 32);
+
+        // The last read of the file asks for whole sectors and gets back what is left
+        DWORD bytesRead = 0;
+        if (!ReadFile(file, buffer, checksumReadBytes, &bytesRead, &overlapped) || bytesRead == 0) {
+            succeeded = false;
+            break;
+        }
+        DWORD used = (length - done < bytesRead) ? (DWORD) (length - done) : bytesRead;
+        xxh64Update(state, buffer, used);
+        done += used;
+        if (bytesDone != nullptr) {
+            *bytesDone += used;
+        }
+    }
+
+    if (buffer != nullptr) {
+        VirtualFree(buffer, 0, MEM_RELEASE);
+    }
+    CloseHandle(file);
+    leafHash = xxh64Digest(state);
+    return succeeded && done == length;
+}
+
+// Get the manifest filename of a recording, e.g. take.mkv.manifest
+string manifestFilename(const string& recording) {
+    return recording + ".manifest";
+}
+
+// Get the tree checksum of a file, hashing its leaves in parallel, adding to bytesDone as it reads if passed
+bool checksumFile(const string& filename, uint64_t& size, uint64_t& checksum, atomic<uint64_t>* bytesDone, const atomic<bool>* cancel,
+                  string& errorText) {
+    WIN32_FILE_ATTRIBUTE_DATA attributes;
+    if (!GetFileAttributesExA(filename.c_str(), GetFileExInfoStandard, &attributes)) {
+        errorText += "ERROR: Could not open \"" + filename + "\"\n";
+        return false;
+    }
+    size = ((uint64_t) attributes.nFileSizeHigh << 32) | attributes.nFileSizeLow;
+
+    // Every leaf is read on its own core, so checking a large file is limited by the disk
+    int leafCount = (size == 0) ? 1 : (int) ((size + treeLeafBytes - 1) / treeLeafBytes);
+    vector<uint64_t> leaves(leafCount);
+    atomic<bool> failed{false};
+    parallelFor(leafCount, [&](int i) {
+        uint64_t offset = i * treeLeafBytes;
+        uint64_t length = (size - offset < treeLeafBytes) ? size - offset : treeLeafBytes;
+        if (!failed && !hashLeaf(filename, offset, length, leaves[i], bytesDone, cancel)) {
+            failed = true;
+        }
+    });
+
+    if (cancel != nullptr && *cancel) {
+        errorText += "Checksum of \"" + filename + "\" cancelled\n";
+        return false;
+    }
+    if (failed) {
+        errorText += "ERROR: Reading \"" + filename + "\" failed\n";
+        return false;
+    }
+    checksum = combineTreeHash(leaves, size);
+    return true;
+}
+
+// Write the manifest next to its recording
+bool writeManifest(const string& recording, const Manifest& manifest, string& errorText) {
+    ofstream manifestFile(manifestFilename(recording), ios::trunc);
+    if (!manifestFile) {
+        errorText += "ERROR: Could not write \"" + manifestFilename(recording) + "\"\n";
+        return false;
+    }
+
+    char checksum[17];
+    snprintf(checksum, sizeof(checksum), "%016llx", (unsigned long long) manifest.checksum);
+    manifestFile << "# K4ARecorder GUI recording manifest" << endl;
+    manifestFile << "file=" << manifest.filename << endl;
+    manifestFile << "size=" << manifest.size << endl;
+    manifestFile << "checksum=xxh64-tree-64MiB:" << checksum << endl;
+    manifestFile << "args=" << manifest.args << endl;
+    return (bool) manifestFile;
+}
+
+// Read a manifest file
+bool readManifest(const string& filename, Manifest& manifest, string& errorText) {
+    ifstream manifestFile(filename);
+    if (!manifestFile) {
+        errorText += "ERROR: Could not open \"" + filename + "\"\n";
+        return false;
+    }
+
+    manifest = Manifest();
+    bool hasChecksum = false;
+    string line;
+    while (getline(manifestFile, line)) {
+        size_t equals = line.find('=');
+        if (line.empty() || line[0] == '#' || equals == string::npos) {
+            continue;
+        }
+        string key = line.substr(0, equals);
+        string value = line.substr(equals + 1);
+
+        if (key == "file") {
+            manifest.filename = value;
+        }
+        else if (key == "size") {
+            manifest.size = strtoull(value.c_str(), nullptr, 10);
+        }
+        else if (key == "checksum" && value.rfind("xxh64-tree-64MiB:", 0) == 0) {
+            manifest.checksum = strtoull(value.c_str() + value.find(':') + 1, nullptr, 16);
+            hasChecksum = true;
+        }
+        else if (key == "args") {
+            manifest.args = value;
+        }
+    }
+
+    if (!hasChecksum) {
+        errorText += "ERROR: \"" + filename + "\" has no checksum this version can check\n";
+        return false;
+    }
+    return true;
+}
+
+// Checksum a recording and write its manifest
+bool writeRecordingManifest(const string& recording, const string& args, Manifest& manifest, atomic<uint64_t>* bytesDone,
+                            const atomic<bool>* cancel, string& errorText) {
+    size_t slash = recording.find_last_of("\\/");
+    manifest.filename = (slash == string::npos) ? recording : recording.substr(slash + 1);
+    manifest.args = args;
+    return checksumFile(recording, manifest.size, manifest.checksum, bytesDone, cancel, errorText) && writeManifest(recording, manifest, errorText);
+}
+
+// Checksum one recording and write its manifest, recording the result for the GUI
+static void runManifest(ManifestWriter* writer) {
+    ManifestResult& result = writer->result;
+    result = ManifestResult();
+    result.job = writer->current;
+    auto start = chrono::steady_clock::now();
+
+    writer->bytesDone = 0;
+    writer->totalBytes = 0;
+    WIN32_FILE_ATTRIBUTE_DATA attributes;
+    if (GetFileAttributesExA(result.job.recording.c_str(), GetFileExInfoStandard, &attributes)) {
+        writer->totalBytes = ((uint64_t) attributes.nFileSizeHigh << 32) | attributes.nFileSizeLow;
+    }
+
+    result.succeeded = writeRecordingManifest(result.job.recording, result.job.args, result.manifest, &writer->bytesDone, &writer->cancel, result.errorText);
+    result.seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    writer->finished = true;
+}
+
+// Queue a manifest to be written in the background
+void queueManifest(ManifestWriter& writer, const string& recording, const string& args) {
+    ManifestJob job;
+    job.recording = recording;
+    job.args = args;
+    writer.queue.push_back(job);
+}
+
+// Collect a written manifest and start the next one, never blocks
+bool pollManifestWriter(ManifestWriter& writer) {
+    bool collected = false;
+    if (writer.running && writer.finished) {
+        writer.workerThread.join();
+        writer.running = false;
+
+        if ((int) writer.results.size() == maxShownManifests) {
+            writer.results.erase(writer.results.begin());
+        }
+        writer.results.push_back(writer.result);
+        collected = true;
+    }
+
+    if (!writer.running && writer.queue.empty() == false) {
+        writer.current = writer.queue.front();
+        writer.queue.pop_front();
+        writer.cancel = false;
+        writer.running = true;
+        writer.finished = false;
+        writer.workerThread = thread(runManifest, &writer);
+    }
+    return collected;
+}
+
+// Cancel the manifest being written and wait for it, listing recordings left without one
+void endManifestWriter(ManifestWriter& writer) {
+    writer.cancel = true;
+    if (writer.workerThread.joinable()) {
+        writer.workerThread.join();
+    }
+    writer.running = false;
+
+    bool currentUnfinished = writer.finished && !writer.result.succeeded;
+    if (writer.queue.empty() == false || currentUnfinished) {
+        cout << "Recordings left without a manifest, write them with --manifest:" << endl;
+        if (currentUnfinished) {
+            cout << "  " << writer.current.recording << endl;
+        }
+        for (const ManifestJob& job : writer.queue) {
+            cout << "  " << job.recording << endl;
+        }
+    }
+}
@@ -0,0 +1,83 @@
+/* Aden Prince
+ * HiMER Lab at U. of Illinois, Chicago
+ * K4ARecorder GUI
+ *
+ * Manifest.h
+ * Contains functions used to checksum recordings on every core and to
+ * write and check the sidecar manifest kept next to each recording, which
+ * holds its size, tree checksum and the K4ARecorder arguments used.
+ */
+
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <deque>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Size of each unbuffered read while checksumming
+const uint32_t checksumReadBytes = 8 * 1024 * 1024;
+// Results kept for display, oldest first
+const int maxShownManifests = 8;
+
+// Contents of a recording's manifest
+struct Manifest {
+    std::string filename; // Name of the recording without its directory
+    uint64_t size = 0;
+    uint64_t checksum = 0; // Tree checksum, see Checksum.h
+    std::string args;      // K4ARecorder arguments the recording was made with
+};
+
+// A recording to write a manifest for
+struct ManifestJob {
+    std::string recording;
+    std::string args;
+};
+
+struct ManifestResult {
+    ManifestJob job;
+    bool succeeded = false;
+    Manifest manifest;
+    double seconds = 0;
+    std::string errorText;
+};
+
+// Manifests waiting to be written and the worker writing one of them
+struct ManifestWriter {
+    std::deque<ManifestJob> queue;
+
+    // Worker checksumming one recording, started by pollManifestWriter
+    std::thread workerThread;
+    std::atomic<bool> running{false};
+    std::atomic<bool> finished{false};
+    std::atomic<bool> cancel{false};
+    ManifestJob current;
+    std::atomic<uint64_t> bytesDone{0};
+    std::atomic<uint64_t> totalBytes{0};
+    ManifestResult result;
+
+    // Finished manifests, filled by pollManifestWriter
+    std::vector<ManifestResult> results;
+};
+
+// Get the manifest filename of a recording, e.g. take.mkv.manifest
+std::string manifestFilename(const std::string& recording);
+// Get the tree checksum of a file, hashing its leaves in parallel, adding to bytesDone as it reads if passed
+bool checksumFile(const std::string& filename, uint64_t& size, uint64_t& checksum, std::atomic<uint64_t>* bytesDone,
+                  const std::atomic<bool>* cancel, std::string& errorText);
+// Write the manifest next to its recording
+bool writeManifest(const std::string& recording, const Manifest& manifest, std::string& errorText);
+// Read a manifest file
+bool readManifest(const std::string& filename, Manifest& manifest, std::string& errorText);
+// Checksum a recording and write its manifest
+bool writeRecordingManifest(const std::string& recording, const std::string& args, Manifest& manifest, std::atomic<uint64_t>* bytesDone,
+                            const std::atomic<bool>* cancel, std::string& errorText);
+
+// Queue a manifest to be written in the background
+void queueManifest(ManifestWriter& writer, const std::string& recording, const std::string& args);
+// Collect a written manifest and start the next one, never blocks
+bool pollManifestWriter(ManifestWriter& writer);
+// Cancel the manifest being written and wait for it, listing recordings left without one
+void endManifestWriter(ManifestWriter& writer);
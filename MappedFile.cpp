@@ -0,0 +1,58 @@
+/* Aden Prince
+ * HiMER Lab at U. of Illinois, Chicago
+ * K4ARecorder GUI
+ *
+ * MappedFile.cpp
+ * Contains functions used to map recordings into memory.
+ */
+
+#include "MappedFile.h"
+
+using namespace std;
+
+// Map the whole of filename into memory for reading, returns false if it cannot be opened or is empty
+bool openMappedFile(const string& filename, MappedFile& mapped, string& errorText) {
+    closeMappedFile(mapped);
+
+    // Allow K4ARecorder to keep writing the file while it is mapped
+    mapped.file = CreateFileA(filename.c_str(), GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE, NULL,
+                              OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+    if (mapped.file == INVALID_HANDLE_VALUE) {
+        errorText += "ERROR: Could not open \"" + filename + "\"\n";
+        return false;
+    }
+
+    LARGE_INTEGER size;
+    if (!GetFileSizeEx(mapped.file, &size) || size.QuadPart == 0) {
+        errorText += "ERROR: \"" + filename + "\" is empty\n";
+        closeMappedFile(mapped);
+        return false;
+    }
+    mapped.length = (uint64_t) size.QuadPart;
+
+    mapped.mapping = CreateFileMappingA(mapped.file, NULL, PAGE_READONLY, 0, 0, NULL);
+    if (mapped.mapping != NULL) {
+        mapped.data = (const uint8_t*) MapViewOfFile(mapped.mapping, FILE_MAP_READ, 0, 0, 0);
+    }
+    if (mapped.data == nullptr) {
+        errorText += "ERROR: Could not map \"" + filename + "\" into memory\n";
+        closeMappedFile(mapped);
+        return false;
+    }
+
+    return true;
+}
+
+// Unmap the file and close its handles
+void closeMappedFile(MappedFile& mapped) {
+    if (mapped.data != nullptr) {
+        UnmapViewOfFile(mapped.data);
+    }
+    if (mapped.mapping != NULL) {
+        CloseHandle(mapped.mapping);
+    }
+    if (mapped.file != INVALID_HANDLE_VALUE) {
+        CloseHandle(mapped.file);
+    }
+    mapped = MappedFile();
+}
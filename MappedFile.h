@@ -0,0 +1,28 @@
+/* Aden Prince
+ * HiMER Lab at U. of Illinois, Chicago
+ * K4ARecorder GUI
+ *
+ * MappedFile.h
+ * Contains a read-only memory mapping of a whole file, used to parse
+ * recordings without copying them into memory.
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <string>
+
+#include <Windows.h>
+
+// Read-only view of a whole file, valid until closeMappedFile
+struct MappedFile {
+    HANDLE file = INVALID_HANDLE_VALUE;
+    HANDLE mapping = NULL;
+    const uint8_t* data = nullptr;
+    uint64_t length = 0;
+};
+
+// Map the whole of filename into memory for reading, returns false if it cannot be opened or is empty
+bool openMappedFile(const std::string& filename, MappedFile& mapped, std::string& errorText);
+// Unmap the file and close its handles
+void closeMappedFile(MappedFile& mapped);
@@ -0,0 +1,623 @@
+/* Aden Prince
+ * HiMER Lab at U. of Illinois, Chicago
+ * K4ARecorder GUI
+ *
+ * MatroskaParser.cpp
+ * Contains functions that read the EBML elements of Matroska files in
+ * place, without copying or reading frame data.
+ */
+
+#include "MatroskaParser.h"
+
+#include <algorithm>
+#include <climits>
+#include <cstring>
+
+using namespace std;
+
+// Read a variable-length EBML element ID, returns its length in bytes or 0 if invalid
+int readElementId(const uint8_t* data, uint64_t available, uint32_t& id) {
+    if (available == 0 || data[0] == 0) {
+        return 0;
+    }
+
+    // The number of leading zero bits gives the number of extra bytes, IDs keep their marker bit
+    int length = 1;
+    for (uint8_t mask = 0x80; (data[0] & mask) == 0; mask >>= 1) {
+        length++;
+    }
+    if (length > 4 || (uint64_t) length > available) {
+        return 0;
+    }
+
+    id = 0;
+    for (int i = 0; i < length; i++) {
+        id = (id << 8) | data[i];
+    }
+    return length;
+}
+
+// Read a variable-length EBML size, returns its length in bytes or 0 if invalid
+int readVarInt(const uint8_t* data, uint64_t available, uint64_t& value, bool* unknown) {
+    if (available == 0 || data[0] == 0) {
+        return 0;
+    }
+
+    int length = 1;
+    uint8_t mask = 0x80;
+    for (; (data[0] & mask) == 0; mask >>= 1) {
+        length++;
+    }
+    if ((uint64_t) length > available) {
+        return 0;
+    }
+
+    // Remove the marker bit, a value with every remaining bit set means unknown
+    value = data[0] & (mask - 1);
+    bool allOnes = value == (uint64_t) (mask - 1);
+    for (int i = 1; i < length; i++) {
+        value = (value << 8) | data[i];
+        allOnes = allOnes && data[i] == 0xFF;
+    }
+    if (unknown != nullptr) {
+        *unknown = allOnes;
+    }
+    return length;
+}
+
+// Read the header of the element starting at offset, returns false if it does not fit before end
+bool readElement(const uint8_t* data, uint64_t offset, uint64_t end, EbmlElement& element) {
+    if (offset >= end) {
+        return false;
+    }
+
+    int idLength = readElementId(data + offset, end - offset, element.id);
+    if (idLength == 0) {
+        return false;
+    }
+
+    bool unknown = false;
+    int sizeLength = readVarInt(data + offset + idLength, end - offset - idLength, element.size, &unknown);
+    if (sizeLength == 0) {
+        return false;
+    }
+
+    element.offset = offset;
+    element.dataOffset = offset + idLength + sizeLength;
+    element.sizeLength = sizeLength;
+    if (unknown) {
+        element.size = unknownElementSize;
+    }
+    return true;
+}
+
+// Check if an element's data fits before end, so it can be read
+static bool fitsBefore(const EbmlElement& element, uint64_t end) {
+    return element.size != unknownElementSize && element.dataOffset <= end && element.size <= end - element.dataOffset;
+}
+
+// Read an unsigned integer element's data, 0 if it does not fit before end
+uint64_t readUnsigned(const uint8_t* data, const EbmlElement& element, uint64_t end) {
+    if (!fitsBefore(element, end)) {
+        return 0;
+    }
+    uint64_t value = 0;
+    for (uint64_t i = 0; i < element.size && i < 8; i++) {
+        value = (value << 8) | data[element.dataOffset + i];
+    }
+    return value;
+}
+
+// Read a 4 or 8 byte big-endian float element's data, 0 if it does not fit before end
+double readFloat(const uint8_t* data, const EbmlElement& element, uint64_t end) {
+    uint64_t bits = readUnsigned(data, element, end);
+    if (element.size == 4) {
+        uint32_t bits32 = (uint32_t) bits;
+        float value;
+        memcpy(&value, &bits32, sizeof(value));
+        return value;
+    }
+    if (element.size == 8) {
+        double value;
+        memcpy(&value, &bits, sizeof(value));
+        return value;
+    }
+    return 0;
+}
+
+// Read a string element's data, stopping at the first null byte, empty if it does not fit before end
+string readString(const uint8_t* data, const EbmlElement& element, uint64_t end) {
+    if (!fitsBefore(element, end)) {
+        return "";
+    }
+    const char* start = (const char*) data + element.dataOffset;
+    size_t length = 0;
+    while (length < element.size && start[length] != '\0') {
+        length++;
+    }
+    return string(start, length);
+}
+
+// Convert a timestamp in TimestampScale units to nanoseconds, saturating instead of overflowing on damaged files
+int64_t scaleTimestamp(int64_t timestamp, uint64_t timestampScale) {
+    if (timestampScale == 0 || timestampScale > (uint64_t) INT64_MAX) {
+        return 0;
+    }
+    int64_t scale = (int64_t) timestampScale;
+    if (timestamp > INT64_MAX / scale) {
+        return INT64_MAX;
+    }
+    if (timestamp < INT64_MIN / scale) {
+        return INT64_MIN;
+    }
+    return timestamp * scale;
+}
+
+// Check if an element ID belongs directly to the segment, which ends a cluster of unknown size
+bool isTopLevelId(uint32_t id) {
+    return id == clusterId || id == cuesId || id == tagsId || id == attachmentsId || id == seekHeadId ||
+           id == infoId || id == tracksId || id == segmentId || id == ebmlHeaderId || id == 0x1043A770; // Chapters
+}
+
+// Get the end of an element clamped to end, or end if its size is unknown
+static uint64_t elementEnd(const EbmlElement& element, uint64_t end) {
+    if (element.size == unknownElementSize || element.size > end - element.dataOffset) {
+        return end;
+    }
+    return element.dataOffset + element.size;
+}
+
+// Read the track entries of a Tracks element
+static void parseTracks(MatroskaFile& file, const EbmlElement& tracks) {
+    uint64_t tracksEnd = elementEnd(tracks, file.segmentEnd);
+    EbmlElement entry;
+
+    for (uint64_t offset = tracks.dataOffset; readElement(file.data, offset, tracksEnd, entry); offset = elementEnd(entry, tracksEnd)) {
+        if (entry.id != trackEntryId) {
+            continue;
+        }
+
+        TrackInfo track;
+        uint64_t entryEnd = elementEnd(entry, tracksEnd);
+        EbmlElement child;
+
+        for (uint64_t childOffset = entry.dataOffset; readElement(file.data, childOffset, entryEnd, child); childOffset = elementEnd(child, entryEnd)) {
+            if (child.id == trackNumberId) {
+                track.number = readUnsigned(file.data, child, entryEnd);
+            }
+            else if (child.id == trackTypeId) {
+                track.type = (int) readUnsigned(file.data, child, entryEnd);
+            }
+            else if (child.id == trackNameId) {
+                track.name = readString(file.data, child, entryEnd);
+            }
+            else if (child.id == codecIdId) {
+                track.codecId = readString(file.data, child, entryEnd);
+            }
+            else if (child.id == codecPrivateId) {
+                track.codecPrivateOffset = child.dataOffset;
+                track.codecPrivateSize = elementEnd(child, entryEnd) - child.dataOffset;
+            }
+            else if (child.id == videoId) {
+                uint64_t videoEnd = elementEnd(child, entryEnd);
+                EbmlElement setting;
+                for (uint64_t settingOffset = child.dataOffset; readElement(file.data, settingOffset, videoEnd, setting); settingOffset = elementEnd(setting, videoEnd)) {
+                    if (setting.id == pixelWidthId) {
+                        track.width = (uint32_t) readUnsigned(file.data, setting, videoEnd);
+                    }
+                    else if (setting.id == pixelHeightId) {
+                        track.height = (uint32_t) readUnsigned(file.data, setting, videoEnd);
+                    }
+                }
+            }
+        }
+
+        file.tracks.push_back(track);
+    }
+}
+
+// Read the name and data position of each attached file
+static void parseAttachments(MatroskaFile& file, const EbmlElement& attachments) {
+    uint64_t attachmentsEnd = elementEnd(attachments, file.segmentEnd);
+    EbmlElement attachedFile;
+
+    for (uint64_t offset = attachments.dataOffset; readElement(file.data, offset, attachmentsEnd, attachedFile); offset = elementEnd(attachedFile, attachmentsEnd)) {
+        if (attachedFile.id != attachedFileId) {
+            continue;
+        }
+
+        AttachmentInfo attachment;
+        uint64_t fileEnd = elementEnd(attachedFile, attachmentsEnd);
+        EbmlElement child;
+
+        for (uint64_t childOffset = attachedFile.dataOffset; readElement(file.data, childOffset, fileEnd, child); childOffset = elementEnd(child, fileEnd)) {
+            if (child.id == fileNameId) {
+                attachment.name = readString(file.data, child, fileEnd);
+            }
+            else if (child.id == fileDataId) {
+                attachment.dataOffset = child.dataOffset;
+                attachment.size = elementEnd(child, fileEnd) - child.dataOffset;
+            }
+        }
+
+        file.attachments.push_back(attachment);
+    }
+}
+
+// Read the name and value of each simple tag
+static void parseTags(MatroskaFile& file, const EbmlElement& tags) {
+    uint64_t tagsEnd = elementEnd(tags, file.segmentEnd);
+    EbmlElement tag;
+
+    for (uint64_t offset = tags.dataOffset; readElement(file.data, offset, tagsEnd, tag); offset = elementEnd(tag, tagsEnd)) {
+        if (tag.id != tagId) {
+            continue;
+        }
+
+        uint64_t tagEnd = elementEnd(tag, tagsEnd);
+        EbmlElement simpleTag;
+
+        for (uint64_t tagOffset = tag.dataOffset; readElement(file.data, tagOffset, tagEnd, simpleTag); tagOffset = elementEnd(simpleTag, tagEnd)) {
+            if (simpleTag.id != simpleTagId) {
+                continue;
+            }
+
+            TagInfo info;
+            uint64_t simpleTagEnd = elementEnd(simpleTag, tagEnd);
+            EbmlElement child;
+
+            for (uint64_t childOffset = simpleTag.dataOffset; readElement(file.data, childOffset, simpleTagEnd, child); childOffset = elementEnd(child, simpleTagEnd)) {
+                if (child.id == tagNameId) {
+                    info.name = readString(file.data, child, simpleTagEnd);
+                }
+                else if (child.id == tagStringId) {
+                    info.value = readString(file.data, child, simpleTagEnd);
+                }
+            }
+
+            file.tags.push_back(info);
+        }
+    }
+}
+
+// Read one top-level element before the clusters, or one found through the seek head
+static void parseTopLevel(MatroskaFile& file, const EbmlElement& element, vector<pair<uint32_t, uint64_t>>& seeks) {
+    uint64_t end = elementEnd(element, file.segmentEnd);
+    EbmlElement child;
+
+    if (element.id == infoId && file.infoOffset == 0) {
+        file.infoOffset = element.offset;
+        for (uint64_t offset = element.dataOffset; readElement(file.data, offset, end, child); offset = elementEnd(child, end)) {
+            if (child.id == timestampScaleId) {
+                file.timestampScale = readUnsigned(file.data, child, end);
+            }
+            else if (child.id == durationId) {
+                file.duration = readFloat(file.data, child, end);
+                file.durationOffset = child.offset;
+            }
+        }
+    }
+    else if (element.id == tracksId && file.tracksOffset == 0) {
+        file.tracksOffset = element.offset;
+        parseTracks(file, element);
+    }
+    else if (element.id == attachmentsId && file.attachmentsOffset == 0) {
+        file.attachmentsOffset = element.offset;
+        parseAttachments(file, element);
+    }
+    else if (element.id == tagsId && file.tagsOffset == 0) {
+        file.tagsOffset = element.offset;
+        parseTags(file, element);
+    }
+    else if (element.id == cuesId && file.cuesOffset == 0) {
+        file.cuesOffset = element.offset;
+    }
+    else if (element.id == seekHeadId && file.seekHeadOffset == 0) {
+        file.seekHeadOffset = element.offset;
+
+        // Remember where elements after the clusters are, positions are relative to the segment data
+        for (uint64_t offset = element.dataOffset; readElement(file.data, offset, end, child); offset = elementEnd(child, end)) {
+            if (child.id != seekId) {
+                continue;
+            }
+            uint64_t seekEnd = elementEnd(child, end);
+            uint32_t id = 0;
+            uint64_t position = 0;
+            EbmlElement field;
+            for (uint64_t fieldOffset = child.dataOffset; readElement(file.data, fieldOffset, seekEnd, field); fieldOffset = elementEnd(field, seekEnd)) {
+                if (field.id == seekIdId) {
+                    id = (uint32_t) readUnsigned(file.data, field, seekEnd);
+                }
+                else if (field.id == seekPositionId) {
+                    position = readUnsigned(file.data, field, seekEnd);
+                }
+            }
+            seeks.push_back(make_pair(id, file.segment.dataOffset + position));
+        }
+    }
+}
+
+// Read every element before the first cluster, returns false if the file is not Matroska
+bool parseMatroskaHeaders(const uint8_t* data, uint64_t length, MatroskaFile& file, string& errorText) {
+    file = MatroskaFile();
+    file.data = data;
+    file.length = length;
+
+    EbmlElement header;
+    if (!readElement(data, 0, length, header) || header.id != ebmlHeaderId || header.size == unknownElementSize) {
+        errorText += "ERROR: Not a Matroska file\n";
+        return false;
+    }
+
+    // Skip anything between the EBML header and the segment
+    uint64_t offset = header.dataOffset + header.size;
+    while (readElement(data, offset, length, file.segment) && file.segment.id != segmentId) {
+        if (file.segment.size == unknownElementSize) {
+            break;
+        }
+        offset = file.segment.dataOffset + file.segment.size;
+    }
+    if (file.segment.id != segmentId) {
+        errorText += "ERROR: Matroska segment not found\n";
+        return false;
+    }
+    file.segmentEnd = elementEnd(file.segment, length);
+
+    vector<pair<uint32_t, uint64_t>> seeks;
+    EbmlElement element;
+
+    for (offset = file.segment.dataOffset; readElement(data, offset, file.segmentEnd, element); offset = element.dataOffset + element.size) {
+        if (element.id == clusterId) {
+            file.firstClusterOffset = element.offset;
+            break;
+        }
+        parseTopLevel(file, element, seeks);
+        if (element.size == unknownElementSize) {
+            break;
+        }
+    }
+
+    // Read elements written after the clusters, such as cues and tags
+    for (const auto& seek : seeks) {
+        if (readElement(data, seek.second, file.segmentEnd, element) && element.id == seek.first) {
+            parseTopLevel(file, element, seeks);
+        }
+    }
+
+    if (file.tracks.empty()) {
+        errorText += "ERROR: Matroska file has no tracks\n";
+        return false;
+    }
+    // Every timestamp is multiplied by the scale, and some tools divide by it
+    if (file.timestampScale == 0 || file.timestampScale > (uint64_t) INT64_MAX) {
+        errorText += "ERROR: Matroska file has an invalid TimestampScale of " + to_string(file.timestampScale) + "\n";
+        return false;
+    }
+    return true;
+}
+
+// Read the cluster starting at or after offset, moving offset past it, returns false when there are none left
+bool nextCluster(const MatroskaFile& file, uint64_t& offset, ClusterInfo& cluster) {
+    if (offset < file.firstClusterOffset) {
+        offset = file.firstClusterOffset;
+    }
+    if (file.firstClusterOffset == 0) {
+        return false;
+    }
+
+    EbmlElement element;
+    while (readElement(file.data, offset, file.segmentEnd, element)) {
+        if (element.id != clusterId) {
+            // Skip cues, tags and anything else between clusters
+            if (element.size == unknownElementSize || element.size > file.segmentEnd - element.dataOffset) {
+                return false;
+            }
+            offset = element.dataOffset + element.size;
+            continue;
+        }
+
+        cluster.offset = element.offset;
+        cluster.dataOffset = element.dataOffset;
+        cluster.timestamp = 0;
+
+        if (element.size != unknownElementSize) {
+            cluster.complete = element.size <= file.segmentEnd - element.dataOffset;
+            cluster.end = elementEnd(element, file.segmentEnd);
+        }
+        else {
+            // A cluster of unknown size ends where the next top-level element starts
+            cluster.complete = false;
+            cluster.end = file.segmentEnd;
+            EbmlElement child;
+            uint64_t childOffset = element.dataOffset;
+            while (readElement(file.data, childOffset, file.segmentEnd, child)) {
+                if (isTopLevelId(child.id)) {
+                    cluster.complete = true;
+                    cluster.end = childOffset;
+                    break;
+                }
+                if (child.size == unknownElementSize || child.size > file.segmentEnd - child.dataOffset) {
+                    cluster.end = childOffset;
+                    break;
+                }
+                childOffset = child.dataOffset + child.size;
+            }
+            if (childOffset >= file.segmentEnd) {
+                cluster.complete = file.segment.size != unknownElementSize;
+            }
+        }
+
+        // The timestamp is normally the first child
+        EbmlElement child;
+        for (uint64_t childOffset = cluster.dataOffset; readElement(file.data, childOffset, cluster.end, child); childOffset = child.dataOffset + child.size) {
+            if (child.id == timestampId) {
+                // A damaged timestamp is clamped so adding a block's relative timestamp to it cannot overflow
+                cluster.timestamp = (int64_t) min(readUnsigned(file.data, child, cluster.end), (uint64_t) INT64_MAX / 2);
+                break;
+            }
+            if (child.id == simpleBlockId || child.id == blockGroupId || child.size == unknownElementSize) {
+                break;
+            }
+        }
+
+        offset = cluster.end;
+        return true;
+    }
+
+    return false;
+}
+
+// Read the track number, relative timestamp and flags at the start of a block's data, returns the header length or 0 if it does not fit
+int readBlockHeader(const uint8_t* data, uint64_t available, uint64_t& track, int16_t& relativeTimestamp, uint8_t& flags) {
+    int trackLength = readVarInt(data, available, track);
+    if (trackLength == 0 || (uint64_t) trackLength + 3 > available) {
+        return 0;
+    }
+
+    relativeTimestamp = (int16_t) ((data[trackLength] << 8) | data[trackLength + 1]);
+    flags = data[trackLength + 2];
+    return trackLength + 3;
+}
+
+// Read the track, timestamp and flags of a Block or SimpleBlock's data
+static bool parseBlockHeader(const MatroskaFile& file, const ClusterInfo& cluster, const EbmlElement& element, uint64_t end, BlockInfo& block) {
+    int16_t relativeTimestamp;
+    uint8_t flags;
+    int headerLength = readBlockHeader(file.data + element.dataOffset, end - element.dataOffset, block.track, relativeTimestamp, flags);
+    if (headerLength == 0) {
+        return false;
+    }
+
+    uint64_t headerEnd = element.dataOffset + headerLength;
+    block.timestampNs = scaleTimestamp(cluster.timestamp + relativeTimestamp, file.timestampScale);
+    block.keyframe = (flags & 0x80) != 0;
+    block.dataOffset = headerEnd;
+    block.dataSize = end - headerEnd;
+    block.frameCount = 1;
+
+    // Laced blocks hold several frames, the byte after the flags is the frame count minus one
+    if ((flags & 0x06) != 0 && headerEnd < end) {
+        block.frameCount = file.data[headerEnd] + 1;
+    }
+    return true;
+}
+
+// Read the block starting at or after offset in a cluster, moving offset past it, returns false when there are none left
+bool nextBlock(const MatroskaFile& file, const ClusterInfo& cluster, uint64_t& offset, BlockInfo& block) {
+    if (offset < cluster.dataOffset) {
+        offset = cluster.dataOffset;
+    }
+
+    EbmlElement element;
+    while (readElement(file.data, offset, cluster.end, element)) {
+        // Blocks cut off by the end of the file are not returned
+        if (isTopLevelId(element.id) || element.size == unknownElementSize || element.size > cluster.end - element.dataOffset) {
+            return false;
+        }
+        uint64_t end = element.dataOffset + element.size;
+        offset = end;
+
+        if (element.id == simpleBlockId) {
+            if (parseBlockHeader(file, cluster, element, end, block)) {
+                block.offset = element.offset;
+                block.end = end;
+                return true;
+            }
+        }
+        else if (element.id == blockGroupId) {
+            // A block group's block is a keyframe unless it references another block
+            bool hasBlock = false;
+            bool references = false;
+            EbmlElement child;
+            for (uint64_t childOffset = element.dataOffset; readElement(file.data, childOffset, end, child); childOffset = elementEnd(child, end)) {
+                if (child.id == blockId) {
+                    hasBlock = parseBlockHeader(file, cluster, child, elementEnd(child, end), block);
+                }
+                else if (child.id == 0xFB) { // ReferenceBlock
+                    references = true;
+                }
+            }
+            if (hasBlock) {
+                block.keyframe = !references;
+                block.offset = element.offset;
+                block.end = end;
+                return true;
+            }
+        }
+    }
+
+    return false;
+}
+
+// Find the offset of a cluster at or before timestampNs using the cues, the first cluster if the file has no cues
+uint64_t findClusterAt(const MatroskaFile& file, int64_t timestampNs) {
+    EbmlElement cues;
+    if (file.cuesOffset == 0 || !readElement(file.data, file.cuesOffset, file.segmentEnd, cues)) {
+        return file.firstClusterOffset;
+    }
+
+    // Cue points are in time order, so keep the last one at or before the time
+    uint64_t best = file.firstClusterOffset;
+    uint64_t cuesEnd = elementEnd(cues, file.segmentEnd);
+    EbmlElement point;
+
+    for (uint64_t offset = cues.dataOffset; readElement(file.data, offset, cuesEnd, point); offset = elementEnd(point, cuesEnd)) {
+        if (point.id != cuePointId) {
+            continue;
+        }
+
+        uint64_t pointEnd = elementEnd(point, cuesEnd);
+        uint64_t time = 0;
+        uint64_t position = 0;
+        EbmlElement child;
+
+        for (uint64_t childOffset = point.dataOffset; readElement(file.data, childOffset, pointEnd, child); childOffset = elementEnd(child, pointEnd)) {
+            if (child.id == cueTimeId) {
+                time = readUnsigned(file.data, child, pointEnd);
+            }
+            else if (child.id == cueTrackPositionsId && position == 0) {
+                uint64_t positionsEnd = elementEnd(child, pointEnd);
+                EbmlElement field;
+                for (uint64_t fieldOffset = child.dataOffset; readElement(file.data, fieldOffset, positionsEnd, field); fieldOffset = elementEnd(field, positionsEnd)) {
+                    if (field.id == cueClusterPositionId) {
+                        position = readUnsigned(file.data, field, positionsEnd);
+                    }
+                }
+            }
+        }
+
+        if (scaleTimestamp((int64_t) min(time, (uint64_t) INT64_MAX), file.timestampScale) > timestampNs) {
+            break;
+        }
+        if (position != 0) {
+            best = file.segment.dataOffset + position;
+        }
+    }
+
+    // Only trust a cue that points at a cluster
+    EbmlElement cluster;
+    if (!readElement(file.data, best, file.segmentEnd, cluster) || cluster.id != clusterId) {
+        return file.firstClusterOffset;
+    }
+    return best;
+}
+
+// Find a track by name, nullptr if the file does not have it
+const TrackInfo* findTrack(const MatroskaFile& file, const string& name) {
+    for (const TrackInfo& track : file.tracks) {
+        if (track.name == name) {
+            return &track;
+        }
+    }
+    return nullptr;
+}
+
+// Find a tag's value by name, empty if the file does not have it
+string findTag(const MatroskaFile& file, const string& name) {
+    for (const TagInfo& tag : file.tags) {
+        if (tag.name == name) {
+            return tag.value;
+        }
+    }
+    return "";
+}
@@ -0,0 +1,176 @@
+/* Aden Prince
+ * HiMER Lab at U. of Illinois, Chicago
+ * K4ARecorder GUI
+ *
+ * MatroskaParser.h
+ * Contains a zero-copy parser for the EBML elements of Matroska (.mkv)
+ * files written by K4ARecorder. Works on bytes already in memory, such
+ * as a memory-mapped file, and never copies frame data. Has no Windows
+ * or ImGui dependencies.
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// EBML and Matroska element IDs used by the parser
+const uint32_t ebmlHeaderId = 0x1A45DFA3;
+const uint32_t segmentId = 0x18538067;
+const uint32_t seekHeadId = 0x114D9B74;
+const uint32_t seekId = 0x4DBB;
+const uint32_t seekIdId = 0x53AB;
+const uint32_t seekPositionId = 0x53AC;
+const uint32_t infoId = 0x1549A966;
+const uint32_t timestampScaleId = 0x2AD7B1;
+const uint32_t durationId = 0x4489;
+const uint32_t tracksId = 0x1654AE6B;
+const uint32_t trackEntryId = 0xAE;
+const uint32_t trackNumberId = 0xD7;
+const uint32_t trackTypeId = 0x83;
+const uint32_t trackNameId = 0x536E;
+const uint32_t codecIdId = 0x86;
+const uint32_t codecPrivateId = 0x63A2;
+const uint32_t videoId = 0xE0;
+const uint32_t pixelWidthId = 0xB0;
+const uint32_t pixelHeightId = 0xBA;
+const uint32_t clusterId = 0x1F43B675;
+const uint32_t timestampId = 0xE7;
+const uint32_t positionId = 0xA7;
+const uint32_t prevSizeId = 0xAB;
+const uint32_t simpleBlockId = 0xA3;
+const uint32_t blockGroupId = 0xA0;
+const uint32_t blockId = 0xA1;
+const uint32_t cuesId = 0x1C53BB6B;
+const uint32_t cuePointId = 0xBB;
+const uint32_t cueTimeId = 0xB3;
+const uint32_t cueTrackPositionsId = 0xB7;
+const uint32_t cueTrackId = 0xF7;
+const uint32_t cueClusterPositionId = 0xF1;
+const uint32_t attachmentsId = 0x1941A469;
+const uint32_t attachedFileId = 0x61A7;
+const uint32_t fileNameId = 0x466E;
+const uint32_t fileDataId = 0x465C;
+const uint32_t tagsId = 0x1254C367;
+const uint32_t tagId = 0x7373;
+const uint32_t simpleTagId = 0x67C8;
+const uint32_t tagNameId = 0x45A3;
+const uint32_t tagStringId = 0x4487;
+const uint32_t voidId = 0xEC;
+const uint32_t crc32Id = 0xBF;
+
+// Matroska track types
+const int videoTrackType = 1;
+const int subtitleTrackType = 17;
+
+// Size field value meaning the element continues until its parent ends
+const uint64_t unknownElementSize = ~0ULL;
+
+// Position and size of one EBML element
+struct EbmlElement {
+    uint32_t id = 0;
+    uint64_t offset = 0;     // First byte of the element ID
+    uint64_t dataOffset = 0; // First byte after the size field
+    uint64_t size = 0;       // Size of the data, unknownElementSize if not known
+    int sizeLength = 0;      // Bytes used by the size field
+};
+
+struct TrackInfo {
+    uint64_t number = 0;
+    int type = 0;
+    std::string name;    // K4ARecorder names its tracks COLOR, DEPTH, IR and IMU
+    std::string codecId;
+    uint32_t width = 0;
+    uint32_t height = 0;
+    uint64_t codecPrivateOffset = 0;
+    uint64_t codecPrivateSize = 0;
+};
+
+struct AttachmentInfo {
+    std::string name;
+    uint64_t dataOffset = 0;
+    uint64_t size = 0;
+};
+
+struct TagInfo {
+    std::string name;
+    std::string value;
+};
+
+// One cluster, whose blocks are read with nextBlock
+struct ClusterInfo {
+    uint64_t offset = 0;     // First byte of the cluster ID
+    uint64_t dataOffset = 0; // First byte of the cluster's children
+    uint64_t end = 0;        // First byte after the cluster
+    int64_t timestamp = 0;   // Cluster timestamp in TimestampScale units
+    bool complete = true;    // False if the file ends inside the cluster
+};
+
+// One frame block in a cluster
+struct BlockInfo {
+    uint64_t track = 0;
+    int64_t timestampNs = 0;
+    uint64_t offset = 0;      // First byte of the SimpleBlock or BlockGroup element
+    uint64_t end = 0;         // First byte after the element
+    uint64_t dataOffset = 0;  // First byte of the frame data
+    uint64_t dataSize = 0;
+    int frameCount = 1;       // More than one if the block uses lacing
+    bool keyframe = false;
+};
+
+// Layout and metadata of a Matroska file, read once by parseMatroskaHeaders
+struct MatroskaFile {
+    const uint8_t* data = nullptr;
+    uint64_t length = 0;
+
+    EbmlElement segment;
+    uint64_t segmentEnd = 0; // End of the segment, or of the file if the segment size is unknown or too large
+
+    uint64_t timestampScale = 1000000; // Nanoseconds per timestamp unit
+    double duration = -1;              // In timestamp units, -1 if missing
+    uint64_t durationOffset = 0;       // Element offsets, 0 if the element is missing
+    uint64_t infoOffset = 0;
+    uint64_t tracksOffset = 0;
+    uint64_t seekHeadOffset = 0;
+    uint64_t cuesOffset = 0;
+    uint64_t attachmentsOffset = 0;
+    uint64_t tagsOffset = 0;
+    uint64_t firstClusterOffset = 0;
+
+    std::vector<TrackInfo> tracks;
+    std::vector<AttachmentInfo> attachments;
+    std::vector<TagInfo> tags;
+};
+
+// Read a variable-length EBML element ID, returns its length in bytes or 0 if invalid
+int readElementId(const uint8_t* data, uint64_t available, uint32_t& id);
+// Read a variable-length EBML size, returns its length in bytes or 0 if invalid
+int readVarInt(const uint8_t* data, uint64_t available, uint64_t& value, bool* unknown = nullptr);
+// Read the header of the element starting at offset, returns false if it does not fit before end
+bool readElement(const uint8_t* data, uint64_t offset, uint64_t end, EbmlElement& element);
+// Read an unsigned integer, float or string element's data, 0 or empty if it does not fit before end, the end of its parent or the data
+uint64_t readUnsigned(const uint8_t* data, const EbmlElement& element, uint64_t end);
+double readFloat(const uint8_t* data, const EbmlElement& element, uint64_t end);
+std::string readString(const uint8_t* data, const EbmlElement& element, uint64_t end);
+// Convert a timestamp in TimestampScale units to nanoseconds, saturating instead of overflowing on damaged files
+int64_t scaleTimestamp(int64_t timestamp, uint64_t timestampScale);
+
+// Read the track number, relative timestamp and flags at the start of a block's data, returns the header length or 0 if it does not fit
+int readBlockHeader(const uint8_t* data, uint64_t available, uint64_t& track, int16_t& relativeTimestamp, uint8_t& flags);
+
+// Check if an element ID belongs directly to the segment, which ends a cluster of unknown size
+bool isTopLevelId(uint32_t id);
+
+// Read every element before the first cluster, returns false if the file is not Matroska
+bool parseMatroskaHeaders(const uint8_t* data, uint64_t length, MatroskaFile& file, std::string& errorText);
+// Read the cluster starting at or after offset, moving offset past it, returns false when there are none left
+bool nextCluster(const MatroskaFile& file, uint64_t& offset, ClusterInfo& cluster);
+// Read the block starting at or after offset in a cluster, moving offset past it, returns false when there are none left
+bool nextBlock(const MatroskaFile& file, const ClusterInfo& cluster, uint64_t& offset, BlockInfo& block);
+// Find the offset of a cluster at or before timestampNs using the cues, the first cluster if the file has no cues
+uint64_t findClusterAt(const MatroskaFile& file, int64_t timestampNs);
+// Find a track by name, nullptr if the file does not have it
+const TrackInfo* findTrack(const MatroskaFile& file, const std::string& name);
+// Find a tag's value by name, empty if the file does not have it
+std::string findTag(const MatroskaFile& file, const std::string& name);
@@ -0,0 +1,216 @@
+/* Aden Prince
+ * HiMER Lab at U. of Illinois, Chicago
+ * K4ARecorder GUI
+ *
+ * MatroskaWriter.cpp
+ * Contains functions used to build EBML elements in memory.
+ */
+
+#include "MatroskaWriter.h"
+
+#include <algorithm>
+#include <cstring>
+
+using namespace std;
+
+// Get the bytes needed to store value as an EBML size, 1 to 8
+int varIntLength(uint64_t value) {
+    // A size with every value bit set would mean unknown, so each length holds one less
+    int length = 1;
+    while (length < 8 && value >= (1ULL << (7 * length)) - 1) {
+        length++;
+    }
+    return length;
+}
+
+// Append an element ID, keeping its marker bits
+void writeElementId(vector<uint8_t>& out, uint32_t id) {
+    int length = (id > 0xFFFFFF) ? 4 : (id > 0xFFFF) ? 3 : (id > 0xFF) ? 2 : 1;
+    for (int i = length - 1; i >= 0; i--) {
+        out.push_back((uint8_t) (id >> (8 * i)));
+    }
+}
+
+// Append an EBML size using length bytes, or the fewest needed if length is 0
+void writeVarInt(vector<uint8_t>& out, uint64_t value, int length) {
+    if (length == 0) {
+        length = varIntLength(value);
+    }
+    size_t start = out.size();
+    out.resize(start + length);
+    patchVarInt(out.data() + start, value, length);
+}
+
+// Overwrite an EBML size of length bytes at data, returns false if value does not fit
+bool patchVarInt(uint8_t* data, uint64_t value, int length) {
+    if (length < 1 || length > 8 || (length < 8 && value >= (1ULL << (7 * length)) - 1)) {
+        return false;
+    }
+
+    // The marker bit after length - 1 zero bits gives the length
+    uint64_t encoded = value | (1ULL << (7 * length));
+    for (int i = length - 1; i >= 0; i--) {
+        data[i] = (uint8_t) encoded;
+        encoded >>= 8;
+    }
+    return true;
+}
+
+// Append an unsigned integer element using the fewest bytes
+void writeUnsignedElement(vector<uint8_t>& out, uint32_t id, uint64_t value) {
+    int length = 1;
+    while (length < 8 && (value >> (8 * length)) != 0) {
+        length++;
+    }
+    writeElementId(out, id);
+    writeVarInt(out, length);
+    for (int i = length - 1; i >= 0; i--) {
+        out.push_back((uint8_t) (value >> (8 * i)));
+    }
+}
+
+// Append an 8 byte float element
+void writeFloatElement(vector<uint8_t>& out, uint32_t id, double value) {
+    uint64_t bits;
+    memcpy(&bits, &value, sizeof(bits));
+    writeElementId(out, id);
+    writeVarInt(out, 8);
+    for (int i = 7; i >= 0; i--) {
+        out.push_back((uint8_t) (bits >> (8 * i)));
+    }
+}
+
+// Append a string element without a terminating null
+void writeStringElement(vector<uint8_t>& out, uint32_t id, const string& value) {
+    writeBinaryElement(out, id, (const uint8_t*) value.data(), value.length());
+}
+
+// Append a binary element
+void writeBinaryElement(vector<uint8_t>& out, uint32_t id, const uint8_t* data, uint64_t size) {
+    writeElementId(out, id);
+    writeVarInt(out, size);
+    out.insert(out.end(), data, data + size);
+}
+
+// Append a master element holding the bytes already built in children
+void writeMasterElement(vector<uint8_t>& out, uint32_t id, const vector<uint8_t>& children) {
+    writeBinaryElement(out, id, children.data(), children.size());
+}
+
+// Append a Void element taking up exactly size bytes, which must be at least 2
+void writeVoidElement(vector<uint8_t>& out, uint64_t size) {
+    // A one byte size fits voids up to 128 bytes, larger ones use eight so any size can be reached
+    int sizeLength = (size - 2 < 127) ? 1 : 8;
+    writeElementId(out, voidId);
+    writeVarInt(out, size - 1 - sizeLength, sizeLength);
+    out.resize(out.size() + (size_t) (size - 1 - sizeLength), 0);
+}
+
+// Build a Cues element with one cue point per entry
+vector<uint8_t> buildCues(const vector<CuePointInfo>& cuePoints) {
+    vector<uint8_t> children;
+    for (const CuePointInfo& cue : cuePoints) {
+        vector<uint8_t> positions;
+        writeUnsignedElement(positions, cueTrackId, cue.track);
+        writeUnsignedElement(positions, cueClusterPositionId, cue.clusterPosition);
+
+        vector<uint8_t> point;
+        writeUnsignedElement(point, cueTimeId, cue.time);
+        writeMasterElement(point, cueTrackPositionsId, positions);
+
+        writeMasterElement(children, cuePointId, point);
+    }
+
+    vector<uint8_t> cues;
+    writeMasterElement(cues, cuesId, children);
+    return cues;
+}
+
+// Build a SeekHead element with one seek per entry
+vector<uint8_t> buildSeekHead(const vector<SeekEntry>& entries) {
+    vector<uint8_t> children;
+    for (const SeekEntry& entry : entries) {
+        vector<uint8_t> idBytes;
+        writeElementId(idBytes, entry.id);
+
+        vector<uint8_t> seek;
+        writeBinaryElement(seek, seekIdId, idBytes.data(), idBytes.size());
+        writeUnsignedElement(seek, seekPositionId, entry.position);
+
+        writeMasterElement(children, seekId, seek);
+    }
+
+    vector<uint8_t> seekHead;
+    writeMasterElement(seekHead, seekHeadId, children);
+    return seekHead;
+}
+
+// Read the seek entries of a SeekHead element, which must end inside the data
+static vector<SeekEntry> readSeekEntries(const MatroskaFile& file, const EbmlElement& seekHead) {
+    vector<SeekEntry> entries;
+    uint64_t end = seekHead.dataOffset + seekHead.size;
+    EbmlElement seek;
+
+    for (uint64_t offset = seekHead.dataOffset; readElement(file.data, offset, end, seek) && seek.size != unknownElementSize &&
+         seek.size <= end - seek.dataOffset; offset = seek.dataOffset + seek.size) {
+        if (seek.id != seekId) {
+            continue;
+        }
+        SeekEntry entry;
+        uint64_t seekEnd = seek.dataOffset + seek.size;
+        EbmlElement field;
+        for (uint64_t fieldOffset = seek.dataOffset; readElement(file.data, fieldOffset, seekEnd, field) && field.size != unknownElementSize;
+             fieldOffset = field.dataOffset + field.size) {
+            if (field.id == seekIdId) {
+                entry.id = (uint32_t) readUnsigned(file.data, field, seekEnd);
+            }
+            else if (field.id == seekPositionId) {
+                entry.position = readUnsigned(file.data, field, seekEnd);
+            }
+        }
+        entries.push_back(entry);
+    }
+    return entries;
+}
+
+// Find the seek head and the voids after it, or the first void if there is no seek head
+SeekHeadRegion findSeekHeadRegion(const MatroskaFile& file) {
+    SeekHeadRegion region;
+    EbmlElement element;
+
+    // A damaged size must not let the region reach past the data or over the first cluster, which a repair would then overwrite
+    uint64_t limit = min(file.firstClusterOffset, file.length);
+
+    for (uint64_t offset = file.segment.dataOffset; offset < limit && readElement(file.data, offset, limit, element) &&
+         element.size != unknownElementSize && element.size <= limit - element.dataOffset; offset = element.dataOffset + element.size) {
+        uint64_t end = element.dataOffset + element.size;
+        if (region.end != 0 && element.offset == region.end && element.id == voidId) {
+            region.end = end;
+        }
+        else if (element.id == seekHeadId && !region.hasSeekHead) {
+            region.hasSeekHead = true;
+            region.entries = readSeekEntries(file, element);
+            region.start = element.offset;
+            region.end = end;
+        }
+        else if (element.id == voidId && region.end == 0) {
+            region.start = element.offset;
+            region.end = end;
+        }
+    }
+    return region;
+}
+
+// Build a seek head taking up exactly size bytes, padded with a void, returns false if it does not fit
+bool buildSeekHeadToFit(const vector<SeekEntry>& entries, uint64_t size, vector<uint8_t>& seekHead) {
+    seekHead = buildSeekHead(entries);
+    if (seekHead.size() != size && seekHead.size() + 2 > size) {
+        return false;
+    }
+
+    // Fill the rest with a void so the following elements do not move
+    if (seekHead.size() < size) {
+        writeVoidElement(seekHead, size - seekHead.size());
+    }
+    return true;
+}
@@ -0,0 +1,66 @@
+/* Aden Prince
+ * HiMER Lab at U. of Illinois, Chicago
+ * K4ARecorder GUI
+ *
+ * MatroskaWriter.h
+ * Contains functions used to build EBML elements in memory, such as
+ * cues and seek heads, for writing into Matroska files. Has no Windows
+ * or ImGui dependencies.
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "MatroskaParser.h"
+
+// One entry of the cues, pointing at the cluster holding a track's frame
+struct CuePointInfo {
+    uint64_t time = 0;            // In TimestampScale units
+    uint64_t track = 0;
+    uint64_t clusterPosition = 0; // Relative to the segment data
+};
+
+// One entry of the seek head
+struct SeekEntry {
+    uint32_t id = 0;
+    uint64_t position = 0; // Relative to the segment data
+};
+
+// Space before the first cluster that a seek head can be written over without moving other elements
+struct SeekHeadRegion {
+    uint64_t start = 0;
+    uint64_t end = 0;               // 0 if the file has neither a seek head nor a void
+    bool hasSeekHead = false;
+    std::vector<SeekEntry> entries; // Entries of the existing seek head
+};
+
+// Get the bytes needed to store value as an EBML size, 1 to 8
+int varIntLength(uint64_t value);
+// Append an element ID, keeping its marker bits
+void writeElementId(std::vector<uint8_t>& out, uint32_t id);
+// Append an EBML size using length bytes, or the fewest needed if length is 0
+void writeVarInt(std::vector<uint8_t>& out, uint64_t value, int length = 0);
+// Overwrite an EBML size of length bytes at data, returns false if value does not fit
+bool patchVarInt(uint8_t* data, uint64_t value, int length);
+
+// Append whole elements
+void writeUnsignedElement(std::vector<uint8_t>& out, uint32_t id, uint64_t value);
+void writeFloatElement(std::vector<uint8_t>& out, uint32_t id, double value);
+void writeStringElement(std::vector<uint8_t>& out, uint32_t id, const std::string& value);
+void writeBinaryElement(std::vector<uint8_t>& out, uint32_t id, const uint8_t* data, uint64_t size);
+// Append a master element holding the bytes already built in children
+void writeMasterElement(std::vector<uint8_t>& out, uint32_t id, const std::vector<uint8_t>& children);
+// Append a Void element taking up exactly size bytes, which must be at least 2
+void writeVoidElement(std::vector<uint8_t>& out, uint64_t size);
+
+// Build a Cues element with one cue point per entry
+std::vector<uint8_t> buildCues(const std::vector<CuePointInfo>& cuePoints);
+// Build a SeekHead element with one seek per entry
+std::vector<uint8_t> buildSeekHead(const std::vector<SeekEntry>& entries);
+// Find the seek head and the voids after it, or the first void if there is no seek head
+SeekHeadRegion findSeekHeadRegion(const MatroskaFile& file);
+// Build a seek head taking up exactly size bytes, padded with a void, returns false if it does not fit
+bool buildSeekHeadToFit(const std::vector<SeekEntry>& entries, uint64_t size, std::vector<uint8_t>& seekHead);
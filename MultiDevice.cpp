@@ -0,0 +1,260 @@
+/* Aden Prince
+ * HiMER Lab at U. of Illinois, Chicago
+ * K4ARecorder GUI
+ *
+ * MultiDevice.cpp
+ * Contains functions used to start, supervise and stop one K4ARecorder
+ * process per device, starting subordinates before the master.
+ */
+
+#include "MultiDevice.h"
+#include "RecorderProcess.h"
+#include "StorageCheck.h"
+
+using namespace std;
+
+// Longest time to wait for subordinates to report they are waiting before starting the master anyway
+const chrono::seconds subordinateTimeout(10);
+
+// Milliseconds between two steady clock times
+static double millisecondsBetween(chrono::steady_clock::time_point start, chrono::steady_clock::time_point end) {
+    return chrono::duration<double, milli>(end - start).count();
+}
+
+// Start one device's K4ARecorder with its output captured
+static bool launchDevice(DeviceTake& device, const string& recorderPathStr, const string& argsStr) {
+    HANDLE childOutput = NULL;
+    if (!startLogCapture(device.log, childOutput)) {
+        childOutput = NULL;
+    }
+
+    device.launched = startRecorderProcess(recorderPathStr, argsStr, device.pi, childOutput);
+    device.launchTime = chrono::steady_clock::now();
+
+    if (childOutput != NULL) {
+        CloseHandle(childOutput);
+    }
+
+    device.running = device.launched;
+    if (!device.launched) {
+        stopLogCapture(device.log);
+    }
+    return device.launched;
+}
+
+// Get the output filename used for one device, e.g. take-master.mkv or take-sub1.mkv
+string deviceOutputFilename(const string& filename, int device) {
+    size_t slash = filename.find_last_of("\\/");
+    size_t dot = filename.find_last_of('.');
+    if (dot == string::npos || (slash != string::npos && dot < slash)) {
+        dot = filename.length();
+    }
+
+    string suffix = (device == 0) ? "-master" : "-sub" + to_string(device);
+    return filename.substr(0, dot) + suffix + filename.substr(dot);
+}
+
+// Check options for every device and start the subordinates, the master is started by pollMultiDeviceTake
+bool startMultiDeviceTake(MultiDeviceSession& multi, const RecorderOptions& options, const string& recorderPathStr, string& errorText) {
+    if (multiDeviceTakeRunning(multi)) {
+        return false;
+    }
+
+    // Build and check the options of every device before starting anything
+    bool valid = true;
+    for (int i = 0; i < multi.deviceCount; i++) {
+        RecorderOptions deviceOptions = options;
+        deviceOptions.device_index = multi.deviceIndices[i];
+        deviceOptions.external_sync_mode_index = (i == 0) ? 2 : 1; // Master or Subordinate
+        deviceOptions.external_sync_delay = (i == 0) ? 0 : multi.syncDelays[i];
+        deviceOptions.output_filename = deviceOutputFilename(options.output_filename, i);
+
+        string deviceErrors;
+        if (!validateOptions(deviceOptions, recorderPathStr, deviceErrors)) {
+            errorText += "Device " + to_string(i) + ":\n" + deviceErrors;
+            valid = false;
+        }
+
+        for (int j = 0; j < i; j++) {
+            if (multi.deviceIndices[j] == multi.deviceIndices[i]) {
+                errorText += "ERROR: Device index " + to_string(multi.deviceIndices[i]) + " is used more than once\n";
+                valid = false;
+            }
+        }
+
+        multi.devices[i].master = (i == 0);
+        multi.devices[i].output_filename = deviceOptions.output_filename;
+        multi.deviceArgs[i] = buildArgs(deviceOptions);
+    }
+
+    // Every device usually records to the same volume
+    if (!checkStorageForTake(options, multi.deviceCount, errorText)) {
+        valid = false;
+    }
+
+    if (!valid) {
+        return false;
+    }
+
+    multi.recorderPathStr = recorderPathStr;
+    multi.takeDeviceCount = multi.deviceCount;
+    multi.stopRequested = false;
+    multi.launchSkewMs = -1;
+    multi.startSkewMs = -1;
+    multi.masterDelayMs = -1;
+    multi.statusText = "";
+
+    for (int i = 0; i < multi.takeDeviceCount; i++) {
+        DeviceTake& device = multi.devices[i];
+        device.launched = false;
+        device.running = false;
+        device.exitCode = 0;
+        device.waitingWatch = watchLog(device.log, "Waiting for signal from master");
+        device.startedWatch = watchLog(device.log, "Started recording");
+    }
+
+    // Subordinates must be waiting for the sync signal before the master starts sending it
+    for (int i = 1; i < multi.takeDeviceCount; i++) {
+        if (!launchDevice(multi.devices[i], recorderPathStr, multi.deviceArgs[i])) {
+            errorText += "ERROR: K4ARecorder failed to start for device " + to_string(multi.deviceIndices[i]) + "\n";
+            multi.state = MultiDeviceState::Recording;
+            stopMultiDeviceTake(multi);
+            return false;
+        }
+    }
+
+    // Spread of subordinate launches, which are made one after another
+    if (multi.takeDeviceCount > 1) {
+        multi.launchSkewMs = millisecondsBetween(multi.devices[1].launchTime, multi.devices[multi.takeDeviceCount - 1].launchTime);
+    }
+
+    multi.waitStart = chrono::steady_clock::now();
+    multi.state = MultiDeviceState::WaitingForSubordinates;
+    pollMultiDeviceTake(multi);
+    return true;
+}
+
+// Start the master once subordinates are waiting, track exits and measure skew, never blocks.
+// Returns true once, when the last process of the take has exited.
+bool pollMultiDeviceTake(MultiDeviceSession& multi) {
+    if (multi.state == MultiDeviceState::Idle || multi.state == MultiDeviceState::Finished) {
+        return false;
+    }
+
+    // Supervise each process on its own
+    for (int i = 0; i < multi.takeDeviceCount; i++) {
+        DeviceTake& device = multi.devices[i];
+        drainLog(device.log);
+
+        if (device.running && WaitForSingleObject(device.pi.hProcess, 0) == WAIT_OBJECT_0) {
+            GetExitCodeProcess(device.pi.hProcess, &device.exitCode);
+            CloseHandle(device.pi.hProcess);
+            CloseHandle(device.pi.hThread);
+            ZeroMemory(&device.pi, sizeof(device.pi));
+            device.running = false;
+        }
+    }
+
+    if (multi.state == MultiDeviceState::WaitingForSubordinates) {
+        bool allWaiting = true;
+        for (int i = 1; i < multi.takeDeviceCount; i++) {
+            DeviceTake& device = multi.devices[i];
+            if (!device.running) {
+                // A subordinate exited early, so the master is never started
+                multi.statusText = "Device " + to_string(multi.deviceIndices[i]) + " exited before the master was started";
+                stopMultiDeviceTake(multi);
+                multi.state = MultiDeviceState::Recording;
+                return false;
+            }
+            allWaiting = allWaiting && watchSeen(device.log, device.waitingWatch);
+        }
+
+        bool timedOut = chrono::steady_clock::now() - multi.waitStart > subordinateTimeout;
+        if (allWaiting || timedOut || multi.stopRequested) {
+            if (timedOut && !allWaiting) {
+                multi.statusText = "Subordinates did not report waiting, master started anyway";
+            }
+            if (!multi.stopRequested) {
+                launchDevice(multi.devices[0], multi.recorderPathStr, multi.deviceArgs[0]);
+            }
+            multi.state = MultiDeviceState::Recording;
+
+            // The master waits on purpose for the subordinates to arm, so this is kept apart from the launch skew
+            if (multi.devices[0].launched && multi.takeDeviceCount > 1) {
+                multi.masterDelayMs = millisecondsBetween(multi.devices[multi.takeDeviceCount - 1].launchTime, multi.devices[0].launchTime);
+            }
+        }
+    }
+
+    if (multi.state == MultiDeviceState::Recording) {
+        // Spread of the times each device reported it started recording
+        if (multi.startSkewMs < 0) {
+            chrono::steady_clock::time_point first, last, started;
+            bool allStarted = true;
+            for (int i = 0; i < multi.takeDeviceCount && allStarted; i++) {
+                allStarted = watchSeen(multi.devices[i].log, multi.devices[i].startedWatch, &started);
+                if (allStarted) {
+                    first = (i == 0 || started < first) ? started : first;
+                    last = (i == 0 || started > last) ? started : last;
+                }
+            }
+            if (allStarted) {
+                multi.startSkewMs = millisecondsBetween(first, last);
+            }
+        }
+
+        if (!multiDeviceTakeRunning(multi)) {
+            if (multi.stopRequested) {
+                restoreInterruptHandling();
+            }
+            multi.state = MultiDeviceState::Finished;
+            return true;
+        }
+    }
+
+    return false;
+}
+
+// Ask every K4ARecorder in the take to finish its file
+void stopMultiDeviceTake(MultiDeviceSession& multi) {
+    if (!multiDeviceTakeRunning(multi) || multi.stopRequested) {
+        return;
+    }
+
+    // Every K4ARecorder shares this console, so one Ctrl+C stops them all
+    interruptRecorders();
+    multi.stopRequested = true;
+}
+
+// Stop the take if there is one and wait for every K4ARecorder to exit
+void endMultiDeviceTake(MultiDeviceSession& multi) {
+    stopMultiDeviceTake(multi);
+
+    for (int i = 0; i < multi.takeDeviceCount; i++) {
+        if (multi.devices[i].running) {
+            WaitForSingleObject(multi.devices[i].pi.hProcess, INFINITE);
+        }
+    }
+
+    if (multi.state == MultiDeviceState::WaitingForSubordinates) {
+        multi.state = MultiDeviceState::Recording;
+    }
+    pollMultiDeviceTake(multi);
+
+    for (int i = 0; i < multi.takeDeviceCount; i++) {
+        stopLogCapture(multi.devices[i].log);
+    }
+}
+
+// Check if any process of the take has not exited yet
+bool multiDeviceTakeRunning(const MultiDeviceSession& multi) {
+    if (multi.state == MultiDeviceState::WaitingForSubordinates) {
+        return true;
+    }
+    for (int i = 0; i < multi.takeDeviceCount; i++) {
+        if (multi.devices[i].running) {
+            return true;
+        }
+    }
+    return false;
+}
@@ -0,0 +1,85 @@
+/* Aden Prince
+ * HiMER Lab at U. of Illinois, Chicago
+ * K4ARecorder GUI
+ *
+ * MultiDevice.h
+ * Contains the state and functions used to record from several
+ * synchronized devices at once, with one K4ARecorder process per device.
+ */
+
+#pragma once
+
+#include <chrono>
+#include <string>
+
+#include <Windows.h>
+
+#include "RecorderLog.h"
+#include "RecorderOptions.h"
+
+// Most devices recorded at once
+const int maxDevices = 8;
+
+// One K4ARecorder process recording one device
+struct DeviceTake {
+    bool master = false;
+    std::string output_filename;
+
+    PROCESS_INFORMATION pi = {};
+    bool launched = false;
+    bool running = false;
+    DWORD exitCode = 0;
+
+    // When CreateProcess returned and when K4ARecorder reported each stage
+    std::chrono::steady_clock::time_point launchTime;
+    int waitingWatch = -1;
+    int startedWatch = -1;
+
+    RecorderLog log;
+};
+
+enum class MultiDeviceState {
+    Idle,                   // No take has been started
+    WaitingForSubordinates, // Subordinates started, master not yet started
+    Recording,              // Every process started
+    Finished                // Every process has exited
+};
+
+// Settings and processes of a take recorded from several devices
+struct MultiDeviceSession {
+    bool enabled = false;
+    int deviceCount = 2;
+
+    // Settings per device, the first device is the master and the rest are subordinates
+    int deviceIndices[maxDevices] = {0, 1, 2, 3, 4, 5, 6, 7};
+    int syncDelays[maxDevices] = {0, 160, 320, 480, 640, 800, 960, 1120};
+
+    DeviceTake devices[maxDevices];
+    std::string deviceArgs[maxDevices];
+    std::string recorderPathStr;
+    int takeDeviceCount = 0;
+    MultiDeviceState state = MultiDeviceState::Idle;
+    std::chrono::steady_clock::time_point waitStart;
+    bool stopRequested = false;
+
+    // Spread of the subordinates' CreateProcess returns and of every device's "Started recording" report, -1 if unknown
+    double launchSkewMs = -1;
+    double startSkewMs = -1;
+    // Time from the last subordinate launch to the master launch, mostly the wait for subordinates to arm, -1 if unknown
+    double masterDelayMs = -1;
+    std::string statusText;
+};
+
+// Check options for every device and start the subordinates, the master is started by pollMultiDeviceTake
+bool startMultiDeviceTake(MultiDeviceSession& multi, const RecorderOptions& options, const std::string& recorderPathStr, std::string& errorText);
+// Start the master once subordinates are waiting, track exits and measure skew, never blocks.
+// Returns true once, when the last process of the take has exited.
+bool pollMultiDeviceTake(MultiDeviceSession& multi);
+// Ask every K4ARecorder in the take to finish its file
+void stopMultiDeviceTake(MultiDeviceSession& multi);
+// Stop the take if there is one and wait for every K4ARecorder to exit
+void endMultiDeviceTake(MultiDeviceSession& multi);
+// Check if any process of the take has not exited yet
+bool multiDeviceTakeRunning(const MultiDeviceSession& multi);
+// Get the output filename used for one device, e.g. take-master.mkv or take-sub1.mkv
+std::string deviceOutputFilename(const std::string& filename, int device);
@@ -0,0 +1,119 @@
+/* Aden Prince
+ * HiMER Lab at U. of Illinois, Chicago
+ * K4ARecorder GUI
+ *
+ * NumberFormat.cpp
+ * Contains functions used to write numbers as text faster than printf.
+ */
+
+#include "NumberFormat.h"
+
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+using namespace std;
+
+// Write value in decimal, returns the end of what was written
+char* writeUnsigned(char* out, uint64_t value) {
+    char digits[20];
+    int count = 0;
+    do {
+        digits[count++] = (char) ('0' + value % 10);
+        value /= 10;
+    } while (value != 0);
+
+    while (count > 0) {
+        *out++ = digits[--count];
+    }
+    return out;
+}
+
+// Multiply value by 10 to the power, which is exact for the integers writeFloat works with
+static double scaleByPowerOfTen(double value, int power) {
+    static const double powersOfTen[] = {1e0,  1e1,  1e2,  1e3,  1e4,  1e5,  1e6,  1e7,  1e8,  1e9,  1e10, 1e11,
+                                         1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22};
+    return (power >= 0) ? value * powersOfTen[power] : value / powersOfTen[-power];
+}
+
+// Write value with the fewest significant digits, up to 9, that read back as the same float, returns the end of what was written
+char* writeFloat(char* out, float value) {
+    if (value == 0) {
+        if (signbit(value)) {
+            *out++ = '-';
+        }
+        *out++ = '0';
+        return out;
+    }
+    // Values this small or large never come from the IMU, printf is only used so nothing is lost if they do
+    double magnitude = fabs(value);
+    if (!(magnitude >= 1e-12 && magnitude < 1e12)) {
+        return out + snprintf(out, maxFloatTextBytes, "%.9g", value);
+    }
+    if (value < 0) {
+        *out++ = '-';
+    }
+
+    // Try more digits until they give back the float, 9 always do
+    int exponent = 0;
+    while (magnitude >= scaleByPowerOfTen(1, exponent + 1)) {
+        exponent++;
+    }
+    while (magnitude < scaleByPowerOfTen(1, exponent)) {
+        exponent--;
+    }
+    int digits = 6;
+    uint64_t mantissa = 0;
+    for (;; digits++) {
+        int scale = digits - 1 - exponent;
+        mantissa = (uint64_t) llround(scaleByPowerOfTen(magnitude, scale));
+        if (digits == 9 || (float) scaleByPowerOfTen((double) mantissa, -scale) == (float) magnitude) {
+            break;
+        }
+    }
+    // Rounding up can carry into another digit, e.g. 9.9999999 to 10.00000
+    if (mantissa >= (uint64_t) scaleByPowerOfTen(1, digits)) {
+        mantissa /= 10;
+        exponent++;
+    }
+    while (digits > 1 && mantissa % 10 == 0) {
+        mantissa /= 10;
+        digits--;
+    }
+
+    char significant[9];
+    for (int i = digits - 1; i >= 0; i--) {
+        significant[i] = (char) ('0' + mantissa % 10);
+        mantissa /= 10;
+    }
+
+    // Plain decimals for readings, an exponent only for values far from 1
+    if (exponent < -4 || exponent > 8) {
+        *out++ = significant[0];
+        if (digits > 1) {
+            *out++ = '.';
+            memcpy(out, significant + 1, digits - 1);
+            out += digits - 1;
+        }
+        *out++ = 'e';
+        *out++ = (exponent < 0) ? '-' : '+';
+        return writeUnsigned(out, (uint64_t) abs(exponent));
+    }
+    if (exponent < 0) {
+        *out++ = '0';
+        *out++ = '.';
+        for (int i = 0; i < -exponent - 1; i++) {
+            *out++ = '0';
+        }
+        memcpy(out, significant, digits);
+        return out + digits;
+    }
+    for (int i = 0; i <= exponent || i < digits; i++) {
+        if (i == exponent + 1) {
+            *out++ = '.';
+        }
+        *out++ = (i < digits) ? significant[i] : '0';
+    }
+    return out;
+}
@@ -0,0 +1,20 @@
+/* Aden Prince
+ * HiMER Lab at U. of Illinois, Chicago
+ * K4ARecorder GUI
+ *
+ * NumberFormat.h
+ * Contains functions used to write numbers as text faster than printf.
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+// Space writeFloat may need at out, including the null printf ends very small or large values with
+const size_t maxFloatTextBytes = 32;
+
+// Write value in decimal, returns the end of what was written
+char* writeUnsigned(char* out, uint64_t value);
+// Write value with the fewest significant digits, up to 9, that read back as the same float, returns the end of what was written
+char* writeFloat(char* out, float value);
@@ -0,0 +1,67 @@
+/* Aden Prince
+ * HiMER Lab at U. of Illinois, Chicago
+ * K4ARecorder GUI
+ *
+ * Parallel.cpp
+ * Contains functions used to spread work over every core.
+ */
+
+#include "Parallel.h"
+
+#include <atomic>
+#include <thread>
+#include <vector>
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+
+using namespace std;
+
+// Get the number of worker threads to use, one per logical core
+int workerCount() {
+    unsigned int cores = thread::hardware_concurrency();
+    return (cores > 0) ? (int) cores : 1;
+}
+
+// Run function(index) for every index from 0 to count - 1 across every core, returns once all have finished
+void parallelFor(int count, const function<void(int)>& function) {
+    // Each worker takes the next index when it finishes one, so uneven items still keep every core busy
+    atomic<int> nextIndex{0};
+    auto work = [&]() {
+        for (int index = nextIndex++; index < count; index = nextIndex++) {
+            function(index);
+        }
+    };
+
+    int threadCount = (workerCount() < count) ? workerCount() : count;
+    vector<thread> workers;
+    for (int i = 1; i < threadCount; i++) {
+        workers.push_back(thread(work));
+    }
+
+    // The calling thread does its share too
+    work();
+    for (thread& worker : workers) {
+        worker.join();
+    }
+}
+
+// Check if the CPU and OS support AVX2, checked once and then cached
+bool hasAvx2() {
+#if defined(_MSC_VER) && defined(_M_X64)
+    static const bool supported = []() {
+        int info[4];
+        __cpuid(info, 1);
+        bool osSavesAvx = (info[2] & (1 << 27)) && (info[2] & (1 << 28)) && (_xgetbv(0) & 6) == 6;
+        __cpuidex(info, 7, 0);
+        return osSavesAvx && (info[1] & (1 << 5));
+    }();
+    return supported;
+#elif defined(__x86_64__)
+    static const bool supported = __builtin_cpu_supports("avx2");
+    return supported;
+#else
+    return false;
+#endif
+}
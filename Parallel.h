@@ -0,0 +1,31 @@
+/* Aden Prince
+ * HiMER Lab at U. of Illinois, Chicago
+ * K4ARecorder GUI
+ *
+ * Parallel.h
+ * Contains functions used to spread work over every core and to pick the
+ * widest SIMD kernels the CPU supports. Has no Windows or ImGui
+ * dependencies.
+ */
+
+#pragma once
+
+#include <functional>
+
+// SSE2 is part of every x64 CPU and AVX2 is checked for at run time, other CPUs use the scalar kernels
+#if defined(_M_X64) || defined(__x86_64__)
+#define X64_SIMD
+#include <immintrin.h>
+#if defined(_MSC_VER)
+#define AVX2_FUNCTION
+#else
+#define AVX2_FUNCTION __attribute__((target("avx2")))
+#endif
+#endif
+
+// Get the number of worker threads to use, one per logical core
+int workerCount();
+// Run function(index) for every index from 0 to count - 1 across every core, returns once all have finished
+void parallelFor(int count, const std::function<void(int)>& function);
+// Check if the CPU and OS support AVX2, checked once and then cached
+bool hasAvx2();
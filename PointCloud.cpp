@@ -0,0 +1,359 @@
+/* Aden Prince
+ * HiMER Lab at U. of Illinois, Chicago
+ * K4ARecorder GUI
+ *
+ * PointCloud.cpp
+ * Contains functions used to unproject depth frames into point clouds.
+ */
+
+#include "PointCloud.h"
+#include "Parallel.h"
+
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+using namespace std;
+
+// Newton steps allowed to undo the lens distortion at one pixel, it normally takes 3 or 4
+const int unprojectIterations = 20;
+// Squared reprojection error in pixels below which a pixel's ray is accepted
+const double unprojectTolerance = 1e-6;
+
+// Calibration resolution and crop of each depth mode, the calibration is for the whole sensor
+struct DepthModeLayout {
+    uint32_t width;
+    uint32_t height;
+    uint32_t calibrationWidth; // Sensor size after binning
+    uint32_t calibrationHeight;
+    uint32_t cropX;
+    uint32_t cropY;
+};
+
+const DepthModeLayout depthModeLayouts[] = {
+    {320, 288, 512, 512, 96, 90},        // NFOV_2X2BINNED
+    {640, 576, 1024, 1024, 192, 180},    // NFOV_UNBINNED
+    {512, 512, 512, 512, 0, 0},          // WFOV_2X2BINNED
+    {1024, 1024, 1024, 1024, 0, 0},      // WFOV_UNBINNED
+};
+
+// Find the end of the JSON object or array starting at begin, string::npos if it is not closed
+static size_t matchingBracket(const string& json, size_t begin) {
+    int depth = 0;
+    bool inString = false;
+    for (size_t i = begin; i < json.length(); i++) {
+        char c = json[i];
+        if (inString) {
+            if (c == '\\') {
+                i++;
+            }
+            else if (c == '"') {
+                inString = false;
+            }
+        }
+        else if (c == '"') {
+            inString = true;
+        }
+        else if (c == '{' || c == '[') {
+            depth++;
+        }
+        else if ((c == '}' || c == ']') && --depth == 0) {
+            return i + 1;
+        }
+    }
+    return string::npos;
+}
+
+// Read the numbers after "key": in object, either one number or an array of them
+static bool readJsonNumbers(const string& object, const string& key, vector<double>& numbers) {
+    size_t position = object.find("\"" + key + "\"");
+    if (position == string::npos || (position = object.find(':', position)) == string::npos) {
+        return false;
+    }
+
+    // Numbers are separated by commas, and the first thing that is not a number ends the list
+    const char* text = object.c_str() + position + 1;
+    text += strspn(text, " \t\r\n[");
+    for (;;) {
+        char* end;
+        double value = strtod(text, &end);
+        if (end == text) {
+            break;
+        }
+        numbers.push_back(value);
+        text = end + strspn(end, " \t\r\n,");
+    }
+    return numbers.empty() == false;
+}
+
+// Read the depth camera's intrinsics from the calibration.json attachment of a recording
+bool readDepthIntrinsics(const string& calibrationJson, DepthIntrinsics& intrinsics, string& errorText) {
+    // Each camera is an object in the Cameras array, the depth camera is the one with the depth purpose
+    size_t cameras = calibrationJson.find("\"Cameras\"");
+    size_t position = (cameras == string::npos) ? string::npos : calibrationJson.find('[', cameras);
+    size_t camerasEnd = (position == string::npos) ? string::npos : matchingBracket(calibrationJson, position);
+    if (camerasEnd == string::npos) {
+        errorText += "ERROR: Calibration has no cameras\n";
+        return false;
+    }
+
+    string camera;
+    while ((position = calibrationJson.find('{', position)) < camerasEnd) {
+        size_t end = matchingBracket(calibrationJson, position);
+        if (end == string::npos) {
+            break;
+        }
+        string object = calibrationJson.substr(position, end - position);
+        if (object.find("CALIBRATION_CameraPurposeDepth") != string::npos) {
+            camera = object;
+            break;
+        }
+        position = end;
+    }
+
+    // K4A stores cx, cy, fx, fy, k1 to k6, codx, cody, p2 and p1 in that order
+    vector<double> parameters;
+    if (camera.empty() || !readJsonNumbers(camera, "ModelParameters", parameters) || parameters.size() < 14) {
+        errorText += "ERROR: Calibration has no depth camera intrinsics\n";
+        return false;
+    }
+    if (camera.find("CALIBRATION_LensDistortionModelBrownConrady") == string::npos) {
+        errorText += "ERROR: Depth camera does not use the Brown-Conrady lens model\n";
+        return false;
+    }
+
+    intrinsics = DepthIntrinsics();
+    intrinsics.cx = parameters[0];
+    intrinsics.cy = parameters[1];
+    intrinsics.fx = parameters[2];
+    intrinsics.fy = parameters[3];
+    for (int i = 0; i < 6; i++) {
+        intrinsics.k[i] = parameters[4 + i];
+    }
+    intrinsics.codx = parameters[10];
+    intrinsics.cody = parameters[11];
+    intrinsics.p2 = parameters[12];
+    intrinsics.p1 = parameters[13];
+
+    vector<double> metricRadius;
+    if (readJsonNumbers(camera, "MetricRadius", metricRadius)) {
+        intrinsics.metricRadius = metricRadius[0];
+    }
+    return true;
+}
+
+// Project a normalized point through the lens to pixel coordinates, returns false outside the model's radius
+static bool projectPoint(const DepthIntrinsics& c, double x, double y, double& u, double& v) {
+    double xp = x - c.codx;
+    double yp = y - c.cody;
+    double rs = xp * xp + yp * yp;
+    if (c.metricRadius > 0 && rs > c.metricRadius * c.metricRadius) {
+        return false;
+    }
+
+    double rss = rs * rs;
+    double rsc = rss * rs;
+    double a = 1 + c.k[0] * rs + c.k[1] * rss + c.k[2] * rsc;
+    double b = 1 + c.k[3] * rs + c.k[4] * rss + c.k[5] * rsc;
+    double d = (b != 0) ? a / b : a;
+
+    double xpd = xp * d + (rs + 2 * xp * xp) * c.p2 + 2 * xp * yp * c.p1;
+    double ypd = yp * d + (rs + 2 * yp * yp) * c.p1 + 2 * xp * yp * c.p2;
+    u = (xpd + c.codx) * c.fx + c.cx;
+    v = (ypd + c.cody) * c.fy + c.cy;
+    return true;
+}
+
+// Find the normalized point that projects to pixel (u, v) with Newton's method, returns false if it does not converge
+static bool unprojectPixel(const DepthIntrinsics& c, double u, double v, double& x, double& y) {
+    const double step = 1e-6;
+    x = (u - c.cx) / c.fx;
+    y = (v - c.cy) / c.fy;
+
+    for (int i = 0; i < unprojectIterations; i++) {
+        double pu, pv;
+        if (!projectPoint(c, x, y, pu, pv)) {
+            return false;
+        }
+        double eu = pu - u;
+        double ev = pv - v;
+        if (eu * eu + ev * ev < unprojectTolerance) {
+            return true;
+        }
+
+        // The distortion is smooth over the sensor, so a forward difference is close enough to the Jacobian
+        double uX, vX, uY, vY;
+        if (!projectPoint(c, x + step, y, uX, vX) || !projectPoint(c, x, y + step, uY, vY)) {
+            return false;
+        }
+        double a = (uX - pu) / step;
+        double b = (uY - pu) / step;
+        double cc = (vX - pv) / step;
+        double d = (vY - pv) / step;
+        double determinant = a * d - b * cc;
+        if (fabs(determinant) < 1e-12) {
+            return false;
+        }
+        x -= (d * eu - b * ev) / determinant;
+        y -= (a * ev - cc * eu) / determinant;
+    }
+    return false;
+}
+
+// Unproject every pixel of the depth mode with the given frame size, returns false if the size is not a known depth mode
+bool buildPointCloudLut(const DepthIntrinsics& intrinsics, uint32_t width, uint32_t height, PointCloudLut& lut, string& errorText) {
+    const DepthModeLayout* layout = nullptr;
+    for (const DepthModeLayout& mode : depthModeLayouts) {
+        if (mode.width == width && mode.height == height) {
+            layout = &mode;
+        }
+    }
+    if (layout == nullptr) {
+        errorText += "ERROR: " + to_string(width) + "x" + to_string(height) + " is not a depth mode\n";
+        return false;
+    }
+
+    // Scale the intrinsics to the mode's pixels, with pixel centers at whole coordinates
+    DepthIntrinsics mode = intrinsics;
+    mode.cx = intrinsics.cx * layout->calibrationWidth - layout->cropX - 0.5;
+    mode.cy = intrinsics.cy * layout->calibrationHeight - layout->cropY - 0.5;
+    mode.fx = intrinsics.fx * layout->calibrationWidth;
+    mode.fy = intrinsics.fy * layout->calibrationHeight;
+
+    lut.width = width;
+    lut.height = height;
+    lut.x.assign((size_t) width * height, 0);
+    lut.y.assign((size_t) width * height, 0);
+    lut.valid.assign((size_t) width * height, 0);
+
+    parallelFor((int) height, [&](int row) {
+        for (uint32_t column = 0; column < width; column++) {
+            size_t i = (size_t) row * width + column;
+            double x, y;
+            if (unprojectPixel(mode, column, row, x, y)) {
+                lut.x[i] = (float) x;
+                lut.y[i] = (float) y;
+                lut.valid[i] = 1;
+            }
+        }
+    });
+    return true;
+}
+
+// Append the points of a block of lanes whose bit is set in mask, returns the number appended
+static size_t appendPoints(float* points, const float* x, const float* y, const float* z, int lanes, int mask) {
+    size_t count = 0;
+    for (int lane = 0; lane < lanes; lane++) {
+        if (mask & (1 << lane)) {
+            points[count * 3] = x[lane];
+            points[count * 3 + 1] = y[lane];
+            points[count * 3 + 2] = z[lane];
+            count++;
+        }
+    }
+    return count;
+}
+
+// Convert pixels first to last - 1 one at a time, returns the number of points
+static size_t depthToPointsScalar(const PointCloudLut& lut, const uint8_t* depth, bool bigEndian, size_t first, size_t last, float* points) {
+    size_t count = 0;
+    for (size_t i = first; i < last; i++) {
+        uint16_t value = bigEndian ? (uint16_t) ((depth[i * 2] << 8) | depth[i * 2 + 1]) : (uint16_t) (depth[i * 2] | (depth[i * 2 + 1] << 8));
+        float z = value * lut.valid[i];
+        if (z > 0) {
+            points[count * 3] = lut.x[i] * z;
+            points[count * 3 + 1] = lut.y[i] * z;
+            points[count * 3 + 2] = z;
+            count++;
+        }
+    }
+    return count;
+}
+
+#ifdef X64_SIMD
+// Convert the first pixelCount pixels 4 at a time, pixelCount must be a multiple of 4, returns the number of points
+static size_t depthToPointsSse2(const PointCloudLut& lut, const uint8_t* depth, bool bigEndian, size_t pixelCount, float* points) {
+    alignas(16) float x[4], y[4], z[4];
+    size_t count = 0;
+    for (size_t i = 0; i < pixelCount; i += 4) {
+        __m128i raw = _mm_loadl_epi64((const __m128i*) (depth + i * 2));
+        if (bigEndian) {
+            raw = _mm_or_si128(_mm_slli_epi16(raw, 8), _mm_srli_epi16(raw, 8));
+        }
+        __m128 zs = _mm_mul_ps(_mm_cvtepi32_ps(_mm_unpacklo_epi16(raw, _mm_setzero_si128())), _mm_loadu_ps(&lut.valid[i]));
+        int mask = _mm_movemask_ps(_mm_cmpgt_ps(zs, _mm_setzero_ps()));
+        if (mask == 0) {
+            continue;
+        }
+        _mm_store_ps(x, _mm_mul_ps(_mm_loadu_ps(&lut.x[i]), zs));
+        _mm_store_ps(y, _mm_mul_ps(_mm_loadu_ps(&lut.y[i]), zs));
+        _mm_store_ps(z, zs);
+        count += appendPoints(points + count * 3, x, y, z, 4, mask);
+    }
+    return count;
+}
+
+// Convert the first pixelCount pixels 8 at a time, pixelCount must be a multiple of 8, returns the number of points
+AVX2_FUNCTION static size_t depthToPointsAvx2(const PointCloudLut& lut, const uint8_t* depth, bool bigEndian, size_t pixelCount, float* points) {
+    alignas(32) float x[8], y[8], z[8];
+    size_t count = 0;
+    for (size_t i = 0; i < pixelCount; i += 8) {
+        __m128i raw = _mm_loadu_si128((const __m128i*) (depth + i * 2));
+        if (bigEndian) {
+            raw = _mm_or_si128(_mm_slli_epi16(raw, 8), _mm_srli_epi16(raw, 8));
+        }
+        __m256 zs = _mm256_mul_ps(_mm256_cvtepi32_ps(_mm256_cvtepu16_epi32(raw)), _mm256_loadu_ps(&lut.valid[i]));
+        int mask = _mm256_movemask_ps(_mm256_cmp_ps(zs, _mm256_setzero_ps(), _CMP_GT_OQ));
+        if (mask == 0) {
+            continue;
+        }
+        _mm256_store_ps(x, _mm256_mul_ps(_mm256_loadu_ps(&lut.x[i]), zs));
+        _mm256_store_ps(y, _mm256_mul_ps(_mm256_loadu_ps(&lut.y[i]), zs));
+        _mm256_store_ps(z, zs);
+        count += appendPoints(points + count * 3, x, y, z, 8, mask);
+    }
+    return count;
+}
+#endif
+
+// Convert one frame of 16-bit depth in millimetres to XYZ float triples, skipping invalid pixels, returns the number of points
+size_t depthToPoints(const PointCloudLut& lut, const uint8_t* depth, bool bigEndian, float* points) {
+    size_t pixelCount = lut.x.size();
+    size_t done = 0;
+    size_t count = 0;
+
+#ifdef X64_SIMD
+    if (hasAvx2()) {
+        done = pixelCount / 8 * 8;
+        count = depthToPointsAvx2(lut, depth, bigEndian, done, points);
+    }
+    else {
+        done = pixelCount / 4 * 4;
+        count = depthToPointsSse2(lut, depth, bigEndian, done, points);
+    }
+#endif
+
+    return count + depthToPointsScalar(lut, depth, bigEndian, done, pixelCount, points + count * 3);
+}
+
+// Get the header of a binary PLY file holding one frame's points
+string pointCloudPlyHeader(uint64_t points, int64_t timestampNs) {
+    char header[512];
+    snprintf(header, sizeof(header),
+             "ply\nformat binary_little_endian 1.0\ncomment K4ARecorder GUI depth frame, millimetres\ncomment timestamp_ns %lld\n"
+             "element vertex %llu\nproperty float x\nproperty float y\nproperty float z\nend_header\n",
+             (long long) timestampNs, (unsigned long long) points);
+    return header;
+}
+
+// Get the header of a binary PLY file holding every frame's points, with a fixed length so the counts can be filled in afterwards
+string streamedPlyHeader(uint64_t frames, uint64_t points) {
+    char header[512];
+    snprintf(header, sizeof(header),
+             "ply\nformat binary_little_endian 1.0\ncomment K4ARecorder GUI depth frames, millimetres, each frame's points follow the last frame's\n"
+             "element frame %012llu\nproperty double timestamp_s\nproperty uint points\n"
+             "element vertex %012llu\nproperty float x\nproperty float y\nproperty float z\nend_header\n",
+             (unsigned long long) frames, (unsigned long long) points);
+    return header;
+}
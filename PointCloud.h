@@ -0,0 +1,51 @@
+/* Aden Prince
+ * HiMER Lab at U. of Illinois, Chicago
+ * K4ARecorder GUI
+ *
+ * PointCloud.h
+ * Contains functions used to turn depth frames into XYZ points using the
+ * depth camera calibration K4ARecorder stores in each recording. Has no
+ * Windows or ImGui dependencies.
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// Brown-Conrady intrinsics of the depth camera, normalized to the sensor size as stored in calibration.json
+struct DepthIntrinsics {
+    double cx = 0;
+    double cy = 0;
+    double fx = 0;
+    double fy = 0;
+    double k[6] = {};
+    double codx = 0;
+    double cody = 0;
+    double p1 = 0;
+    double p2 = 0;
+    double metricRadius = 0; // Largest distortion radius the model is valid for, 0 if not stored
+};
+
+// Ray through each pixel of one depth mode, so a point is (x * depth, y * depth, depth)
+struct PointCloudLut {
+    uint32_t width = 0;
+    uint32_t height = 0;
+    std::vector<float> x;
+    std::vector<float> y;
+    std::vector<float> valid; // 1 for pixels the calibration covers, 0 for the rest
+};
+
+// Read the depth camera's intrinsics from the calibration.json attachment of a recording
+bool readDepthIntrinsics(const std::string& calibrationJson, DepthIntrinsics& intrinsics, std::string& errorText);
+// Unproject every pixel of the depth mode with the given frame size, returns false if the size is not a known depth mode
+bool buildPointCloudLut(const DepthIntrinsics& intrinsics, uint32_t width, uint32_t height, PointCloudLut& lut, std::string& errorText);
+// Convert one frame of 16-bit depth in millimetres to XYZ float triples, skipping invalid pixels, returns the number of points
+size_t depthToPoints(const PointCloudLut& lut, const uint8_t* depth, bool bigEndian, float* points);
+
+// Get the header of a binary PLY file holding one frame's points
+std::string pointCloudPlyHeader(uint64_t points, int64_t timestampNs);
+// Get the header of a binary PLY file holding every frame's points, with a fixed length so the counts can be filled in afterwards
+std::string streamedPlyHeader(uint64_t frames, uint64_t points);
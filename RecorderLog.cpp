@@ -0,0 +1,184 @@
+/* Aden Prince
+ * HiMER Lab at U. of Illinois, Chicago
+ * K4ARecorder GUI
+ *
+ * RecorderLog.cpp
+ * Contains functions used to capture K4ARecorder's output through a pipe
+ * and show it in the GUI.
+ */
+
+#include "RecorderLog.h"
+
+#include <cstring>
+
+#include "imgui.h"
+
+using namespace std;
+
+// Read K4ARecorder's output until it exits, copying it to this console and the ring buffer
+static void readPipe(RecorderLog* log) {
+    HANDLE console = GetStdHandle(STD_OUTPUT_HANDLE);
+    char chunk[4096];
+    DWORD bytesRead = 0;
+
+    // Recent output, long enough to find watched text split across reads
+    string recent;
+
+    // ReadFile fails once every write end of the pipe has been closed
+    while (ReadFile(log->pipeRead, chunk, sizeof(chunk), &bytesRead, NULL) && bytesRead > 0) {
+        auto readTime = chrono::steady_clock::now();
+
+        DWORD bytesWritten;
+        WriteFile(console, chunk, bytesRead, &bytesWritten, NULL);
+
+        if (log->watchCount > 0) {
+            recent.append(chunk, bytesRead);
+            for (int i = 0; i < log->watchCount; i++) {
+                LogWatch& watch = log->watches[i];
+                if (!watch.seen && recent.find(watch.text) != string::npos) {
+                    watch.time = readTime;
+                    watch.seen = true;
+                }
+            }
+            if (recent.length() > 256) {
+                recent.erase(0, recent.length() - 256);
+            }
+        }
+
+        // Wait for the GUI thread to make space instead of dropping output, unless the GUI thread is waiting to join this one
+        size_t pushed = 0;
+        while (pushed < bytesRead && !log->stopping) {
+            pushed += log->buffer.push(chunk + pushed, bytesRead - pushed);
+            if (pushed < bytesRead) {
+                Sleep(1);
+            }
+        }
+    }
+
+    log->readerFinished = true;
+}
+
+// Add a complete line to the log, replacing the oldest line once the log is full
+static void addLine(RecorderLog& log, string& line) {
+    if (log.lines.size() < maxLogLines) {
+        log.lines.push_back(line);
+    }
+    else {
+        log.lines[log.firstLine].swap(line);
+        log.firstLine = (log.firstLine + 1) % maxLogLines;
+    }
+    line.clear();
+}
+
+// Create the output pipe and start reading from it, returns the write end to give to K4ARecorder
+bool startLogCapture(RecorderLog& log, HANDLE& childOutput) {
+    stopLogCapture(log);
+
+    // Only the write end is inherited by K4ARecorder
+    SECURITY_ATTRIBUTES sa = {sizeof(SECURITY_ATTRIBUTES), NULL, TRUE};
+    if (!CreatePipe(&log.pipeRead, &childOutput, &sa, 0)) {
+        log.pipeRead = NULL;
+        return false;
+    }
+    SetHandleInformation(log.pipeRead, HANDLE_FLAG_INHERIT, 0);
+
+    for (int i = 0; i < log.watchCount; i++) {
+        log.watches[i].seen = false;
+    }
+
+    log.readerFinished = false;
+    log.stopping = false;
+    log.readerThread = thread(readPipe, &log);
+    return true;
+}
+
+// Look for text in the next capture, returns its watch slot or -1 if every slot is used
+int watchLog(RecorderLog& log, const char* text) {
+    for (int i = 0; i < log.watchCount; i++) {
+        if (strcmp(log.watches[i].text, text) == 0) {
+            return i;
+        }
+    }
+    if (log.watchCount == maxLogWatches) {
+        return -1;
+    }
+    log.watches[log.watchCount].text = text;
+    log.watches[log.watchCount].seen = false;
+    return log.watchCount++;
+}
+
+// Check if a watched text has appeared yet, and get the time it was read
+bool watchSeen(const RecorderLog& log, int watch, chrono::steady_clock::time_point* time) {
+    if (watch < 0 || watch >= log.watchCount || !log.watches[watch].seen) {
+        return false;
+    }
+    if (time != nullptr) {
+        *time = log.watches[watch].time;
+    }
+    return true;
+}
+
+// Move captured output into the log lines, never blocks
+void drainLog(RecorderLog& log) {
+    char chunk[4096];
+    size_t count;
+
+    while ((count = log.buffer.pop(chunk, sizeof(chunk))) > 0) {
+        for (size_t i = 0; i < count; i++) {
+            char c = chunk[i];
+            if (c == '\n') {
+                addLine(log, log.currentLine);
+            }
+            else if (c == '\r') {
+                // Progress updates rewrite the current line
+                log.currentLine.clear();
+            }
+            else if (log.currentLine.length() < maxLogLineLength) {
+                log.currentLine += c;
+            }
+        }
+    }
+
+    // The reader thread has already returned, so joining here does not wait
+    if (log.readerFinished && log.readerThread.joinable() && log.buffer.empty()) {
+        stopLogCapture(log);
+    }
+}
+
+// Show the log lines, drawing only the lines that are visible
+void showLogPane(RecorderLog& log) {
+    ImGui::Checkbox("Scroll to end", &log.autoScroll);
+    ImGui::BeginChild("Recorder output", ImVec2(0, ImGui::GetTextLineHeightWithSpacing() * 10), true, ImGuiWindowFlags_HorizontalScrollbar);
+
+    int lineCount = (int) log.lines.size();
+    bool showCurrentLine = log.currentLine.empty() == false;
+
+    ImGuiListClipper clipper;
+    clipper.Begin(lineCount + (showCurrentLine ? 1 : 0));
+    while (clipper.Step()) {
+        for (int i = clipper.DisplayStart; i < clipper.DisplayEnd; i++) {
+            const string& line = (i < lineCount) ? log.lines[(log.firstLine + i) % log.lines.size()] : log.currentLine;
+            ImGui::TextUnformatted(line.c_str(), line.c_str() + line.length());
+        }
+    }
+    clipper.End();
+
+    if (log.autoScroll && ImGui::GetScrollY() < ImGui::GetScrollMaxY()) {
+        ImGui::SetScrollHereY(1.0f);
+    }
+
+    ImGui::EndChild();
+}
+
+// Wait for the reader thread and close the pipe
+void stopLogCapture(RecorderLog& log) {
+    // Nothing drains the buffer while this thread waits, so a reader stuck on a full buffer would never return
+    log.stopping = true;
+    if (log.readerThread.joinable()) {
+        log.readerThread.join();
+    }
+    if (log.pipeRead != NULL) {
+        CloseHandle(log.pipeRead);
+        log.pipeRead = NULL;
+    }
+}
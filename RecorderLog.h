@@ -0,0 +1,70 @@
+/* Aden Prince
+ * HiMER Lab at U. of Illinois, Chicago
+ * K4ARecorder GUI
+ *
+ * RecorderLog.h
+ * Contains the state and functions used to capture K4ARecorder's output
+ * through a pipe and show it in the GUI.
+ */
+
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <Windows.h>
+
+#include "RingBuffer.h"
+
+// Most lines kept in the log pane, older lines are dropped
+const size_t maxLogLines = 4096;
+// Longest line kept in the log pane, longer lines are cut off
+const size_t maxLogLineLength = 256;
+
+// Most pieces of text that can be watched for in one log
+const int maxLogWatches = 4;
+
+// Text looked for in K4ARecorder's output by the reader thread, so it is timestamped as soon as it arrives
+struct LogWatch {
+    const char* text = nullptr;
+    std::atomic<bool> seen{false};
+    std::chrono::steady_clock::time_point time;
+};
+
+// Output captured from K4ARecorder
+struct RecorderLog {
+    // Filled by the pipe reader thread, emptied by the GUI thread
+    SpscRingBuffer<char, 65536> buffer;
+    std::thread readerThread;
+    std::atomic<bool> readerFinished{false};
+    std::atomic<bool> stopping{false}; // Set by stopLogCapture so the reader drops output instead of waiting for space
+    HANDLE pipeRead = NULL;
+
+    // Set with watchLog before capture starts, checked with watchSeen
+    LogWatch watches[maxLogWatches];
+    int watchCount = 0;
+
+    // Complete lines, used as a ring of maxLogLines entries starting at firstLine
+    std::vector<std::string> lines;
+    size_t firstLine = 0;
+    // Line that has not been ended with a newline yet
+    std::string currentLine;
+
+    bool autoScroll = true;
+};
+
+// Create the output pipe and start reading from it, returns the write end to give to K4ARecorder
+bool startLogCapture(RecorderLog& log, HANDLE& childOutput);
+// Look for text in the next capture, returns its watch slot or -1 if every slot is used
+int watchLog(RecorderLog& log, const char* text);
+// Check if a watched text has appeared yet, and get the time it was read
+bool watchSeen(const RecorderLog& log, int watch, std::chrono::steady_clock::time_point* time = nullptr);
+// Move captured output into the log lines, never blocks
+void drainLog(RecorderLog& log);
+// Show the log lines, drawing only the lines that are visible
+void showLogPane(RecorderLog& log);
+// Wait for the reader thread and close the pipe
+void stopLogCapture(RecorderLog& log);
@@ -0,0 +1,319 @@
+/* Aden Prince
+ * HiMER Lab at U. of Illinois, Chicago
+ * K4ARecorder GUI
+ *
+ * RecorderOptions.cpp
+ * Contains functions that turn recorder options into K4ARecorder
+ * arguments, check them for errors and read them from the command line.
+ */
+
+#include "RecorderOptions.h"
+
+#include <cctype>
+#include <climits>
+#include <cstdlib>
+#include <fstream>
+
+using namespace std;
+
+static_assert(!supportsFrameRate(colorModeTable[8].frameRates, 2), "3072p does not support 30 FPS");
+static_assert(!supportsFrameRate(depthModeTable[2].frameRates, 2), "WFOV_UNBINNED does not support 30 FPS");
+
+const char* const external_sync_modes[3] = {"Standalone", "Subordinate", "Master"};
+
+// Check if a file exists with the passed filename
+bool fileExists(string filename) {
+    ifstream inputFile;
+    inputFile.open(filename);
+    bool isOpen = inputFile.is_open();
+    inputFile.close();
+    return isOpen;
+}
+
+// Compare two strings ignoring case, as K4ARecorder does for mode names
+static bool equalsIgnoreCase(const string& a, const char* b) {
+    size_t i = 0;
+    for (; i < a.length() && b[i] != '\0'; i++) {
+        if (tolower((unsigned char) a[i]) != tolower((unsigned char) b[i])) {
+            return false;
+        }
+    }
+    return i == a.length() && b[i] == '\0';
+}
+
+// Find the index of value in a table of option strings or modes, or -1 if it is not there
+template <typename T>
+static const char* entryName(const T& entry) {
+    return entry.name;
+}
+static const char* entryName(const char* entry) {
+    return entry;
+}
+
+template <typename T>
+static int findIndex(const string& value, const T table[], int tableSize) {
+    for (int i = 0; i < tableSize; i++) {
+        if (equalsIgnoreCase(value, entryName(table[i]))) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+// Read a whole base-10 integer, returns false if value contains anything else
+static bool parseInt(const string& value, int& result) {
+    if (value.empty()) {
+        return false;
+    }
+    // long is 32 bits on Windows, where strtol would clamp out-of-range values to INT_MAX instead of failing
+    char* end = nullptr;
+    long long parsed = strtoll(value.c_str(), &end, 10);
+    if (*end != '\0' || parsed < INT_MIN || parsed > INT_MAX) {
+        return false;
+    }
+    result = (int) parsed;
+    return true;
+}
+
+// Get the expected bytes written per second by K4ARecorder with the passed options
+double expectedBytesPerSecond(const RecorderOptions& options) {
+    const CameraModeInfo& color = colorModeTable[options.color_mode_index];
+    const CameraModeInfo& depth = depthModeTable[options.depth_mode_index];
+    double bytesPerSecond = (double) (color.bytesPerFrame + depth.bytesPerFrame) * frameRateTable[options.frame_rate_index].fps;
+
+    if (options.imu_recording_mode) {
+        bytesPerSecond += imuBytesPerSecond;
+    }
+    return bytesPerSecond;
+}
+
+// Build the K4ARecorder command-line arguments for the passed options
+string buildArgs(const RecorderOptions& options) {
+    if (options.print_help) {
+        return " --help";
+    }
+    if (options.list_devices) {
+        return " --list";
+    }
+
+    string argsStr;
+
+    argsStr += " --imu";
+    if (options.imu_recording_mode) {
+        argsStr += " ON";
+    }
+    else {
+        argsStr += " OFF";
+    }
+
+    if (options.record_for_time) {
+        argsStr += " --record-length " + to_string(options.recording_time);
+    }
+
+    argsStr += " --depth-delay " + to_string(options.depth_delay);
+    argsStr += " --color-mode " + string(colorModeTable[options.color_mode_index].name);
+    argsStr += " --depth-mode " + string(depthModeTable[options.depth_mode_index].name);
+    argsStr += " --rate " + string(frameRateTable[options.frame_rate_index].name);
+
+    if (options.manual_exposure) {
+        argsStr += " --exposure-control " + to_string(options.exposure_value);
+    }
+
+    if (options.manual_gain) {
+        argsStr += " --gain " + to_string(options.gain_value);
+    }
+
+    argsStr += " --external-sync " + string(external_sync_modes[options.external_sync_mode_index]);
+    argsStr += " --sync-delay " + to_string(options.external_sync_delay);
+    argsStr += " --device " + to_string(options.device_index);
+    argsStr += " " + options.output_filename;
+
+    return argsStr;
+}
+
+// Append an error line for every invalid option, returns true if there are none
+bool validateOptions(const RecorderOptions& options, const string& recorderPathStr, string& errorText) {
+    bool valid = true;
+
+    // Help and device listing ignore every other option
+    if (options.print_help || options.list_devices) {
+        if (fileExists(recorderPathStr) == false) {
+            errorText += "ERROR: Recorder file path \"" + recorderPathStr + "\" not found\n";
+            valid = false;
+        }
+        return valid;
+    }
+
+    if (options.record_for_time && options.recording_time < 0) {
+        errorText += "ERROR: Recording length cannot be negative\n";
+        valid = false;
+    }
+
+    const CameraModeInfo& color = colorModeTable[options.color_mode_index];
+    const CameraModeInfo& depth = depthModeTable[options.depth_mode_index];
+    const char* frameRate = frameRateTable[options.frame_rate_index].name;
+
+    if (!supportsFrameRate(color.frameRates, options.frame_rate_index)) {
+        errorText += "ERROR: Color mode " + string(color.name) + " does not support " + frameRate + " FPS\n";
+        valid = false;
+    }
+
+    if (!supportsFrameRate(depth.frameRates, options.frame_rate_index)) {
+        errorText += "ERROR: Depth mode " + string(depth.name) + " does not support " + frameRate + " FPS\n";
+        valid = false;
+    }
+
+    if (color.bytesPerFrame == 0 && depth.bytesPerFrame == 0) {
+        errorText += "ERROR: Color mode and depth mode cannot both be OFF\n";
+        valid = false;
+    }
+
+    if (options.exposure_value < -11 || options.exposure_value > 200000) {
+        errorText += "ERROR: Exposure value must be between -11 and 200,000\n";
+        valid = false;
+    }
+
+    if (options.gain_value < 0 || options.gain_value > 255) {
+        errorText += "ERROR: Gain value must be between 0 and 255\n";
+        valid = false;
+    }
+
+    if (options.device_index < 0 || options.device_index > 255) {
+        errorText += "ERROR: Device index must be between 0 and 255\n";
+        valid = false;
+    }
+
+    if (options.external_sync_delay < 0) {
+        errorText += "ERROR: External sync delay cannot be negative\n";
+        valid = false;
+    }
+
+    if (fileExists(recorderPathStr) == false) {
+        errorText += "ERROR: Recorder file path \"" + recorderPathStr + "\" not found\n";
+        valid = false;
+    }
+
+    // Check if there are no non-space characters in the output filename
+    if (options.output_filename.find_first_not_of(' ') == string::npos) {
+        errorText += "ERROR: Output filename is empty\n";
+        valid = false;
+    }
+    else if (fileExists(options.output_filename)) {
+        errorText += "ERROR: Output file \"" + options.output_filename + "\" already exists\n";
+        valid = false;
+    }
+
+    return valid;
+}
+
+// Fill options from K4ARecorder-style command-line arguments, returns false on unknown or malformed arguments
+bool parseCommandLine(int argc, char* argv[], RecorderOptions& options, string& recorderPathStr, string& errorText) {
+    bool valid = true;
+
+    for (int i = 1; i < argc; i++) {
+        string arg = argv[i];
+
+        // Options handled before parsing or without a value
+        if (arg == "--headless") {
+            continue;
+        }
+        if (arg == "-h" || arg == "--help") {
+            options.print_help = true;
+            continue;
+        }
+        if (arg == "--list") {
+            options.list_devices = true;
+            continue;
+        }
+
+        // Every other option starting with a dash takes a value
+        if (arg.length() > 1 && arg[0] == '-') {
+            if (i + 1 >= argc) {
+                errorText += "ERROR: Missing value for " + arg + "\n";
+                valid = false;
+                break;
+            }
+            string value = argv[++i];
+            bool badValue = false;
+
+            if (arg == "--imu") {
+                if (equalsIgnoreCase(value, "ON")) {
+                    options.imu_recording_mode = true;
+                }
+                else if (equalsIgnoreCase(value, "OFF")) {
+                    options.imu_recording_mode = false;
+                }
+                else {
+                    badValue = true;
+                }
+            }
+            else if (arg == "-l" || arg == "--record-length") {
+                options.record_for_time = true;
+                badValue = !parseInt(value, options.recording_time);
+            }
+            else if (arg == "--depth-delay") {
+                badValue = !parseInt(value, options.depth_delay);
+            }
+            else if (arg == "-c" || arg == "--color-mode") {
+                options.color_mode_index = findIndex(value, colorModeTable, colorModeCount);
+                badValue = options.color_mode_index < 0;
+            }
+            else if (arg == "-d" || arg == "--depth-mode") {
+                options.depth_mode_index = findIndex(value, depthModeTable, depthModeCount);
+                badValue = options.depth_mode_index < 0;
+            }
+            else if (arg == "-r" || arg == "--rate") {
+                options.frame_rate_index = findIndex(value, frameRateTable, frameRateCount);
+                badValue = options.frame_rate_index < 0;
+            }
+            else if (arg == "-e" || arg == "--exposure-control") {
+                options.manual_exposure = true;
+                badValue = !parseInt(value, options.exposure_value);
+            }
+            else if (arg == "-g" || arg == "--gain") {
+                options.manual_gain = true;
+                badValue = !parseInt(value, options.gain_value);
+            }
+            else if (arg == "--external-sync") {
+                options.external_sync_mode_index = findIndex(value, external_sync_modes, 3);
+                badValue = options.external_sync_mode_index < 0;
+            }
+            else if (arg == "--sync-delay") {
+                badValue = !parseInt(value, options.external_sync_delay);
+            }
+            else if (arg == "--device") {
+                badValue = !parseInt(value, options.device_index);
+            }
+            else if (arg == "--recorder-path") {
+                recorderPathStr = value;
+            }
+            else {
+                errorText += "ERROR: Unknown option " + arg + "\n";
+                valid = false;
+                continue;
+            }
+
+            if (badValue) {
+                errorText += "ERROR: Invalid value \"" + value + "\" for " + arg + "\n";
+                valid = false;
+
+                // Keep indices in range so the options can still be displayed
+                if (options.color_mode_index < 0) options.color_mode_index = 3;
+                if (options.depth_mode_index < 0) options.depth_mode_index = 4;
+                if (options.frame_rate_index < 0) options.frame_rate_index = 2;
+                if (options.external_sync_mode_index < 0) options.external_sync_mode_index = 0;
+            }
+            continue;
+        }
+
+        // The only positional argument is the output filename
+        if (options.output_filename.empty() == false) {
+            errorText += "ERROR: Unexpected argument \"" + arg + "\"\n";
+            valid = false;
+            continue;
+        }
+        options.output_filename = arg;
+    }
+
+    return valid;
+}
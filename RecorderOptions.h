@@ -0,0 +1,120 @@
+/* Aden Prince
+ * HiMER Lab at U. of Illinois, Chicago
+ * K4ARecorder GUI
+ *
+ * RecorderOptions.h
+ * Contains the K4ARecorder option model shared by the GUI and the
+ * headless command-line mode, along with its argument builder and
+ * validator. Has no Windows or ImGui dependencies.
+ */
+
+#pragma once
+
+#include <string>
+
+// Frame rates a mode supports, one bit per entry of frameRateTable
+const int fps5 = 1;
+const int fps15 = 2;
+const int fps30 = 4;
+const int fpsAll = fps5 | fps15 | fps30;
+
+// Typical size of an MJPG color frame, K4ARecorder does not choose the compression ratio
+constexpr int mjpgFrameBytes(int width, int height) {
+    return width * height * 3 / 20;
+}
+
+struct FrameRateInfo {
+    const char* name;
+    int fps;
+};
+
+// Depth modes also record an IR image of the same size, which is included in bytesPerFrame
+struct CameraModeInfo {
+    const char* name;
+    int width;
+    int height;
+    const char* format;
+    int bytesPerFrame;
+    int frameRates;
+};
+
+// Modes passed to K4ARecorder, in the order shown in the GUI
+constexpr FrameRateInfo frameRateTable[] = {
+    {"5", 5},
+    {"15", 15},
+    {"30", 30}
+};
+
+constexpr CameraModeInfo colorModeTable[] = {
+    {"OFF",       0,    0,    "",     0,                          fpsAll},
+    {"720p_YUY2", 1280, 720,  "YUY2", 1280 * 720 * 2,             fpsAll},
+    {"720p_NV12", 1280, 720,  "NV12", 1280 * 720 * 3 / 2,         fpsAll},
+    {"720p",      1280, 720,  "MJPG", mjpgFrameBytes(1280, 720),  fpsAll},
+    {"1080p",     1920, 1080, "MJPG", mjpgFrameBytes(1920, 1080), fpsAll},
+    {"1440p",     2560, 1440, "MJPG", mjpgFrameBytes(2560, 1440), fpsAll},
+    {"1536p",     2048, 1536, "MJPG", mjpgFrameBytes(2048, 1536), fpsAll},
+    {"2160p",     3840, 2160, "MJPG", mjpgFrameBytes(3840, 2160), fpsAll},
+    {"3072p",     4096, 3072, "MJPG", mjpgFrameBytes(4096, 3072), fps5 | fps15}
+};
+
+constexpr CameraModeInfo depthModeTable[] = {
+    {"OFF",            0,    0,    "",    0,                      fpsAll},
+    {"PASSIVE_IR",     1024, 1024, "Y16", 1024 * 1024 * 2,        fpsAll},
+    {"WFOV_UNBINNED",  1024, 1024, "Y16", 1024 * 1024 * 2 * 2,    fps5 | fps15},
+    {"WFOV_2X2BINNED", 512,  512,  "Y16", 512 * 512 * 2 * 2,      fpsAll},
+    {"NFOV_UNBINNED",  640,  576,  "Y16", 640 * 576 * 2 * 2,      fpsAll},
+    {"NFOV_2X2BINNED", 320,  288,  "Y16", 320 * 288 * 2 * 2,      fpsAll}
+};
+
+constexpr int frameRateCount = sizeof(frameRateTable) / sizeof(frameRateTable[0]);
+constexpr int colorModeCount = sizeof(colorModeTable) / sizeof(colorModeTable[0]);
+constexpr int depthModeCount = sizeof(depthModeTable) / sizeof(depthModeTable[0]);
+
+// IMU samples are recorded at 1.6 kHz, about 48 bytes each with block overhead
+const int imuBytesPerSecond = 1600 * 48;
+
+extern const char* const external_sync_modes[3];
+
+// Every option that can be passed to K4ARecorder
+struct RecorderOptions {
+    // Print help or list devices instead of recording
+    bool print_help = false;
+    bool list_devices = false;
+
+    // Recording options
+    bool imu_recording_mode = false;
+    bool record_for_time = false;
+    int recording_time = 0;
+    int depth_delay = 0;
+
+    // Camera options
+    int color_mode_index = 3; // Default color mode is 720p
+    int depth_mode_index = 4; // Default depth mode is NFOV_UNBINNED
+    int frame_rate_index = 2; // Default frame rate is 30 FPS
+    bool manual_exposure = false;
+    bool manual_gain = false;
+    int exposure_value = 0;
+    int gain_value = 0;
+
+    // Multiple device options
+    int external_sync_mode_index = 0; // Default external sync mode is Standalone
+    int external_sync_delay = 0;
+    int device_index = 0;
+
+    std::string output_filename;
+};
+
+// Check if a color mode or depth mode supports the selected frame rate
+constexpr bool supportsFrameRate(int modeFrameRates, int frameRateIndex) {
+    return (modeFrameRates & (1 << frameRateIndex)) != 0;
+}
+// Get the expected bytes written per second by K4ARecorder with the passed options
+double expectedBytesPerSecond(const RecorderOptions& options);
+// Check if a file exists with the passed filename
+bool fileExists(std::string filename);
+// Build the K4ARecorder command-line arguments for the passed options
+std::string buildArgs(const RecorderOptions& options);
+// Append an error line for every invalid option, returns true if there are none
+bool validateOptions(const RecorderOptions& options, const std::string& recorderPathStr, std::string& errorText);
+// Fill options from K4ARecorder-style command-line arguments, returns false on unknown or malformed arguments
+bool parseCommandLine(int argc, char* argv[], RecorderOptions& options, std::string& recorderPathStr, std::string& errorText);
@@ -0,0 +1,100 @@
+/* Aden Prince
+ * HiMER Lab at U. of Illinois, Chicago
+ * K4ARecorder GUI
+ *
+ * RecorderProcess.cpp
+ * Contains functions used to find and start the K4ARecorder executable.
+ *
+ * CreateProcess code obtained from: https://docs.microsoft.com/en-us/windows/win32/procthread/creating-processes
+ */
+
+#include "RecorderProcess.h"
+
+using namespace std;
+
+// Find k4arecorder.exe in the newest Azure Kinect SDK folder in Program Files
+string detectRecorderPath() {
+    string recorderPathStr;
+
+    // Detect Azure Kinect SDK folder in Program Files
+    WIN32_FIND_DATAA SDKFolderData;
+    HANDLE SDKFolderHandle;
+    bool SDKFolderFound = false;
+
+    SDKFolderHandle = FindFirstFileA("C:\\Program Files\\Azure Kinect SDK*", &SDKFolderData);
+
+    if(SDKFolderHandle != INVALID_HANDLE_VALUE) {
+        SDKFolderFound = true;
+        FindClose(SDKFolderHandle);
+    }
+
+    // Set recorder path string to folder name
+    if(SDKFolderFound) {
+        recorderPathStr = SDKFolderData.cFileName;
+    }
+    else {
+        // Set to latest version (at time of writing) if SDK folder not found
+        recorderPathStr = "Azure Kinect SDK v1.4.1";
+    }
+
+    // Set full path for K4ARecorder executable
+    return "C:\\Program Files\\" + recorderPathStr + "\\tools\\k4arecorder.exe";
+}
+
+// Start K4ARecorder with the passed arguments, returns false if CreateProcess failed.
+// If outputPipe is set, K4ARecorder's stdout and stderr are written to it instead of the console.
+bool startRecorderProcess(const string& recorderPathStr, const string& argsStr, PROCESS_INFORMATION& pi, HANDLE outputPipe) {
+    STARTUPINFO si;
+
+    ZeroMemory(&si, sizeof(si));
+    si.cb = sizeof(si);
+    ZeroMemory(&pi, sizeof(pi));
+
+    // Redirect output to the pipe, keeping the console as input so Ctrl+C still reaches K4ARecorder
+    if(outputPipe != NULL) {
+        si.dwFlags |= STARTF_USESTDHANDLES;
+        si.hStdInput = GetStdHandle(STD_INPUT_HANDLE);
+        si.hStdOutput = outputPipe;
+        si.hStdError = outputPipe;
+    }
+
+    // Copy arguments to LPWSTR variable to be passed to CreateProcess
+    wstring argsWStr(argsStr.length(), L' ');
+    copy(argsStr.begin(), argsStr.end(), argsWStr.begin());
+    LPWSTR args = const_cast<LPWSTR>(argsWStr.c_str());
+
+    // Copy recorder file path to LPCWSTR variable to be passed to CreateProcess
+    wstring recorderPathWStr(recorderPathStr.length(), L' ');
+    copy(recorderPathStr.begin(), recorderPathStr.end(), recorderPathWStr.begin());
+    LPCWSTR recorderPathArg = const_cast<LPCWSTR>(recorderPathWStr.c_str());
+
+    // Start K4ARecorder process
+    if(!CreateProcess(recorderPathArg,   // Program file
+        args,           // Command line
+        NULL,           // Process handle not inheritable
+        NULL,           // Thread handle not inheritable
+        outputPipe != NULL, // Inherit the output pipe if there is one
+        0,              // No creation flags
+        NULL,           // Use parent's environment block
+        NULL,           // Use parent's starting directory
+        &si,            // Pointer to STARTUPINFO structure
+        &pi)            // Pointer to PROCESS_INFORMATION structure
+        ) {
+        printf("CreateProcess failed (%d).\n", GetLastError());
+        return false;
+    }
+
+    return true;
+}
+
+// Send Ctrl+C to every K4ARecorder sharing this console so they finish their files,
+// ignoring it in this process until restoreInterruptHandling is called
+void interruptRecorders() {
+    SetConsoleCtrlHandler(NULL, TRUE);
+    GenerateConsoleCtrlEvent(CTRL_C_EVENT, 0);
+}
+
+// Handle Ctrl+C normally again once interrupted recorders have exited
+void restoreInterruptHandling() {
+    SetConsoleCtrlHandler(NULL, FALSE);
+}
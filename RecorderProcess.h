@@ -0,0 +1,24 @@
+/* Aden Prince
+ * HiMER Lab at U. of Illinois, Chicago
+ * K4ARecorder GUI
+ *
+ * RecorderProcess.h
+ * Contains functions used to find and start the K4ARecorder executable.
+ */
+
+#pragma once
+
+#include <string>
+
+#include <Windows.h>
+
+// Find k4arecorder.exe in the newest Azure Kinect SDK folder in Program Files
+std::string detectRecorderPath();
+// Start K4ARecorder with the passed arguments, returns false if CreateProcess failed.
+// If outputPipe is set, K4ARecorder's stdout and stderr are written to it instead of the console.
+bool startRecorderProcess(const std::string& recorderPathStr, const std::string& argsStr, PROCESS_INFORMATION& pi, HANDLE outputPipe = NULL);
+// Send Ctrl+C to every K4ARecorder sharing this console so they finish their files,
+// ignoring it in this process until restoreInterruptHandling is called
+void interruptRecorders();
+// Handle Ctrl+C normally again once interrupted recorders have exited
+void restoreInterruptHandling();
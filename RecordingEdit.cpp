@@ -0,0 +1,474 @@
+/* Aden Prince
+ * HiMER Lab at U. of Illinois, Chicago
+ * K4ARecorder GUI
+ *
+ * RecordingEdit.cpp
+ * Contains functions used to cut and join recordings.
+ */
+
+#include "RecordingEdit.h"
+#include "MappedFile.h"
+#include "MatroskaParser.h"
+#include "MatroskaWriter.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+
+#include <Windows.h>
+
+using namespace std;
+
+// A recording being copied and how far its timestamps move, in TimestampScale units
+struct EditSource {
+    string filename;
+    MappedFile mapped;
+    MatroskaFile file;
+    vector<ClusterInfo> clusters;
+    int64_t shift = 0;
+};
+
+// Write the buffered bytes of an output to its file
+void flushEditOutput(EditOutput& out) {
+    DWORD bytesWritten = 0;
+    if (out.buffer.empty() == false && !out.failed) {
+        out.failed = !WriteFile(out.file, out.buffer.data(), (DWORD) out.buffer.size(), &bytesWritten, NULL) || bytesWritten != out.buffer.size();
+    }
+    out.buffer.clear();
+}
+
+// Append bytes to an output, writing long spans from where they are without copying them into the buffer
+void appendEditBytes(EditOutput& out, const uint8_t* data, uint64_t size) {
+    out.position += size;
+    if (size < editDirectWriteBytes) {
+        out.buffer.insert(out.buffer.end(), data, data + size);
+        if (out.buffer.size() >= editBufferBytes) {
+            flushEditOutput(out);
+        }
+        return;
+    }
+
+    flushEditOutput(out);
+    for (uint64_t done = 0; done < size && !out.failed; done += editMaxWriteBytes) {
+        DWORD length = (DWORD) min(size - done, editMaxWriteBytes);
+        DWORD bytesWritten = 0;
+        out.failed = !WriteFile(out.file, data + done, length, &bytesWritten, NULL) || bytesWritten != length;
+    }
+    out.bytesCopied += size;
+}
+
+static void appendEditBytes(EditOutput& out, const vector<uint8_t>& bytes) {
+    appendEditBytes(out, bytes.data(), bytes.size());
+}
+
+// Write bytes at an offset of a file without moving its file pointer
+bool writeEditAt(HANDLE file, uint64_t offset, const vector<uint8_t>& bytes) {
+    OVERLAPPED overlapped = {};
+    overlapped.Offset = (DWORD) offset;
+    overlapped.OffsetHigh = (DWORD) (offset >> 32);
+
+    DWORD bytesWritten = 0;
+    return WriteFile(file, bytes.data(), (DWORD) bytes.size(), &bytesWritten, &overlapped) && bytesWritten == bytes.size();
+}
+
+// Map a recording and list its clusters, returns false if it cannot be read or was cut off
+static bool openSource(const string& filename, EditSource& source, string& errorText) {
+    source.filename = filename;
+    if (!openMappedFile(filename, source.mapped, errorText)) {
+        return false;
+    }
+    if (!parseMatroskaHeaders(source.mapped.data, source.mapped.length, source.file, errorText)) {
+        return false;
+    }
+
+    uint64_t offset = 0;
+    ClusterInfo cluster;
+    while (nextCluster(source.file, offset, cluster)) {
+        if (!cluster.complete) {
+            errorText += "ERROR: \"" + filename + "\" was cut off inside a cluster, repair it with --repair first\n";
+            return false;
+        }
+        source.clusters.push_back(cluster);
+    }
+    if (source.clusters.empty()) {
+        errorText += "ERROR: \"" + filename + "\" has no clusters\n";
+        return false;
+    }
+    return true;
+}
+
+// Check that a recording can be joined after the first, its tracks must be the same down to their codec data
+static bool compatibleSource(const EditSource& first, const EditSource& source, EditResult& result, string& errorText) {
+    const MatroskaFile& a = first.file;
+    const MatroskaFile& b = source.file;
+    bool same = a.timestampScale == b.timestampScale && a.tracks.size() == b.tracks.size();
+    for (size_t i = 0; same && i < a.tracks.size(); i++) {
+        const TrackInfo& x = a.tracks[i];
+        const TrackInfo& y = b.tracks[i];
+        same = x.number == y.number && x.name == y.name && x.codecId == y.codecId && x.width == y.width && x.height == y.height &&
+               x.codecPrivateSize == y.codecPrivateSize && memcmp(a.data + x.codecPrivateOffset, b.data + y.codecPrivateOffset, (size_t) x.codecPrivateSize) == 0;
+    }
+    if (!same) {
+        errorText += "ERROR: \"" + source.filename + "\" was not recorded with the same modes as \"" + first.filename + "\"\n";
+        return false;
+    }
+
+    for (const AttachmentInfo& x : a.attachments) {
+        for (const AttachmentInfo& y : b.attachments) {
+            if (x.name == "calibration.json" && y.name == x.name &&
+                (x.size != y.size || memcmp(a.data + x.dataOffset, b.data + y.dataOffset, (size_t) x.size) != 0)) {
+                result.warningText += "WARNING: \"" + source.filename + "\" is from another device, the calibration of \"" + first.filename + "\" is kept\n";
+            }
+        }
+    }
+    return true;
+}
+
+// Get the typical step between clusters, K4ARecorder writes one cluster per capture so it is the frame period
+static int64_t clusterStep(const EditSource& source) {
+    vector<int64_t> steps;
+    for (size_t i = 1; i < source.clusters.size(); i++) {
+        steps.push_back(source.clusters[i].timestamp - source.clusters[i - 1].timestamp);
+    }
+    if (steps.empty()) {
+        return 1;
+    }
+    nth_element(steps.begin(), steps.begin() + steps.size() / 2, steps.end());
+    return max(steps[steps.size() / 2], (int64_t) 1);
+}
+
+// Copy a SimpleTag, or a Tag or Tags element holding one, with the K4A_START_OFFSET_NS value lowered by shiftNs
+static void appendShiftedTag(vector<uint8_t>& out, const MatroskaFile& file, const EbmlElement& element, int64_t shiftNs) {
+    if (element.id != tagsId && element.id != tagId && element.id != simpleTagId) {
+        out.insert(out.end(), file.data + element.offset, file.data + element.dataOffset + element.size);
+        return;
+    }
+
+    // A SimpleTag is only changed if it is the start offset
+    bool startOffset = false;
+    uint64_t end = element.dataOffset + element.size;
+    EbmlElement child;
+    if (element.id == simpleTagId) {
+        for (uint64_t offset = element.dataOffset; readElement(file.data, offset, end, child) && child.size != unknownElementSize &&
+             child.size <= end - child.dataOffset; offset = child.dataOffset + child.size) {
+            startOffset = startOffset || (child.id == tagNameId && readString(file.data, child, end) == "K4A_START_OFFSET_NS");
+        }
+    }
+
+    vector<uint8_t> children;
+    for (uint64_t offset = element.dataOffset; readElement(file.data, offset, end, child) && child.size != unknownElementSize &&
+         child.size <= end - child.dataOffset; offset = child.dataOffset + child.size) {
+        if (startOffset && child.id == tagStringId) {
+            writeStringElement(children, tagStringId, to_string(strtoll(readString(file.data, child, end).c_str(), nullptr, 10) - shiftNs));
+        }
+        else if (element.id != simpleTagId) {
+            appendShiftedTag(children, file, child, shiftNs);
+        }
+        else {
+            children.insert(children.end(), file.data + child.offset, file.data + child.dataOffset + child.size);
+        }
+    }
+    writeMasterElement(out, element.id, children);
+}
+
+// Copy a top-level element before or after the clusters, returns false for ones rebuilt or dropped
+static bool appendTopLevelElement(EditOutput& out, const EditSource& source, const EbmlElement& element, uint64_t& durationOffset, vector<SeekEntry>& seekEntries,
+                                  uint64_t segmentDataOffset) {
+    const MatroskaFile& file = source.file;
+    if (element.id == seekHeadId || element.id == cuesId || element.id == voidId || element.id == crc32Id || element.id == clusterId) {
+        return false;
+    }
+
+    SeekEntry entry;
+    entry.id = element.id;
+    entry.position = out.position - segmentDataOffset;
+    seekEntries.push_back(entry);
+
+    if (element.id == tagsId) {
+        // Timestamps move by shift, moving the start offset the other way keeps every device timestamp the same
+        vector<uint8_t> tags;
+        appendShiftedTag(tags, file, element, scaleTimestamp(source.shift, file.timestampScale));
+        appendEditBytes(out, tags);
+        return true;
+    }
+    if (element.id == infoId && file.durationOffset != 0) {
+        // The duration is written once the last cluster is known
+        EbmlElement duration;
+        readElement(file.data, file.durationOffset, element.dataOffset + element.size, duration);
+        durationOffset = out.position + (duration.dataOffset - element.offset);
+    }
+    appendEditBytes(out, file.data + element.offset, element.dataOffset + element.size - element.offset);
+    return true;
+}
+
+// Copy the top-level elements in a range of the first source, stopping at the first cluster
+static void appendTopLevelRange(EditOutput& out, const EditSource& source, uint64_t begin, uint64_t end, uint64_t& durationOffset,
+                                vector<SeekEntry>& seekEntries, uint64_t segmentDataOffset) {
+    const MatroskaFile& file = source.file;
+    EbmlElement element;
+    for (uint64_t offset = begin; offset < end && readElement(file.data, offset, end, element); offset = element.dataOffset + element.size) {
+        if (element.size == unknownElementSize || element.size > end - element.dataOffset) {
+            break;
+        }
+        if (element.id != clusterId) {
+            appendTopLevelElement(out, source, element, durationOffset, seekEntries, segmentDataOffset);
+        }
+    }
+}
+
+// Append a cluster with its timestamp moved and its blocks copied unchanged, adding a cue for its first block
+static void appendCluster(EditOutput& out, const EditSource& source, const ClusterInfo& cluster, uint64_t segmentDataOffset, uint64_t& previousSize,
+                          vector<CuePointInfo>& cuePoints, int64_t& lastTimestamp) {
+    const MatroskaFile& file = source.file;
+    uint64_t clusterPosition = out.position - segmentDataOffset;
+
+    // Blocks store their time relative to the cluster, so only the cluster's own elements change
+    vector<pair<uint64_t, uint64_t>> spans;
+    uint64_t keptBytes = 0;
+    bool hasPosition = false;
+    bool hasPrevSize = false;
+    EbmlElement child;
+    for (uint64_t offset = cluster.dataOffset; offset < cluster.end && readElement(file.data, offset, cluster.end, child) &&
+         child.size != unknownElementSize; offset = child.dataOffset + child.size) {
+        hasPosition = hasPosition || child.id == positionId;
+        hasPrevSize = hasPrevSize || child.id == prevSizeId;
+        // A checksum of the cluster would no longer match, so it is dropped
+        if (child.id == timestampId || child.id == positionId || child.id == prevSizeId || child.id == crc32Id) {
+            continue;
+        }
+        uint64_t end = min(child.dataOffset + child.size, cluster.end);
+        if (spans.empty() == false && spans.back().second == child.offset) {
+            spans.back().second = end;
+        }
+        else {
+            spans.push_back(make_pair(child.offset, end));
+        }
+        keptBytes += end - child.offset;
+    }
+
+    vector<uint8_t> header;
+    writeUnsignedElement(header, timestampId, (uint64_t) (cluster.timestamp + source.shift));
+    if (hasPosition) {
+        writeUnsignedElement(header, positionId, clusterPosition);
+    }
+    if (hasPrevSize) {
+        writeUnsignedElement(header, prevSizeId, previousSize);
+    }
+    vector<uint8_t> start;
+    writeElementId(start, clusterId);
+    writeVarInt(start, header.size() + keptBytes);
+    start.insert(start.end(), header.begin(), header.end());
+
+    appendEditBytes(out, start);
+    for (const pair<uint64_t, uint64_t>& span : spans) {
+        appendEditBytes(out, file.data + span.first, span.second - span.first);
+    }
+    previousSize = start.size() + keptBytes;
+
+    // The cue points at the cluster's first block
+    uint64_t blockOffset = 0;
+    BlockInfo block;
+    bool first = true;
+    while (nextBlock(file, cluster, blockOffset, block)) {
+        int64_t time = block.timestampNs / (int64_t) file.timestampScale + source.shift;
+        if (first) {
+            CuePointInfo cue;
+            cue.time = (uint64_t) max(time, (int64_t) 0);
+            cue.track = block.track;
+            cue.clusterPosition = clusterPosition;
+            cuePoints.push_back(cue);
+            first = false;
+        }
+        lastTimestamp = max(lastTimestamp, time);
+    }
+}
+
+// Write the headers of the first source, the clusters of every source and new cues to output
+static bool writeEditedFile(vector<unique_ptr<EditSource>>& sources, const string& output, EditResult& result, string& errorText) {
+    const EditSource& first = *sources[0];
+    const MatroskaFile& file = first.file;
+
+    // Never overwrite an existing file, which also keeps an input from being written over
+    EditOutput out;
+    out.file = CreateFileA(output.c_str(), GENERIC_WRITE, 0, NULL, CREATE_NEW, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+    if (out.file == INVALID_HANDLE_VALUE) {
+        errorText += "ERROR: Could not create \"" + output + "\", it may already exist\n";
+        return false;
+    }
+
+    // The EBML header is copied, the segment gets an 8-byte size patched at the end and room for the seek head
+    appendEditBytes(out, file.data, file.segment.offset);
+    vector<uint8_t> segmentStart;
+    writeElementId(segmentStart, segmentId);
+    writeVarInt(segmentStart, 0, 8);
+    appendEditBytes(out, segmentStart);
+    uint64_t segmentDataOffset = out.position;
+    vector<uint8_t> seekHead;
+    writeVoidElement(seekHead, editSeekHeadBytes);
+    appendEditBytes(out, seekHead);
+
+    uint64_t durationOffset = 0;
+    vector<SeekEntry> seekEntries;
+    appendTopLevelRange(out, first, file.segment.dataOffset, file.firstClusterOffset, durationOffset, seekEntries, segmentDataOffset);
+
+    vector<CuePointInfo> cuePoints;
+    uint64_t previousSize = 0;
+    int64_t lastTimestamp = 0;
+    for (const unique_ptr<EditSource>& source : sources) {
+        for (const ClusterInfo& cluster : source->clusters) {
+            appendCluster(out, *source, cluster, segmentDataOffset, previousSize, cuePoints, lastTimestamp);
+            result.clusters++;
+        }
+    }
+
+    // Elements K4ARecorder writes after the clusters, such as tags, come from the first source
+    appendTopLevelRange(out, first, file.firstClusterOffset, file.segmentEnd, durationOffset, seekEntries, segmentDataOffset);
+    SeekEntry cuesEntry;
+    cuesEntry.id = cuesId;
+    cuesEntry.position = out.position - segmentDataOffset;
+    seekEntries.push_back(cuesEntry);
+    appendEditBytes(out, buildCues(cuePoints));
+    flushEditOutput(out);
+
+    int64_t firstTimestamp = first.clusters.front().timestamp + first.shift;
+    result.durationSeconds = (lastTimestamp - firstTimestamp) * (double) file.timestampScale / 1e9;
+
+    vector<uint8_t> segmentSize(8);
+    bool written = !out.failed && patchVarInt(segmentSize.data(), out.position - segmentDataOffset, 8) &&
+                   writeEditAt(out.file, segmentDataOffset - 8, segmentSize);
+    if (written && durationOffset != 0) {
+        // Duration is a float of 4 or 8 bytes, the same size as before is kept
+        EbmlElement duration;
+        readElement(file.data, file.durationOffset, file.segmentEnd, duration);
+        vector<uint8_t> value;
+        writeFloatElement(value, durationId, (double) (lastTimestamp - firstTimestamp));
+        value.erase(value.begin(), value.end() - 8);
+        if (duration.size == 4) {
+            float single = (float) (lastTimestamp - firstTimestamp);
+            uint32_t bits;
+            memcpy(&bits, &single, 4);
+            value = {(uint8_t) (bits >> 24), (uint8_t) (bits >> 16), (uint8_t) (bits >> 8), (uint8_t) bits};
+        }
+        written = writeEditAt(out.file, durationOffset, value);
+    }
+    if (written && (!buildSeekHeadToFit(seekEntries, editSeekHeadBytes, seekHead) || !writeEditAt(out.file, segmentDataOffset, seekHead))) {
+        result.warningText += "WARNING: Too many top-level elements for the seek head, players will have to find the cues at the end of the file\n";
+    }
+    written = written && FlushFileBuffers(out.file);
+    CloseHandle(out.file);
+
+    if (!written) {
+        DeleteFileA(output.c_str());
+        errorText += "ERROR: Writing to \"" + output + "\" failed\n";
+        return false;
+    }
+    result.outputBytes = out.position;
+    result.bytesCopied = out.bytesCopied;
+    return true;
+}
+
+// Unmap every source
+static void closeSources(vector<unique_ptr<EditSource>>& sources) {
+    for (unique_ptr<EditSource>& source : sources) {
+        closeMappedFile(source->mapped);
+    }
+}
+
+// Write the clusters of input from the one holding startSeconds up to endSeconds to output, -1 for the end of the recording
+bool cutRecording(const string& input, const string& output, double startSeconds, double endSeconds, EditResult& result, string& errorText) {
+    result = EditResult();
+    result.inputFiles = 1;
+    auto start = chrono::steady_clock::now();
+    if (startSeconds < 0 || (endSeconds >= 0 && endSeconds <= startSeconds)) {
+        errorText += "ERROR: The start must not be negative and the end must be after the start\n";
+        return false;
+    }
+
+    vector<unique_ptr<EditSource>> sources;
+    sources.push_back(unique_ptr<EditSource>(new EditSource()));
+    EditSource& source = *sources[0];
+    if (!openSource(input, source, errorText)) {
+        closeSources(sources);
+        return false;
+    }
+
+    // Keep the cluster holding the start, so its first frame is at or before it, up to the last cluster starting before the end
+    double unitSeconds = source.file.timestampScale / 1e9;
+    int64_t origin = source.clusters.front().timestamp;
+    int64_t startTime = origin + (int64_t) (startSeconds / unitSeconds);
+    int64_t endTime = (endSeconds < 0) ? INT64_MAX : origin + (int64_t) (endSeconds / unitSeconds);
+    size_t firstCluster = 0;
+    while (firstCluster + 1 < source.clusters.size() && source.clusters[firstCluster + 1].timestamp <= startTime) {
+        firstCluster++;
+    }
+    size_t endCluster = firstCluster + 1;
+    while (endCluster < source.clusters.size() && source.clusters[endCluster].timestamp < endTime) {
+        endCluster++;
+    }
+    if (startTime > source.clusters.back().timestamp) {
+        result.warningText += "WARNING: The recording ends before the start, only its last cluster is kept\n";
+    }
+    result.startSeconds = (source.clusters[firstCluster].timestamp - origin) * unitSeconds;
+    result.endSeconds = (endCluster < source.clusters.size()) ? (source.clusters[endCluster].timestamp - origin) * unitSeconds : -1;
+    source.clusters = vector<ClusterInfo>(source.clusters.begin() + firstCluster, source.clusters.begin() + endCluster);
+
+    // The kept range starts where the recording did
+    source.shift = origin - source.clusters.front().timestamp;
+    bool succeeded = writeEditedFile(sources, output, result, errorText);
+    closeSources(sources);
+    result.seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    return succeeded;
+}
+
+// Write the clusters of every input one after another to output, with the headers of the first input
+bool concatRecordings(const vector<string>& inputs, const string& output, EditResult& result, string& errorText) {
+    result = EditResult();
+    result.inputFiles = inputs.size();
+    auto start = chrono::steady_clock::now();
+
+    vector<unique_ptr<EditSource>> sources;
+    for (const string& input : inputs) {
+        sources.push_back(unique_ptr<EditSource>(new EditSource()));
+        if (!openSource(input, *sources.back(), errorText) || !compatibleSource(*sources[0], *sources.back(), result, errorText)) {
+            closeSources(sources);
+            return false;
+        }
+    }
+
+    // Each recording starts one frame period after the last cluster of the one before
+    for (size_t i = 1; i < sources.size(); i++) {
+        const EditSource& previous = *sources[i - 1];
+        int64_t next = previous.clusters.back().timestamp + previous.shift + clusterStep(previous);
+        sources[i]->shift = next - sources[i]->clusters.front().timestamp;
+    }
+
+    bool succeeded = writeEditedFile(sources, output, result, errorText);
+    closeSources(sources);
+    result.seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    return succeeded;
+}
+
+// Format what a cut or join did as lines of text for the console
+string formatEditResult(const EditResult& result) {
+    char line[256];
+    string text;
+    if (result.inputFiles == 1) {
+        if (result.endSeconds < 0) {
+            snprintf(line, sizeof(line), "Kept %.3f s to the end\n", result.startSeconds);
+        }
+        else {
+            snprintf(line, sizeof(line), "Kept %.3f s to %.3f s\n", result.startSeconds, result.endSeconds);
+        }
+        text += line;
+    }
+    snprintf(line, sizeof(line), "Wrote %llu clusters from %llu recordings, %.1f s long, %.2f GB in %.1f s (%.0f MB/s)\n", (unsigned long long) result.clusters,
+             (unsigned long long) result.inputFiles, result.durationSeconds, result.outputBytes / 1e9, result.seconds,
+             (result.seconds > 0) ? result.outputBytes / 1e6 / result.seconds : 0);
+    text += line;
+    snprintf(line, sizeof(line), "%.1f%% of the output was written straight from the inputs\n",
+             (result.outputBytes > 0) ? 100.0 * result.bytesCopied / result.outputBytes : 0);
+    return text + line + result.warningText;
+}
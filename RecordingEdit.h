@@ -0,0 +1,63 @@
+/* Aden Prince
+ * HiMER Lab at U. of Illinois, Chicago
+ * K4ARecorder GUI
+ *
+ * RecordingEdit.h
+ * Contains functions used to cut a time range out of a recording and to
+ * join recordings end to end. Whole clusters are copied from the mapped
+ * inputs, only the headers, cluster timestamps and cues are rewritten,
+ * and no frame is ever decoded.
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include <Windows.h>
+
+// Spans at least this long, such as a depth frame, are written straight from the mapped input
+const uint64_t editDirectWriteBytes = 64 * 1024;
+// Shorter spans are gathered in a buffer written once it holds this much
+const uint64_t editBufferBytes = 1024 * 1024;
+// Most bytes passed to one write, which WriteFile takes as a 32-bit count
+const uint64_t editMaxWriteBytes = 64 * 1024 * 1024;
+// Space kept at the start of the segment for the seek head, which is written last
+const uint64_t editSeekHeadBytes = 192;
+
+// A file being written through a buffer except for long spans
+struct EditOutput {
+    HANDLE file = INVALID_HANDLE_VALUE;
+    std::vector<uint8_t> buffer;
+    uint64_t position = 0;    // Bytes written or buffered so far
+    uint64_t bytesCopied = 0; // Bytes written straight from where they were
+    bool failed = false;
+};
+
+// What a cut or join did, for display
+struct EditResult {
+    uint64_t inputFiles = 0;
+    uint64_t clusters = 0;
+    uint64_t bytesCopied = 0; // Written straight from the inputs
+    uint64_t outputBytes = 0;
+    double startSeconds = 0;  // Range of the input kept by a cut, from its first cluster
+    double endSeconds = 0;
+    double durationSeconds = 0; // Of the output
+    double seconds = 0;
+    std::string warningText;
+};
+
+// Write the buffered bytes of an output to its file
+void flushEditOutput(EditOutput& out);
+// Append bytes to an output, writing long spans from where they are without copying them into the buffer
+void appendEditBytes(EditOutput& out, const uint8_t* data, uint64_t size);
+// Write bytes at an offset of a file without moving its file pointer
+bool writeEditAt(HANDLE file, uint64_t offset, const std::vector<uint8_t>& bytes);
+
+// Write the clusters of input from the one holding startSeconds up to endSeconds to output, -1 for the end of the recording
+bool cutRecording(const std::string& input, const std::string& output, double startSeconds, double endSeconds, EditResult& result, std::string& errorText);
+// Write the clusters of every input one after another to output, with the headers of the first input
+bool concatRecordings(const std::vector<std::string>& inputs, const std::string& output, EditResult& result, std::string& errorText);
+// Format what a cut or join did as lines of text for the console
+std::string formatEditResult(const EditResult& result);
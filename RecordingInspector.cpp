@@ -0,0 +1,227 @@
+/* Aden Prince
+ * HiMER Lab at U. of Illinois, Chicago
+ * K4ARecorder GUI
+ *
+ * RecordingInspector.cpp
+ * Contains functions used to check a recording once K4ARecorder has
+ * finished it.
+ */
+
+#include "RecordingInspector.h"
+#include "MappedFile.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+
+using namespace std;
+
+// Find the gaps in one track's block timestamps and its frame rate
+static void summarizeTimestamps(TrackSummary& track, vector<int64_t>& timestamps) {
+    if (timestamps.empty()) {
+        return;
+    }
+    track.firstNs = timestamps.front();
+    track.lastNs = timestamps.back();
+
+    if (timestamps.size() < 3) {
+        return;
+    }
+
+    // The median step is the frame period, even with a few dropped frames
+    vector<int64_t> steps;
+    steps.reserve(timestamps.size() - 1);
+    for (size_t i = 1; i < timestamps.size(); i++) {
+        if (timestamps[i] > timestamps[i - 1]) {
+            steps.push_back(timestamps[i] - timestamps[i - 1]);
+        }
+    }
+    if (steps.empty()) {
+        return;
+    }
+    nth_element(steps.begin(), steps.begin() + steps.size() / 2, steps.end());
+    track.medianStepNs = steps[steps.size() / 2];
+
+    for (int64_t step : steps) {
+        if (step > track.medianStepNs * gapThreshold) {
+            track.gapCount++;
+            track.droppedFrames += (uint64_t) ((step + track.medianStepNs / 2) / track.medianStepNs) - 1;
+            if (step > track.longestGapNs) {
+                track.longestGapNs = step;
+            }
+        }
+    }
+
+    // Count the last frame's period so N frames at F FPS give F
+    double spanSeconds = (track.lastNs - track.firstNs + track.medianStepNs) / 1e9;
+    track.rate = track.frameCount / spanSeconds;
+}
+
+// Summarize the tracks of a parsed Matroska file
+void summarizeRecording(const MatroskaFile& file, RecordingSummary& summary) {
+    summary.fileBytes = file.length;
+    summary.colorMode = findTag(file, "K4A_COLOR_MODE");
+    summary.depthMode = findTag(file, "K4A_DEPTH_MODE");
+    summary.imuMode = findTag(file, "K4A_IMU_MODE");
+    summary.serialNumber = findTag(file, "K4A_DEVICE_SERIAL_NUMBER");
+    summary.hasCues = file.cuesOffset != 0;
+
+    summary.tracks.clear();
+    vector<vector<int64_t>> timestamps(file.tracks.size());
+    for (const TrackInfo& info : file.tracks) {
+        TrackSummary track;
+        track.name = info.name;
+        track.codecId = info.codecId;
+        track.width = info.width;
+        track.height = info.height;
+        summary.tracks.push_back(track);
+    }
+
+    // Walk every block header, frame data is never touched
+    uint64_t clusterOffset = 0;
+    ClusterInfo cluster;
+    while (nextCluster(file, clusterOffset, cluster)) {
+        summary.clusterCount++;
+        if (!cluster.complete) {
+            summary.truncated = true;
+        }
+
+        uint64_t blockOffset = 0;
+        BlockInfo block;
+        while (nextBlock(file, cluster, blockOffset, block)) {
+            size_t index = 0;
+            while (index < file.tracks.size() && file.tracks[index].number != block.track) {
+                index++;
+            }
+            if (index == file.tracks.size()) {
+                continue;
+            }
+
+            TrackSummary& track = summary.tracks[index];
+            track.blockCount++;
+            if (track.codecId == "S_K4A/IMU") {
+                track.frameCount += block.dataSize / imuSampleBytes;
+            }
+            else {
+                track.frameCount += block.frameCount;
+            }
+            timestamps[index].push_back(block.timestampNs);
+        }
+    }
+
+    int64_t firstNs = INT64_MAX;
+    int64_t lastNs = INT64_MIN;
+    for (size_t i = 0; i < summary.tracks.size(); i++) {
+        TrackSummary& track = summary.tracks[i];
+        summarizeTimestamps(track, timestamps[i]);
+        if (track.blockCount > 0) {
+            firstNs = (track.firstNs < firstNs) ? track.firstNs : firstNs;
+            lastNs = (track.lastNs + track.medianStepNs > lastNs) ? track.lastNs + track.medianStepNs : lastNs;
+        }
+    }
+    if (lastNs > firstNs) {
+        summary.durationSeconds = (lastNs - firstNs) / 1e9;
+    }
+}
+
+// Map filename into memory and summarize it, returns false if it cannot be read as a Matroska file
+bool inspectRecording(const string& filename, RecordingSummary& summary, string& errorText) {
+    auto start = chrono::steady_clock::now();
+    summary = RecordingSummary();
+    summary.filename = filename;
+
+    MappedFile mapped;
+    if (!openMappedFile(filename, mapped, errorText)) {
+        return false;
+    }
+
+    // Name the file in parse errors, since several may be inspected at once
+    MatroskaFile file;
+    string parseError;
+    bool parsed = parseMatroskaHeaders(mapped.data, mapped.length, file, parseError);
+    if (parsed) {
+        summarizeRecording(file, summary);
+    }
+    else {
+        errorText += parseError.substr(0, parseError.length() - 1) + " in \"" + filename + "\"\n";
+    }
+
+    closeMappedFile(mapped);
+    summary.parseMs = chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+    return parsed;
+}
+
+// Format a summary as lines of text for the console
+string formatRecordingSummary(const RecordingSummary& summary) {
+    char line[256];
+    string text = summary.filename + "\n";
+
+    snprintf(line, sizeof(line), "  %.2f GB, %.3f s, %llu clusters, parsed in %.1f ms\n", summary.fileBytes / 1e9,
+             summary.durationSeconds, (unsigned long long) summary.clusterCount, summary.parseMs);
+    text += line;
+    if (summary.colorMode.empty() == false || summary.depthMode.empty() == false) {
+        text += "  Color " + summary.colorMode + ", depth " + summary.depthMode + ", IMU " + summary.imuMode;
+        if (summary.serialNumber.empty() == false) {
+            text += ", device " + summary.serialNumber;
+        }
+        text += "\n";
+    }
+    if (summary.truncated) {
+        text += "  WARNING: File ends inside a cluster, K4ARecorder may not have exited cleanly\n";
+    }
+    if (!summary.hasCues) {
+        text += "  WARNING: File has no cues, seeking will be slow\n";
+    }
+
+    for (const TrackSummary& track : summary.tracks) {
+        const char* unit = (track.codecId == "S_K4A/IMU") ? "samples" : "frames";
+        snprintf(line, sizeof(line), "  %-6s %10llu %s  %8.2f/s  %llu gaps, %llu dropped, longest gap %.1f ms\n",
+                 track.name.c_str(), (unsigned long long) track.frameCount, unit, track.rate, (unsigned long long) track.gapCount,
+                 (unsigned long long) track.droppedFrames, track.longestGapNs / 1e6);
+        text += line;
+    }
+    return text;
+}
+
+// Summarize every file in the list, keeping going past files that cannot be read
+static void runInspection(RecordingInspection* inspection) {
+    for (const string& filename : inspection->filenames) {
+        RecordingSummary summary;
+        if (inspectRecording(filename, summary, inspection->errorText)) {
+            inspection->summaries.push_back(summary);
+        }
+    }
+    inspection->finished = true;
+}
+
+// Start summarizing recordings on a worker thread
+bool startInspection(RecordingInspection& inspection, const vector<string>& filenames) {
+    endInspection(inspection);
+
+    inspection.filenames = filenames;
+    inspection.summaries.clear();
+    inspection.errorText = "";
+
+    inspection.running = true;
+    inspection.finished = false;
+    inspection.workerThread = thread(runInspection, &inspection);
+    return true;
+}
+
+// Check if the inspection has finished, joining the worker once it has, never blocks
+bool pollInspection(RecordingInspection& inspection) {
+    if (!inspection.running || !inspection.finished) {
+        return false;
+    }
+    inspection.workerThread.join();
+    inspection.running = false;
+    return true;
+}
+
+// Wait for the inspection to finish
+void endInspection(RecordingInspection& inspection) {
+    if (inspection.workerThread.joinable()) {
+        inspection.workerThread.join();
+    }
+    inspection.running = false;
+}
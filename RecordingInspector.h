@@ -0,0 +1,90 @@
+/* Aden Prince
+ * HiMER Lab at U. of Illinois, Chicago
+ * K4ARecorder GUI
+ *
+ * RecordingInspector.h
+ * Contains functions used to summarize a finished recording's tracks,
+ * such as frame counts, timestamp gaps and the IMU sample rate, by
+ * walking its clusters without reading frame data.
+ */
+
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "MatroskaParser.h"
+
+// Size of one IMU sample in K4ARecorder's IMU track
+const int imuSampleBytes = 40;
+// A timestamp step longer than this many typical steps counts as a gap
+const double gapThreshold = 1.5;
+
+struct TrackSummary {
+    std::string name;
+    std::string codecId;
+    uint32_t width = 0;
+    uint32_t height = 0;
+
+    uint64_t blockCount = 0;
+    uint64_t frameCount = 0; // IMU samples for the IMU track
+    int64_t firstNs = 0;
+    int64_t lastNs = 0;
+    double rate = 0;         // Frames or IMU samples per second
+
+    // Gaps between blocks longer than gapThreshold typical steps
+    int64_t medianStepNs = 0;
+    uint64_t gapCount = 0;
+    uint64_t droppedFrames = 0; // Blocks missing from the gaps, at the typical step
+    int64_t longestGapNs = 0;
+};
+
+struct RecordingSummary {
+    std::string filename;
+    uint64_t fileBytes = 0;
+
+    // Tags written by K4ARecorder
+    std::string colorMode;
+    std::string depthMode;
+    std::string imuMode;
+    std::string serialNumber;
+
+    double durationSeconds = 0;
+    uint64_t clusterCount = 0;
+    bool truncated = false; // The file ends inside a cluster, as when K4ARecorder does not exit cleanly
+    bool hasCues = false;
+    double parseMs = 0;
+
+    std::vector<TrackSummary> tracks;
+};
+
+// Summarizes a list of recordings on a worker thread
+struct RecordingInspection {
+    std::thread workerThread;
+    std::atomic<bool> running{false};
+    std::atomic<bool> finished{false};
+
+    // Set before the worker starts
+    std::vector<std::string> filenames;
+
+    // Set by the worker, read once finished is true
+    std::vector<RecordingSummary> summaries;
+    std::string errorText;
+};
+
+// Summarize the tracks of a parsed Matroska file
+void summarizeRecording(const MatroskaFile& file, RecordingSummary& summary);
+// Map filename into memory and summarize it, returns false if it cannot be read as a Matroska file
+bool inspectRecording(const std::string& filename, RecordingSummary& summary, std::string& errorText);
+// Format a summary as lines of text for the console
+std::string formatRecordingSummary(const RecordingSummary& summary);
+
+// Start summarizing recordings on a worker thread
+bool startInspection(RecordingInspection& inspection, const std::vector<std::string>& filenames);
+// Check if the inspection has finished, joining the worker once it has, never blocks
+bool pollInspection(RecordingInspection& inspection);
+// Wait for the inspection to finish
+void endInspection(RecordingInspection& inspection);
@@ -0,0 +1,347 @@
+/* Aden Prince
+ * HiMER Lab at U. of Illinois, Chicago
+ * K4ARecorder GUI
+ *
+ * RecordingRepair.cpp
+ * Contains functions used to finish recordings that K4ARecorder did not
+ * close properly.
+ */
+
+#include "RecordingRepair.h"
+#include "MappedFile.h"
+#include "MatroskaWriter.h"
+
+#include <cstdio>
+#include <cstring>
+
+using namespace std;
+
+// Point the seek head at the cues, writing a new one over the void K4ARecorder reserves for it if there is none
+static void planSeekHead(const MatroskaFile& file, uint64_t dataEnd, uint64_t cuesPosition, RepairPlan& plan) {
+    SeekHeadRegion region = findSeekHeadRegion(file);
+    const vector<SeekEntry>& entries = region.entries;
+
+    // Nothing to do if the seek head already points at the cues
+    for (const SeekEntry& entry : entries) {
+        if (entry.id == cuesId && entry.position == cuesPosition) {
+            return;
+        }
+    }
+
+    // Keep entries for elements that survive the repair
+    vector<SeekEntry> newEntries;
+    for (const SeekEntry& entry : entries) {
+        if (entry.id != cuesId && file.segment.dataOffset + entry.position < dataEnd) {
+            newEntries.push_back(entry);
+        }
+    }
+    if (!region.hasSeekHead) {
+        const uint32_t ids[4] = {infoId, tracksId, attachmentsId, tagsId};
+        const uint64_t offsets[4] = {file.infoOffset, file.tracksOffset, file.attachmentsOffset, file.tagsOffset};
+        for (int i = 0; i < 4; i++) {
+            if (offsets[i] != 0 && offsets[i] < dataEnd) {
+                SeekEntry entry;
+                entry.id = ids[i];
+                entry.position = offsets[i] - file.segment.dataOffset;
+                newEntries.push_back(entry);
+            }
+        }
+    }
+    SeekEntry cuesEntry;
+    cuesEntry.id = cuesId;
+    cuesEntry.position = cuesPosition;
+    newEntries.push_back(cuesEntry);
+
+    vector<uint8_t> seekHead;
+    if (region.end == 0 || !buildSeekHeadToFit(newEntries, region.end - region.start, seekHead)) {
+        plan.warningText += "WARNING: No room for a seek head, players will have to find the cues at the end of the file\n";
+        return;
+    }
+    RepairPatch patch;
+    patch.offset = region.start;
+    patch.bytes = seekHead;
+    plan.patches.push_back(patch);
+    plan.seekHeadWritten = true;
+}
+
+// Scan the clusters of a parsed file once and work out the changes needed to finish it
+bool planRepair(const MatroskaFile& parsed, RepairPlan& plan, string& errorText) {
+    plan = RepairPlan();
+    if (parsed.firstClusterOffset == 0) {
+        errorText += "ERROR: Recording has no clusters\n";
+        return false;
+    }
+
+    // The segment size cannot be trusted, so read up to the end of the file
+    MatroskaFile file = parsed;
+    file.segmentEnd = file.length;
+
+    uint64_t dataEnd = file.firstClusterOffset;
+    uint64_t existingCues = 0;
+    int64_t lastTimestampNs = -1;
+    vector<CuePointInfo> cuePoints;
+    EbmlElement element;
+
+    // Walk the top-level elements after the headers, stopping at the first one that was not fully written
+    uint64_t offset = file.firstClusterOffset;
+    while (readElement(file.data, offset, file.length, element)) {
+        if (element.id != clusterId) {
+            if (element.size == unknownElementSize || element.size > file.length - element.dataOffset) {
+                break;
+            }
+            if (element.id == cuesId) {
+                existingCues = element.offset;
+            }
+            dataEnd = element.dataOffset + element.size;
+            offset = dataEnd;
+            continue;
+        }
+
+        uint64_t clusterOffset = offset;
+        ClusterInfo cluster;
+        if (!nextCluster(file, clusterOffset, cluster)) {
+            break;
+        }
+        plan.clusterCount++;
+
+        // Every complete block is kept, the cue points at the cluster's first one
+        uint64_t blockOffset = 0;
+        BlockInfo block;
+        bool firstBlock = true;
+        while (nextBlock(file, cluster, blockOffset, block)) {
+            if (firstBlock) {
+                CuePointInfo cue;
+                cue.time = (uint64_t) (block.timestampNs / (int64_t) file.timestampScale);
+                cue.track = block.track;
+                cue.clusterPosition = cluster.offset - file.segment.dataOffset;
+                cuePoints.push_back(cue);
+                firstBlock = false;
+            }
+            if (block.timestampNs > lastTimestampNs) {
+                lastTimestampNs = block.timestampNs;
+            }
+        }
+        uint64_t validEnd = (blockOffset < cluster.end) ? blockOffset : cluster.end;
+
+        if (element.size != unknownElementSize && cluster.complete) {
+            dataEnd = cluster.end;
+            offset = cluster.end;
+            continue;
+        }
+
+        // Shrink a cut-off cluster to its complete blocks, or give a cluster of unknown size its real size
+        RepairPatch patch;
+        patch.offset = element.dataOffset - element.sizeLength;
+        patch.bytes.resize(element.sizeLength);
+        if (!patchVarInt(patch.bytes.data(), validEnd - element.dataOffset, element.sizeLength)) {
+            errorText += "ERROR: Cluster size at byte " + to_string(element.offset) + " is too short to be patched in place\n";
+            return false;
+        }
+        plan.patches.push_back(patch);
+        plan.clustersResized++;
+        dataEnd = validEnd;
+
+        // A cluster of unknown size that was followed by another element is complete
+        if (!cluster.complete || validEnd < cluster.end || cluster.end >= file.length) {
+            break;
+        }
+        offset = cluster.end;
+    }
+
+    plan.truncateTo = dataEnd;
+    plan.bytesDropped = file.length - dataEnd;
+
+    // Rebuild the cues unless a complete set was written before K4ARecorder stopped
+    uint64_t cuesOffset = existingCues;
+    if (cuesOffset == 0) {
+        cuesOffset = dataEnd;
+        plan.append = buildCues(cuePoints);
+        plan.cuePointCount = cuePoints.size();
+    }
+    uint64_t finalEnd = dataEnd + plan.append.size();
+
+    uint64_t segmentSize = finalEnd - file.segment.dataOffset;
+    if (file.segment.size != segmentSize) {
+        RepairPatch patch;
+        patch.offset = file.segment.dataOffset - file.segment.sizeLength;
+        patch.bytes.resize(file.segment.sizeLength);
+        if (!patchVarInt(patch.bytes.data(), segmentSize, file.segment.sizeLength)) {
+            errorText += "ERROR: Segment size is too short to be patched in place\n";
+            return false;
+        }
+        plan.patches.push_back(patch);
+        plan.segmentSizePatched = true;
+    }
+
+    // Set the duration to the last frame's timestamp if K4ARecorder did not
+    EbmlElement duration;
+    if (file.durationOffset != 0 && lastTimestampNs >= 0 && readElement(file.data, file.durationOffset, file.length, duration) &&
+        (duration.size == 4 || duration.size == 8)) {
+        double value = (double) lastTimestampNs / file.timestampScale;
+        double stored = (duration.size == 4) ? (double) (float) value : value;
+        if (readFloat(file.data, duration, file.length) != stored) {
+            RepairPatch patch;
+            patch.offset = duration.dataOffset;
+            uint64_t bits;
+            if (duration.size == 4) {
+                float value32 = (float) value;
+                uint32_t bits32;
+                memcpy(&bits32, &value32, sizeof(bits32));
+                bits = bits32;
+            }
+            else {
+                memcpy(&bits, &value, sizeof(bits));
+            }
+            for (int i = (int) duration.size - 1; i >= 0; i--) {
+                patch.bytes.push_back((uint8_t) (bits >> (8 * i)));
+            }
+            plan.patches.push_back(patch);
+            plan.durationPatched = true;
+        }
+    }
+
+    planSeekHead(file, dataEnd, cuesOffset - file.segment.dataOffset, plan);
+
+    plan.needed = plan.bytesDropped > 0 || plan.append.empty() == false || plan.patches.empty() == false;
+    return true;
+}
+
+// Write bytes at offset without moving the file pointer
+static bool writeAt(HANDLE file, uint64_t offset, const vector<uint8_t>& bytes) {
+    OVERLAPPED overlapped = {};
+    overlapped.Offset = (DWORD) offset;
+    overlapped.OffsetHigh = (DWORD) (offset >> 32);
+
+    DWORD bytesWritten = 0;
+    return WriteFile(file, bytes.data(), (DWORD) bytes.size(), &bytesWritten, &overlapped) && bytesWritten == bytes.size();
+}
+
+// Repair filename in place, returns false if it cannot be read or written
+bool repairRecording(const string& filename, RepairPlan& plan, string& errorText) {
+    MappedFile mapped;
+    if (!openMappedFile(filename, mapped, errorText)) {
+        return false;
+    }
+
+    MatroskaFile file;
+    bool planned = parseMatroskaHeaders(mapped.data, mapped.length, file, errorText) && planRepair(file, plan, errorText);
+    closeMappedFile(mapped);
+    if (!planned || !plan.needed) {
+        return planned;
+    }
+
+    // Nothing else may write the file while it is repaired
+    HANDLE handle = CreateFileA(filename.c_str(), GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (handle == INVALID_HANDLE_VALUE) {
+        if (GetLastError() == ERROR_SHARING_VIOLATION) {
+            errorText += "ERROR: \"" + filename + "\" is open for writing in another program, close it and repair again\n";
+        }
+        else {
+            errorText += "ERROR: Could not open \"" + filename + "\" for writing\n";
+        }
+        return false;
+    }
+
+    // Cut off the partly written data, add the cues, then fix the headers to point at them.
+    // Windows will not cut short a file that is still mapped, and nothing has changed if it refuses.
+    LARGE_INTEGER end;
+    end.QuadPart = (LONGLONG) plan.truncateTo;
+    if (!SetFilePointerEx(handle, end, NULL, FILE_BEGIN) || !SetEndOfFile(handle)) {
+        DWORD error = GetLastError();
+        CloseHandle(handle);
+        if (error == ERROR_USER_MAPPED_FILE) {
+            errorText += "ERROR: \"" + filename + "\" is being read by another program or job, repair it again once that has finished\n";
+        }
+        else {
+            errorText += "ERROR: Could not cut \"" + filename + "\" short (error " + to_string(error) + ")\n";
+        }
+        return false;
+    }
+    bool written = true;
+    if (plan.append.empty() == false) {
+        written = writeAt(handle, plan.truncateTo, plan.append);
+    }
+    for (const RepairPatch& patch : plan.patches) {
+        written = written && writeAt(handle, patch.offset, patch.bytes);
+    }
+    written = written && FlushFileBuffers(handle);
+    CloseHandle(handle);
+
+    if (!written) {
+        errorText += "ERROR: Writing to \"" + filename + "\" failed\n";
+    }
+    return written;
+}
+
+// Format what a repair did as lines of text for the console
+string formatRepairPlan(const RepairPlan& plan) {
+    if (!plan.needed) {
+        return "  Recording is complete, nothing to repair\n";
+    }
+
+    char line[256];
+    string text;
+    snprintf(line, sizeof(line), "  %llu clusters kept, %llu bytes of unfinished data removed\n", (unsigned long long) plan.clusterCount,
+             (unsigned long long) plan.bytesDropped);
+    text += line;
+    if (plan.cuePointCount > 0) {
+        snprintf(line, sizeof(line), "  Cues rebuilt with %llu cue points\n", (unsigned long long) plan.cuePointCount);
+        text += line;
+    }
+    if (plan.clustersResized > 0) {
+        snprintf(line, sizeof(line), "  %d cluster sizes fixed\n", plan.clustersResized);
+        text += line;
+    }
+    if (plan.segmentSizePatched) {
+        text += "  Segment size fixed\n";
+    }
+    if (plan.seekHeadWritten) {
+        text += "  Seek head written\n";
+    }
+    if (plan.durationPatched) {
+        text += "  Duration set\n";
+    }
+    return text + plan.warningText;
+}
+
+// Repair the file and record the result for the GUI
+static void runRepair(RecordingRepair* repair) {
+    repair->succeeded = repairRecording(repair->filename, repair->plan, repair->errorText);
+    repair->finished = true;
+}
+
+// Start repairing a recording on a worker thread
+bool startRepair(RecordingRepair& repair, const string& filename) {
+    if (repair.running) {
+        return false;
+    }
+    endRepair(repair);
+
+    repair.filename = filename;
+    repair.succeeded = false;
+    repair.plan = RepairPlan();
+    repair.errorText = "";
+
+    repair.running = true;
+    repair.finished = false;
+    repair.workerThread = thread(runRepair, &repair);
+    return true;
+}
+
+// Check if the repair has finished, joining the worker once it has, never blocks
+bool pollRepair(RecordingRepair& repair) {
+    if (!repair.running || !repair.finished) {
+        return false;
+    }
+    repair.workerThread.join();
+    repair.running = false;
+    return true;
+}
+
+// Wait for the repair to finish
+void endRepair(RecordingRepair& repair) {
+    if (repair.workerThread.joinable()) {
+        repair.workerThread.join();
+    }
+    repair.running = false;
+}
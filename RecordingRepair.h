@@ -0,0 +1,74 @@
+/* Aden Prince
+ * HiMER Lab at U. of Illinois, Chicago
+ * K4ARecorder GUI
+ *
+ * RecordingRepair.h
+ * Contains functions used to repair recordings K4ARecorder could not
+ * finish, such as after it was killed or the computer lost power, by
+ * rebuilding the cues and patching sizes in place.
+ */
+
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "MatroskaParser.h"
+
+// Bytes to overwrite in place
+struct RepairPatch {
+    uint64_t offset = 0;
+    std::vector<uint8_t> bytes;
+};
+
+// Changes that make a recording complete, which never move or rewrite frame data
+struct RepairPlan {
+    bool needed = false;
+
+    // The file is cut at truncateTo, then append is written there, then the patches are applied
+    uint64_t truncateTo = 0;
+    std::vector<uint8_t> append;
+    std::vector<RepairPatch> patches;
+
+    // What the repair does, for display
+    uint64_t clusterCount = 0;
+    uint64_t cuePointCount = 0; // 0 if the file already had complete cues
+    uint64_t bytesDropped = 0;  // Partly written data after the last complete block
+    int clustersResized = 0;
+    bool segmentSizePatched = false;
+    bool seekHeadWritten = false;
+    bool durationPatched = false;
+    std::string warningText;
+};
+
+// Repairs one recording on a worker thread
+struct RecordingRepair {
+    std::thread workerThread;
+    std::atomic<bool> running{false};
+    std::atomic<bool> finished{false};
+
+    // Set before the worker starts
+    std::string filename;
+
+    // Set by the worker, read once finished is true
+    bool succeeded = false;
+    RepairPlan plan;
+    std::string errorText;
+};
+
+// Scan the clusters of a parsed file once and work out the changes needed to finish it
+bool planRepair(const MatroskaFile& file, RepairPlan& plan, std::string& errorText);
+// Repair filename in place, returns false if it cannot be read or written
+bool repairRecording(const std::string& filename, RepairPlan& plan, std::string& errorText);
+// Format what a repair did as lines of text for the console
+std::string formatRepairPlan(const RepairPlan& plan);
+
+// Start repairing a recording on a worker thread
+bool startRepair(RecordingRepair& repair, const std::string& filename);
+// Check if the repair has finished, joining the worker once it has, never blocks
+bool pollRepair(RecordingRepair& repair);
+// Wait for the repair to finish
+void endRepair(RecordingRepair& repair);
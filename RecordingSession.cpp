@@ -0,0 +1,467 @@
+/* Aden Prince
+ * HiMER Lab at U. of Illinois, Chicago
+ * K4ARecorder GUI
+ *
+ * RecordingSession.cpp
+ * Contains functions used to run K4ARecorder in the background and
+ * number the output files of back-to-back takes.
+ */
+
+#include "RecordingSession.h"
+#include "RecorderProcess.h"
+
+#include <algorithm>
+#include <cctype>
+#include <iostream>
+#include <unordered_set>
+
+using namespace std;
+
+// Lowercase a filename, since Windows filenames are not case-sensitive
+static string toLower(string str) {
+    for (char& c : str) {
+        c = (char) tolower((unsigned char) c);
+    }
+    return str;
+}
+
+// Queue the moves of a take's files if it was recorded to the scratch directory, otherwise queue their manifests
+static void finishTakeFiles(RecordingSession& session, const vector<string>& filenames, const vector<string>& args) {
+    // Moved files get their manifest once the copy has been checked
+    if (session.mover.takeJobs.empty() == false) {
+        for (size_t i = 0; i < session.mover.takeJobs.size() && i < args.size(); i++) {
+            session.mover.takeJobs[i].args = args[i];
+        }
+        queueTakeMoves(session.mover);
+        return;
+    }
+
+    for (size_t i = 0; i < filenames.size(); i++) {
+        if (fileExists(filenames[i])) {
+            queueManifest(session.manifests, filenames[i], args[i]);
+        }
+    }
+}
+
+// Get the K4ARecorder arguments a recording's manifest was or will be written with, empty if it has none
+static string manifestArgs(const RecordingSession& session, const string& recording) {
+    for (const ManifestJob& job : session.manifests.queue) {
+        if (job.recording == recording) {
+            return job.args;
+        }
+    }
+    if (session.manifests.running && session.manifests.current.recording == recording) {
+        return session.manifests.current.args;
+    }
+    for (const MoveResult& result : session.mover.results) {
+        if (result.job.destination == recording) {
+            return result.job.args;
+        }
+    }
+
+    Manifest manifest;
+    string errorText;
+    if (readManifest(manifestFilename(recording), manifest, errorText)) {
+        return manifest.args;
+    }
+    return "";
+}
+
+// Inspect a take's files, waiting until they have been moved if they were recorded to the scratch directory, so a repair is made where they end up
+static void startTakeInspection(RecordingSession& session, const vector<string>& filenames) {
+    session.inspectionPending.clear();
+    session.inspectionReady.clear();
+    if (session.mover.takeJobs.empty() == false) {
+        for (const MoveJob& job : session.mover.takeJobs) {
+            session.inspectionPending.push_back(job.destination);
+        }
+        return;
+    }
+    startInspection(session.inspection, filenames);
+}
+
+// Make the filmstrip of a take's first file, waiting until it has been moved if it was recorded to the scratch directory
+static void startTakeFilmstrip(RecordingSession& session, const string& filename) {
+    if (session.mover.takeJobs.empty() == false) {
+        session.filmstripPending = session.mover.takeJobs[0].destination;
+        return;
+    }
+    session.filmstripPending = "";
+    startFilmstrip(session.filmstrip, filename);
+}
+
+// Start K4ARecorder for a new take without waiting for it to exit
+bool startTake(RecordingSession& session, const string& recorderPathStr, const string& argsStr) {
+    if (session.running) {
+        return false;
+    }
+
+    // Keep the last take's output and let its reader finish before it is joined, since this can run with the session locked by a control request
+    drainLog(session.log);
+
+    // Capture K4ARecorder's output, falling back to the console if the pipe cannot be created
+    int startedWatch = watchLog(session.log, "Started recording");
+    HANDLE childOutput = NULL;
+    if (!startLogCapture(session.log, childOutput)) {
+        childOutput = NULL;
+    }
+
+    bool started = startRecorderProcess(recorderPathStr, argsStr, session.pi, childOutput);
+    session.takeArgs = argsStr;
+
+    // Close this process's copy of the write end so the reader sees the pipe close when K4ARecorder exits
+    if (childOutput != NULL) {
+        CloseHandle(childOutput);
+    }
+
+    if (!started) {
+        stopLogCapture(session.log);
+        return false;
+    }
+
+    recorderLaunched(session.latency, session.pi.hProcess, (childOutput != NULL) ? &session.log : nullptr, startedWatch);
+
+    if (session.outputFilename.empty() == false) {
+        startThroughputMonitor(session.throughput, {session.outputFilename});
+        startDropMonitor(session.drops, {session.outputFilename}, session.fps);
+    }
+
+    session.running = true;
+    session.stopRequested = false;
+    session.multiDevice.state = MultiDeviceState::Idle;
+    session.takeFinished = false;
+    session.takeCount++;
+    return true;
+}
+
+// Record to the scratch directory if staging is enabled, filling takeOptions and the take's moves, returns false if it cannot be used
+static bool stageTake(RecordingSession& session, const RecorderOptions& options, RecorderOptions& takeOptions, string& errorText) {
+    FileMover& mover = session.mover;
+    mover.takeJobs.clear();
+    takeOptions = options;
+    if (!mover.enabled) {
+        return true;
+    }
+
+    // Takes are moved in the background, so the GUI has to stay open
+    bool valid = true;
+    if (!session.enabled) {
+        errorText += "ERROR: Recording to a scratch directory needs \"Keep GUI open between takes\"\n";
+        valid = false;
+    }
+    if (mover.scratchDirectory.find_first_not_of(' ') == string::npos) {
+        errorText += "ERROR: Scratch directory is empty\n";
+        valid = false;
+    }
+    takeOptions.output_filename = stagedFilename(mover.scratchDirectory, options.output_filename);
+
+    // One file per device, each moved to where it would have been recorded
+    int deviceCount = session.multiDevice.enabled ? session.multiDevice.deviceCount : 1;
+    for (int i = 0; i < deviceCount; i++) {
+        MoveJob job;
+        job.source = session.multiDevice.enabled ? deviceOutputFilename(takeOptions.output_filename, i) : takeOptions.output_filename;
+        job.destination = session.multiDevice.enabled ? deviceOutputFilename(options.output_filename, i) : options.output_filename;
+        if (fileExists(job.destination)) {
+            errorText += "ERROR: Output file \"" + job.destination + "\" already exists\n";
+            valid = false;
+        }
+        mover.takeJobs.push_back(job);
+    }
+
+    // The take has to fit on the output volume once it is moved
+    if (!checkStorageForTake(options, deviceCount, errorText)) {
+        valid = false;
+    }
+    if (!valid) {
+        mover.takeJobs.clear();
+    }
+    return valid;
+}
+
+// Check and stage a take's options and start it as the Start button does, K4ARecorder is left for main to start if the GUI is not kept open
+bool beginTake(RecordingSession& session, const RecorderOptions& options, const string& recorderPathStr, string& argsStr, string& errorText) {
+    argsStr = "";
+
+    // The benchmark's writes would compete with the take's for the same volume
+    if (session.storageBenchmark.running) {
+        errorText += "ERROR: Wait for the storage test to finish before starting a take\n";
+        return false;
+    }
+
+    session.fps = frameRateTable[options.frame_rate_index].fps;
+
+    // The options K4ARecorder is run with, recording to the scratch directory when staging
+    RecorderOptions takeOptions;
+    bool staged = stageTake(session, options, takeOptions, errorText);
+    bool started = false;
+
+    // startTake follows the file K4ARecorder writes, so it is set first
+    session.outputFilename = takeOptions.output_filename;
+    session.requestedFilename = options.output_filename;
+
+    // Start every device's K4ARecorder here, keeping the GUI running
+    if (session.multiDevice.enabled) {
+        if (staged && startMultiDeviceTake(session.multiDevice, takeOptions, recorderPathStr, errorText)) {
+            session.takeCount++;
+
+            vector<string> filenames;
+            for (int i = 0; i < session.multiDevice.takeDeviceCount; i++) {
+                filenames.push_back(session.multiDevice.devices[i].output_filename);
+            }
+            startThroughputMonitor(session.throughput, filenames);
+            startDropMonitor(session.drops, filenames, session.fps);
+            started = true;
+        }
+    }
+    else {
+        // Time from here to K4ARecorder writing its first frames
+        beginStartLatency(session.latency, takeOptions);
+
+        // Set K4ARecorder command-line arguments
+        argsStr = buildArgs(takeOptions);
+
+        // K4ARecorder does not start if there are any errors
+        started = validateOptions(takeOptions, recorderPathStr, errorText);
+        if (!checkStorageForTake(takeOptions, 1, errorText) || !staged) {
+            started = false;
+        }
+
+        if (started && session.enabled) {
+            cout << "Arguments: " << argsStr << endl;
+            if (!startTake(session, recorderPathStr, argsStr)) {
+                errorText += "ERROR: K4ARecorder failed to start\n";
+                started = false;
+            }
+        }
+
+        // Takes that are not started are not timed
+        if (!started) {
+            session.latency.measuring = false;
+        }
+    }
+    return started;
+}
+
+// Check if the current take has ended without blocking, returns true while it is running
+bool pollTake(RecordingSession& session) {
+    drainLog(session.log);
+    pollStartLatency(session.latency);
+    drainThroughputMonitor(session.throughput);
+    drainDropMonitor(session.drops);
+    pollStorageBenchmark(session.storageBenchmark);
+    pollInspection(session.inspection);
+    bool moved = pollFileMover(session.mover);
+    pollManifestWriter(session.manifests);
+    pollDepthCompression(session.depthCompression);
+    if (pollFilmstrip(session.filmstrip)) {
+        startDepthQuality(session.depthQuality, session.filmstrip.filename);
+    }
+    pollDepthQuality(session.depthQuality);
+    pollLibraryScan(session.library);
+
+    // Inspect a staged take once all of its files have been moved, or where it was recorded if its move failed
+    if (moved) {
+        const MoveResult& result = session.mover.results.back();
+        auto pending = find(session.inspectionPending.begin(), session.inspectionPending.end(), result.job.destination);
+        if (pending != session.inspectionPending.end()) {
+            session.inspectionPending.erase(pending);
+            session.inspectionReady.push_back(result.succeeded ? result.job.destination : result.job.source);
+            if (session.inspectionPending.empty()) {
+                startInspection(session.inspection, session.inspectionReady);
+            }
+        }
+    }
+
+    // Make the filmstrip of a staged take once it is at its output path
+    if (moved && session.mover.results.back().job.destination == session.filmstripPending) {
+        if (session.mover.results.back().succeeded) {
+            startFilmstrip(session.filmstrip, session.filmstripPending);
+        }
+        session.filmstripPending = "";
+    }
+
+    // Inspect the take again once one of its files has been repaired, and checksum it again since its manifest no longer matches
+    if (pollRepair(session.repair) && session.repair.succeeded) {
+        if (session.repair.plan.needed) {
+            queueManifest(session.manifests, session.repair.filename, manifestArgs(session, session.repair.filename));
+        }
+        vector<string> filenames = session.inspection.filenames;
+        startInspection(session.inspection, filenames);
+    }
+
+    // A multiple device take is handled like a single take once every device has exited
+    if (pollMultiDeviceTake(session.multiDevice)) {
+        stopThroughputMonitor(session.throughput);
+        stopDropMonitor(session.drops);
+        session.takeFinished = true;
+        session.takeWroteFile = false;
+
+        vector<string> filenames;
+        vector<string> args;
+        for (int i = 0; i < session.multiDevice.takeDeviceCount; i++) {
+            filenames.push_back(session.multiDevice.devices[i].output_filename);
+            args.push_back(session.multiDevice.deviceArgs[i]);
+            if (fileExists(filenames[i])) {
+                session.takeWroteFile = true;
+            }
+        }
+        startTakeInspection(session, filenames);
+        startTakeFilmstrip(session, filenames[0]);
+        finishTakeFiles(session, filenames, args);
+    }
+
+    if (!session.running) {
+        return false;
+    }
+
+    if (WaitForSingleObject(session.pi.hProcess, 0) != WAIT_OBJECT_0) {
+        return true;
+    }
+
+    GetExitCodeProcess(session.pi.hProcess, &session.lastExitCode);
+    CloseHandle(session.pi.hProcess);
+    CloseHandle(session.pi.hThread);
+    ZeroMemory(&session.pi, sizeof(session.pi));
+
+    // Handle Ctrl+C normally again once K4ARecorder has been stopped
+    if (session.stopRequested) {
+        restoreInterruptHandling();
+    }
+
+    stopThroughputMonitor(session.throughput);
+    stopDropMonitor(session.drops);
+
+    // Check the finished file in the background
+    session.takeWroteFile = session.outputFilename.empty() == false && fileExists(session.outputFilename);
+    if (session.outputFilename.empty() == false) {
+        startTakeInspection(session, {session.outputFilename});
+        startTakeFilmstrip(session, session.outputFilename);
+        finishTakeFiles(session, {session.outputFilename}, {session.takeArgs});
+    }
+
+    session.running = false;
+    session.takeFinished = true;
+    return false;
+}
+
+// Ask K4ARecorder to finish the current take as if Ctrl+C was pressed
+void stopTake(RecordingSession& session) {
+    if (!session.running || session.stopRequested) {
+        return;
+    }
+
+    // K4ARecorder shares this console, so Ctrl+C reaches it and it closes the file properly
+    interruptRecorders();
+    session.stopRequested = true;
+}
+
+// Check if a single or multiple device take is running
+bool sessionBusy(const RecordingSession& session) {
+    return session.running || multiDeviceTakeRunning(session.multiDevice);
+}
+
+// Get the name of a background job reading or mapping filename, which keeps a repair from cutting it short, empty if there is none
+string jobUsingRecording(const RecordingSession& session, const string& filename) {
+    if (session.inspection.running) {
+        return "inspection";
+    }
+    if (session.filmstrip.running && session.filmstrip.filename == filename) {
+        return "filmstrip";
+    }
+    if (session.depthQuality.running && session.depthQuality.filename == filename) {
+        return "depth statistics";
+    }
+    if (session.depthCompression.running && session.depthCompression.inputFilename == filename) {
+        return "depth compression";
+    }
+    if (session.manifests.running && session.manifests.current.recording == filename) {
+        return "checksum";
+    }
+    return "";
+}
+
+// Stop serving control requests and the current take if there is one, and wait for K4ARecorder to exit
+void endSession(RecordingSession& session) {
+    // No request can start a take once the session is ending
+    endControlServer(session.control);
+    endMultiDeviceTake(session.multiDevice);
+
+    if (session.running) {
+        stopTake(session);
+        WaitForSingleObject(session.pi.hProcess, INFINITE);
+        pollTake(session);
+        stopLogCapture(session.log);
+    }
+
+    finishStartLatency(session.latency);
+    stopThroughputMonitor(session.throughput);
+    stopDropMonitor(session.drops);
+    endStorageBenchmark(session.storageBenchmark);
+    endInspection(session.inspection);
+    endRepair(session.repair);
+    endDepthCompression(session.depthCompression);
+    endFilmstrip(session.filmstrip);
+    endDepthQuality(session.depthQuality);
+    endFileMover(session.mover);
+    endManifestWriter(session.manifests);
+    endLibraryScan(session.library);
+}
+
+// Get the next unused numbered filename after filename, e.g. take_002.mkv after take_001.mkv
+string nextTakeFilename(const string& filename) {
+    // Split filename into directory, stem, take number and extension
+    size_t slash = filename.find_last_of("\\/");
+    string directory = (slash == string::npos) ? "" : filename.substr(0, slash + 1);
+    string name = filename.substr(directory.length());
+
+    size_t dot = name.find_last_of('.');
+    string extension = (dot == string::npos) ? "" : name.substr(dot);
+    string stem = name.substr(0, name.length() - extension.length());
+
+    size_t digits = stem.length();
+    while (digits > 0 && isdigit((unsigned char) stem[digits - 1])) {
+        digits--;
+    }
+
+    // Longer digit runs such as dates stay part of the stem, so the take number cannot overflow
+    if (stem.length() - digits > maxTakeNumberDigits) {
+        digits = stem.length();
+    }
+
+    int number = 0;
+    int width = 3;
+    if (digits < stem.length()) {
+        number = stoi(stem.substr(digits));
+        if ((int) (stem.length() - digits) > width) {
+            width = (int) (stem.length() - digits);
+        }
+        stem = stem.substr(0, digits);
+    }
+    else {
+        stem += "_";
+    }
+
+    // List every file that could clash in one directory scan instead of checking each candidate
+    unordered_set<string> existing;
+    WIN32_FIND_DATAA findData;
+    HANDLE findHandle = FindFirstFileA((directory + stem + "*" + extension).c_str(), &findData);
+
+    if (findHandle != INVALID_HANDLE_VALUE) {
+        do {
+            existing.insert(toLower(findData.cFileName));
+        } while (FindNextFileA(findHandle, &findData));
+        FindClose(findHandle);
+    }
+
+    string candidate;
+    do {
+        number++;
+        string numberStr = to_string(number);
+        if ((int) numberStr.length() < width) {
+            numberStr.insert(0, width - numberStr.length(), '0');
+        }
+        candidate = stem + numberStr + extension;
+    } while (existing.count(toLower(candidate)) > 0);
+
+    return directory + candidate;
+}
@@ -0,0 +1,130 @@
+/* Aden Prince
+ * HiMER Lab at U. of Illinois, Chicago
+ * K4ARecorder GUI
+ *
+ * RecordingSession.h
+ * Contains the state and functions used to keep the GUI open while
+ * K4ARecorder runs, so takes can be recorded back to back.
+ */
+
+#pragma once
+
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include <Windows.h>
+
+#include "ControlServer.h"
+#include "DepthCompression.h"
+#include "DropMonitor.h"
+#include "FileMover.h"
+#include "DepthQuality.h"
+#include "Filmstrip.h"
+#include "LibraryIndex.h"
+#include "Manifest.h"
+#include "MultiDevice.h"
+#include "RecorderLog.h"
+#include "RecordingInspector.h"
+#include "RecordingRepair.h"
+#include "StartLatency.h"
+#include "StorageCheck.h"
+#include "ThroughputMonitor.h"
+
+// Most trailing digits read as a take number, which keeps it within an int
+const size_t maxTakeNumberDigits = 9;
+
+// State of a session of takes recorded without closing the GUI
+struct RecordingSession {
+    // Keep the GUI open while K4ARecorder runs and after it exits
+    bool enabled = false;
+
+    // Current K4ARecorder process, valid while running is true
+    PROCESS_INFORMATION pi = {};
+    bool running = false;
+    bool stopRequested = false;
+
+    // Set when a take ends, cleared by the GUI once it has been handled
+    bool takeFinished = false;
+    bool takeWroteFile = false; // Whether the take that finished left a file behind, false if K4ARecorder failed to start recording
+    DWORD lastExitCode = 0;
+
+    // Output file of the current or last take, empty for help and device listing
+    std::string outputFilename;
+    // Output file the take was started with, where outputFilename is moved to when recording to a scratch directory
+    std::string requestedFilename;
+    // Arguments K4ARecorder was started with for the current or last single device take
+    std::string takeArgs;
+    int takeCount = 0;
+
+    // Frame rate of the current or last take, used to find dropped frames
+    int fps = 30;
+
+    // Output of K4ARecorder, kept across takes
+    RecorderLog log;
+
+    // Takes recorded from several devices at once
+    MultiDeviceSession multiDevice;
+
+    // Time from clicking Start to K4ARecorder writing frames
+    StartLatency latency;
+
+    // Write rate of the output files and free space on their volume
+    ThroughputMonitor throughput;
+
+    // Frames missing from the output files while they are written
+    DropMonitor drops;
+
+    // Write benchmark of the output directory, run before a take
+    StorageBenchmark storageBenchmark;
+
+    // Summary of the files written by the last take, inspected at their output paths once a staged take has been moved
+    RecordingInspection inspection;
+    std::vector<std::string> inspectionPending; // Output paths of the take's files still waiting to be moved
+    std::vector<std::string> inspectionReady;   // Files inspected once none are pending
+
+    // Repair of a file from the last take that K4ARecorder did not finish
+    RecordingRepair repair;
+
+    // Copy of a file from the last take with its depth track compressed
+    DepthCompression depthCompression;
+
+    // Color and depth thumbnails of the last take, made once a staged take has been moved to its output path
+    FilmstripJob filmstrip;
+    std::string filmstripPending;
+
+    // Depth statistics of the last take, measured once its filmstrip is done so the two do not build its frame index at once
+    DepthQualityJob depthQuality;
+
+    // Moves of takes recorded to the scratch directory
+    FileMover mover;
+
+    // Checksums and manifests of takes recorded straight to their output paths
+    ManifestWriter manifests;
+
+    // Index of the recordings in a directory tree, shown by the library view
+    LibraryScan library;
+
+    // Held by the GUI while it builds a frame and by the control server while it runs a request
+    std::mutex mutex;
+
+    // Start, stop and status requests from scripts
+    ControlServer control;
+};
+
+// Start K4ARecorder for a new take without waiting for it to exit
+bool startTake(RecordingSession& session, const std::string& recorderPathStr, const std::string& argsStr);
+// Check and stage a take's options and start it as the Start button does, K4ARecorder is left for main to start if the GUI is not kept open
+bool beginTake(RecordingSession& session, const RecorderOptions& options, const std::string& recorderPathStr, std::string& argsStr, std::string& errorText);
+// Check if the current take has ended without blocking, returns true while it is running
+bool pollTake(RecordingSession& session);
+// Ask K4ARecorder to finish the current take as if Ctrl+C was pressed
+void stopTake(RecordingSession& session);
+// Check if a single or multiple device take is running
+bool sessionBusy(const RecordingSession& session);
+// Get the name of a background job reading or mapping filename, which keeps a repair from cutting it short, empty if there is none
+std::string jobUsingRecording(const RecordingSession& session, const std::string& filename);
+// Stop serving control requests and the current take if there is one, and wait for K4ARecorder to exit
+void endSession(RecordingSession& session);
+// Get the next unused numbered filename after filename, e.g. take_002.mkv after take_001.mkv
+std::string nextTakeFilename(const std::string& filename);
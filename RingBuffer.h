@@ -0,0 +1,62 @@
+/* Aden Prince
+ * HiMER Lab at U. of Illinois, Chicago
+ * K4ARecorder GUI
+ *
+ * RingBuffer.h
+ * Contains a fixed-size lock-free ring buffer for passing data from one
+ * producer thread to one consumer thread.
+ */
+
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+
+// Lock-free single-producer/single-consumer queue holding up to Capacity items
+template <typename T, size_t Capacity>
+class SpscRingBuffer {
+    static_assert((Capacity & (Capacity - 1)) == 0, "Capacity must be a power of two");
+
+public:
+    // Producer thread only: copy as many items as fit, returns the number copied
+    size_t push(const T* items, size_t count) {
+        size_t head = head_.load(std::memory_order_relaxed);
+        size_t tail = tail_.load(std::memory_order_acquire);
+        size_t space = Capacity - (head - tail);
+        if (count > space) {
+            count = space;
+        }
+        for (size_t i = 0; i < count; i++) {
+            buffer_[(head + i) & (Capacity - 1)] = items[i];
+        }
+        head_.store(head + count, std::memory_order_release);
+        return count;
+    }
+
+    // Consumer thread only: copy up to maxCount items out, returns the number copied
+    size_t pop(T* items, size_t maxCount) {
+        size_t tail = tail_.load(std::memory_order_relaxed);
+        size_t head = head_.load(std::memory_order_acquire);
+        size_t count = head - tail;
+        if (count > maxCount) {
+            count = maxCount;
+        }
+        for (size_t i = 0; i < count; i++) {
+            items[i] = buffer_[(tail + i) & (Capacity - 1)];
+        }
+        tail_.store(tail + count, std::memory_order_release);
+        return count;
+    }
+
+    // Either thread: true if nothing is waiting to be popped
+    bool empty() const {
+        return head_.load(std::memory_order_acquire) == tail_.load(std::memory_order_acquire);
+    }
+
+private:
+    T buffer_[Capacity];
+
+    // Kept on separate cache lines so the two threads do not contend
+    alignas(64) std::atomic<size_t> head_{0}; // Next slot to write, owned by the producer
+    alignas(64) std::atomic<size_t> tail_{0}; // Next slot to read, owned by the consumer
+};
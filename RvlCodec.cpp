@@ -0,0 +1,173 @@
+/* Aden Prince
+ * HiMER Lab at U. of Illinois, Chicago
+ * K4ARecorder GUI
+ *
+ * RvlCodec.cpp
+ * Contains functions used to compress and decompress depth frames with
+ * RVL coding.
+ */
+
+#include "RvlCodec.h"
+
+using namespace std;
+
+// Nibbles are packed into 32-bit words, first nibble highest, and each word is stored little-endian
+struct NibbleWriter {
+    uint8_t* output;
+    size_t size = 0;
+    uint32_t word = 0;
+    int nibbles = 0;
+};
+
+struct NibbleReader {
+    const uint8_t* data;
+    size_t size;
+    size_t position = 0;
+    uint32_t word = 0;
+    int nibbles = 0;
+    bool overrun = false;
+};
+
+// Store the current word and start a new one
+static inline void flushWord(NibbleWriter& writer) {
+    uint8_t* out = writer.output + writer.size;
+    out[0] = (uint8_t) writer.word;
+    out[1] = (uint8_t) (writer.word >> 8);
+    out[2] = (uint8_t) (writer.word >> 16);
+    out[3] = (uint8_t) (writer.word >> 24);
+    writer.size += 4;
+    writer.word = 0;
+    writer.nibbles = 0;
+}
+
+// Append value 3 bits at a time, lowest first, setting the high bit of every nibble but the last
+static inline void encodeVle(NibbleWriter& writer, uint32_t value) {
+    do {
+        uint32_t nibble = value & 0x7;
+        value >>= 3;
+        if (value != 0) {
+            nibble |= 0x8;
+        }
+        writer.word = (writer.word << 4) | nibble;
+        if (++writer.nibbles == 8) {
+            flushWord(writer);
+        }
+    } while (value != 0);
+}
+
+// Read a value written by encodeVle, setting overrun if the data ends first
+static inline uint32_t decodeVle(NibbleReader& reader) {
+    uint32_t value = 0;
+    int shift = 0;
+    uint32_t nibble;
+    do {
+        if (reader.nibbles == 0) {
+            if (reader.size - reader.position < 4) {
+                reader.overrun = true;
+                return 0;
+            }
+            const uint8_t* in = reader.data + reader.position;
+            reader.word = in[0] | (in[1] << 8) | (in[2] << 16) | ((uint32_t) in[3] << 24);
+            reader.position += 4;
+            reader.nibbles = 8;
+        }
+        nibble = reader.word >> 28;
+        reader.word <<= 4;
+        reader.nibbles--;
+        value |= (nibble & 0x7) << shift;
+        shift += 3;
+    } while ((nibble & 0x8) != 0 && shift < 32);
+    return value;
+}
+
+// Read one pixel in the frame's byte order
+static inline int32_t readPixel(const uint8_t* pixels, size_t index, bool bigEndian) {
+    const uint8_t* pixel = pixels + 2 * index;
+    return bigEndian ? (pixel[0] << 8) | pixel[1] : pixel[0] | (pixel[1] << 8);
+}
+
+static inline void writePixel(uint8_t* pixels, size_t index, uint32_t value, bool bigEndian) {
+    uint8_t* pixel = pixels + 2 * index;
+    pixel[bigEndian ? 0 : 1] = (uint8_t) (value >> 8);
+    pixel[bigEndian ? 1 : 0] = (uint8_t) value;
+}
+
+// Get the most bytes compressRvl can write for a frame of pixelCount pixels
+size_t rvlMaxCompressedSize(size_t pixelCount) {
+    // A pixel change takes up to 6 nibbles and each run length adds at most 1 more per pixel, plus the last runs and a partial word
+    return pixelCount * 4 + 32;
+}
+
+// Compress pixelCount 16-bit pixels, big-endian if bigEndian is set, returns the compressed size in bytes
+size_t compressRvl(const uint8_t* pixels, size_t pixelCount, bool bigEndian, uint8_t* output) {
+    NibbleWriter writer;
+    writer.output = output;
+    int32_t previous = 0;
+    size_t index = 0;
+
+    while (index < pixelCount) {
+        size_t zeros = 0;
+        while (index < pixelCount && readPixel(pixels, index, bigEndian) == 0) {
+            index++;
+            zeros++;
+        }
+        encodeVle(writer, (uint32_t) zeros);
+
+        size_t nonzeros = 0;
+        while (index + nonzeros < pixelCount && readPixel(pixels, index + nonzeros, bigEndian) != 0) {
+            nonzeros++;
+        }
+        encodeVle(writer, (uint32_t) nonzeros);
+
+        // Zigzag the change so small steps either way take few bits
+        for (size_t i = 0; i < nonzeros; i++, index++) {
+            int32_t current = readPixel(pixels, index, bigEndian);
+            int32_t delta = current - previous;
+            encodeVle(writer, ((uint32_t) delta << 1) ^ (uint32_t) (delta >> 31));
+            previous = current;
+        }
+    }
+
+    // Move the last nibbles to the top of a final word
+    if (writer.nibbles > 0) {
+        writer.word <<= 4 * (8 - writer.nibbles);
+        flushWord(writer);
+    }
+    return writer.size;
+}
+
+// Decompress to pixelCount 16-bit pixels in the passed byte order, returns false if data does not hold exactly one frame
+bool decompressRvl(const uint8_t* data, size_t size, size_t pixelCount, bool bigEndian, uint8_t* pixels) {
+    NibbleReader reader;
+    reader.data = data;
+    reader.size = size;
+    int32_t previous = 0;
+    size_t index = 0;
+
+    while (index < pixelCount) {
+        uint32_t zeros = decodeVle(reader);
+        if (reader.overrun || zeros > pixelCount - index) {
+            return false;
+        }
+        for (uint32_t i = 0; i < zeros; i++, index++) {
+            writePixel(pixels, index, 0, bigEndian);
+        }
+
+        uint32_t nonzeros = decodeVle(reader);
+        if (reader.overrun || nonzeros > pixelCount - index) {
+            return false;
+        }
+        for (uint32_t i = 0; i < nonzeros; i++, index++) {
+            uint32_t positive = decodeVle(reader);
+            int32_t current = previous + (int32_t) ((positive >> 1) ^ (0 - (positive & 1)));
+            if (reader.overrun || current <= 0 || current > 0xFFFF) {
+                return false;
+            }
+            writePixel(pixels, index, (uint32_t) current, bigEndian);
+            previous = current;
+        }
+    }
+
+    // Anything past the last partial word means the data was not one frame
+    return reader.position == size;
+}
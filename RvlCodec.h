@@ -0,0 +1,22 @@
+/* Aden Prince
+ * HiMER Lab at U. of Illinois, Chicago
+ * K4ARecorder GUI
+ *
+ * RvlCodec.h
+ * Contains a lossless codec for 16-bit depth frames using run-length and
+ * variable-length (RVL) coding. Runs of invalid zero pixels are stored as
+ * their length, and valid pixels as the change from the last valid pixel
+ * in 3-bit groups. Has no Windows or ImGui dependencies.
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+// Get the most bytes compressRvl can write for a frame of pixelCount pixels
+size_t rvlMaxCompressedSize(size_t pixelCount);
+// Compress pixelCount 16-bit pixels, big-endian if bigEndian is set, returns the compressed size in bytes
+size_t compressRvl(const uint8_t* pixels, size_t pixelCount, bool bigEndian, uint8_t* output);
+// Decompress to pixelCount 16-bit pixels in the passed byte order, returns false if data does not hold exactly one frame
+bool decompressRvl(const uint8_t* data, size_t size, size_t pixelCount, bool bigEndian, uint8_t* pixels);
@@ -0,0 +1,262 @@
+/* Aden Prince
+ * HiMER Lab at U. of Illinois, Chicago
+ * K4ARecorder GUI
+ *
+ * StartLatency.cpp
+ * Contains functions used to time each stage between clicking Start and
+ * K4ARecorder writing frames, and to keep a history of those times.
+ */
+
+#include "StartLatency.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstdlib>
+#include <fstream>
+#include <map>
+#include <sstream>
+
+using namespace std;
+
+const char* const startStageNames[StageCount] = {"launched", "started", "first_byte", "first_cluster"};
+
+// Matroska Cluster element ID, the first one marks the first frames written
+const uint32_t clusterId = 0x1F43B675;
+
+// Milliseconds from clicking Start to time
+static double msSinceClick(const StartLatency& latency, chrono::steady_clock::time_point time) {
+    return chrono::duration<double, milli>(time - latency.clickTime).count();
+}
+
+// Get the history file, kept in this user's local app data since the executable's folder may not be writable, e.g. under Program Files
+static string historyPath() {
+    char localAppData[MAX_PATH];
+    DWORD localAppDataLength = GetEnvironmentVariableA("LOCALAPPDATA", localAppData, MAX_PATH);
+    if (localAppDataLength > 0 && localAppDataLength < MAX_PATH) {
+        string directory = string(localAppData, localAppDataLength) + "\\K4ARecorderGUI";
+        CreateDirectoryA(directory.c_str(), NULL);
+        return directory + "\\start_latency.csv";
+    }
+
+    // Without a profile fall back to the executable's folder
+    char exePath[MAX_PATH];
+    DWORD length = GetModuleFileNameA(NULL, exePath, MAX_PATH);
+    string path(exePath, length);
+    size_t slash = path.find_last_of("\\/");
+    return path.substr(0, slash + 1) + "start_latency.csv";
+}
+
+// Group the history by mode and get the percentiles of each stage
+static void updateStats(StartLatency& latency) {
+    map<string, vector<const StartLatencyRecord*>> byMode;
+    for (const StartLatencyRecord& record : latency.history) {
+        byMode[record.mode].push_back(&record);
+    }
+
+    latency.stats.clear();
+    for (auto& mode : byMode) {
+        StartLatencyStats stats;
+        stats.mode = mode.first;
+        stats.takeCount = (int) mode.second.size();
+
+        for (int stage = 0; stage < StageCount; stage++) {
+            vector<double> values;
+            for (const StartLatencyRecord* record : mode.second) {
+                if (record->stageMs[stage] >= 0) {
+                    values.push_back(record->stageMs[stage]);
+                }
+            }
+            stats.p50Ms[stage] = percentile(values, 50);
+            stats.p99Ms[stage] = percentile(values, 99);
+        }
+        latency.stats.push_back(stats);
+    }
+}
+
+// Read every take from the history file
+static void loadHistory(StartLatency& latency) {
+    latency.historyLoaded = true;
+    latency.history.clear();
+
+    ifstream historyFile(historyPath());
+    string line;
+    getline(historyFile, line); // Skip column names
+
+    while (getline(historyFile, line)) {
+        stringstream lineStream(line);
+        StartLatencyRecord record;
+        string field;
+
+        getline(lineStream, record.mode, ',');
+        for (int stage = 0; stage < StageCount && getline(lineStream, field, ','); stage++) {
+            record.stageMs[stage] = atof(field.c_str());
+        }
+        if (record.mode.empty() == false) {
+            latency.history.push_back(record);
+        }
+    }
+
+    updateStats(latency);
+}
+
+// Add the current take to the history file and the stats
+static void saveCurrent(StartLatency& latency) {
+    string path = historyPath();
+    bool newFile = !fileExists(path);
+
+    ofstream historyFile(path, ios::app);
+    if (newFile) {
+        historyFile << "mode";
+        for (int stage = 0; stage < StageCount; stage++) {
+            historyFile << "," << startStageNames[stage] << "_ms";
+        }
+        historyFile << "\n";
+    }
+
+    historyFile << latency.current.mode;
+    for (int stage = 0; stage < StageCount; stage++) {
+        historyFile << "," << latency.current.stageMs[stage];
+    }
+    historyFile << "\n";
+
+    latency.history.push_back(latency.current);
+    updateStats(latency);
+}
+
+// Poll the log and the output file every millisecond until every stage is reached or K4ARecorder exits
+static void watchStages(StartLatency* latency) {
+    double* stageMs = latency->current.stageMs;
+    HANDLE file = INVALID_HANDLE_VALUE;
+    uint32_t lastFourBytes = 0;
+    char chunk[65536];
+
+    while (true) {
+        // Waiting on the process doubles as the polling interval
+        bool exited = WaitForSingleObject(latency->process, 1) == WAIT_OBJECT_0;
+        auto now = chrono::steady_clock::now();
+
+        chrono::steady_clock::time_point startedTime;
+        if (stageMs[StageStarted] < 0 && latency->log != nullptr &&
+            watchSeen(*latency->log, latency->startedWatch, &startedTime)) {
+            stageMs[StageStarted] = msSinceClick(*latency, startedTime);
+        }
+
+        // Check the size through the file's attributes without opening it
+        if (stageMs[StageFirstByte] < 0) {
+            WIN32_FILE_ATTRIBUTE_DATA attributes;
+            if (GetFileAttributesExA(latency->outputFilename.c_str(), GetFileExInfoStandard, &attributes) &&
+                (attributes.nFileSizeLow != 0 || attributes.nFileSizeHigh != 0)) {
+                stageMs[StageFirstByte] = msSinceClick(*latency, now);
+            }
+        }
+
+        // Look for the first cluster in the bytes written since the last check
+        if (stageMs[StageFirstByte] >= 0 && stageMs[StageFirstCluster] < 0) {
+            if (file == INVALID_HANDLE_VALUE) {
+                file = CreateFileA(latency->outputFilename.c_str(), GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE,
+                                   NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+            }
+
+            DWORD bytesRead = 0;
+            while (file != INVALID_HANDLE_VALUE && stageMs[StageFirstCluster] < 0 &&
+                   ReadFile(file, chunk, sizeof(chunk), &bytesRead, NULL) && bytesRead > 0) {
+                for (DWORD i = 0; i < bytesRead; i++) {
+                    lastFourBytes = (lastFourBytes << 8) | (uint8_t) chunk[i];
+                    if (lastFourBytes == clusterId) {
+                        stageMs[StageFirstCluster] = msSinceClick(*latency, now);
+                        break;
+                    }
+                }
+            }
+        }
+
+        bool allReached = stageMs[StageFirstByte] >= 0 && stageMs[StageFirstCluster] >= 0 &&
+                          (latency->log == nullptr || stageMs[StageStarted] >= 0);
+        if (allReached || exited) {
+            break;
+        }
+    }
+
+    if (file != INVALID_HANDLE_VALUE) {
+        CloseHandle(file);
+    }
+    latency->watcherFinished = true;
+}
+
+// Start timing a take when Start is clicked
+void beginStartLatency(StartLatency& latency, const RecorderOptions& options) {
+    finishStartLatency(latency);
+    if (!latency.historyLoaded) {
+        loadHistory(latency);
+    }
+
+    latency.clickTime = chrono::steady_clock::now();
+    latency.outputFilename = options.output_filename;
+    latency.current = StartLatencyRecord();
+    latency.current.mode = string(colorModeTable[options.color_mode_index].name) + " " +
+                           depthModeTable[options.depth_mode_index].name + " " + frameRateTable[options.frame_rate_index].name;
+    latency.measuring = true;
+}
+
+// Record that CreateProcess returned and start watching for the later stages.
+// log and startedWatch are used to time "Started recording" if output is captured.
+void recorderLaunched(StartLatency& latency, HANDLE process, const RecorderLog* log, int startedWatch) {
+    if (!latency.measuring || latency.watcherThread.joinable()) {
+        return;
+    }
+
+    latency.current.stageMs[StageLaunched] = msSinceClick(latency, chrono::steady_clock::now());
+
+    // The watcher keeps its own handle so it stays valid after the session closes the process handles
+    // Without a handle the later stages cannot be watched, so the take is not timed
+    if (!DuplicateHandle(GetCurrentProcess(), process, GetCurrentProcess(), &latency.process, SYNCHRONIZE, FALSE, 0)) {
+        latency.process = NULL;
+        latency.measuring = false;
+        return;
+    }
+
+    latency.log = log;
+    latency.startedWatch = startedWatch;
+    latency.watcherFinished = false;
+    latency.watcherThread = thread(watchStages, &latency);
+}
+
+// Save the take to the history once every stage is reached or K4ARecorder exits, never blocks
+bool pollStartLatency(StartLatency& latency) {
+    if (!latency.measuring || !latency.watcherFinished) {
+        return false;
+    }
+    finishStartLatency(latency);
+    return true;
+}
+
+// Wait for the watcher thread and save the take to the history
+void finishStartLatency(StartLatency& latency) {
+    // Nothing to finish until K4ARecorder has been started
+    if (!latency.measuring || latency.current.stageMs[StageLaunched] < 0) {
+        return;
+    }
+
+    if (latency.watcherThread.joinable()) {
+        latency.watcherThread.join();
+    }
+    if (latency.process != NULL) {
+        CloseHandle(latency.process);
+        latency.process = NULL;
+    }
+
+    saveCurrent(latency);
+    latency.measuring = false;
+}
+
+// Get the nearest-rank percentile p (0 to 100) of values, -1 if there are none
+double percentile(vector<double> values, double p) {
+    if (values.empty()) {
+        return -1;
+    }
+    size_t rank = (size_t) ceil(p / 100.0 * values.size());
+    rank = (rank == 0) ? 0 : rank - 1;
+    nth_element(values.begin(), values.begin() + rank, values.end());
+    return values[rank];
+}
@@ -0,0 +1,81 @@
+/* Aden Prince
+ * HiMER Lab at U. of Illinois, Chicago
+ * K4ARecorder GUI
+ *
+ * StartLatency.h
+ * Contains the state and functions used to time each stage between
+ * clicking Start and K4ARecorder writing frames, and to keep a history
+ * of those times across sessions.
+ */
+
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <Windows.h>
+
+#include "RecorderLog.h"
+#include "RecorderOptions.h"
+
+// Stages timed from clicking Start, in the order they happen
+enum StartStage {
+    StageLaunched,     // CreateProcess returned
+    StageStarted,      // K4ARecorder printed "Started recording"
+    StageFirstByte,    // The output file first had a non-zero size
+    StageFirstCluster, // The output file first contained a Matroska cluster
+    StageCount
+};
+
+// Stage names shown in the GUI and used as history file columns
+extern const char* const startStageNames[StageCount];
+
+// Stage times of one take, in milliseconds from clicking Start, -1 if the stage was not reached
+struct StartLatencyRecord {
+    std::string mode; // Color mode, depth mode and frame rate
+    double stageMs[StageCount] = {-1, -1, -1, -1};
+};
+
+// Percentiles of each stage over every take recorded in one mode
+struct StartLatencyStats {
+    std::string mode;
+    int takeCount = 0;
+    double p50Ms[StageCount];
+    double p99Ms[StageCount];
+};
+
+// Timing of the current take and the history of earlier takes
+struct StartLatency {
+    // Set when Start is clicked
+    std::chrono::steady_clock::time_point clickTime;
+    std::string outputFilename;
+    StartLatencyRecord current;
+    bool measuring = false;
+
+    // Watches the output file and the log until every stage is reached or K4ARecorder exits
+    std::thread watcherThread;
+    std::atomic<bool> watcherFinished{false};
+    HANDLE process = NULL;
+    const RecorderLog* log = nullptr;
+    int startedWatch = -1;
+
+    // Loaded from the history file the first time a take is timed
+    std::vector<StartLatencyRecord> history;
+    std::vector<StartLatencyStats> stats;
+    bool historyLoaded = false;
+};
+
+// Start timing a take when Start is clicked
+void beginStartLatency(StartLatency& latency, const RecorderOptions& options);
+// Record that CreateProcess returned and start watching for the later stages.
+// log and startedWatch are used to time "Started recording" if output is captured.
+void recorderLaunched(StartLatency& latency, HANDLE process, const RecorderLog* log, int startedWatch);
+// Save the take to the history once every stage is reached or K4ARecorder exits, never blocks
+bool pollStartLatency(StartLatency& latency);
+// Wait for the watcher thread and save the take to the history
+void finishStartLatency(StartLatency& latency);
+// Get the nearest-rank percentile p (0 to 100) of values, -1 if there are none
+double percentile(std::vector<double> values, double p);
@@ -0,0 +1,209 @@
+/* Aden Prince
+ * HiMER Lab at U. of Illinois, Chicago
+ * K4ARecorder GUI
+ *
+ * StorageCheck.cpp
+ * Contains functions used to check that the target volume can hold a
+ * recording before K4ARecorder is started.
+ */
+
+#include "StorageCheck.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <vector>
+
+#include <Windows.h>
+
+using namespace std;
+
+// Name of the scratch file written by the storage benchmark, deleted when it is closed
+const char* const benchmarkFilename = "k4arecorder_gui_benchmark.tmp";
+
+// Get the directory holding filename, "." if it has none
+string directoryOfFile(const string& filename) {
+    size_t slash = filename.find_last_of("\\/");
+    return (slash == string::npos) ? "." : filename.substr(0, slash + 1);
+}
+
+// Get the free space on the volume holding filename, returns false if it cannot be read
+bool freeSpaceForFile(const string& filename, uint64_t& freeBytes) {
+    ULARGE_INTEGER available;
+    if (!GetDiskFreeSpaceExA(directoryOfFile(filename).c_str(), &available, NULL, NULL)) {
+        return false;
+    }
+    freeBytes = available.QuadPart;
+    return true;
+}
+
+// Check the target volume can hold a timed take from deviceCount devices, returns true if it can
+bool checkStorageForTake(const RecorderOptions& options, int deviceCount, string& errorText) {
+    // Untimed takes can be stopped at any point, so only timed takes are checked
+    if (!options.record_for_time || options.recording_time <= 0 || options.print_help || options.list_devices) {
+        return true;
+    }
+
+    uint64_t freeBytes;
+    if (!freeSpaceForFile(options.output_filename, freeBytes)) {
+        return true;
+    }
+
+    double neededBytes = expectedBytesPerSecond(options) * options.recording_time * deviceCount;
+    if (neededBytes <= (double) freeBytes) {
+        return true;
+    }
+
+    char message[160];
+    snprintf(message, sizeof(message), "ERROR: Recording needs about %.1f GB but only %.1f GB is free\n",
+             neededBytes / 1e9, freeBytes / 1e9);
+    errorText += message;
+    return false;
+}
+
+// Write one block and get how long it took in milliseconds, -1 if the write failed
+static double timedWrite(HANDLE file, const char* data, DWORD bytes) {
+    auto start = chrono::steady_clock::now();
+    DWORD bytesWritten = 0;
+    if (!WriteFile(file, data, bytes, &bytesWritten, NULL) || bytesWritten != bytes) {
+        return -1;
+    }
+    return chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+}
+
+// Write color and depth frame-sized blocks flat out, then at the recording rate
+static void runStorageBenchmark(StorageBenchmark* benchmark) {
+    string path = benchmark->directory + benchmarkFilename;
+
+    // Write-through so the disk is measured instead of the file cache,
+    // and delete-on-close so the scratch file is removed even if the program stops
+    HANDLE file = CreateFileA(path.c_str(), GENERIC_WRITE, 0, NULL, CREATE_ALWAYS,
+                              FILE_ATTRIBUTE_TEMPORARY | FILE_FLAG_WRITE_THROUGH | FILE_FLAG_DELETE_ON_CLOSE, NULL);
+    if (file == INVALID_HANDLE_VALUE) {
+        benchmark->errorText = "ERROR: Could not create \"" + path + "\"\n";
+        benchmark->finished = true;
+        return;
+    }
+
+    // Fill the blocks with varied data so compressed volumes cannot shrink them
+    size_t bufferBytes = (size_t) ((benchmark->colorBlockBytes > benchmark->depthBlockBytes) ? benchmark->colorBlockBytes : benchmark->depthBlockBytes);
+    vector<char> buffer(bufferBytes);
+    uint32_t seed = 2463534242u;
+    for (char& byte : buffer) {
+        seed ^= seed << 13;
+        seed ^= seed >> 17;
+        seed ^= seed << 5;
+        byte = (char) seed;
+    }
+
+    DWORD blockBytes[2] = {(DWORD) benchmark->colorBlockBytes, (DWORD) benchmark->depthBlockBytes};
+    bool failed = false;
+
+    // Phase 1: sustained throughput, writing frames back to back
+    uint64_t bytesWritten = 0;
+    auto start = chrono::steady_clock::now();
+    double elapsed = 0;
+    while (!failed && elapsed < benchmarkPhaseSeconds && bytesWritten < benchmark->maxBytes) {
+        for (DWORD bytes : blockBytes) {
+            if (bytes > 0 && timedWrite(file, buffer.data(), bytes) < 0) {
+                failed = true;
+            }
+            bytesWritten += bytes;
+        }
+        elapsed = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    }
+    benchmark->sustainedMBps = bytesWritten / 1e6 / elapsed;
+
+    // Phase 2: write latency at the recording rate, one frame per frame period
+    vector<double> frameWriteMs;
+    auto framePeriod = chrono::duration<double>(1.0 / benchmark->fps);
+    auto nextFrame = chrono::steady_clock::now();
+    int frameCount = (int) (benchmarkPhaseSeconds * benchmark->fps);
+
+    for (int frame = 0; frame < frameCount && !failed; frame++) {
+        this_thread::sleep_until(nextFrame);
+        nextFrame += chrono::duration_cast<chrono::steady_clock::duration>(framePeriod);
+
+        double frameMs = 0;
+        for (DWORD bytes : blockBytes) {
+            double writeMs = (bytes > 0) ? timedWrite(file, buffer.data(), bytes) : 0;
+            if (writeMs < 0) {
+                failed = true;
+            }
+            frameMs += writeMs;
+        }
+        frameWriteMs.push_back(frameMs);
+    }
+
+    CloseHandle(file);
+
+    if (failed) {
+        benchmark->errorText = "ERROR: Writing to \"" + path + "\" failed, the volume may be full\n";
+    }
+    else if (frameWriteMs.empty() == false) {
+        sort(frameWriteMs.begin(), frameWriteMs.end());
+        benchmark->pacedP99Ms = frameWriteMs[(frameWriteMs.size() * 99 - 1) / 100];
+        benchmark->pacedMaxMs = frameWriteMs.back();
+    }
+
+    benchmark->finished = true;
+}
+
+// Start benchmarking the output directory with the block sizes and rate of the passed options
+bool startStorageBenchmark(StorageBenchmark& benchmark, const RecorderOptions& options, string& errorText) {
+    if (benchmark.running) {
+        return false;
+    }
+
+    const CameraModeInfo& color = colorModeTable[options.color_mode_index];
+    const CameraModeInfo& depth = depthModeTable[options.depth_mode_index];
+    if (color.bytesPerFrame == 0 && depth.bytesPerFrame == 0) {
+        errorText += "ERROR: Color mode and depth mode cannot both be OFF\n";
+        return false;
+    }
+
+    benchmark.directory = directoryOfFile(options.output_filename);
+    if (benchmark.directory.back() != '\\' && benchmark.directory.back() != '/') {
+        benchmark.directory += "\\";
+    }
+
+    // Leave at least half of the free space untouched
+    uint64_t freeBytes;
+    if (!freeSpaceForFile(options.output_filename, freeBytes)) {
+        errorText += "ERROR: Output directory \"" + benchmark.directory + "\" not found\n";
+        return false;
+    }
+    benchmark.maxBytes = (freeBytes / 2 < benchmarkMaxBytes) ? freeBytes / 2 : benchmarkMaxBytes;
+    benchmark.colorBlockBytes = color.bytesPerFrame;
+    benchmark.depthBlockBytes = depth.bytesPerFrame;
+    benchmark.fps = frameRateTable[options.frame_rate_index].fps;
+    benchmark.requiredMBps = expectedBytesPerSecond(options) / 1e6;
+    benchmark.frameMs = 1000.0 / benchmark.fps;
+    benchmark.sustainedMBps = 0;
+    benchmark.pacedP99Ms = 0;
+    benchmark.pacedMaxMs = 0;
+    benchmark.errorText = "";
+
+    benchmark.running = true;
+    benchmark.finished = false;
+    benchmark.workerThread = thread(runStorageBenchmark, &benchmark);
+    return true;
+}
+
+// Check if the benchmark has finished, joining the worker once it has, never blocks
+bool pollStorageBenchmark(StorageBenchmark& benchmark) {
+    if (!benchmark.running || !benchmark.finished) {
+        return false;
+    }
+    benchmark.workerThread.join();
+    benchmark.running = false;
+    return true;
+}
+
+// Wait for the benchmark to finish
+void endStorageBenchmark(StorageBenchmark& benchmark) {
+    if (benchmark.workerThread.joinable()) {
+        benchmark.workerThread.join();
+    }
+    benchmark.running = false;
+}
@@ -0,0 +1,58 @@
+/* Aden Prince
+ * HiMER Lab at U. of Illinois, Chicago
+ * K4ARecorder GUI
+ *
+ * StorageCheck.h
+ * Contains functions used to check that the target volume can hold and
+ * keep up with a recording before K4ARecorder is started.
+ */
+
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <string>
+#include <thread>
+
+#include "RecorderOptions.h"
+
+// Get the directory holding filename, "." if it has none
+std::string directoryOfFile(const std::string& filename);
+// Get the free space on the volume holding filename, returns false if it cannot be read
+bool freeSpaceForFile(const std::string& filename, uint64_t& freeBytes);
+// Check the target volume can hold a timed take from deviceCount devices, returns true if it can
+bool checkStorageForTake(const RecorderOptions& options, int deviceCount, std::string& errorText);
+
+// Length of each phase of the storage benchmark
+const double benchmarkPhaseSeconds = 3.0;
+// Most bytes written by the first phase of the storage benchmark
+const uint64_t benchmarkMaxBytes = 2000000000;
+
+// Sequential write benchmark run on a worker thread in the output directory
+struct StorageBenchmark {
+    std::thread workerThread;
+    std::atomic<bool> running{false};
+    std::atomic<bool> finished{false};
+
+    // Set before the worker starts
+    std::string directory;
+    int colorBlockBytes = 0;
+    int depthBlockBytes = 0;
+    int fps = 0;
+    double requiredMBps = 0;
+    uint64_t maxBytes = 0;
+
+    // Set by the worker, read once finished is true
+    double sustainedMBps = 0; // Writing frame-sized blocks as fast as possible
+    double pacedP99Ms = 0;    // 99th percentile write time when writing at the recording rate
+    double pacedMaxMs = 0;    // Slowest write when writing at the recording rate
+    double frameMs = 0;       // Time available for each frame's writes at the recording rate
+    std::string errorText;
+};
+
+// Start benchmarking the output directory with the block sizes and rate of the passed options
+bool startStorageBenchmark(StorageBenchmark& benchmark, const RecorderOptions& options, std::string& errorText);
+// Check if the benchmark has finished, joining the worker once it has, never blocks
+bool pollStorageBenchmark(StorageBenchmark& benchmark);
+// Wait for the benchmark to finish
+void endStorageBenchmark(StorageBenchmark& benchmark);
@@ -0,0 +1,303 @@
+/* Aden Prince
+ * HiMER Lab at U. of Illinois, Chicago
+ * K4ARecorder GUI
+ *
+ * SyncAnalysis.cpp
+ * Contains functions used to check the alignment of the recordings of a
+ * multiple device take.
+ */
+
+#include "SyncAnalysis.h"
+#include "MappedFile.h"
+#include "MatroskaParser.h"
+#include "Parallel.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+
+using namespace std;
+
+// Timestamps and sync tags read from one recording
+struct DeviceTimeline {
+    vector<int64_t> timestampsNs; // Device timestamps, the recording's timestamps plus its start offset
+    string syncMode;
+    int64_t subordinateDelayNs = 0;
+    int64_t depthDelayNs = 0;
+    string errorText;
+};
+
+// Read a tag holding an integer, 0 if the recording does not have it
+static int64_t integerTag(const MatroskaFile& file, const string& name) {
+    return strtoll(findTag(file, name).c_str(), nullptr, 10);
+}
+
+// Read the device timestamps of one track and the sync tags of a recording, reading only block headers
+static bool readTimeline(const string& filename, const string& trackName, DeviceTimeline& timeline) {
+    MappedFile mapped;
+    if (!openMappedFile(filename, mapped, timeline.errorText)) {
+        return false;
+    }
+
+    MatroskaFile file;
+    if (!parseMatroskaHeaders(mapped.data, mapped.length, file, timeline.errorText)) {
+        closeMappedFile(mapped);
+        return false;
+    }
+    const TrackInfo* track = findTrack(file, trackName);
+    if (track == nullptr) {
+        timeline.errorText += "ERROR: \"" + filename + "\" has no " + trackName + " track\n";
+        closeMappedFile(mapped);
+        return false;
+    }
+
+    // K4ARecorder subtracts the start offset from every timestamp it writes, adding it back gives times synchronized devices share
+    timeline.syncMode = findTag(file, "K4A_WIRED_SYNC_MODE");
+    timeline.subordinateDelayNs = integerTag(file, "K4A_SUBORDINATE_DELAY_OFF_MASTER_USEC") * 1000;
+    timeline.depthDelayNs = integerTag(file, "K4A_DEPTH_DELAY_NS");
+    int64_t startOffsetNs = integerTag(file, "K4A_START_OFFSET_NS");
+
+    uint64_t offset = 0;
+    ClusterInfo cluster;
+    while (nextCluster(file, offset, cluster)) {
+        uint64_t blockOffset = 0;
+        BlockInfo block;
+        while (nextBlock(file, cluster, blockOffset, block)) {
+            if (block.track == track->number) {
+                timeline.timestampsNs.push_back(block.timestampNs + startOffsetNs);
+            }
+        }
+    }
+    closeMappedFile(mapped);
+
+    sort(timeline.timestampsNs.begin(), timeline.timestampsNs.end());
+    if (timeline.timestampsNs.size() < 2) {
+        timeline.errorText += "ERROR: \"" + filename + "\" has fewer than 2 " + trackName + " frames\n";
+        return false;
+    }
+    return true;
+}
+
+// Get the typical step between timestamps, which dropped frames do not change
+static int64_t medianStep(const vector<int64_t>& timestamps) {
+    vector<int64_t> steps;
+    steps.reserve(timestamps.size() - 1);
+    for (size_t i = 1; i < timestamps.size(); i++) {
+        steps.push_back(timestamps[i] - timestamps[i - 1]);
+    }
+    nth_element(steps.begin(), steps.begin() + steps.size() / 2, steps.end());
+    return steps[steps.size() / 2];
+}
+
+// Pair each of a device's frames with the closest master frame and fit a line to their offsets
+static void alignDevice(const DeviceTimeline& master, const DeviceTimeline& device, int64_t periodNs, int64_t expectedNs,
+                        DeviceAlignment& alignment) {
+    const vector<int64_t>& masterTimes = master.timestampsNs;
+    int64_t windowNs = (int64_t) (periodNs * partnerWindow);
+
+    // Compare in the master's time, where the device's frames should land after the expected offset
+    int64_t rangeStart = max(masterTimes.front(), device.timestampsNs.front() - expectedNs) - windowNs;
+    int64_t rangeEnd = min(masterTimes.back(), device.timestampsNs.back() - expectedNs) + windowNs;
+
+    vector<bool> masterPaired(masterTimes.size(), false);
+    vector<double> times;   // Seconds since the master's first frame
+    vector<double> offsets; // Nanoseconds from the master frame to the device frame
+    size_t next = 0;
+
+    for (int64_t timestamp : device.timestampsNs) {
+        int64_t target = timestamp - expectedNs;
+        if (target < rangeStart || target > rangeEnd) {
+            alignment.outsideFrames++;
+            continue;
+        }
+
+        // Both lists are sorted, so the closest master frame only moves forward
+        while (next + 1 < masterTimes.size() && masterTimes[next + 1] <= target) {
+            next++;
+        }
+        size_t closest = next;
+        if (next + 1 < masterTimes.size() && llabs(masterTimes[next + 1] - target) < llabs(masterTimes[next] - target)) {
+            closest = next + 1;
+        }
+
+        if (llabs(masterTimes[closest] - target) > windowNs || masterPaired[closest]) {
+            alignment.unpairedFrames++;
+            if ((int) alignment.unpairedTimestampsNs.size() < maxListedUnpaired) {
+                alignment.unpairedTimestampsNs.push_back(timestamp);
+            }
+            continue;
+        }
+        masterPaired[closest] = true;
+        times.push_back((masterTimes[closest] - masterTimes.front()) / 1e9);
+        offsets.push_back((double) (timestamp - masterTimes[closest]));
+    }
+
+    for (size_t i = 0; i < masterTimes.size(); i++) {
+        if (!masterPaired[i] && masterTimes[i] >= rangeStart && masterTimes[i] <= rangeEnd) {
+            alignment.unpairedMasterFrames++;
+        }
+    }
+
+    alignment.pairedFrames = offsets.size();
+    if (offsets.empty()) {
+        return;
+    }
+
+    // Least squares line through the offsets, its slope is the drift between the device clocks
+    double meanTime = 0;
+    double meanOffset = 0;
+    for (size_t i = 0; i < offsets.size(); i++) {
+        meanTime += times[i];
+        meanOffset += offsets[i];
+    }
+    meanTime /= offsets.size();
+    meanOffset /= offsets.size();
+
+    double covariance = 0;
+    double variance = 0;
+    for (size_t i = 0; i < offsets.size(); i++) {
+        covariance += (times[i] - meanTime) * (offsets[i] - meanOffset);
+        variance += (times[i] - meanTime) * (times[i] - meanTime);
+    }
+    double slope = (variance > 0) ? covariance / variance : 0;
+
+    double squares = 0;
+    for (size_t i = 0; i < offsets.size(); i++) {
+        double deviation = offsets[i] - (meanOffset + slope * (times[i] - meanTime));
+        squares += deviation * deviation;
+        alignment.maxDeviationUs = max(alignment.maxDeviationUs, fabs(deviation) / 1000);
+    }
+
+    alignment.offsetUs = meanOffset / 1000;
+    alignment.driftPpm = slope / 1000;
+    alignment.jitterUs = sqrt(squares / offsets.size()) / 1000;
+}
+
+// Read the timestamps of a track from every file on its own thread and align each device with the master
+bool analyzeSync(const vector<string>& filenames, const string& trackName, SyncAnalysis& analysis, string& errorText) {
+    analysis = SyncAnalysis();
+    analysis.trackName = trackName;
+    auto start = chrono::steady_clock::now();
+
+    if (filenames.size() < 2) {
+        errorText += "ERROR: Pass the recordings of at least two devices\n";
+        return false;
+    }
+
+    vector<DeviceTimeline> timelines(filenames.size());
+    vector<char> succeeded(filenames.size(), 0);
+    parallelFor((int) filenames.size(), [&](int i) {
+        succeeded[i] = readTimeline(filenames[i], trackName, timelines[i]);
+    });
+    for (size_t i = 0; i < filenames.size(); i++) {
+        if (!succeeded[i]) {
+            errorText += timelines[i].errorText;
+        }
+    }
+    if (errorText.empty() == false) {
+        return false;
+    }
+
+    // The master is the recording K4ARecorder tagged as one, or the first passed
+    int masters = 0;
+    for (size_t i = 0; i < timelines.size(); i++) {
+        if (timelines[i].syncMode == "MASTER" && masters++ == 0) {
+            analysis.masterIndex = (int) i;
+        }
+    }
+    if (masters == 0) {
+        analysis.warningText += "WARNING: No recording is tagged as the master, comparing with the first one\n";
+    }
+    else if (masters > 1) {
+        analysis.warningText += "WARNING: More than one recording is tagged as the master, comparing with the first one\n";
+    }
+
+    const DeviceTimeline& master = timelines[analysis.masterIndex];
+    int64_t periodNs = medianStep(master.timestampsNs);
+    analysis.framePeriodMs = periodNs / 1e6;
+
+    for (size_t i = 0; i < timelines.size(); i++) {
+        DeviceAlignment alignment;
+        alignment.filename = filenames[i];
+        alignment.syncMode = timelines[i].syncMode;
+        alignment.frames = timelines[i].timestampsNs.size();
+
+        if ((int) i == analysis.masterIndex) {
+            alignment.pairedFrames = alignment.frames;
+            analysis.devices.push_back(alignment);
+            continue;
+        }
+
+        // Subordinates capture after the master by their sync delay, and depth also by any difference in depth delay
+        int64_t expectedNs = (timelines[i].syncMode == "SUBORDINATE") ? timelines[i].subordinateDelayNs : 0;
+        if (trackName == "DEPTH" || trackName == "IR") {
+            expectedNs += timelines[i].depthDelayNs - master.depthDelayNs;
+        }
+        alignment.expectedOffsetUs = expectedNs / 1000.0;
+        alignDevice(master, timelines[i], periodNs, expectedNs, alignment);
+
+        if (alignment.pairedFrames == 0) {
+            analysis.warningText += "WARNING: No frames of \"" + filenames[i] + "\" line up with the master, it may be from another take\n";
+        }
+        // A device late by more than half a period still pairs, but with the wrong master frame
+        else if (fabs(alignment.offsetUs - alignment.expectedOffsetUs) > analysis.framePeriodMs * 1000 * maxOffsetError) {
+            analysis.warningText += "WARNING: \"" + filenames[i] + "\" is far from its expected offset, check its sync cable and delay\n";
+        }
+        analysis.devices.push_back(alignment);
+    }
+
+    analysis.seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    return true;
+}
+
+// Check if any device has frames without a partner
+bool hasUnpairedFrames(const SyncAnalysis& analysis) {
+    for (const DeviceAlignment& device : analysis.devices) {
+        if (device.unpairedFrames > 0 || device.unpairedMasterFrames > 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// Format an analysis as lines of text for the console
+string formatSyncAnalysis(const SyncAnalysis& analysis) {
+    char line[512];
+    string text;
+    snprintf(line, sizeof(line), "Aligned %s frames of %d recordings in %.2f s, frame period %.2f ms\n", analysis.trackName.c_str(),
+             (int) analysis.devices.size(), analysis.seconds, analysis.framePeriodMs);
+    text += line;
+
+    for (size_t i = 0; i < analysis.devices.size(); i++) {
+        const DeviceAlignment& device = analysis.devices[i];
+        string mode = device.syncMode.empty() ? "no sync mode" : device.syncMode;
+        if ((int) i == analysis.masterIndex) {
+            snprintf(line, sizeof(line), "%s (%s): %llu frames, compared against\n", device.filename.c_str(), mode.c_str(),
+                     (unsigned long long) device.frames);
+            text += line;
+            continue;
+        }
+
+        snprintf(line, sizeof(line), "%s (%s): %llu frames, %llu paired, %llu unpaired, %llu master frames unpaired, %llu outside the common range\n",
+                 device.filename.c_str(), mode.c_str(), (unsigned long long) device.frames, (unsigned long long) device.pairedFrames,
+                 (unsigned long long) device.unpairedFrames, (unsigned long long) device.unpairedMasterFrames, (unsigned long long) device.outsideFrames);
+        text += line;
+        if (device.pairedFrames > 0) {
+            snprintf(line, sizeof(line), "  Offset %.1f us (expected %.1f us), jitter %.1f us, drift %.2f ppm, largest deviation %.1f us\n",
+                     device.offsetUs, device.expectedOffsetUs, device.jitterUs, device.driftPpm, device.maxDeviationUs);
+            text += line;
+        }
+        if (device.unpairedTimestampsNs.empty() == false) {
+            snprintf(line, sizeof(line), "  Frames with no master frame within %.2f ms, at device time:", analysis.framePeriodMs * partnerWindow);
+            text += line;
+            for (int64_t timestamp : device.unpairedTimestampsNs) {
+                snprintf(line, sizeof(line), " %.6f s", timestamp / 1e9);
+                text += line;
+            }
+            text += (device.unpairedFrames > device.unpairedTimestampsNs.size()) ? " ...\n" : "\n";
+        }
+    }
+    return text + analysis.warningText;
+}
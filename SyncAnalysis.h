@@ -0,0 +1,59 @@
+/* Aden Prince
+ * HiMER Lab at U. of Illinois, Chicago
+ * K4ARecorder GUI
+ *
+ * SyncAnalysis.h
+ * Contains functions used to check that the recordings of a synchronized
+ * multiple device take were captured in lockstep, by pairing each device's
+ * frames with the master's and measuring their offset, jitter and drift.
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// A frame is paired with the master frame closest in time if it is within this fraction of a frame period
+const double partnerWindow = 0.5;
+// An offset further than this fraction of a frame period from the expected one is warned about
+const double maxOffsetError = 0.1;
+// Unpaired frames listed per device in the report
+const int maxListedUnpaired = 10;
+
+// How one device's frames line up with the master's
+struct DeviceAlignment {
+    std::string filename;
+    std::string syncMode; // K4A_WIRED_SYNC_MODE tag, MASTER, SUBORDINATE or STANDALONE
+    uint64_t frames = 0;
+
+    // Only frames in the time range every device recorded are paired, the rest are from starting and stopping
+    uint64_t pairedFrames = 0;
+    uint64_t unpairedFrames = 0;       // Frames with no master frame close enough
+    uint64_t unpairedMasterFrames = 0; // Master frames with no frame from this device close enough
+    uint64_t outsideFrames = 0;        // Frames outside the common time range
+    std::vector<int64_t> unpairedTimestampsNs;
+
+    double expectedOffsetUs = 0; // From the sync delay and depth delay tags
+    double offsetUs = 0;         // Mean time of a frame after its master frame
+    double jitterUs = 0;         // Standard deviation of the offset around the drift line
+    double driftPpm = 0;         // Change in the offset per second of the master's time, in microseconds
+    double maxDeviationUs = 0;   // Largest distance of an offset from the drift line
+};
+
+// Alignment of every device of a take against the master
+struct SyncAnalysis {
+    std::string trackName;
+    double framePeriodMs = 0;
+    int masterIndex = 0;
+    std::vector<DeviceAlignment> devices; // In the order the files were passed, the master included
+    double seconds = 0;
+    std::string warningText;
+};
+
+// Read the timestamps of a track from every file on its own thread and align each device with the master
+bool analyzeSync(const std::vector<std::string>& filenames, const std::string& trackName, SyncAnalysis& analysis, std::string& errorText);
+// Check if any device has frames without a partner
+bool hasUnpairedFrames(const SyncAnalysis& analysis);
+// Format an analysis as lines of text for the console
+std::string formatSyncAnalysis(const SyncAnalysis& analysis);
@@ -0,0 +1,112 @@
+/* Aden Prince
+ * HiMER Lab at U. of Illinois, Chicago
+ * K4ARecorder GUI
+ *
+ * ThroughputMonitor.cpp
+ * Contains functions used to sample how fast output files grow while
+ * recording and how long the target volume has until it fills.
+ */
+
+#include "ThroughputMonitor.h"
+#include "StorageCheck.h"
+
+#include <chrono>
+
+using namespace std;
+
+// Weight of the newest sample in the average write rate
+const double averageWeight = 0.1;
+
+// Get the size of a file from its attributes, 0 if it does not exist yet
+static uint64_t fileSize(const string& filename) {
+    WIN32_FILE_ATTRIBUTE_DATA attributes;
+    if (!GetFileAttributesExA(filename.c_str(), GetFileExInfoStandard, &attributes)) {
+        return 0;
+    }
+    return ((uint64_t) attributes.nFileSizeHigh << 32) | attributes.nFileSizeLow;
+}
+
+// Sample sizes and free space every interval until the stop event is set
+static void sampleThroughput(ThroughputMonitor* monitor) {
+    auto startTime = chrono::steady_clock::now();
+    ThroughputSample previous;
+    bool first = true;
+
+    do {
+        ThroughputSample sample;
+        sample.seconds = chrono::duration<double>(chrono::steady_clock::now() - startTime).count();
+
+        for (const string& filename : monitor->filenames) {
+            sample.totalBytes += fileSize(filename);
+        }
+
+        // Free space is read for the volume of the first file
+        if (monitor->filenames.empty() == false) {
+            freeSpaceForFile(monitor->filenames[0], sample.freeBytes);
+        }
+
+        if (!first && sample.seconds > previous.seconds && sample.totalBytes >= previous.totalBytes) {
+            sample.mbPerSecond = (float) ((sample.totalBytes - previous.totalBytes) / 1e6 / (sample.seconds - previous.seconds));
+        }
+
+        // Drop the sample if the GUI has fallen far behind rather than waiting
+        monitor->samples.push(&sample, 1);
+        previous = sample;
+        first = false;
+    } while (WaitForSingleObject(monitor->stopEvent, throughputIntervalMs) == WAIT_TIMEOUT);
+}
+
+// Start sampling the size of filenames and the free space on their volume
+void startThroughputMonitor(ThroughputMonitor& monitor, const vector<string>& filenames) {
+    stopThroughputMonitor(monitor);
+
+    monitor.filenames = filenames;
+
+    for (float& value : monitor.plot) {
+        value = 0;
+    }
+    monitor.plotOffset = 0;
+    monitor.hasSamples = false;
+    monitor.latest = ThroughputSample();
+    monitor.averageMBps = 0;
+
+    monitor.stopEvent = CreateEvent(NULL, TRUE, FALSE, NULL);
+    monitor.samplerThread = thread(sampleThroughput, &monitor);
+}
+
+// Stop the sampler thread, keeping the samples for display
+void stopThroughputMonitor(ThroughputMonitor& monitor) {
+    if (monitor.samplerThread.joinable()) {
+        // The sampler wakes up straight away instead of finishing its interval
+        SetEvent(monitor.stopEvent);
+        monitor.samplerThread.join();
+    }
+    if (monitor.stopEvent != NULL) {
+        CloseHandle(monitor.stopEvent);
+        monitor.stopEvent = NULL;
+    }
+    drainThroughputMonitor(monitor);
+}
+
+// Move new samples into the plot history, never blocks
+void drainThroughputMonitor(ThroughputMonitor& monitor) {
+    ThroughputSample sample;
+    while (monitor.samples.pop(&sample, 1) == 1) {
+        // The first sample has no previous size to compare with
+        if (monitor.hasSamples) {
+            monitor.plot[monitor.plotOffset] = sample.mbPerSecond;
+            monitor.plotOffset = (monitor.plotOffset + 1) % throughputPlotLength;
+            monitor.averageMBps += averageWeight * (sample.mbPerSecond - monitor.averageMBps);
+        }
+        monitor.latest = sample;
+        monitor.hasSamples = true;
+    }
+}
+
+// Get the projected seconds until the target volume is full, -1 if it is not filling up
+double secondsUntilFull(const ThroughputMonitor& monitor) {
+    if (!monitor.hasSamples || monitor.averageMBps < 0.01) {
+        return -1;
+    }
+    return monitor.latest.freeBytes / 1e6 / monitor.averageMBps;
+}
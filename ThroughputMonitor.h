@@ -0,0 +1,60 @@
+/* Aden Prince
+ * HiMER Lab at U. of Illinois, Chicago
+ * K4ARecorder GUI
+ *
+ * ThroughputMonitor.h
+ * Contains the state and functions used to sample how fast output files
+ * grow while recording and how long the target volume has until it fills.
+ */
+
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <Windows.h>
+
+#include "RingBuffer.h"
+
+// Time between samples of the output file size
+const DWORD throughputIntervalMs = 500;
+// Number of samples shown in the plot
+const int throughputPlotLength = 120;
+
+// Output size and free space at one point in time
+struct ThroughputSample {
+    double seconds = 0;      // Time since monitoring started
+    uint64_t totalBytes = 0; // Size of every output file together
+    uint64_t freeBytes = 0;  // Free space on the target volume
+    float mbPerSecond = 0;   // Write rate since the previous sample
+};
+
+// Sampler thread and the samples shown in the GUI
+struct ThroughputMonitor {
+    // Sampler thread, which only reads file attributes and never opens the files
+    std::thread samplerThread;
+    HANDLE stopEvent = NULL;
+    std::vector<std::string> filenames;
+    SpscRingBuffer<ThroughputSample, 256> samples;
+
+    // Plot history as a ring starting at plotOffset, filled by drainThroughputMonitor
+    float plot[throughputPlotLength] = {};
+    int plotOffset = 0;
+    bool hasSamples = false;
+    ThroughputSample latest;
+
+    // Average write rate over the last several samples, used to project when the volume fills
+    double averageMBps = 0;
+};
+
+// Start sampling the size of filenames and the free space on their volume
+void startThroughputMonitor(ThroughputMonitor& monitor, const std::vector<std::string>& filenames);
+// Stop the sampler thread, keeping the samples for display
+void stopThroughputMonitor(ThroughputMonitor& monitor);
+// Move new samples into the plot history, never blocks
+void drainThroughputMonitor(ThroughputMonitor& monitor);
+// Get the projected seconds until the target volume is full, -1 if it is not filling up
+double secondsUntilFull(const ThroughputMonitor& monitor);
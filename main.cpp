@@ -7,12 +7,18 @@
  * 
  * ImGui sample code obtained from: https://github.com/ocornut/imgui/blob/master/examples/example_win32_directx11/main.cpp
  * ImGui font scaling code obtained from: https://github.com/microsoft/Azure-Kinect-Sensor-SDK/blob/develop/tools/k4aviewer/k4aviewer.cpp
- * CreateProcess code obtained from: https://docs.microsoft.com/en-us/windows/win32/procthread/creating-processes
  */
 
+#include "CommandLineTools.h"
 #include "GUIWidgets.h"
+#include "Manifest.h"
+#include "RecorderOptions.h"
+#include "RecorderProcess.h"
+#include "StorageCheck.h"
 
+#include <cstdlib>
 #include <iostream>
+#include <mutex>
 
 #include <Windows.h>
 
@@ -20,6 +26,52 @@
 
 using namespace std;
 
+// Checksum a finished take and write its manifest next to it, printing any error
+void writeTakeManifest(const string& recording, const string& argsStr) {
+    Manifest manifest;
+    string errorText;
+    cout << "Writing " << manifestFilename(recording) << endl;
+    if(!writeRecordingManifest(recording, argsStr, manifest, nullptr, nullptr, errorText)) {
+        cout << errorText;
+    }
+}
+
+// Parse recorder options from the command line and run K4ARecorder without creating a window
+int runHeadless(int argc, char* argv[], string recorderPathStr) {
+    RecorderOptions options;
+    string errorText;
+
+    if(!parseCommandLine(argc, argv, options, recorderPathStr, errorText) ||
+       !validateOptions(options, recorderPathStr, errorText) ||
+       !checkStorageForTake(options, 1, errorText)) {
+        cout << errorText;
+        return 1;
+    }
+
+    string argsStr = buildArgs(options);
+    cout << "Arguments: " << argsStr << endl;
+
+    PROCESS_INFORMATION pi;
+
+    if(!startRecorderProcess(recorderPathStr, argsStr, pi)) {
+        return 1;
+    }
+
+    // Wait until child process exits and pass on its exit code
+    DWORD exitCode = 0;
+    WaitForSingleObject(pi.hProcess, INFINITE);
+    GetExitCodeProcess(pi.hProcess, &exitCode);
+
+    CloseHandle(pi.hProcess);
+    CloseHandle(pi.hThread);
+
+    if(exitCode == 0 && fileExists(options.output_filename)) {
+        writeTakeManifest(options.output_filename, argsStr);
+    }
+
+    return (int) exitCode;
+}
+
 int main(int argc, char* argv[]) {
     const float GUIScalingFactor = 1.5f;
 
@@ -27,39 +79,60 @@ int main(int argc, char* argv[]) {
     int startRecorder = 0;
 
     // Passed to getArgs function to be updated
+    RecordingSession session;
     string argsStr;
     string errorText;
     string recorderPathStr;
     
-    // Detect Azure Kinect SDK folder in Program Files
-    WIN32_FIND_DATAA SDKFolderData;
-    HANDLE SDKFolderHandle;
-    bool SDKFolderFound = false;
+    // Detect K4ARecorder in the Azure Kinect SDK folder in Program Files
+    recorderPathStr = detectRecorderPath();
 
-    SDKFolderHandle = FindFirstFileA("C:\\Program Files\\Azure Kinect SDK*", &SDKFolderData);
-
-    if(SDKFolderHandle != INVALID_HANDLE_VALUE) {
-        SDKFolderFound = true;
-        FindClose(SDKFolderHandle);
+    // Run a tool on finished recordings instead of recording
+    int toolExitCode = 0;
+    if(runCommandLineTool(argc, argv, toolExitCode)) {
+        return toolExitCode;
     }
 
-    // Set recorder path string to folder name
-    if(SDKFolderFound) {
-        recorderPathStr = SDKFolderData.cFileName;
+    // Skip the GUI and start K4ARecorder straight away in headless mode
+    for(int i = 1; i < argc; i++) {
+        if(strcmp(argv[i], "--headless") == 0) {
+            return runHeadless(argc, argv, recorderPathStr);
+        }
     }
-    else {
-        // Set to latest version (at time of writing) if SDK folder not found
-        recorderPathStr = "Azure Kinect SDK v1.4.1";
+
+    // Take start, stop and status requests from scripts on a named pipe, and on a loopback HTTP port if one is passed
+    bool control = false;
+    int controlPort = 0;
+    for(int i = 1; i < argc; i++) {
+        if(strcmp(argv[i], "--control") == 0) {
+            control = true;
+        }
+        else if(strcmp(argv[i], "--control-port") == 0 && i + 1 < argc) {
+            control = true;
+            controlPort = atoi(argv[++i]);
+        }
     }
+    if(control) {
+        if(!startControlServer(session.control, session, recorderPathStr, controlPipeName, controlPort, errorText)) {
+            cout << errorText;
+            return 1;
+        }
+        cout << "Serving control requests on " << controlPipeName;
+        if(controlPort > 0) {
+            cout << " and http://127.0.0.1:" << controlPort;
+        }
+        cout << endl;
 
-    // Set full path for K4ARecorder executable
-    recorderPathStr = "C:\\Program Files\\" + recorderPathStr + "\\tools\\k4arecorder.exe";
+        // Takes started by scripts keep the GUI open between them
+        session.enabled = true;
+    }
 
     // Correct font scaling
     if(!glfwInit()) {
         string errorText = "GLFW failed to initialize.";
         cout << errorText << endl;
         MessageBoxA(0, errorText.c_str(), NULL, MB_OK | MB_ICONHAND);
+        endControlServer(session.control);
         return 1;
     }
 
@@ -75,6 +148,7 @@ int main(int argc, char* argv[]) {
         MessageBoxA(0, errorText.c_str(), NULL, MB_OK | MB_ICONHAND);
         CleanupDeviceD3D();
         ::UnregisterClass(wc.lpszClassName, wc.hInstance);
+        endControlServer(session.control);
         return 1;
     }
 
@@ -127,11 +201,17 @@ int main(int argc, char* argv[]) {
         ImGui::SetNextWindowPos(ImVec2(0, 0));
         ImGui::SetNextWindowSize(io.DisplaySize);
         
+        // The control server changes the session between frames, never while it is being shown
+        unique_lock<mutex> sessionLock(session.mutex);
+
         // Open options window
         ImGui::Begin("Options", (bool*) 0, ImGuiWindowFlags_NoCollapse | ImGuiWindowFlags_NoResize);
-        startRecorder = getArgs(argsStr, errorText, recorderPathStr);
+        startRecorder = getArgs(argsStr, errorText, recorderPathStr, session);
         ImGui::End();
 
+        pollTake(session);
+        sessionLock.unlock();
+
         // Render
         ImGui::Render();
         g_pd3dDeviceContext->OMSetRenderTargets(1, &g_mainRenderTargetView, NULL);
@@ -142,6 +222,10 @@ int main(int argc, char* argv[]) {
         //g_pSwapChain->Present(0, 0); // Present without vsync
     }
 
+    // Let a take that is still running finish its file before exiting
+    endSession(session);
+    releaseFilmstripTextures(session.filmstrip);
+
     // Cleanup
     ImGui_ImplDX11_Shutdown();
     ImGui_ImplWin32_Shutdown();
@@ -161,41 +245,28 @@ int main(int argc, char* argv[]) {
 
     cout << "Arguments: " << argsStr << endl;
 
-    STARTUPINFO si;
     PROCESS_INFORMATION pi;
 
-    ZeroMemory(&si, sizeof(si));
-    si.cb = sizeof(si);
-    ZeroMemory(&pi, sizeof(pi));
-
-    // Copy arguments to LPWSTR variable to be passed to CreateProcess
-    wstring argsWStr(argsStr.length(), L' ');
-    copy(argsStr.begin(), argsStr.end(), argsWStr.begin());
-    LPWSTR args = const_cast<LPWSTR>(argsWStr.c_str());
-
-    // Copy recorder file path to LPCWSTR variable to be passed to CreateProcess
-    wstring recorderPathWStr(recorderPathStr.length(), L' ');
-    copy(recorderPathStr.begin(), recorderPathStr.end(), recorderPathWStr.begin());
-    LPCWSTR recorderPathArg = const_cast<LPCWSTR>(recorderPathWStr.c_str());
-
     // Start K4ARecorder process
-    if(!CreateProcess(recorderPathArg,   // Program file
-        args,           // Command line
-        NULL,           // Process handle not inheritable
-        NULL,           // Thread handle not inheritable
-        FALSE,          // Set handle inheritance to FALSE
-        0,              // No creation flags
-        NULL,           // Use parent's environment block
-        NULL,           // Use parent's starting directory
-        &si,            // Pointer to STARTUPINFO structure
-        &pi)            // Pointer to PROCESS_INFORMATION structure
-        ) {
-        printf("CreateProcess failed (%d).\n", GetLastError());
+    if(!startRecorderProcess(recorderPathStr, argsStr, pi)) {
         return 1;
     }
+    recorderLaunched(session.latency, pi.hProcess, nullptr, -1);
 
     // Wait until child process exits.
     WaitForSingleObject(pi.hProcess, INFINITE);
+    finishStartLatency(session.latency);
+
+    // A recording K4ARecorder could not finish has no cues and a wrong segment size
+    DWORD exitCode = 0;
+    GetExitCodeProcess(pi.hProcess, &exitCode);
+    if(exitCode != 0 && session.outputFilename.empty() == false && fileExists(session.outputFilename)) {
+        cout << "K4ARecorder exited with code " << exitCode << ", if the recording was cut off repair it with:" << endl;
+        cout << "K4ARecorderGUI.exe --repair " << session.outputFilename << endl;
+    }
+    else if(exitCode == 0 && session.outputFilename.empty() == false && fileExists(session.outputFilename)) {
+        writeTakeManifest(session.outputFilename, argsStr);
+    }
 
     // Close process and thread handles. 
     CloseHandle(pi.hProcess);
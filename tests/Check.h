@@ -0,0 +1,33 @@
+/* Aden Prince
+ * HiMER Lab at U. of Illinois, Chicago
+ * K4ARecorder GUI
+ *
+ * Check.h
+ * Contains the check macro and failure count shared by the tests, which
+ * build without Windows or ImGui.
+ */
+
+#pragma once
+
+#include <cstdio>
+
+// Checks that have failed so far, returned by each test's main
+inline int& checkFailures() {
+    static int failures = 0;
+    return failures;
+}
+
+// Print the condition and where it is if it does not hold, and carry on with the next check
+#define CHECK(condition)                                                          \
+    do {                                                                          \
+        if (!(condition)) {                                                       \
+            std::printf("%s:%d: CHECK(%s) failed\n", __FILE__, __LINE__, #condition); \
+            checkFailures()++;                                                    \
+        }                                                                         \
+    } while (0)
+
+// Print the test's result and get its exit code
+inline int finishChecks(const char* name) {
+    std::printf("%s: %s\n", name, (checkFailures() == 0) ? "passed" : "FAILED");
+    return (checkFailures() == 0) ? 0 : 1;
+}
@@ -0,0 +1,135 @@
+/* Aden Prince
+ * HiMER Lab at U. of Illinois, Chicago
+ * K4ARecorder GUI
+ *
+ * NumberFormatTests.cpp
+ * Contains checks that numbers written as text read back as the same
+ * value and use as few digits as they need.
+ */
+
+#include "Check.h"
+#include "NumberFormat.h"
+
+#include <cfloat>
+#include <cmath>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <iomanip>
+#include <random>
+#include <sstream>
+#include <string>
+
+using namespace std;
+
+// Write value with writeFloat and get the text
+static string floatText(float value) {
+    char text[maxFloatTextBytes];
+    char* end = writeFloat(text, value);
+    return string(text, end);
+}
+
+// Count the significant digits of a number written by writeFloat, leaving out the sign, point, exponent and zeros around them
+static int significantDigits(const string& text) {
+    string digits;
+    for (char c : text.substr(0, text.find('e'))) {
+        if (c >= '0' && c <= '9') {
+            digits += c;
+        }
+    }
+    size_t first = digits.find_first_not_of('0');
+    if (first == string::npos) {
+        return 0;
+    }
+    return (int) (digits.find_last_not_of('0') - first + 1);
+}
+
+// Check that value reads back exactly, and that one digit fewer would not have when more than 6 were used
+static bool roundTrips(float value) {
+    string text = floatText(value);
+    float parsed = strtof(text.c_str(), nullptr);
+    if (memcmp(&parsed, &value, sizeof(float)) != 0) {
+        printf("%.9g was written as %s\n", value, text.c_str());
+        return false;
+    }
+
+    int digits = significantDigits(text);
+    if (digits > 6 && isfinite(value) && fabs(value) >= 1e-12 && fabs(value) < 1e12) {
+        ostringstream shorter;
+        shorter << setprecision(digits - 1) << value;
+        if (strtof(shorter.str().c_str(), nullptr) == value) {
+            printf("%.9g was written as %s, but %s also reads back\n", value, text.c_str(), shorter.str().c_str());
+            return false;
+        }
+    }
+    return true;
+}
+
+// Check integers, including the largest, are written in full
+static void testWriteUnsigned() {
+    char text[21];
+    CHECK(string(text, writeUnsigned(text, 0)) == "0");
+    CHECK(string(text, writeUnsigned(text, 7)) == "7");
+    CHECK(string(text, writeUnsigned(text, 1000)) == "1000");
+    CHECK(string(text, writeUnsigned(text, 1603829102345678ULL)) == "1603829102345678");
+    CHECK(string(text, writeUnsigned(text, UINT64_MAX)) == "18446744073709551615");
+}
+
+// Check the text of typical IMU readings and of values that need an exponent or round to a power of ten
+static void testFloatText() {
+    CHECK(floatText(0.0f) == "0");
+    CHECK(floatText(-0.0f) == "-0");
+    CHECK(floatText(1.0f) == "1");
+    CHECK(floatText(-2.5f) == "-2.5");
+    CHECK(floatText(0.1f) == "0.1");
+    CHECK(floatText(9.80665f) == "9.80665");
+    CHECK(floatText(-0.00123f) == "-0.00123");
+    CHECK(floatText(100.0f) == "100");
+    CHECK(floatText(123456792.0f) == "123456790");
+    CHECK(floatText(1.5e9f) == "1.5e+9");
+    CHECK(floatText(2.5e-5f) == "2.5e-5");
+    CHECK(floatText(9.9999999f) == "10");
+    CHECK(floatText(0.3333333433f) == "0.33333334");
+}
+
+// Check edge cases and a million random floats read back as the same float
+static void testFloatRoundTrip() {
+    const float edgeCases[] = {FLT_MIN, -FLT_MIN, FLT_MAX, -FLT_MAX, FLT_TRUE_MIN, FLT_EPSILON, 1e-12f, 9.99999e-13f, 1e12f, 9.99999e11f,
+                               0.999999f, 1.00000012f, 16777216.0f, 16777217.0f, INFINITY, -INFINITY};
+    for (float value : edgeCases) {
+        CHECK(roundTrips(value));
+    }
+
+    // Every bit pattern is equally likely, so all exponents are covered
+    mt19937 random(20170923);
+    int failures = 0;
+    for (int i = 0; i < 1000000 && failures < 10; i++) {
+        uint32_t bits = (uint32_t) random();
+        float value;
+        memcpy(&value, &bits, sizeof(float));
+        if (isnan(value)) {
+            continue;
+        }
+        if (!roundTrips(value)) {
+            failures++;
+        }
+    }
+    CHECK(failures == 0);
+
+    // Readings in the ranges the accelerometer and gyroscope report
+    uniform_real_distribution<float> reading(-40.0f, 40.0f);
+    failures = 0;
+    for (int i = 0; i < 1000000 && failures < 10; i++) {
+        if (!roundTrips(reading(random))) {
+            failures++;
+        }
+    }
+    CHECK(failures == 0);
+}
+
+int main() {
+    testWriteUnsigned();
+    testFloatText();
+    testFloatRoundTrip();
+    return finishChecks("NumberFormatTests");
+}
@@ -0,0 +1,229 @@
+/* Aden Prince
+ * HiMER Lab at U. of Illinois, Chicago
+ * K4ARecorder GUI
+ *
+ * RecorderOptionsTests.cpp
+ * Contains checks of building K4ARecorder arguments, rejecting invalid
+ * option combinations and parsing the command line.
+ */
+
+#include "Check.h"
+#include "RecorderOptions.h"
+
+#include <string>
+#include <vector>
+
+using namespace std;
+
+// Output file that validation checks does not exist yet
+const char* const takeFilename = "recorder_options_test_take.mkv";
+
+// Parse words as if they followed the program name on the command line
+static bool parseWords(const vector<string>& words, RecorderOptions& options, string& recorderPathStr, string& errorText) {
+    vector<char*> argv;
+    argv.push_back(const_cast<char*>("K4ARecorderGUI.exe"));
+    for (const string& word : words) {
+        argv.push_back(const_cast<char*>(word.c_str()));
+    }
+    return parseCommandLine((int) argv.size(), argv.data(), options, recorderPathStr, errorText);
+}
+
+// Check the arguments built for the default options and for every optional argument
+static void testBuildArgs() {
+    RecorderOptions options;
+    options.output_filename = "take.mkv";
+    CHECK(buildArgs(options) == " --imu OFF --depth-delay 0 --color-mode 720p --depth-mode NFOV_UNBINNED --rate 30"
+                                " --external-sync Standalone --sync-delay 0 --device 0 take.mkv");
+
+    options.imu_recording_mode = true;
+    options.record_for_time = true;
+    options.recording_time = 60;
+    options.manual_exposure = true;
+    options.exposure_value = -5;
+    options.manual_gain = true;
+    options.gain_value = 128;
+    options.external_sync_mode_index = 2;
+    options.external_sync_delay = 160;
+    options.device_index = 1;
+    CHECK(buildArgs(options) == " --imu ON --record-length 60 --depth-delay 0 --color-mode 720p --depth-mode NFOV_UNBINNED --rate 30"
+                                " --exposure-control -5 --gain 128 --external-sync Master --sync-delay 160 --device 1 take.mkv");
+
+    RecorderOptions help;
+    help.print_help = true;
+    CHECK(buildArgs(help) == " --help");
+
+    RecorderOptions list;
+    list.list_devices = true;
+    CHECK(buildArgs(list) == " --list");
+}
+
+// Check that valid options pass and every invalid combination is reported
+static void testValidateOptions(const string& recorderPathStr) {
+    RecorderOptions options;
+    options.output_filename = takeFilename;
+    string errorText;
+    CHECK(validateOptions(options, recorderPathStr, errorText));
+    CHECK(errorText.empty());
+
+    // 3072p color and WFOV_UNBINNED depth only run at 5 and 15 FPS
+    RecorderOptions color3072p = options;
+    color3072p.color_mode_index = 8;
+    errorText = "";
+    CHECK(!validateOptions(color3072p, recorderPathStr, errorText));
+    CHECK(errorText.find("Color mode 3072p does not support 30 FPS") != string::npos);
+
+    color3072p.frame_rate_index = 1;
+    errorText = "";
+    CHECK(validateOptions(color3072p, recorderPathStr, errorText));
+
+    RecorderOptions wideDepth = options;
+    wideDepth.depth_mode_index = 2;
+    errorText = "";
+    CHECK(!validateOptions(wideDepth, recorderPathStr, errorText));
+    CHECK(errorText.find("Depth mode WFOV_UNBINNED does not support 30 FPS") != string::npos);
+
+    RecorderOptions camerasOff = options;
+    camerasOff.color_mode_index = 0;
+    camerasOff.depth_mode_index = 0;
+    errorText = "";
+    CHECK(!validateOptions(camerasOff, recorderPathStr, errorText));
+    CHECK(errorText.find("cannot both be OFF") != string::npos);
+
+    RecorderOptions negativeLength = options;
+    negativeLength.record_for_time = true;
+    negativeLength.recording_time = -1;
+    errorText = "";
+    CHECK(!validateOptions(negativeLength, recorderPathStr, errorText));
+    CHECK(errorText.find("Recording length cannot be negative") != string::npos);
+
+    RecorderOptions outOfRange = options;
+    outOfRange.exposure_value = 200001;
+    outOfRange.gain_value = 256;
+    outOfRange.device_index = -1;
+    outOfRange.external_sync_delay = -1;
+    errorText = "";
+    CHECK(!validateOptions(outOfRange, recorderPathStr, errorText));
+    CHECK(errorText.find("Exposure value") != string::npos);
+    CHECK(errorText.find("Gain value") != string::npos);
+    CHECK(errorText.find("Device index") != string::npos);
+    CHECK(errorText.find("External sync delay") != string::npos);
+
+    RecorderOptions noOutput = options;
+    noOutput.output_filename = "   ";
+    errorText = "";
+    CHECK(!validateOptions(noOutput, recorderPathStr, errorText));
+    CHECK(errorText.find("Output filename is empty") != string::npos);
+
+    // The recorder itself exists, so it stands in for an output file that would be overwritten
+    RecorderOptions existingOutput = options;
+    existingOutput.output_filename = recorderPathStr;
+    errorText = "";
+    CHECK(!validateOptions(existingOutput, recorderPathStr, errorText));
+    CHECK(errorText.find("already exists") != string::npos);
+
+    errorText = "";
+    CHECK(!validateOptions(options, "missing_k4arecorder.exe", errorText));
+    CHECK(errorText.find("not found") != string::npos);
+}
+
+// Check that parsed options match K4ARecorder's names and that malformed command lines are refused
+static void testParseCommandLine() {
+    RecorderOptions options;
+    string recorderPathStr;
+    string errorText;
+    CHECK(parseWords({"--headless", "-c", "1080P", "--depth-mode", "wfov_2x2binned", "-r", "15", "--imu", "on", "-l", "90", "-e", "-3", "-g", "10",
+                      "--external-sync", "subordinate", "--sync-delay", "200", "--device", "2", "--recorder-path", "C:\\k4arecorder.exe", "take.mkv"},
+                     options, recorderPathStr, errorText));
+    CHECK(errorText.empty());
+    CHECK(options.color_mode_index == 4);
+    CHECK(options.depth_mode_index == 3);
+    CHECK(options.frame_rate_index == 1);
+    CHECK(options.imu_recording_mode);
+    CHECK(options.record_for_time && options.recording_time == 90);
+    CHECK(options.manual_exposure && options.exposure_value == -3);
+    CHECK(options.manual_gain && options.gain_value == 10);
+    CHECK(options.external_sync_mode_index == 1);
+    CHECK(options.external_sync_delay == 200);
+    CHECK(options.device_index == 2);
+    CHECK(recorderPathStr == "C:\\k4arecorder.exe");
+    CHECK(options.output_filename == "take.mkv");
+    CHECK(!options.print_help && !options.list_devices);
+
+    RecorderOptions help;
+    CHECK(parseWords({"--help"}, help, recorderPathStr, errorText) && help.print_help);
+    RecorderOptions list;
+    CHECK(parseWords({"--list"}, list, recorderPathStr, errorText) && list.list_devices);
+
+    // Durations and other numbers must be whole integers
+    const vector<vector<string>> badLengths = {{"-l", "abc"}, {"-l", "10s"}, {"-l", ""}, {"-l", "99999999999"}};
+    for (const vector<string>& words : badLengths) {
+        RecorderOptions bad;
+        errorText = "";
+        CHECK(!parseWords(words, bad, recorderPathStr, errorText));
+        CHECK(errorText.find("Invalid value") != string::npos);
+    }
+
+    // Unknown modes are reported and leave the defaults in place so the options can still be shown
+    RecorderOptions badMode;
+    errorText = "";
+    CHECK(!parseWords({"-c", "4k", "-d", "NFOV", "-r", "60", "--external-sync", "leader"}, badMode, recorderPathStr, errorText));
+    CHECK(badMode.color_mode_index == 3);
+    CHECK(badMode.depth_mode_index == 4);
+    CHECK(badMode.frame_rate_index == 2);
+    CHECK(badMode.external_sync_mode_index == 0);
+
+    RecorderOptions unknown;
+    errorText = "";
+    CHECK(!parseWords({"--fast", "1"}, unknown, recorderPathStr, errorText));
+    CHECK(errorText.find("Unknown option --fast") != string::npos);
+
+    RecorderOptions missing;
+    errorText = "";
+    CHECK(!parseWords({"take.mkv", "--rate"}, missing, recorderPathStr, errorText));
+    CHECK(errorText.find("Missing value for --rate") != string::npos);
+
+    RecorderOptions twoOutputs;
+    errorText = "";
+    CHECK(!parseWords({"a.mkv", "b.mkv"}, twoOutputs, recorderPathStr, errorText));
+    CHECK(errorText.find("Unexpected argument \"b.mkv\"") != string::npos);
+    CHECK(twoOutputs.output_filename == "a.mkv");
+}
+
+// Check that building arguments and parsing them again gives back the same options
+static void testRoundTrip() {
+    RecorderOptions options;
+    options.imu_recording_mode = true;
+    options.record_for_time = true;
+    options.recording_time = 30;
+    options.color_mode_index = 7;
+    options.depth_mode_index = 5;
+    options.frame_rate_index = 0;
+    options.external_sync_mode_index = 1;
+    options.external_sync_delay = 80;
+    options.output_filename = "take.mkv";
+
+    vector<string> words;
+    string args = buildArgs(options);
+    size_t start = args.find_first_not_of(' ');
+    while (start != string::npos) {
+        size_t end = args.find(' ', start);
+        words.push_back(args.substr(start, end - start));
+        start = args.find_first_not_of(' ', end);
+    }
+
+    RecorderOptions parsed;
+    string recorderPathStr;
+    string errorText;
+    CHECK(parseWords(words, parsed, recorderPathStr, errorText));
+    CHECK(buildArgs(parsed) == args);
+}
+
+int main(int argc, char* argv[]) {
+    (void) argc;
+    testBuildArgs();
+    // The test's own executable stands in for K4ARecorder, which validation only checks exists
+    testValidateOptions(argv[0]);
+    testParseCommandLine();
+    testRoundTrip();
+    return finishChecks("RecorderOptionsTests");
+}